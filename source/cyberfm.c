@@ -5,6 +5,7 @@ David Reid - mackron@gmail.com
 */
 #include "libcyberfm.c"
 #include <stdio.h>
+#include <stddef.h>     /* offsetof() */
 
 #define AUDIO_OUTPUT_PATH   "output/audio2"
 
@@ -65,29 +66,2494 @@ const char* cyberfm_argv_get_value(int argc, char** argv, const char* key)
 
 
 
+/*
+Extraction is done as a pipeline with three stages:
+
+    1) Readers load spans of the read plan and pass each item on. Uncompressed items go straight to the writers.
+    2) Decoders decompress items into their own buffer.
+    3) Writers write items out to a file.
+
+Large uncompressed items are never loaded. The writers copy them straight from the archive to the output file which on
+Linux is done in the kernel.
+
+When deduplicating, files are written to a content-addressed store rather than the output directory, keyed by the hash
+from the central directory. Only the first file with a given hash is written, and only if it's not already in the store
+from an earlier extraction. The output paths are then linked to the store as the progress is reported. Because this is all
+decided from the central directory, duplicates are never read or decompressed.
+
+When extracting incrementally, a manifest of everything that was extracted is kept next to the output. On the next run any
+file that's in the manifest with the same sizes, hash and timestamp, and is still on disk, is left out of the plan. Files
+that are in the manifest but no longer in the archive are deleted. As each file is finished it's appended to a journal so
+that an interrupted extraction can pick up where it left off. The manifest is rewritten and the journal deleted at the end.
+
+The stages are connected with bounded queues of item indices. A stage that can't push to the next stage because it's full,
+or that has nothing to pop, just waits. This means reading, decompressing and writing all overlap. The amount of memory
+in flight is limited by having the readers wait until the writers catch up.
+*/
+#define CYBERFM_EXTRACT_QUEUE_CAPACITY          1024
+#define CYBERFM_EXTRACT_MAX_BYTES_IN_FLIGHT     (128 * 1024 * 1024)
+#define CYBERFM_EXTRACT_DIRECT_COPY_MIN_SIZE    (64 * 1024)     /* Uncompressed items at least this big are copied without being loaded. */
+
+#define CYBERFM_EXTRACT_LINK_HARD       0   /* Output paths are hard links to the store. Falls back to symbolic links if that fails. */
+#define CYBERFM_EXTRACT_LINK_SYMBOLIC   1   /* Output paths are symbolic links to the store. */
+#define CYBERFM_EXTRACT_LINK_INDEX      2   /* Nothing is created in the output directory except for an index mapping output paths to the store. */
+
+#define CYBERFM_EXTRACT_NOT_DEDUPLICATED    0xFFFFFFFF
+
+#define CYBERFM_EXTRACT_STAGE_READ      0
+#define CYBERFM_EXTRACT_STAGE_DECODE    1
+#define CYBERFM_EXTRACT_STAGE_WRITE     2
+#define CYBERFM_EXTRACT_STAGE_COUNT     3
+
+typedef struct
+{
+    uint32_t iFile;
+    uint32_t iSubFile;
+    const char* pErrorMessage;  /* Set to NULL if the sub-file was extracted successfully. */
+    volatile uint32_t isDone;
+} cyberfm_extract_job;
+
+typedef struct
+{
+    const void* pData;          /* The loaded span. Released when the last item in the span has been written. */
+    volatile uint32_t refCount;
+} cyberfm_extract_span;
+
+typedef struct
+{
+    const uint8_t* pData;       /* The data to write. Points into the span for uncompressed items. */
+    void* pDecodedData;         /* Allocated by the decoder for compressed items. */
+    const char* pErrorMessage;
+    uint32_t spanIndex;
+    cyberfm_bool32 isDirect;    /* Set for items that are copied straight from the archive. These don't have a loaded span. */
+} cyberfm_extract_item;
+
+typedef struct
+{
+    uint32_t readerThreadCount;
+    uint32_t decoderThreadCount;
+    uint32_t writerThreadCount;
+    const char* pStoreDir;      /* When set, files are deduplicated into a content-addressed store in this directory. */
+    uint32_t linkMode;          /* One of CYBERFM_EXTRACT_LINK_*. Only used when deduplicating. */
+    const char* pManifestPath;  /* When set, only files that have changed since the last extraction are extracted. */
+    const cyberfm_path_dictionary* pPathDictionary; /* When set, files that are in the dictionary are output with their path instead of their hashed name. */
+    const uint8_t* pFileSelection;  /* Optional. One for each file in the archive. Files set to 0 are left out completely, as if they weren't in the archive. */
+} cyberfm_extract_config;
+
+typedef struct
+{
+    uint32_t threadCount;
+    double busyTime;            /* The total time spent working across every thread in the stage. */
+} cyberfm_extract_stage_stats;
+
+typedef struct cyberfm_extract_context cyberfm_extract_context;
+
+typedef struct
+{
+    cyberfm_extract_context* pContext;
+    uint32_t stage;
+    double busyTime;
+} cyberfm_extract_thread;
+
+struct cyberfm_extract_context
+{
+    cyberfm_archive* pArchive;
+    const char* pOutputDir;
+    cyberfm_extract_job* pJobs;
+    const uint32_t* pFirstJobOfFile;    /* Maps a file index to the index of the job for it's first sub-file. */
+    const cyberfm_read_plan* pPlan;
+    const char* pStoreDir;              /* An absolute path. NULL when not deduplicating. */
+    const cyberfm_path_dictionary* pPathDictionary;
+    uint32_t* pContentFiles;            /* For each file, the index of the first file with the same content. CYBERFM_EXTRACT_NOT_DEDUPLICATED if the file isn't deduplicated. */
+    cyberfm_extract_span* pSpans;       /* One for each span in the plan. */
+    cyberfm_extract_item* pItems;       /* One for each item in the plan. */
+    cyberfm_queue decodeQueue;
+    cyberfm_queue writeQueue;
+    volatile uint32_t nextSpan;         /* The next span for a reader to load. */
+    volatile uint32_t runningThreadCount[CYBERFM_EXTRACT_STAGE_COUNT];
+    volatile uint64_t bytesInFlight;
+};
+
+cyberfm_extract_config cyberfm_extract_config_init(uint32_t threadCount)
+{
+    cyberfm_extract_config config;
+
+    /* Decompression is the most expensive part so that's where most of the threads go. */
+    config.readerThreadCount  = 1;
+    config.decoderThreadCount = (threadCount > 0) ? threadCount : 1;
+    config.writerThreadCount  = (threadCount > 1) ? threadCount / 2 : 1;
+    config.pStoreDir          = NULL;
+    config.linkMode           = CYBERFM_EXTRACT_LINK_HARD;
+    config.pManifestPath      = NULL;
+    config.pPathDictionary    = NULL;
+    config.pFileSelection     = NULL;
+
+    return config;
+}
+
+/* Waits a little while for another stage to catch up. */
+static void cyberfm_extract_wait(uint32_t* pWaitCount)
+{
+    if (*pWaitCount < 16) {
+        cyberfm_sleep(0);
+    } else {
+        cyberfm_sleep(1);
+    }
+
+    *pWaitCount += 1;
+}
+
+static void cyberfm_extract_push(cyberfm_queue* pQueue, uint32_t iItem)
+{
+    uint32_t waitCount = 0;
+
+    while (!cyberfm_queue_try_push(pQueue, iItem)) {
+        cyberfm_extract_wait(&waitCount);
+    }
+}
+
+/*
+Pops the next item from a queue, waiting if necessary. Returns false when the queue is empty and the stage feeding it has
+finished.
+*/
+static cyberfm_bool32 cyberfm_extract_pop(cyberfm_extract_context* pContext, cyberfm_queue* pQueue, uint32_t producerStage, uint32_t* pItem)
+{
+    uint32_t waitCount = 0;
+
+    for (;;) {
+        if (cyberfm_queue_try_pop(pQueue, pItem)) {
+            return CYBERFM_TRUE;
+        }
+
+        /* The producers need to be checked before trying again so we don't miss anything pushed just before they finished. */
+        if (cyberfm_atomic_load_32(&pContext->runningThreadCount[producerStage]) == 0) {
+            return cyberfm_queue_try_pop(pQueue, pItem);
+        }
+
+        cyberfm_extract_wait(&waitCount);
+    }
+}
+
+static void cyberfm_extract_finish_item(cyberfm_extract_context* pContext, uint32_t iItem, const char* pErrorMessage)
+{
+    const cyberfm_read_plan_item* pPlanItem = &pContext->pPlan->pItems[iItem];
+    cyberfm_extract_job* pJob = &pContext->pJobs[pContext->pFirstJobOfFile[pPlanItem->fileIndex] + pPlanItem->subfile];
+
+    pJob->pErrorMessage = pErrorMessage;
+    cyberfm_atomic_store_32(&pJob->isDone, 1);
+}
+
+/* Called when an item is done with it's span. The span is unloaded once every item is done with it. */
+static void cyberfm_extract_release_span(cyberfm_extract_context* pContext, uint32_t iSpan)
+{
+    cyberfm_extract_span* pSpan = &pContext->pSpans[iSpan];
+
+    if (cyberfm_atomic_fetch_add_32(&pSpan->refCount, (uint32_t)-1) == 1) {
+        cyberfm_read_plan_unload_span(pContext->pArchive, &pContext->pPlan->pSpans[iSpan], pSpan->pData);
+        cyberfm_atomic_fetch_add_64(&pContext->bytesInFlight, (uint64_t)0 - pContext->pPlan->pSpans[iSpan].size);
+    }
+}
+
+/* Paths from a dictionary come from outside the archive so anything that could end up outside the output directory is rejected. */
+static cyberfm_bool32 cyberfm_extract_is_safe_path(const char* pPath)
+{
+    const char* pSegment = pPath;
+    const char* pChar;
+
+    if (pPath[0] == '\0' || pPath[0] == '/' || pPath[0] == '\\' || strchr(pPath, ':') != NULL) {
+        return CYBERFM_FALSE;
+    }
+
+    for (pChar = pPath; ; pChar += 1) {
+        if (pChar[0] == '/' || pChar[0] == '\\' || pChar[0] == '\0') {
+            size_t segmentLength = (size_t)(pChar - pSegment);
+
+            if (segmentLength == 0 || (pSegment[0] == '.' && (segmentLength == 1 || (segmentLength == 2 && pSegment[1] == '.')))) {
+                return CYBERFM_FALSE;
+            }
+
+            if (pChar[0] == '\0') {
+                break;
+            }
+
+            pSegment = pChar + 1;
+        }
+    }
+
+    return CYBERFM_TRUE;
+}
+
+/*
+Retrieves the name of a file relative to the output directory. This is the path from the dictionary with forward slashes
+when the file is in it, and otherwise the hashed name.
+*/
+static void cyberfm_extract_get_file_name(const cyberfm_path_dictionary* pPathDictionary, uint64_t hashedName, char* pName, size_t nameCap)
+{
+    const char* pPath = cyberfm_path_dictionary_find(pPathDictionary, hashedName);
+
+    if (pPath != NULL && strlen(pPath) < nameCap && cyberfm_extract_is_safe_path(pPath)) {
+        size_t iChar;
+
+        for (iChar = 0; pPath[iChar] != '\0'; iChar += 1) {
+            pName[iChar] = (pPath[iChar] == '\\') ? '/' : pPath[iChar];
+        }
+        pName[iChar] = '\0';
+
+        return;
+    }
+
+    snprintf(pName, nameCap, "%llu", hashedName);
+}
+
+/*
+Retrieves the output path of a sub-file. When there's only a single sub-file we'll just output the file directly. Otherwise
+we'll create a folder. Returns CYBERFM_OUT_OF_RANGE if the path doesn't fit.
+*/
+static cyberfm_result cyberfm_extract_get_subfile_path(cyberfm_archive* pArchive, const cyberfm_path_dictionary* pPathDictionary, const char* pOutputDir, uint32_t iFile, uint32_t iSubFile, char* pPath, size_t pathCap)
+{
+    const cyberfm_archive_file_info* pFileInfo = &pArchive->pCentralDirectory->pFileInfo[iFile];
+    char fileName[256];
+    char fileDir[512];
+
+    cyberfm_extract_get_file_name(pPathDictionary, pFileInfo->hashedName, fileName, sizeof(fileName));
+
+    if ((pFileInfo->dataSpecRangeEnd - pFileInfo->dataSpecRangeBeg) > 1) {
+        /* Output to a folder. First make sure the folder exists. */
+        if (snprintf(fileDir, sizeof(fileDir), "%s/%s", pOutputDir, fileName) >= (int)sizeof(fileDir)) {
+            return CYBERFM_OUT_OF_RANGE;
+        }
+
+        mfs_mkdir(fileDir, MFS_TRUE);
+
+        if (snprintf(pPath, pathCap, "%s/%u", fileDir, iSubFile) >= (int)pathCap) {
+            return CYBERFM_OUT_OF_RANGE;
+        }
+    } else {
+        /* Output the file directly. Files with a path from the dictionary need their folder to exist first. */
+        if (snprintf(pPath, pathCap, "%s/%s", pOutputDir, fileName) >= (int)pathCap) {
+            return CYBERFM_OUT_OF_RANGE;
+        }
+
+        if (strchr(fileName, '/') != NULL) {
+            if (snprintf(fileDir, sizeof(fileDir), "%s", pPath) >= (int)sizeof(fileDir)) {
+                return CYBERFM_OUT_OF_RANGE;
+            }
+
+            *strrchr(fileDir, '/') = '\0';
+            mfs_mkdir(fileDir, MFS_TRUE);
+        }
+    }
+
+    return CYBERFM_SUCCESS;
+}
+
+#ifndef CYBERFM_NO_MAIN
+/* Converts a path to an absolute path. pPath and pAbsolutePath can be the same buffer. */
+static cyberfm_result cyberfm_get_absolute_path(const char* pPath, char* pAbsolutePath, size_t absolutePathCap)
+{
+#ifdef _WIN32
+    char absolutePath[MAX_PATH];
+
+    if (_fullpath(absolutePath, pPath, sizeof(absolutePath)) == NULL) {
+        return CYBERFM_ERROR;
+    }
+
+    snprintf(pAbsolutePath, absolutePathCap, "%s", absolutePath);
+#else
+    char* pRealPath;
+
+    pRealPath = realpath(pPath, NULL);
+    if (pRealPath == NULL) {
+        return CYBERFM_ERROR;
+    }
+
+    snprintf(pAbsolutePath, absolutePathCap, "%s", pRealPath);
+    free(pRealPath);
+#endif
+
+    return CYBERFM_SUCCESS;
+}
+#endif  /* CYBERFM_NO_MAIN */
+
+/*
+Retrieves the path of a sub-file in the content-addressed store. Objects are spread across 256 folders based on the first
+byte of the hash. Files with more than one sub-file have the index of the sub-file appended.
+*/
+static void cyberfm_extract_get_object_path(cyberfm_archive* pArchive, const char* pStoreDir, uint32_t iFile, uint32_t iSubFile, char* pPath, size_t pathCap)
+{
+    const cyberfm_archive_file_info* pFileInfo = &pArchive->pCentralDirectory->pFileInfo[iFile];
+    uint8_t hash[20];
+    char hashString[41];
+    uint32_t iByte;
+
+    cyberfm_file_info_get_hash(pFileInfo, hash);
+    for (iByte = 0; iByte < sizeof(hash); iByte += 1) {
+        snprintf(hashString + (iByte * 2), 3, "%02x", hash[iByte]);
+    }
+
+    if ((pFileInfo->dataSpecRangeEnd - pFileInfo->dataSpecRangeBeg) > 1) {
+        snprintf(pPath, pathCap, "%s/%.2s/%s.%u", pStoreDir, hashString, hashString, iSubFile);
+    } else {
+        snprintf(pPath, pathCap, "%s/%.2s/%s", pStoreDir, hashString, hashString);
+    }
+}
+
+/* Links an output path to an object in the store, replacing anything that's already there. */
+static cyberfm_result cyberfm_extract_link(const char* pObjectPath, const char* pOutputPath, uint32_t linkMode)
+{
+    remove(pOutputPath);
+
+#ifdef _WIN32
+    if (linkMode == CYBERFM_EXTRACT_LINK_HARD && CreateHardLinkA(pOutputPath, pObjectPath, NULL)) {
+        return CYBERFM_SUCCESS;
+    }
+
+    if (CreateSymbolicLinkA(pOutputPath, pObjectPath, 0)) {
+        return CYBERFM_SUCCESS;
+    }
+#else
+    if (linkMode == CYBERFM_EXTRACT_LINK_HARD && link(pObjectPath, pOutputPath) == 0) {
+        return CYBERFM_SUCCESS;
+    }
+
+    /* Hard links don't work across filesystems, and there's a limit to how many links a file can have. */
+    if (symlink(pObjectPath, pOutputPath) == 0) {
+        return CYBERFM_SUCCESS;
+    }
+#endif
+
+    return CYBERFM_ERROR;
+}
+
+/*
+Works out which files need to be written to the store. Files are sorted by their hash, and the first file of each group of
+files with the same hash is the one that gets written. The others are filtered out of the read plan. If the first file is
+already in the store it's filtered out as well. Files without a hash, or without any sub-files, are extracted normally.
+*/
+typedef struct
+{
+    uint8_t hash[20];
+    uint32_t subFileCount;
+    uint64_t size;
+    uint32_t fileIndex;
+} cyberfm_extract_dedupe_item;
+
+static int cyberfm_extract_dedupe_item_compare(const void* a, const void* b)
+{
+    const cyberfm_extract_dedupe_item* pA = (const cyberfm_extract_dedupe_item*)a;
+    const cyberfm_extract_dedupe_item* pB = (const cyberfm_extract_dedupe_item*)b;
+    int hashComparison;
+
+    hashComparison = memcmp(pA->hash, pB->hash, sizeof(pA->hash));
+    if (hashComparison != 0) {
+        return hashComparison;
+    }
+
+    /* The sub-files need to line up as well. */
+    if (pA->subFileCount != pB->subFileCount) {
+        return (pA->subFileCount < pB->subFileCount) ? -1 : 1;
+    }
+
+    if (pA->size != pB->size) {
+        return (pA->size < pB->size) ? -1 : 1;
+    }
+
+    /* The first file is the one that's written. */
+    return (pA->fileIndex < pB->fileIndex) ? -1 : (pA->fileIndex > pB->fileIndex) ? 1 : 0;
+}
+
+static cyberfm_result cyberfm_extract_build_dedupe_filter(cyberfm_archive* pArchive, const char* pStoreDir, const uint8_t* pFileSelection, uint32_t* pContentFiles, uint8_t* pFileFilter)
+{
+    const cyberfm_archive_central_directory* pCentralDirectory = pArchive->pCentralDirectory;
+    cyberfm_extract_dedupe_item* pItems;
+    uint32_t itemCount = 0;
+    uint32_t iFile;
+    uint32_t iItem;
+    static const uint8_t nullHash[20] = {0};
+
+    pItems = (cyberfm_extract_dedupe_item*)malloc((pCentralDirectory->fileInfoCount + 1) * sizeof(*pItems));
+    if (pItems == NULL) {
+        return CYBERFM_OUT_OF_MEMORY;
+    }
+
+    for (iFile = 0; iFile < pCentralDirectory->fileInfoCount; iFile += 1) {
+        const cyberfm_archive_file_info* pFileInfo = &pCentralDirectory->pFileInfo[iFile];
+        cyberfm_extract_dedupe_item* pItem = &pItems[itemCount];
+        uint32_t iDataSpec;
+
+        pContentFiles[iFile] = CYBERFM_EXTRACT_NOT_DEDUPLICATED;
+        pFileFilter[iFile]   = 1;
+
+        if (pFileInfo->dataSpecRangeEnd <= pFileInfo->dataSpecRangeBeg || pFileInfo->dataSpecRangeEnd > pCentralDirectory->fileDataSpecCount) {
+            continue;
+        }
+
+        /* Files that aren't being extracted can't be the ones that get written to the store. */
+        if (pFileSelection != NULL && pFileSelection[iFile] == 0) {
+            continue;
+        }
+
+        cyberfm_file_info_get_hash(pFileInfo, pItem->hash);
+        if (memcmp(pItem->hash, nullHash, sizeof(nullHash)) == 0) {
+            continue;
+        }
+
+        pItem->subFileCount = pFileInfo->dataSpecRangeEnd - pFileInfo->dataSpecRangeBeg;
+        pItem->size         = 0;
+        pItem->fileIndex    = iFile;
+
+        for (iDataSpec = pFileInfo->dataSpecRangeBeg; iDataSpec < pFileInfo->dataSpecRangeEnd; iDataSpec += 1) {
+            pItem->size += pCentralDirectory->pFileDataSpec[iDataSpec].uncompressedSize;
+        }
+
+        itemCount += 1;
+    }
+
+    qsort(pItems, itemCount, sizeof(*pItems), cyberfm_extract_dedupe_item_compare);
+
+    for (iItem = 0; iItem < itemCount; iItem += 1) {
+        uint32_t iContentFile = pItems[iItem].fileIndex;
+
+        if (iItem > 0 && memcmp(pItems[iItem].hash, pItems[iItem - 1].hash, sizeof(pItems[iItem].hash)) == 0 && pItems[iItem].subFileCount == pItems[iItem - 1].subFileCount && pItems[iItem].size == pItems[iItem - 1].size) {
+            /* A duplicate of the previous file. */
+            iContentFile = pContentFiles[pItems[iItem - 1].fileIndex];
+            pFileFilter[pItems[iItem].fileIndex] = 0;
+        } else {
+            /* The first of it's kind. It only needs to be written if it's not already in the store. */
+            uint32_t iSubFile;
+            cyberfm_bool32 isInStore = CYBERFM_TRUE;
+
+            for (iSubFile = 0; iSubFile < pItems[iItem].subFileCount; iSubFile += 1) {
+                char objectPath[512];
+
+                cyberfm_extract_get_object_path(pArchive, pStoreDir, iContentFile, iSubFile, objectPath, sizeof(objectPath));
+                if (!mfs_file_exists(objectPath)) {
+                    isInStore = CYBERFM_FALSE;
+                    break;
+                }
+            }
+
+            if (isInStore) {
+                pFileFilter[iContentFile] = 0;
+            }
+        }
+
+        pContentFiles[pItems[iItem].fileIndex] = iContentFile;
+    }
+
+    free(pItems);
+    return CYBERFM_SUCCESS;
+}
+
+
+
+/*
+The manifest is just a header followed by an entry for each sub-file. The journal is the same thing without the header, and
+only ever appended to. Entries are in native byte order. The manifest is only meant to be read by the machine that wrote it.
+*/
+#define CYBERFM_MANIFEST_MAGIC      0x4D4D4643  /* "CFMM" */
+#define CYBERFM_MANIFEST_VERSION    1
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t entrySize;         /* For making sure the manifest was written by a compatible build. */
+    uint32_t entryCount;
+} cyberfm_manifest_header;
+
+typedef struct
+{
+    uint64_t hashedName;
+    uint64_t unknown1;          /* Looks to be a timestamp. Compared along with everything else just in case. */
+    uint32_t subFile;
+    uint32_t subFileCount;
+    uint32_t compressedSize;
+    uint32_t uncompressedSize;
+    uint32_t hash[5];
+    uint32_t sequence;          /* Not saved. Used to make later entries win when merging the journal into the manifest. */
+} cyberfm_manifest_entry;
+
+typedef struct
+{
+    cyberfm_manifest_entry* pEntries;
+    uint32_t entryCount;
+    uint32_t entryCap;
+} cyberfm_manifest;
+
+#define CYBERFM_MANIFEST_ENTRY_SAVED_SIZE   offsetof(cyberfm_manifest_entry, sequence)
+
+static void cyberfm_manifest_entry_init(cyberfm_archive* pArchive, uint32_t iFile, uint32_t iSubFile, cyberfm_manifest_entry* pEntry)
+{
+    const cyberfm_archive_file_info* pFileInfo = &pArchive->pCentralDirectory->pFileInfo[iFile];
+    const cyberfm_archive_file_data_spec* pDataSpec = &pArchive->pCentralDirectory->pFileDataSpec[pFileInfo->dataSpecRangeBeg + iSubFile];
+
+    memset(pEntry, 0, sizeof(*pEntry));
+    pEntry->hashedName       = pFileInfo->hashedName;
+    pEntry->unknown1         = pFileInfo->unknown1;
+    pEntry->subFile          = iSubFile;
+    pEntry->subFileCount     = pFileInfo->dataSpecRangeEnd - pFileInfo->dataSpecRangeBeg;
+    pEntry->compressedSize   = pDataSpec->compressedSize;
+    pEntry->uncompressedSize = pDataSpec->uncompressedSize;
+    memcpy(pEntry->hash, pFileInfo->hash, sizeof(pEntry->hash));
+}
+
+static cyberfm_result cyberfm_manifest_push(cyberfm_manifest* pManifest, const cyberfm_manifest_entry* pEntry)
+{
+    if (pManifest->entryCount == pManifest->entryCap) {
+        uint32_t newCap = (pManifest->entryCap == 0) ? 1024 : pManifest->entryCap * 2;
+        cyberfm_manifest_entry* pNewEntries;
+
+        pNewEntries = (cyberfm_manifest_entry*)realloc(pManifest->pEntries, newCap * sizeof(*pNewEntries));
+        if (pNewEntries == NULL) {
+            return CYBERFM_OUT_OF_MEMORY;
+        }
+
+        pManifest->pEntries = pNewEntries;
+        pManifest->entryCap = newCap;
+    }
+
+    pManifest->pEntries[pManifest->entryCount] = *pEntry;
+    pManifest->pEntries[pManifest->entryCount].sequence = pManifest->entryCount;
+    pManifest->entryCount += 1;
+
+    return CYBERFM_SUCCESS;
+}
+
+/*
+Appends the entries in a file to the manifest. Set hasHeader to false for journals. An incomplete entry at the end of a
+journal is from an interrupted write and is ignored. A file that doesn't exist is not an error.
+*/
+static cyberfm_result cyberfm_manifest_load(cyberfm_manifest* pManifest, const char* pFilePath, cyberfm_bool32 hasHeader)
+{
+    cyberfm_result result = CYBERFM_SUCCESS;
+    FILE* pFile;
+    cyberfm_manifest_entry entry;
+
+    if (mfs_fopen(&pFile, pFilePath, "rb") != MFS_SUCCESS) {
+        return CYBERFM_SUCCESS;
+    }
+
+    if (hasHeader) {
+        cyberfm_manifest_header header;
+
+        if (fread(&header, sizeof(header), 1, pFile) != 1 || header.magic != CYBERFM_MANIFEST_MAGIC || header.version != CYBERFM_MANIFEST_VERSION || header.entrySize != CYBERFM_MANIFEST_ENTRY_SAVED_SIZE) {
+            mfs_fclose(pFile);
+            return CYBERFM_SUCCESS;     /* Not a manifest we understand. Everything will be extracted again. */
+        }
+    }
+
+    memset(&entry, 0, sizeof(entry));
+    while (fread(&entry, CYBERFM_MANIFEST_ENTRY_SAVED_SIZE, 1, pFile) == 1) {
+        result = cyberfm_manifest_push(pManifest, &entry);
+        if (result != CYBERFM_SUCCESS) {
+            break;
+        }
+    }
+
+    mfs_fclose(pFile);
+    return result;
+}
+
+static int cyberfm_manifest_entry_compare(const void* a, const void* b)
+{
+    const cyberfm_manifest_entry* pA = (const cyberfm_manifest_entry*)a;
+    const cyberfm_manifest_entry* pB = (const cyberfm_manifest_entry*)b;
+
+    if (pA->hashedName != pB->hashedName) {
+        return (pA->hashedName < pB->hashedName) ? -1 : 1;
+    }
+
+    if (pA->subFile != pB->subFile) {
+        return (pA->subFile < pB->subFile) ? -1 : 1;
+    }
+
+    return (pA->sequence < pB->sequence) ? -1 : (pA->sequence > pB->sequence) ? 1 : 0;
+}
+
+/* Sorts the manifest for searching. Where a sub-file has more than one entry, only the last one to be added is kept. */
+static void cyberfm_manifest_sort(cyberfm_manifest* pManifest)
+{
+    uint32_t iEntry;
+    uint32_t entryCount = 0;
+
+    if (pManifest->entryCount == 0) {
+        return;
+    }
+
+    qsort(pManifest->pEntries, pManifest->entryCount, sizeof(*pManifest->pEntries), cyberfm_manifest_entry_compare);
+
+    for (iEntry = 0; iEntry < pManifest->entryCount; iEntry += 1) {
+        if (entryCount > 0 && pManifest->pEntries[entryCount - 1].hashedName == pManifest->pEntries[iEntry].hashedName && pManifest->pEntries[entryCount - 1].subFile == pManifest->pEntries[iEntry].subFile) {
+            entryCount -= 1;
+        }
+
+        pManifest->pEntries[entryCount] = pManifest->pEntries[iEntry];
+        entryCount += 1;
+    }
+
+    pManifest->entryCount = entryCount;
+}
+
+/* The manifest must be sorted. */
+static const cyberfm_manifest_entry* cyberfm_manifest_find(const cyberfm_manifest* pManifest, uint64_t hashedName, uint32_t subFile)
+{
+    uint32_t lo = 0;
+    uint32_t hi = pManifest->entryCount;
+
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        const cyberfm_manifest_entry* pEntry = &pManifest->pEntries[mid];
+
+        if (pEntry->hashedName < hashedName || (pEntry->hashedName == hashedName && pEntry->subFile < subFile)) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (lo < pManifest->entryCount && pManifest->pEntries[lo].hashedName == hashedName && pManifest->pEntries[lo].subFile == subFile) {
+        return &pManifest->pEntries[lo];
+    }
+
+    return NULL;
+}
+
+/* Saves to a temporary file first and then renames it so there's never a half written manifest. */
+static cyberfm_result cyberfm_manifest_save(const cyberfm_manifest* pManifest, const char* pFilePath)
+{
+    FILE* pFile;
+    cyberfm_manifest_header header;
+    char tempPath[512];
+    uint32_t iEntry;
+    cyberfm_bool32 isWriteOK;
+
+    snprintf(tempPath, sizeof(tempPath), "%s.tmp", pFilePath);
+
+    if (mfs_fopen(&pFile, tempPath, "wb") != MFS_SUCCESS) {
+        return CYBERFM_ERROR;
+    }
+
+    header.magic      = CYBERFM_MANIFEST_MAGIC;
+    header.version    = CYBERFM_MANIFEST_VERSION;
+    header.entrySize  = CYBERFM_MANIFEST_ENTRY_SAVED_SIZE;
+    header.entryCount = pManifest->entryCount;
+
+    isWriteOK = (fwrite(&header, sizeof(header), 1, pFile) == 1);
+    for (iEntry = 0; iEntry < pManifest->entryCount && isWriteOK; iEntry += 1) {
+        isWriteOK = (fwrite(&pManifest->pEntries[iEntry], CYBERFM_MANIFEST_ENTRY_SAVED_SIZE, 1, pFile) == 1);
+    }
+
+    if (fflush(pFile) != 0) {
+        isWriteOK = CYBERFM_FALSE;
+    }
+
+    mfs_fclose(pFile);
+
+    if (!isWriteOK) {
+        remove(tempPath);
+        return CYBERFM_ERROR;
+    }
+
+    /* The old manifest is replaced in one step so that there's always one there, even if we're interrupted. */
+#ifdef _WIN32
+    if (!MoveFileExA(tempPath, pFilePath, MOVEFILE_REPLACE_EXISTING)) {
+        remove(tempPath);
+        return CYBERFM_ERROR;
+    }
+#else
+    if (rename(tempPath, pFilePath) != 0) {
+        remove(tempPath);
+        return CYBERFM_ERROR;
+    }
+#endif
+
+    return CYBERFM_SUCCESS;
+}
+
+/* Deletes whatever was extracted for the file of a manifest entry. This is done once for each file, from it's first sub-file. */
+static void cyberfm_manifest_delete_output(const cyberfm_manifest_entry* pEntry, const cyberfm_path_dictionary* pPathDictionary, const char* pOutputDir)
+{
+    char path[512];
+    char fileName[256];
+    uint32_t iSubFile;
+
+    cyberfm_extract_get_file_name(pPathDictionary, pEntry->hashedName, fileName, sizeof(fileName));
+
+    /* A path that doesn't fit is never deleted since the cut off path could be something else entirely. */
+    if (pEntry->subFileCount > 1) {
+        for (iSubFile = 0; iSubFile < pEntry->subFileCount; iSubFile += 1) {
+            if (snprintf(path, sizeof(path), "%s/%s/%u", pOutputDir, fileName, iSubFile) < (int)sizeof(path)) {
+                remove(path);
+            }
+        }
+
+        if (snprintf(path, sizeof(path), "%s/%s", pOutputDir, fileName) >= (int)sizeof(path)) {
+            return;
+        }
+
+#ifdef _WIN32
+        RemoveDirectoryA(path);
+#else
+        rmdir(path);
+#endif
+    } else {
+        if (snprintf(path, sizeof(path), "%s/%s", pOutputDir, fileName) < (int)sizeof(path)) {
+            remove(path);
+        }
+    }
+}
+
+/*
+Compares the archive against the manifest. Files that are unchanged are filtered out. Anything in the manifest that's
+been removed from the archive, or has a different number of sub-files, has it's old output deleted. Files that are being
+deduplicated are left alone because the store already takes care of not writing them again. Outputs the number of files
+that were skipped and deleted.
+*/
+static void cyberfm_extract_build_incremental_filter(cyberfm_archive* pArchive, const cyberfm_path_dictionary* pPathDictionary, const char* pOutputDir, const cyberfm_manifest* pManifest, const uint32_t* pContentFiles, uint8_t* pFileFilter, uint8_t* pIsUnchanged, uint32_t* pSkippedFileCount, uint32_t* pDeletedFileCount)
+{
+    const cyberfm_archive_central_directory* pCentralDirectory = pArchive->pCentralDirectory;
+    uint32_t iFile;
+    uint32_t iEntry;
+
+    *pSkippedFileCount = 0;
+    *pDeletedFileCount = 0;
+
+    for (iFile = 0; iFile < pCentralDirectory->fileInfoCount; iFile += 1) {
+        const cyberfm_archive_file_info* pFileInfo = &pCentralDirectory->pFileInfo[iFile];
+        uint32_t subFileCount = pFileInfo->dataSpecRangeEnd - pFileInfo->dataSpecRangeBeg;
+        uint32_t iSubFile;
+        cyberfm_bool32 isUnchanged = (subFileCount > 0 && pFileInfo->dataSpecRangeEnd <= pCentralDirectory->fileDataSpecCount);
+
+        for (iSubFile = 0; iSubFile < subFileCount && isUnchanged; iSubFile += 1) {
+            const cyberfm_manifest_entry* pEntry = cyberfm_manifest_find(pManifest, pFileInfo->hashedName, iSubFile);
+            cyberfm_manifest_entry entry;
+            char subFilePath[512];
+
+            cyberfm_manifest_entry_init(pArchive, iFile, iSubFile, &entry);
+            if (pEntry == NULL || memcmp(pEntry, &entry, CYBERFM_MANIFEST_ENTRY_SAVED_SIZE) != 0) {
+                isUnchanged = CYBERFM_FALSE;
+                break;
+            }
+
+            /* It might have been deleted since it was extracted. */
+            if (pContentFiles == NULL || pContentFiles[iFile] == CYBERFM_EXTRACT_NOT_DEDUPLICATED) {
+                if (cyberfm_extract_get_subfile_path(pArchive, pPathDictionary, pOutputDir, iFile, iSubFile, subFilePath, sizeof(subFilePath)) != CYBERFM_SUCCESS || !mfs_file_exists(subFilePath)) {
+                    isUnchanged = CYBERFM_FALSE;
+                }
+            }
+        }
+
+        pIsUnchanged[iFile] = (uint8_t)isUnchanged;
+
+        if (isUnchanged) {
+            if (pContentFiles == NULL || pContentFiles[iFile] == CYBERFM_EXTRACT_NOT_DEDUPLICATED) {
+                pFileFilter[iFile] = 0;
+            }
+
+            *pSkippedFileCount += 1;
+        }
+    }
+
+    /*
+    Old output is deleted when the file is gone, or if the number of sub-files has changed since there'll either be sub-files
+    left over, or the output will be changing between a file and a folder.
+    */
+    for (iEntry = 0; iEntry < pManifest->entryCount; iEntry += 1) {
+        const cyberfm_manifest_entry* pEntry = &pManifest->pEntries[iEntry];
+
+        if (pEntry->subFile != 0) {
+            continue;
+        }
+
+        if (cyberfm_archive_find(pArchive, pEntry->hashedName, &iFile) != CYBERFM_SUCCESS) {
+            cyberfm_manifest_delete_output(pEntry, pPathDictionary, pOutputDir);
+            *pDeletedFileCount += 1;
+        } else if ((pCentralDirectory->pFileInfo[iFile].dataSpecRangeEnd - pCentralDirectory->pFileInfo[iFile].dataSpecRangeBeg) != pEntry->subFileCount) {
+            cyberfm_manifest_delete_output(pEntry, pPathDictionary, pOutputDir);
+        }
+    }
+}
+
+/* Adds every sub-file of a file to the manifest, and to the journal if one is specified. */
+static cyberfm_result cyberfm_extract_add_to_manifest(cyberfm_archive* pArchive, uint32_t iFile, cyberfm_manifest* pManifest, FILE* pJournalFile)
+{
+    const cyberfm_archive_file_info* pFileInfo = &pArchive->pCentralDirectory->pFileInfo[iFile];
+    uint32_t iSubFile;
+
+    for (iSubFile = 0; iSubFile < (pFileInfo->dataSpecRangeEnd - pFileInfo->dataSpecRangeBeg); iSubFile += 1) {
+        cyberfm_result result;
+        cyberfm_manifest_entry entry;
+
+        cyberfm_manifest_entry_init(pArchive, iFile, iSubFile, &entry);
+
+        result = cyberfm_manifest_push(pManifest, &entry);
+        if (result != CYBERFM_SUCCESS) {
+            return result;
+        }
+
+        if (pJournalFile != NULL && fwrite(&entry, CYBERFM_MANIFEST_ENTRY_SAVED_SIZE, 1, pJournalFile) != 1) {
+            return CYBERFM_ERROR;
+        }
+    }
+
+    /* Flushed straight away so an interrupted extraction loses as little as possible. */
+    if (pJournalFile != NULL && fflush(pJournalFile) != 0) {
+        return CYBERFM_ERROR;
+    }
+
+    return CYBERFM_SUCCESS;
+}
+
+static void cyberfm_extract_read_stage(cyberfm_extract_context* pContext, double* pBusyTime)
+{
+    const cyberfm_read_plan* pPlan = pContext->pPlan;
+
+    for (;;) {
+        uint32_t iSpan;
+        uint32_t iItem;
+        uint32_t waitCount = 0;
+        const cyberfm_read_plan_span* pPlanSpan;
+        cyberfm_result result;
+        double startTime;
+
+        iSpan = cyberfm_atomic_fetch_add_32(&pContext->nextSpan, 1);
+        if (iSpan >= pPlan->spanCount) {
+            break;
+        }
+
+        pPlanSpan = &pPlan->pSpans[iSpan];
+
+        /* Direct copies don't need to be loaded so they can go straight to the writers. */
+        if ((pPlanSpan->flags & CYBERFM_READ_PLAN_SPAN_FLAG_DIRECT) != 0) {
+            pContext->pItems[pPlanSpan->firstItem].spanIndex = iSpan;
+            pContext->pItems[pPlanSpan->firstItem].isDirect  = CYBERFM_TRUE;
+            cyberfm_extract_push(&pContext->writeQueue, pPlanSpan->firstItem);
+            continue;
+        }
+
+        /* Wait for the writers to catch up if there's too much in flight. There's always room for one span, no matter how big. */
+        while (cyberfm_atomic_fetch_add_64(&pContext->bytesInFlight, 0) > 0 && cyberfm_atomic_fetch_add_64(&pContext->bytesInFlight, 0) + pPlanSpan->size > CYBERFM_EXTRACT_MAX_BYTES_IN_FLIGHT) {
+            cyberfm_extract_wait(&waitCount);
+        }
+
+        startTime = cyberfm_get_time();
+        result = cyberfm_read_plan_load_span(pContext->pArchive, pPlanSpan, &pContext->pSpans[iSpan].pData);
+        *pBusyTime += cyberfm_get_time() - startTime;
+
+        if (result != CYBERFM_SUCCESS) {
+            for (iItem = pPlanSpan->firstItem; iItem < pPlanSpan->firstItem + pPlanSpan->itemCount; iItem += 1) {
+                cyberfm_extract_finish_item(pContext, iItem, ". Failed to open file");
+            }
+
+            continue;
+        }
+
+        cyberfm_atomic_fetch_add_64(&pContext->bytesInFlight, pPlanSpan->size);
+        cyberfm_atomic_store_32(&pContext->pSpans[iSpan].refCount, pPlanSpan->itemCount);
+
+        for (iItem = pPlanSpan->firstItem; iItem < pPlanSpan->firstItem + pPlanSpan->itemCount; iItem += 1) {
+            const cyberfm_read_plan_item* pPlanItem = &pPlan->pItems[iItem];
+            const cyberfm_archive_file_data_spec* pDataSpec = &pContext->pArchive->pCentralDirectory->pFileDataSpec[pPlanItem->dataSpecIndex];
+
+            pContext->pItems[iItem].pData     = (const uint8_t*)pContext->pSpans[iSpan].pData + (pPlanItem->offset - pPlanSpan->offset);
+            pContext->pItems[iItem].spanIndex = iSpan;
+
+            /* Uncompressed items don't need to go through the decoders. */
+            if (pDataSpec->compressedSize != pDataSpec->uncompressedSize) {
+                cyberfm_extract_push(&pContext->decodeQueue, iItem);
+            } else {
+                cyberfm_extract_push(&pContext->writeQueue, iItem);
+            }
+        }
+    }
+}
+
+static void cyberfm_extract_decode_stage(cyberfm_extract_context* pContext, double* pBusyTime)
+{
+    uint32_t iItem;
+
+    while (cyberfm_extract_pop(pContext, &pContext->decodeQueue, CYBERFM_EXTRACT_STAGE_READ, &iItem)) {
+        cyberfm_extract_item* pItem = &pContext->pItems[iItem];
+        const cyberfm_archive_file_data_spec* pDataSpec = &pContext->pArchive->pCentralDirectory->pFileDataSpec[pContext->pPlan->pItems[iItem].dataSpecIndex];
+        double startTime;
+
+        startTime = cyberfm_get_time();
+
+        pItem->pDecodedData = malloc(pDataSpec->uncompressedSize + 1);  /* +1 so we never malloc(0). */
+        if (pItem->pDecodedData != NULL) {
+            if (cyberfm_archive_decompress_block(pContext->pArchive, pItem->pData, pDataSpec->compressedSize, pItem->pDecodedData, pDataSpec->uncompressedSize) == CYBERFM_SUCCESS) {
+                pItem->pData = (const uint8_t*)pItem->pDecodedData;
+                cyberfm_atomic_fetch_add_64(&pContext->bytesInFlight, pDataSpec->uncompressedSize);
+            } else {
+                free(pItem->pDecodedData);
+                pItem->pDecodedData  = NULL;
+                pItem->pErrorMessage = ". Failed to open file";
+            }
+        } else {
+            pItem->pErrorMessage = ". Failed to open file";
+        }
+
+        *pBusyTime += cyberfm_get_time() - startTime;
+
+        cyberfm_extract_push(&pContext->writeQueue, iItem);
+    }
+}
+
+static void cyberfm_extract_write_stage(cyberfm_extract_context* pContext, double* pBusyTime)
+{
+    uint32_t iItem;
+
+    while (cyberfm_extract_pop(pContext, &pContext->writeQueue, CYBERFM_EXTRACT_STAGE_DECODE, &iItem)) {
+        cyberfm_extract_item* pItem = &pContext->pItems[iItem];
+        const cyberfm_read_plan_item* pPlanItem = &pContext->pPlan->pItems[iItem];
+        const cyberfm_archive_file_data_spec* pDataSpec = &pContext->pArchive->pCentralDirectory->pFileDataSpec[pPlanItem->dataSpecIndex];
+        cyberfm_result result;
+        double startTime;
+
+        startTime = cyberfm_get_time();
+
+        if (pItem->pErrorMessage == NULL) {
+            char objectPath[512];
+            char subFilePath[sizeof(objectPath) + 5];   /* Room for the ".part" suffix. */
+            cyberfm_bool32 isDeduplicated = (pContext->pContentFiles != NULL && pContext->pContentFiles[pPlanItem->fileIndex] != CYBERFM_EXTRACT_NOT_DEDUPLICATED);
+
+            /*
+            Objects in the store are written to a temporary file and then renamed so that an interrupted extraction never
+            leaves behind an incomplete object that a later extraction would think is complete.
+            */
+            if (isDeduplicated) {
+                cyberfm_extract_get_object_path(pContext->pArchive, pContext->pStoreDir, pPlanItem->fileIndex, pPlanItem->subfile, objectPath, sizeof(objectPath));
+
+                /* The folder is the object path up to the last slash. */
+                snprintf(subFilePath, sizeof(subFilePath), "%s", objectPath);
+                *strrchr(subFilePath, '/') = '\0';
+                mfs_mkdir(subFilePath, MFS_TRUE);
+
+                snprintf(subFilePath, sizeof(subFilePath), "%s.part", objectPath);
+                result = CYBERFM_SUCCESS;
+            } else {
+                result = cyberfm_extract_get_subfile_path(pContext->pArchive, pContext->pPathDictionary, pContext->pOutputDir, pPlanItem->fileIndex, pPlanItem->subfile, subFilePath, sizeof(subFilePath));
+            }
+
+            if (result == CYBERFM_SUCCESS) {
+                if (pItem->isDirect) {
+                    result = cyberfm_archive_copy_to_file(pContext->pArchive, pPlanItem->offset, pDataSpec->uncompressedSize, subFilePath);
+                } else {
+                    CYBERFM_STATS_DECLARE_TIMER(writeStartTime)
+
+                    CYBERFM_STATS_BEGIN_TIMER(writeStartTime);
+                    result = cyberfm_result_from_minifs(mfs_open_and_write_file(subFilePath, pDataSpec->uncompressedSize, pItem->pData));
+                    CYBERFM_STATS_END_TIMER(CYBERFM_STAT_TIMER_WRITE, writeStartTime);
+
+                    if (result == CYBERFM_SUCCESS) {
+                        CYBERFM_STATS_ADD(CYBERFM_STAT_BYTES_WRITTEN, pDataSpec->uncompressedSize);
+                    }
+                }
+            }
+
+            if (result == CYBERFM_SUCCESS && isDeduplicated) {
+                remove(objectPath);     /* Windows won't rename over an existing file. */
+                if (rename(subFilePath, objectPath) != 0) {
+                    result = CYBERFM_ERROR;
+                }
+            }
+
+            if (result != CYBERFM_SUCCESS) {
+                pItem->pErrorMessage = ". Failed to extract file";
+            }
+        }
+
+        if (pItem->pDecodedData != NULL) {
+            free(pItem->pDecodedData);
+            pItem->pDecodedData = NULL;
+            cyberfm_atomic_fetch_add_64(&pContext->bytesInFlight, (uint64_t)0 - pDataSpec->uncompressedSize);
+        }
+
+        if (!pItem->isDirect) {
+            cyberfm_extract_release_span(pContext, pItem->spanIndex);
+        }
+
+        *pBusyTime += cyberfm_get_time() - startTime;
+
+        cyberfm_extract_finish_item(pContext, iItem, pItem->pErrorMessage);
+    }
+}
+
+static void* cyberfm_extract_thread_proc(void* pUserData)
+{
+    cyberfm_extract_thread* pThread = (cyberfm_extract_thread*)pUserData;
+
+    if (pThread->stage == CYBERFM_EXTRACT_STAGE_READ) {
+        cyberfm_extract_read_stage(pThread->pContext, &pThread->busyTime);
+    } else if (pThread->stage == CYBERFM_EXTRACT_STAGE_DECODE) {
+        cyberfm_extract_decode_stage(pThread->pContext, &pThread->busyTime);
+    } else {
+        cyberfm_extract_write_stage(pThread->pContext, &pThread->busyTime);
+    }
+
+    cyberfm_atomic_fetch_add_32(&pThread->pContext->runningThreadCount[pThread->stage], (uint32_t)-1);
+    return NULL;
+}
+
+/*
+Extracts every file in the archive. The sub-files are read in the order they sit in the archive rather than file order, with
+nearby sub-files coalesced into a single read. This keeps the reads sequential which matters a lot for hard drives and
+network mounts. The progress is always reported in file order so that the output is the same regardless of the thread
+count. The time each stage spent working is output to pStageStats.
+
+When pConfig->pStoreDir is set, files are deduplicated into the store and linked into the output directory. See the top of
+this file.
+*/
+static cyberfm_result cyberfm_extract_archive(cyberfm_archive* pArchive, const char* pOutputDir, const cyberfm_extract_config* pConfig, cyberfm_extract_stage_stats* pStageStats)
+{
+    cyberfm_result result;
+    cyberfm_extract_context context;
+    cyberfm_extract_job* pJobs = NULL;
+    uint32_t* pFirstJobOfFile = NULL;
+    cyberfm_extract_thread* pThreads = NULL;
+    cyberfm_thread* pThreadHandles = NULL;
+    cyberfm_bool32* pIsThreadCreated = NULL;
+    uint32_t threadCounts[CYBERFM_EXTRACT_STAGE_COUNT];
+    uint32_t totalThreadCount;
+    uint32_t jobCount;
+    uint32_t iJob;
+    uint32_t iFile;
+    uint32_t iItem;
+    uint32_t iThread;
+    int iStage;
+    cyberfm_bool32 isAborted = CYBERFM_FALSE;
+    cyberfm_read_plan_config planConfig;
+    cyberfm_read_plan plan;
+    uint32_t fileCount = pArchive->pCentralDirectory->fileInfoCount;
+    uint8_t* pFileFilter = NULL;
+    uint8_t* pIsUnchanged = NULL;
+    uint32_t* pContentFiles = NULL;
+    uint8_t* pIsContentFailed = NULL;
+    FILE* pIndexFile = NULL;
+    FILE* pJournalFile = NULL;
+    char journalPath[512];
+    cyberfm_manifest manifest;
+    cyberfm_manifest newManifest;
+    uint32_t dedupedFileCount = 0;
+    uint64_t dedupedSize = 0;
+    uint32_t unchangedFileCount = 0;
+    uint32_t deletedFileCount = 0;
+
+    threadCounts[CYBERFM_EXTRACT_STAGE_READ]   = CYBERFM_MAX(pConfig->readerThreadCount,  1);
+    threadCounts[CYBERFM_EXTRACT_STAGE_DECODE] = CYBERFM_MAX(pConfig->decoderThreadCount, 1);
+    threadCounts[CYBERFM_EXTRACT_STAGE_WRITE]  = CYBERFM_MAX(pConfig->writerThreadCount,  1);
+    totalThreadCount = threadCounts[0] + threadCounts[1] + threadCounts[2];
+
+    for (iStage = 0; iStage < CYBERFM_EXTRACT_STAGE_COUNT; iStage += 1) {
+        pStageStats[iStage].threadCount = threadCounts[iStage];
+        pStageStats[iStage].busyTime    = 0;
+    }
+
+    memset(&context, 0, sizeof(context));
+    memset(&plan, 0, sizeof(plan));
+    memset(&manifest, 0, sizeof(manifest));
+    memset(&newManifest, 0, sizeof(newManifest));
+
+    planConfig = cyberfm_read_plan_config_init();
+    planConfig.directCopyMinSize = CYBERFM_EXTRACT_DIRECT_COPY_MIN_SIZE;
+
+    if (pConfig->pStoreDir != NULL || pConfig->pManifestPath != NULL || pConfig->pFileSelection != NULL) {
+        pFileFilter  = (uint8_t*)malloc(fileCount + 1);
+        pIsUnchanged = (uint8_t*)calloc(fileCount + 1, 1);
+        if (pFileFilter == NULL || pIsUnchanged == NULL) {
+            result = CYBERFM_OUT_OF_MEMORY;
+            goto done;
+        }
+
+        memset(pFileFilter, 1, fileCount + 1);
+        planConfig.pFileFilter = pFileFilter;
+    }
+
+    /* When deduplicating, anything that doesn't need to be written to the store is left out of the plan. */
+    if (pConfig->pStoreDir != NULL) {
+        pContentFiles    = (uint32_t*)malloc((fileCount + 1) * sizeof(*pContentFiles));
+        pIsContentFailed = (uint8_t*)calloc(fileCount + 1, 1);
+        if (pContentFiles == NULL || pIsContentFailed == NULL) {
+            result = CYBERFM_OUT_OF_MEMORY;
+            goto done;
+        }
+
+        result = cyberfm_extract_build_dedupe_filter(pArchive, pConfig->pStoreDir, pConfig->pFileSelection, pContentFiles, pFileFilter);
+        if (result != CYBERFM_SUCCESS) {
+            goto done;
+        }
+
+        if (pConfig->linkMode == CYBERFM_EXTRACT_LINK_INDEX) {
+            char indexPath[512];
+
+            snprintf(indexPath, sizeof(indexPath), "%s/dedupe.txt", pOutputDir);
+            if (mfs_fopen(&pIndexFile, indexPath, "wb") != MFS_SUCCESS) {
+                result = CYBERFM_ERROR;
+                goto done;
+            }
+        }
+    }
+
+    /*
+    When extracting incrementally, the journal of an interrupted extraction is merged into the manifest. What's left of the
+    manifest after removing anything that's changed is then saved straight away so the journal can be started again.
+    */
+    if (pConfig->pManifestPath != NULL) {
+        snprintf(journalPath, sizeof(journalPath), "%s.journal", pConfig->pManifestPath);
+
+        result = cyberfm_manifest_load(&manifest, pConfig->pManifestPath, CYBERFM_TRUE);
+        if (result == CYBERFM_SUCCESS) {
+            result = cyberfm_manifest_load(&manifest, journalPath, CYBERFM_FALSE);
+        }
+
+        if (result != CYBERFM_SUCCESS) {
+            goto done;
+        }
+
+        cyberfm_manifest_sort(&manifest);
+        cyberfm_extract_build_incremental_filter(pArchive, pConfig->pPathDictionary, pOutputDir, &manifest, pContentFiles, pFileFilter, pIsUnchanged, &unchangedFileCount, &deletedFileCount);
+
+        for (iFile = 0; iFile < fileCount; iFile += 1) {
+            if (pIsUnchanged[iFile]) {
+                result = cyberfm_extract_add_to_manifest(pArchive, iFile, &newManifest, NULL);
+                if (result != CYBERFM_SUCCESS) {
+                    goto done;
+                }
+            }
+        }
+
+        result = cyberfm_manifest_save(&newManifest, pConfig->pManifestPath);
+        if (result != CYBERFM_SUCCESS) {
+            goto done;
+        }
+
+        if (mfs_fopen(&pJournalFile, journalPath, "wb") != MFS_SUCCESS) {
+            result = CYBERFM_ERROR;
+            goto done;
+        }
+    }
+
+    /* Files that weren't selected are never read. */
+    if (pConfig->pFileSelection != NULL) {
+        for (iFile = 0; iFile < fileCount; iFile += 1) {
+            if (pConfig->pFileSelection[iFile] == 0) {
+                pFileFilter[iFile] = 0;
+            }
+        }
+    }
+
+    result = cyberfm_read_plan_init(pArchive, &planConfig, &plan);
+    if (result != CYBERFM_SUCCESS) {
+        goto done;
+    }
+
+    result = cyberfm_queue_init(CYBERFM_EXTRACT_QUEUE_CAPACITY, &context.decodeQueue);
+    if (result != CYBERFM_SUCCESS) {
+        goto done;
+    }
+
+    result = cyberfm_queue_init(CYBERFM_EXTRACT_QUEUE_CAPACITY, &context.writeQueue);
+    if (result != CYBERFM_SUCCESS) {
+        goto done;
+    }
+
+    /*
+    Every sub-file gets it's own job for tracking it's progress. Files without any sub-files still get a job so that the error
+    is reported like it would be for any other file.
+    */
+    jobCount = 0;
+    for (iFile = 0; iFile < fileCount; iFile += 1) {
+        uint32_t subFileCount = pArchive->pCentralDirectory->pFileInfo[iFile].dataSpecRangeEnd - pArchive->pCentralDirectory->pFileInfo[iFile].dataSpecRangeBeg;
+        jobCount += (subFileCount > 0) ? subFileCount : 1;
+    }
+
+    pJobs            = (cyberfm_extract_job*)calloc(jobCount + 1, sizeof(*pJobs));
+    pFirstJobOfFile  = (uint32_t*)calloc(fileCount + 1, sizeof(*pFirstJobOfFile));
+    context.pSpans   = (cyberfm_extract_span*)calloc(plan.spanCount + 1, sizeof(*context.pSpans));
+    context.pItems   = (cyberfm_extract_item*)calloc(plan.itemCount + 1, sizeof(*context.pItems));
+    pThreads         = (cyberfm_extract_thread*)calloc(totalThreadCount, sizeof(*pThreads));
+    pThreadHandles   = (cyberfm_thread*)calloc(totalThreadCount, sizeof(*pThreadHandles));
+    pIsThreadCreated = (cyberfm_bool32*)calloc(totalThreadCount, sizeof(*pIsThreadCreated));
+    if (pJobs == NULL || pFirstJobOfFile == NULL || context.pSpans == NULL || context.pItems == NULL || pThreads == NULL || pThreadHandles == NULL || pIsThreadCreated == NULL) {
+        result = CYBERFM_OUT_OF_MEMORY;
+        goto done;
+    }
+
+    /*
+    Anything that didn't make it into the plan can't be extracted. These are marked as failed up front and then the jobs in
+    the plan are reset so they can be picked up by the pipeline.
+    */
+    iJob = 0;
+    for (iFile = 0; iFile < fileCount; iFile += 1) {
+        const cyberfm_archive_file_info* pFileInfo = &pArchive->pCentralDirectory->pFileInfo[iFile];
+        uint32_t iSubFile = 0;
+
+        pFirstJobOfFile[iFile] = iJob;
+
+        do {
+            pJobs[iJob].iFile         = iFile;
+            pJobs[iJob].iSubFile      = iSubFile;
+            pJobs[iJob].pErrorMessage = ". Failed to open file";
+            pJobs[iJob].isDone        = 1;
+
+            iJob     += 1;
+            iSubFile += 1;
+        } while (iSubFile < (pFileInfo->dataSpecRangeEnd - pFileInfo->dataSpecRangeBeg));
+    }
+
+    /*
+    Files that were deduplicated out of the plan have nothing to do until they're linked. Files that haven't changed since
+    the last extraction have nothing to do at all.
+    */
+    if (pFileFilter != NULL) {
+        for (iFile = 0; iFile < fileCount; iFile += 1) {
+            const cyberfm_archive_file_info* pFileInfo = &pArchive->pCentralDirectory->pFileInfo[iFile];
+            uint32_t iDataSpec;
+            cyberfm_bool32 isDeduplicated = (pContentFiles != NULL && pContentFiles[iFile] != CYBERFM_EXTRACT_NOT_DEDUPLICATED);
+            cyberfm_bool32 isSelected = (pConfig->pFileSelection == NULL || pConfig->pFileSelection[iFile] != 0);
+
+            if (pFileFilter[iFile] != 0 || (isSelected && !isDeduplicated && !pIsUnchanged[iFile])) {
+                continue;
+            }
+
+            for (iJob = pFirstJobOfFile[iFile]; iJob < pFirstJobOfFile[iFile] + (pFileInfo->dataSpecRangeEnd - pFileInfo->dataSpecRangeBeg); iJob += 1) {
+                pJobs[iJob].pErrorMessage = NULL;
+            }
+
+            if (isDeduplicated) {
+                for (iDataSpec = pFileInfo->dataSpecRangeBeg; iDataSpec < pFileInfo->dataSpecRangeEnd; iDataSpec += 1) {
+                    dedupedSize += pArchive->pCentralDirectory->pFileDataSpec[iDataSpec].uncompressedSize;
+                }
+
+                dedupedFileCount += 1;
+            }
+        }
+    }
+
+    for (iItem = 0; iItem < plan.itemCount; iItem += 1) {
+        cyberfm_extract_job* pJob = &pJobs[pFirstJobOfFile[plan.pItems[iItem].fileIndex] + plan.pItems[iItem].subfile];
+        pJob->pErrorMessage = NULL;
+        pJob->isDone        = 0;
+    }
+
+    context.pArchive        = pArchive;
+    context.pOutputDir      = pOutputDir;
+    context.pJobs           = pJobs;
+    context.pFirstJobOfFile = pFirstJobOfFile;
+    context.pPlan           = &plan;
+    context.pStoreDir       = pConfig->pStoreDir;
+    context.pPathDictionary = pConfig->pPathDictionary;
+    context.pContentFiles   = pContentFiles;
+
+    /*
+    The running thread counts need to be set before any thread starts so a stage doesn't think the stage before it has
+    already finished. Threads are created starting from the end of the pipeline. If every thread of a stage fails to be
+    created, the stages before it are never started, and there won't be anything for the later stages to do.
+    */
+    for (iStage = 0; iStage < CYBERFM_EXTRACT_STAGE_COUNT; iStage += 1) {
+        context.runningThreadCount[iStage] = threadCounts[iStage];
+    }
+
+    iThread = 0;
+    for (iStage = CYBERFM_EXTRACT_STAGE_COUNT - 1; iStage >= 0; iStage -= 1) {
+        uint32_t iStageThread;
+
+        if (isAborted) {
+            pStageStats[iStage].threadCount = 0;
+            cyberfm_atomic_store_32(&context.runningThreadCount[iStage], 0);
+            continue;
+        }
+
+        for (iStageThread = 0; iStageThread < threadCounts[iStage]; iStageThread += 1) {
+            pThreads[iThread].pContext = &context;
+            pThreads[iThread].stage    = (uint32_t)iStage;
+
+            if (cyberfm_thread_create(&pThreadHandles[iThread], cyberfm_extract_thread_proc, &pThreads[iThread]) == CYBERFM_SUCCESS) {
+                pIsThreadCreated[iThread] = CYBERFM_TRUE;
+            } else {
+                pStageStats[iStage].threadCount -= 1;
+                cyberfm_atomic_fetch_add_32(&context.runningThreadCount[iStage], (uint32_t)-1);
+            }
+
+            iThread += 1;
+        }
+
+        if (pStageStats[iStage].threadCount == 0) {
+            isAborted = CYBERFM_TRUE;
+        }
+    }
+
+    if (isAborted) {
+        /* Nothing will have been read. Just mark everything as failed. */
+        for (iJob = 0; iJob < jobCount; iJob += 1) {
+            if (cyberfm_atomic_load_32(&pJobs[iJob].isDone) == 0) {
+                pJobs[iJob].pErrorMessage = ". Failed to extract file";
+                pJobs[iJob].isDone        = 1;
+            }
+        }
+    }
+
+    /* Report progress in file order. */
+    iJob = 0;
+    for (iFile = 0; iFile < pArchive->pCentralDirectory->fileInfoCount; iFile += 1) {
+        const cyberfm_archive_file_info* pFileInfo = &pArchive->pCentralDirectory->pFileInfo[iFile];
+        cyberfm_bool32 hasError = CYBERFM_FALSE;
+        char fileName[256];
+
+        /* Files that weren't selected aren't mentioned at all. Their jobs were marked as done up front. */
+        if (pConfig->pFileSelection != NULL && pConfig->pFileSelection[iFile] == 0) {
+            while (iJob < jobCount && pJobs[iJob].iFile == iFile) {
+                iJob += 1;
+            }
+
+            continue;
+        }
+
+        cyberfm_extract_get_file_name(pConfig->pPathDictionary, pFileInfo->hashedName, fileName, sizeof(fileName));
+        printf("Extracting %u/%u: %s", iFile + 1, pArchive->pCentralDirectory->fileInfoCount, fileName);
+
+        for (; iJob < jobCount && pJobs[iJob].iFile == iFile; iJob += 1) {
+            while (cyberfm_atomic_load_32(&pJobs[iJob].isDone) == 0) {
+                cyberfm_sleep(1);
+            }
+
+            if (pJobs[iJob].pErrorMessage != NULL) {
+                printf("%s", pJobs[iJob].pErrorMessage);
+                hasError = CYBERFM_TRUE;
+            }
+        }
+
+        /*
+        The file this one shares it's content with will always come first, so by the time we get here it's object will
+        have been written to the store, unless it failed. If it failed, so does every file that shares it's content.
+        */
+        if (pContentFiles != NULL && pContentFiles[iFile] != CYBERFM_EXTRACT_NOT_DEDUPLICATED) {
+            if (hasError && pContentFiles[iFile] == iFile) {
+                pIsContentFailed[iFile] = 1;
+            } else if (!hasError && pIsContentFailed[pContentFiles[iFile]]) {
+                printf(". Failed to extract file");
+                hasError = CYBERFM_TRUE;
+            }
+        }
+
+        if (pContentFiles != NULL && pContentFiles[iFile] != CYBERFM_EXTRACT_NOT_DEDUPLICATED && !hasError) {
+            uint32_t iSubFile;
+
+            for (iSubFile = 0; iSubFile < (pFileInfo->dataSpecRangeEnd - pFileInfo->dataSpecRangeBeg); iSubFile += 1) {
+                char objectPath[512];
+                char subFilePath[512];
+
+                cyberfm_extract_get_object_path(pArchive, pConfig->pStoreDir, pContentFiles[iFile], iSubFile, objectPath, sizeof(objectPath));
+
+                /* Don't point at an object that isn't there. A dangling link isn't an extracted file. */
+                if (!mfs_file_exists(objectPath)) {
+                    printf(". Missing from store");
+                    hasError = CYBERFM_TRUE;
+                    break;
+                }
+
+                if (pIndexFile != NULL) {
+                    if ((pFileInfo->dataSpecRangeEnd - pFileInfo->dataSpecRangeBeg) > 1) {
+                        fprintf(pIndexFile, "%llu/%u\t%s\n", pFileInfo->hashedName, iSubFile, objectPath);
+                    } else {
+                        fprintf(pIndexFile, "%llu\t%s\n", pFileInfo->hashedName, objectPath);
+                    }
+                } else {
+                    if (cyberfm_extract_get_subfile_path(pArchive, pConfig->pPathDictionary, pOutputDir, iFile, iSubFile, subFilePath, sizeof(subFilePath)) != CYBERFM_SUCCESS || cyberfm_extract_link(objectPath, subFilePath, pConfig->linkMode) != CYBERFM_SUCCESS) {
+                        printf(". Failed to link file");
+                        hasError = CYBERFM_TRUE;
+                        break;
+                    }
+                }
+            }
+        }
+
+        /* Only files that were completely extracted make it into the manifest. Anything else is tried again next time. */
+        if (pJournalFile != NULL && !hasError && !pIsUnchanged[iFile]) {
+            if (cyberfm_extract_add_to_manifest(pArchive, iFile, &newManifest, pJournalFile) != CYBERFM_SUCCESS) {
+                printf(". Failed to update manifest");
+            }
+        }
+
+        printf("\n");
+    }
+
+    if (pContentFiles != NULL) {
+        printf("Deduplicated %u of %u files. %.2f MB was not written.\n", dedupedFileCount, fileCount, dedupedSize / (1024.0 * 1024.0));
+    }
+
+    if (pJournalFile != NULL) {
+        printf("Skipped %u unchanged files. Deleted %u files that are no longer in the archive.\n", unchangedFileCount, deletedFileCount);
+
+        mfs_fclose(pJournalFile);
+        pJournalFile = NULL;
+
+        /* The journal is only removed once the manifest is safely saved. */
+        if (cyberfm_manifest_save(&newManifest, pConfig->pManifestPath) == CYBERFM_SUCCESS) {
+            remove(journalPath);
+        } else {
+            printf("Failed to save manifest: %s\n", pConfig->pManifestPath);
+        }
+    }
+
+    for (iThread = 0; iThread < totalThreadCount; iThread += 1) {
+        if (pIsThreadCreated[iThread]) {
+            cyberfm_thread_wait(&pThreadHandles[iThread]);
+            pStageStats[pThreads[iThread].stage].busyTime += pThreads[iThread].busyTime;
+        }
+    }
+
+done:
+    free(pJobs);
+    free(pFirstJobOfFile);
+    free(context.pSpans);
+    free(context.pItems);
+    free(pThreads);
+    free(pThreadHandles);
+    free(pIsThreadCreated);
+    cyberfm_queue_uninit(&context.writeQueue);
+    cyberfm_queue_uninit(&context.decodeQueue);
+    cyberfm_read_plan_uninit(&plan);
+
+    if (pIndexFile != NULL) {
+        mfs_fclose(pIndexFile);
+    }
+
+    if (pJournalFile != NULL) {
+        mfs_fclose(pJournalFile);
+    }
+
+    free(manifest.pEntries);
+    free(newManifest.pEntries);
+    free(pFileFilter);
+    free(pIsUnchanged);
+    free(pContentFiles);
+    free(pIsContentFailed);
+
+    return result;
+}
+
+/*
+Everything from here on is only used by the command line tool. The benchmarks include this file for the extractor, but
+have their own main().
+*/
+#ifndef CYBERFM_NO_MAIN
+
+/* Parses a decimal number. Returns false if there's anything other than digits, or if it doesn't fit in 64 bits. */
+static cyberfm_bool32 cyberfm_parse_uint64(const char* pString, uint64_t* pValue)
+{
+    uint64_t value = 0;
+    const char* pChar;
+
+    if (pString[0] == '\0') {
+        return CYBERFM_FALSE;
+    }
+
+    for (pChar = pString; pChar[0] != '\0'; pChar += 1) {
+        uint64_t digit;
+
+        if (pChar[0] < '0' || pChar[0] > '9') {
+            return CYBERFM_FALSE;
+        }
+
+        digit = (uint64_t)(pChar[0] - '0');
+        if (value > (~(uint64_t)0 - digit) / 10) {
+            return CYBERFM_FALSE;   /* Too big. */
+        }
+
+        value = (value * 10) + digit;
+    }
+
+    *pValue = value;
+    return CYBERFM_TRUE;
+}
+
+/* Parses the value of a numeric command line option. Prints an error and returns false if it's not a valid number. */
+static cyberfm_bool32 cyberfm_parse_uint64_option(const char* pKey, const char* pValue, uint64_t* pResult)
+{
+    if (!cyberfm_parse_uint64(pValue, pResult)) {
+        printf("Invalid value for %s: \"%s\"\n", pKey, pValue);
+        return CYBERFM_FALSE;
+    }
+
+    return CYBERFM_TRUE;
+}
+
+/* The same as cyberfm_parse_uint64_option(), but for options that need to fit in 32 bits such as thread counts. */
+static cyberfm_bool32 cyberfm_parse_uint32_option(const char* pKey, const char* pValue, uint32_t* pResult)
+{
+    uint64_t value;
+
+    if (!cyberfm_parse_uint64(pValue, &value) || value > 0xFFFFFFFF) {
+        printf("Invalid value for %s: \"%s\"\n", pKey, pValue);
+        return CYBERFM_FALSE;
+    }
+
+    *pResult = (uint32_t)value;
+    return CYBERFM_TRUE;
+}
+
+/* Prints the share of time each stage spent working. The stage closest to 100% is the bottleneck. */
+static void cyberfm_extract_print_stage_stats(const cyberfm_extract_stage_stats* pStageStats, double totalTime)
+{
+    static const char* stageNames[CYBERFM_EXTRACT_STAGE_COUNT] = {"Read", "Decompress", "Write"};
+    int iStage;
+
+    printf("Stage utilisation over %.2fs:\n", totalTime);
+
+    for (iStage = 0; iStage < CYBERFM_EXTRACT_STAGE_COUNT; iStage += 1) {
+        double utilisation = 0;
+
+        if (pStageStats[iStage].threadCount > 0 && totalTime > 0) {
+            utilisation = (pStageStats[iStage].busyTime / (totalTime * pStageStats[iStage].threadCount)) * 100;
+        }
+
+        printf("    %-12s %u thread(s), %5.1f%% busy\n", stageNames[iStage], pStageStats[iStage].threadCount, utilisation);
+    }
+}
+
+/*
+Prints the library's counters and timers for --stats. Times are printed in microseconds. The JSON format is for scripts
+that compare runs, and is printed as a single object.
+*/
+static void cyberfm_print_stats(cyberfm_bool32 isJSON)
+{
+    static const double percentiles[4] = {50, 90, 99, 100};
+    cyberfm_stats* pStats;
+    uint32_t iCounter;
+    uint32_t iTimer;
+    int iPercentile;
+
+    /* The histograms make this too big to put on the stack. */
+    pStats = (cyberfm_stats*)malloc(sizeof(*pStats));
+    if (pStats == NULL) {
+        return;
+    }
+
+    if (cyberfm_get_stats(pStats) != CYBERFM_SUCCESS) {
+        printf("Statistics are not available. Compile with CYBERFM_ENABLE_STATS defined.\n");
+        free(pStats);
+        return;
+    }
+
+    if (isJSON) {
+        printf("{\"counters\": {");
+        for (iCounter = 0; iCounter < CYBERFM_STAT_COUNTER_COUNT; iCounter += 1) {
+            printf("%s\"%s\": %llu", (iCounter > 0) ? ", " : "", cyberfm_stat_counter_to_string(iCounter), (unsigned long long)pStats->counters[iCounter]);
+        }
+
+        printf("}, \"timers\": {");
+        for (iTimer = 0; iTimer < CYBERFM_STAT_TIMER_COUNT; iTimer += 1) {
+            const cyberfm_histogram* pHistogram = &pStats->timers[iTimer];
+
+            printf("%s\"%s\": {\"count\": %llu, \"totalUs\": %.3f", (iTimer > 0) ? ", " : "", cyberfm_stat_timer_to_string(iTimer), (unsigned long long)pHistogram->count, pHistogram->totalNanoseconds / 1000.0);
+            printf(", \"p50Us\": %.3f, \"p90Us\": %.3f, \"p99Us\": %.3f, \"maxUs\": %.3f}",
+                cyberfm_histogram_get_percentile(pHistogram, 50) / 1000.0,
+                cyberfm_histogram_get_percentile(pHistogram, 90) / 1000.0,
+                cyberfm_histogram_get_percentile(pHistogram, 99) / 1000.0,
+                cyberfm_histogram_get_max(pHistogram) / 1000.0);
+        }
+
+        printf("}}\n");
+    } else {
+        printf("Counters:\n");
+        for (iCounter = 0; iCounter < CYBERFM_STAT_COUNTER_COUNT; iCounter += 1) {
+            printf("    %-18s %llu\n", cyberfm_stat_counter_to_string(iCounter), (unsigned long long)pStats->counters[iCounter]);
+        }
+
+        printf("Timers (us):\n");
+        printf("    %-18s %10s %12s %10s %10s %10s %10s %10s\n", "", "count", "total", "mean", "p50", "p90", "p99", "max");
+        for (iTimer = 0; iTimer < CYBERFM_STAT_TIMER_COUNT; iTimer += 1) {
+            const cyberfm_histogram* pHistogram = &pStats->timers[iTimer];
+            double mean = (pHistogram->count > 0) ? (pHistogram->totalNanoseconds / 1000.0) / pHistogram->count : 0;
+
+            printf("    %-18s %10llu %12.1f %10.1f", cyberfm_stat_timer_to_string(iTimer), (unsigned long long)pHistogram->count, pHistogram->totalNanoseconds / 1000.0, mean);
+            for (iPercentile = 0; iPercentile < 4; iPercentile += 1) {
+                printf(" %10.1f", cyberfm_histogram_get_percentile(pHistogram, percentiles[iPercentile]) / 1000.0);
+            }
+            printf("\n");
+        }
+    }
+
+    free(pStats);
+}
+
+
+
+
+/*
+Verification checks every file against the hash in the central directory. This is the same as
+cyberfm_archive_verify_files(), except that each file is flagged when it's done so that the progress can be reported in
+file order while the rest are still being verified.
+*/
+typedef struct
+{
+    cyberfm_archive* pArchive;
+    cyberfm_verify_request* pRequests;
+    volatile uint32_t* pIsDone;
+    volatile uint32_t hashKind;
+} cyberfm_verify_context;
+
+static void cyberfm_verify_job_proc_with_progress(void* pUserData, uint32_t jobIndex)
+{
+    cyberfm_verify_context* pContext = (cyberfm_verify_context*)pUserData;
+    cyberfm_verify_request* pRequest = &pContext->pRequests[jobIndex];
+
+    pRequest->hashKind = cyberfm_atomic_load_32(&pContext->hashKind);
+    pRequest->result   = cyberfm_archive_verify_file(pContext->pArchive, pRequest->index, &pRequest->hashKind);
+
+    if (pRequest->result == CYBERFM_SUCCESS) {
+        cyberfm_atomic_store_32(&pContext->hashKind, pRequest->hashKind);
+    }
+
+    cyberfm_atomic_store_32(&pContext->pIsDone[jobIndex], 1);
+}
+
+/* Verifies every file in the archive. The number of files that failed is output to pFailedCount. */
+static cyberfm_result cyberfm_verify_archive(cyberfm_archive* pArchive, uint32_t threadCount, uint32_t* pFailedCount)
+{
+    cyberfm_verify_context context;
+    cyberfm_job_pool pool;
+    cyberfm_job_pool_config poolConfig;
+    uint64_t* pJobCosts;
+    uint32_t fileCount = pArchive->pCentralDirectory->fileInfoCount;
+    uint32_t hashKindCounts[CYBERFM_HASH_KIND_COUNT];
+    uint32_t mismatchCount = 0;
+    uint32_t unreadableCount = 0;
+    uint32_t iFile;
+    uint32_t iHashKind;
+    cyberfm_bool32 isPoolInitialized;
+
+    *pFailedCount = 0;
+
+    context.pArchive  = pArchive;
+    context.hashKind  = CYBERFM_HASH_KIND_UNKNOWN;
+    context.pRequests = (cyberfm_verify_request*)calloc(fileCount + 1, sizeof(*context.pRequests));
+    context.pIsDone   = (volatile uint32_t*)calloc(fileCount + 1, sizeof(*context.pIsDone));
+    pJobCosts         = (uint64_t*)calloc(fileCount + 1, sizeof(*pJobCosts));
+    if (context.pRequests == NULL || context.pIsDone == NULL || pJobCosts == NULL) {
+        free(context.pRequests);
+        free((void*)context.pIsDone);
+        free(pJobCosts);
+        return CYBERFM_OUT_OF_MEMORY;
+    }
+
+    /* Large files are started first so that one doesn't get left until the end. */
+    for (iFile = 0; iFile < fileCount; iFile += 1) {
+        const cyberfm_archive_file_info* pFileInfo = &pArchive->pCentralDirectory->pFileInfo[iFile];
+        uint32_t iDataSpec;
+
+        context.pRequests[iFile].index = iFile;
+
+        for (iDataSpec = pFileInfo->dataSpecRangeBeg; iDataSpec < pFileInfo->dataSpecRangeEnd && iDataSpec < pArchive->pCentralDirectory->fileDataSpecCount; iDataSpec += 1) {
+            pJobCosts[iFile] += pArchive->pCentralDirectory->pFileDataSpec[iDataSpec].uncompressedSize;
+        }
+    }
+
+    poolConfig = cyberfm_job_pool_config_init(threadCount, fileCount, cyberfm_verify_job_proc_with_progress, &context);
+    poolConfig.pJobCosts = pJobCosts;
+
+    isPoolInitialized = (fileCount > 0 && cyberfm_job_pool_init(&poolConfig, &pool) == CYBERFM_SUCCESS);
+    if (!isPoolInitialized) {
+        for (iFile = 0; iFile < fileCount; iFile += 1) {
+            cyberfm_verify_job_proc_with_progress(&context, iFile);
+        }
+    }
+
+    memset(hashKindCounts, 0, sizeof(hashKindCounts));
+
+    /* Report progress in file order. */
+    for (iFile = 0; iFile < fileCount; iFile += 1) {
+        const cyberfm_verify_request* pRequest = &context.pRequests[iFile];
+
+        printf("Verifying %u/%u: %llu", iFile + 1, fileCount, pArchive->pCentralDirectory->pFileInfo[iFile].hashedName);
+
+        while (cyberfm_atomic_load_32(&context.pIsDone[iFile]) == 0) {
+            cyberfm_sleep(1);
+        }
+
+        if (pRequest->result == CYBERFM_SUCCESS) {
+            hashKindCounts[pRequest->hashKind] += 1;
+        } else if (pRequest->result == CYBERFM_CORRUPT_DATA) {
+            printf(". Hash mismatch");
+            mismatchCount += 1;
+        } else if (pRequest->result == CYBERFM_INVALID_OPERATION) {
+            printf(". No hash");
+        } else {
+            printf(". Failed to read file");
+            unreadableCount += 1;
+        }
+
+        printf("\n");
+    }
+
+    if (isPoolInitialized) {
+        cyberfm_job_pool_uninit(&pool);
+    }
+
+    printf("Verified %u files using %s. %u did not match. %u could not be read.\n", fileCount, (cyberfm_sha1_is_accelerated()) ? "the SHA extensions" : "plain C", mismatchCount, unreadableCount);
+    for (iHashKind = 1; iHashKind < CYBERFM_HASH_KIND_COUNT; iHashKind += 1) {
+        if (hashKindCounts[iHashKind] > 0) {
+            printf("    %u matched the %s.\n", hashKindCounts[iHashKind], cyberfm_hash_kind_to_string(iHashKind));
+        }
+    }
+
+    *pFailedCount = mismatchCount + unreadableCount;
+
+    free(context.pRequests);
+    free((void*)context.pIsDone);
+    free(pJobCosts);
+
+    return CYBERFM_SUCCESS;
+}
+
+
+/*
+Packing is the reverse of extracting. The input directory is expected to be laid out the same way the extractor writes it,
+with each file named after it's hashed name. Files with more than one sub-file are folders, with each sub-file named after
+it's index. Anything not named like this, such as a manifest or dedupe store, is skipped.
+*/
+typedef struct
+{
+    uint64_t hashedName;
+    size_t nameIndex;   /* Index into the list of names in the directory. */
+} cyberfm_pack_item;
+
+static cyberfm_bool32 cyberfm_pack_filter_any(const char* pFileName)
+{
+    (void)pFileName;
+    return CYBERFM_TRUE;
+}
+
+static int cyberfm_pack_item_compare(const void* a, const void* b)
+{
+    const cyberfm_pack_item* pItemA = (const cyberfm_pack_item*)a;
+    const cyberfm_pack_item* pItemB = (const cyberfm_pack_item*)b;
+
+    if (pItemA->hashedName < pItemB->hashedName) {
+        return -1;
+    } else if (pItemA->hashedName > pItemB->hashedName) {
+        return  1;
+    } else {
+        return  0;
+    }
+}
+
+/*
+Reads a whole file onto the end of a buffer, growing it as required. The modified time is output as a FILETIME (100ns
+intervals since 1601) since that's what the timestamps in the archive look like.
+*/
+static cyberfm_result cyberfm_pack_read_file(const char* pFilePath, uint8_t** ppBuffer, size_t* pBufferCap, size_t* pBufferSize, uint64_t* pModifiedTime)
+{
+    cyberfm_result result;
+    FILE* pFile;
+    struct _stat64 info;
+    size_t fileSize;
+
+    result = cyberfm_result_from_minifs(mfs_fopen(&pFile, pFilePath, "rb"));
+    if (result != CYBERFM_SUCCESS) {
+        return result;
+    }
+
+    result = cyberfm_result_from_minifs(mfs_fstat(pFile, &info));
+    if (result != CYBERFM_SUCCESS) {
+        mfs_fclose(pFile);
+        return result;
+    }
+
+    if ((uint64_t)info.st_size > 0xFFFFFFFF) {
+        mfs_fclose(pFile);
+        return CYBERFM_OUT_OF_RANGE;    /* Sizes are 32-bit in the archive format. */
+    }
+
+    fileSize = (size_t)info.st_size;
+
+    if (*pBufferSize + fileSize > *pBufferCap) {
+        size_t newCap = CYBERFM_MAX(*pBufferCap * 2, *pBufferSize + fileSize);
+        uint8_t* pNewBuffer = (uint8_t*)realloc(*ppBuffer, CYBERFM_MAX(newCap, 1));
+        if (pNewBuffer == NULL) {
+            mfs_fclose(pFile);
+            return CYBERFM_OUT_OF_MEMORY;
+        }
+
+        *ppBuffer   = pNewBuffer;
+        *pBufferCap = newCap;
+    }
+
+    if (fileSize > 0) {
+        result = cyberfm_result_from_minifs(mfs_fread(pFile, *ppBuffer + *pBufferSize, fileSize, NULL));
+    }
+
+    mfs_fclose(pFile);
+
+    if (result != CYBERFM_SUCCESS) {
+        return result;
+    }
+
+    *pBufferSize += fileSize;
+    *pModifiedTime = ((uint64_t)info.st_mtime * 10000000) + 116444736000000000ULL;
+
+    return CYBERFM_SUCCESS;
+}
+
+static cyberfm_result cyberfm_pack_directory(const char* pInputDir, const char* pOutputPath, const cyberfm_archive_writer_config* pWriterConfig)
+{
+    cyberfm_result result;
+    cyberfm_string_list names;
+    cyberfm_pack_item* pItems = NULL;
+    size_t itemCount = 0;
+    size_t skippedCount = 0;
+    size_t iName;
+    size_t iItem;
+    cyberfm_archive_writer writer;
+    cyberfm_archive_writer_stats stats;
+    uint8_t* pBuffer = NULL;
+    size_t bufferCap = 0;
+    size_t* pSubFileSizes = NULL;
+    const void** ppSubFileData = NULL;
+    uint32_t subFileCap = 0;
+
+    result = cyberfm_list_directory(pInputDir, cyberfm_pack_filter_any, &names);
+    if (result != CYBERFM_SUCCESS) {
+        printf("Failed to open directory: %s\n", pInputDir);
+        return result;
+    }
+
+    pItems = (cyberfm_pack_item*)malloc(CYBERFM_MAX(names.count, 1) * sizeof(*pItems));
+    if (pItems == NULL) {
+        cyberfm_string_list_free(&names);
+        return CYBERFM_OUT_OF_MEMORY;
+    }
+
+    for (iName = 0; iName < names.count; iName += 1) {
+        if (cyberfm_parse_uint64(names.ppNames[iName], &pItems[itemCount].hashedName)) {
+            pItems[itemCount].nameIndex = iName;
+            itemCount += 1;
+        } else {
+            skippedCount += 1;
+        }
+    }
+
+    /* The writer will sort the central directory anyway, but doing it here too means the data is laid out in the same order. */
+    if (itemCount > 1) {
+        qsort(pItems, itemCount, sizeof(*pItems), cyberfm_pack_item_compare);
+    }
+
+    /* Names like "0123" and "123" are the same hashed name. The archive can only have one of them. */
+    for (iItem = 1; iItem < itemCount; iItem += 1) {
+        if (pItems[iItem].hashedName == pItems[iItem - 1].hashedName) {
+            printf("\"%s\" and \"%s\" are both named %llu. Rename or remove one of them.\n", names.ppNames[pItems[iItem - 1].nameIndex], names.ppNames[pItems[iItem].nameIndex], pItems[iItem].hashedName);
+            free(pItems);
+            cyberfm_string_list_free(&names);
+            return CYBERFM_INVALID_ARGS;
+        }
+    }
+
+    result = cyberfm_archive_writer_init(pOutputPath, pWriterConfig, &writer);
+    if (result != CYBERFM_SUCCESS) {
+        printf("Failed to create archive: %s\n", pOutputPath);
+        free(pItems);
+        cyberfm_string_list_free(&names);
+        return result;
+    }
+
+    for (iItem = 0; iItem < itemCount; iItem += 1) {
+        cyberfm_archive_writer_file file;
+        char path[4096];
+        size_t bufferSize = 0;
+        uint64_t modifiedTime = 0;
+        uint32_t subFileCount = 0;
+        uint32_t iSubFile;
+
+        printf("Packing %u/%u: %llu", (uint32_t)iItem + 1, (uint32_t)itemCount, pItems[iItem].hashedName);
+
+        if (snprintf(path, sizeof(path), "%s/%s", pInputDir, names.ppNames[pItems[iItem].nameIndex]) >= (int)sizeof(path)) {
+            printf(". Path is too long\n");
+            result = CYBERFM_OUT_OF_RANGE;
+            break;
+        }
+
+        /*
+        A folder holds the sub-files of a file, named 0, 1, 2, etc. There's no dedicated way of checking if something is a
+        folder, but a file can't contain a sub-file so we can just look for the first one.
+        */
+        for (;;) {
+            char subFilePath[4096];
+            const char* pFilePath;
+            size_t prevBufferSize = bufferSize;
+            uint64_t subFileModifiedTime;
+
+            if (mfs_file_exists(path)) {
+                if (subFileCount == 1) {
+                    break;
+                }
+
+                pFilePath = path;
+            } else {
+                if (snprintf(subFilePath, sizeof(subFilePath), "%s/%u", path, subFileCount) >= (int)sizeof(subFilePath)) {
+                    result = CYBERFM_OUT_OF_RANGE;
+                    break;
+                }
+
+                if (!mfs_file_exists(subFilePath)) {
+                    break;
+                }
+
+                pFilePath = subFilePath;
+            }
+
+            if (subFileCount == subFileCap) {
+                uint32_t newCap = CYBERFM_MAX(subFileCap * 2, 8);
+                size_t* pNewSizes;
+                const void** ppNewData;
+
+                pNewSizes = (size_t*)realloc(pSubFileSizes, newCap * sizeof(*pSubFileSizes));
+                if (pNewSizes == NULL) {
+                    result = CYBERFM_OUT_OF_MEMORY;
+                    break;
+                }
+                pSubFileSizes = pNewSizes;
+
+                ppNewData = (const void**)realloc((void*)ppSubFileData, newCap * sizeof(*ppSubFileData));
+                if (ppNewData == NULL) {
+                    result = CYBERFM_OUT_OF_MEMORY;
+                    break;
+                }
+                ppSubFileData = ppNewData;
+
+                subFileCap = newCap;
+            }
+
+            result = cyberfm_pack_read_file(pFilePath, &pBuffer, &bufferCap, &bufferSize, &subFileModifiedTime);
+            if (result != CYBERFM_SUCCESS) {
+                break;
+            }
+
+            pSubFileSizes[subFileCount] = bufferSize - prevBufferSize;
+            modifiedTime = CYBERFM_MAX(modifiedTime, subFileModifiedTime);
+            subFileCount += 1;
+        }
+
+        if (result != CYBERFM_SUCCESS) {
+            printf(". Failed to read file\n");
+            break;
+        }
+
+        if (subFileCount == 0) {
+            printf(". No sub-files. Skipping\n");
+            skippedCount += 1;
+            continue;
+        }
+
+        /* The buffer can move while it's being filled so the pointers are set up at the end. */
+        bufferSize = 0;
+        for (iSubFile = 0; iSubFile < subFileCount; iSubFile += 1) {
+            ppSubFileData[iSubFile] = pBuffer + bufferSize;
+            bufferSize += pSubFileSizes[iSubFile];
+        }
+
+        CYBERFM_ZERO_OBJECT(&file);
+        file.hashedName    = pItems[iItem].hashedName;
+        file.unknown1      = modifiedTime;
+        file.subFileCount  = subFileCount;
+        file.ppSubFileData = ppSubFileData;
+        file.pSubFileSizes = pSubFileSizes;
+
+        result = cyberfm_archive_writer_add_file(&writer, &file);
+        if (result != CYBERFM_SUCCESS) {
+            printf(". Failed to write file\n");
+            break;
+        }
+
+        printf("\n");
+    }
+
+    if (result == CYBERFM_SUCCESS) {
+        result = cyberfm_archive_writer_finalize(&writer);
+        if (result != CYBERFM_SUCCESS) {
+            printf("Failed to finalize archive: %s\n", pOutputPath);
+        }
+    }
+
+    if (result == CYBERFM_SUCCESS) {
+        cyberfm_archive_writer_get_stats(&writer, &stats);
+        printf("Packed %u files (%u sub-files, %u compressed). %.2f MB in, %.2f MB out. Skipped %u items.\n", stats.fileCount, stats.subFileCount, stats.compressedSubFileCount, stats.uncompressedSize / (1024.0 * 1024.0), stats.archiveSize / (1024.0 * 1024.0), (uint32_t)skippedCount);
+    }
+
+    cyberfm_archive_writer_uninit(&writer);
+
+    free(pBuffer);
+    free(pSubFileSizes);
+    free((void*)ppSubFileData);
+    free(pItems);
+    cyberfm_string_list_free(&names);
+
+    return result;
+}
+
+
+
+/*
+Listing prints what's in the central directory of archives without reading any file data. Archives are opened in parallel,
+one job per archive. Without sorting, an archive is printed as soon as it and every archive before it are done so output
+starts straight away and memory use stays low. With sorting, everything needs to be collected first.
+
+Output is CSV with a header, or JSON with one object per line. Hashes are output as strings in JSON because a lot of JSON
+parsers can't handle 64-bit integers.
+*/
+#define CYBERFM_LIST_FORMAT_CSV             0
+#define CYBERFM_LIST_FORMAT_JSON            1
+
+#define CYBERFM_LIST_SORT_NONE              0
+#define CYBERFM_LIST_SORT_HASH              1
+#define CYBERFM_LIST_SORT_SIZE              2
+#define CYBERFM_LIST_SORT_COMPRESSED_SIZE   3
+#define CYBERFM_LIST_SORT_RATIO             4
+
+typedef struct
+{
+    uint32_t threadCount;       /* Set to 0 to use one thread per CPU. */
+    uint32_t format;            /* CYBERFM_LIST_FORMAT_* */
+    uint32_t sortKey;           /* CYBERFM_LIST_SORT_* */
+    cyberfm_bool32 isDescending;
+    cyberfm_bool32 isSummary;   /* Print a line for each archive rather than for each file. */
+    uint64_t limit;             /* The maximum number of lines to print. Set to 0 for no limit. */
+    cyberfm_archive_entry_filter filter;
+    const cyberfm_path_dictionary* pPathDictionary;
+} cyberfm_list_config;
+
+typedef struct
+{
+    const char* pArchivePath;
+    cyberfm_result result;
+    cyberfm_archive_entry* pEntries;    /* The entries that passed the filter. Not used for summaries. */
+    size_t entryCount;
+    uint64_t subFileCount;              /* These totals are of the entries that passed the filter. */
+    uint64_t compressedSize;
+    uint64_t uncompressedSize;
+    volatile uint32_t isDone;
+} cyberfm_list_archive;
+
+typedef struct
+{
+    const cyberfm_list_config* pConfig;
+    cyberfm_list_archive* pArchives;
+} cyberfm_list_context;
+
+typedef struct
+{
+    const cyberfm_list_archive* pArchive;
+    const cyberfm_archive_entry* pEntry;
+} cyberfm_list_item;
+
+static uint32_t g_cyberfmListSortKey;   /* qsort() doesn't take any user data. */
+
+static void cyberfm_list_job_proc(void* pUserData, uint32_t jobIndex)
+{
+    cyberfm_list_context* pContext = (cyberfm_list_context*)pUserData;
+    cyberfm_list_archive* pListArchive = &pContext->pArchives[jobIndex];
+    cyberfm_archive_config archiveConfig;
+    cyberfm_archive archive;
+    cyberfm_archive_iterator iterator;
+    size_t entryCap = 0;
+
+    /* Only the central directory is needed so there's no point mapping the archive. */
+    archiveConfig = cyberfm_archive_config_init(0);
+
+    pListArchive->result = cyberfm_archive_init_ex(pListArchive->pArchivePath, &archiveConfig, &archive);
+    if (pListArchive->result == CYBERFM_SUCCESS) {
+        cyberfm_archive_iterator_init(&archive, &pContext->pConfig->filter, &iterator);
+
+        while (cyberfm_archive_iterator_next(&iterator)) {
+            pListArchive->subFileCount     += iterator.entry.subFileCount;
+            pListArchive->compressedSize   += iterator.entry.compressedSize;
+            pListArchive->uncompressedSize += iterator.entry.uncompressedSize;
+
+            if (pContext->pConfig->isSummary) {
+                pListArchive->entryCount += 1;
+                continue;
+            }
+
+            if (pListArchive->entryCount == entryCap) {
+                size_t newCap = (entryCap > 0) ? entryCap * 2 : 256;
+                cyberfm_archive_entry* pNewEntries = (cyberfm_archive_entry*)realloc(pListArchive->pEntries, newCap * sizeof(*pNewEntries));
+                if (pNewEntries == NULL) {
+                    pListArchive->result = CYBERFM_OUT_OF_MEMORY;
+                    break;
+                }
+
+                pListArchive->pEntries = pNewEntries;
+                entryCap = newCap;
+            }
+
+            pListArchive->pEntries[pListArchive->entryCount] = iterator.entry;
+            pListArchive->entryCount += 1;
+        }
+
+        cyberfm_archive_uninit(&archive);
+    }
+
+    cyberfm_atomic_store_32(&pListArchive->isDone, 1);
+}
+
+static double cyberfm_list_get_ratio(uint64_t compressedSize, uint64_t uncompressedSize)
+{
+    return (uncompressedSize > 0) ? (double)compressedSize / (double)uncompressedSize : 1;
+}
+
+static int cyberfm_list_item_compare(const void* a, const void* b)
+{
+    const cyberfm_archive_entry* pEntryA = ((const cyberfm_list_item*)a)->pEntry;
+    const cyberfm_archive_entry* pEntryB = ((const cyberfm_list_item*)b)->pEntry;
+    double valueA;
+    double valueB;
+
+    if (g_cyberfmListSortKey == CYBERFM_LIST_SORT_HASH) {
+        return (pEntryA->hashedName < pEntryB->hashedName) ? -1 : (pEntryA->hashedName > pEntryB->hashedName) ? 1 : 0;
+    }
+
+    if (g_cyberfmListSortKey == CYBERFM_LIST_SORT_SIZE) {
+        valueA = (double)pEntryA->uncompressedSize;
+        valueB = (double)pEntryB->uncompressedSize;
+    } else if (g_cyberfmListSortKey == CYBERFM_LIST_SORT_COMPRESSED_SIZE) {
+        valueA = (double)pEntryA->compressedSize;
+        valueB = (double)pEntryB->compressedSize;
+    } else {
+        valueA = cyberfm_list_get_ratio(pEntryA->compressedSize, pEntryA->uncompressedSize);
+        valueB = cyberfm_list_get_ratio(pEntryB->compressedSize, pEntryB->uncompressedSize);
+    }
+
+    return (valueA < valueB) ? -1 : (valueA > valueB) ? 1 : 0;
+}
+
+/* Prints a string with the quoting needed for the format. */
+static void cyberfm_list_print_string(const char* pString, uint32_t format)
+{
+    const char* pChar;
+
+    putchar('"');
+
+    for (pChar = pString; pChar[0] != '\0'; pChar += 1) {
+        if (format == CYBERFM_LIST_FORMAT_JSON) {
+            if (pChar[0] == '"' || pChar[0] == '\\') {
+                putchar('\\');
+            } else if ((unsigned char)pChar[0] < 0x20) {
+                printf("\\u%04x", (unsigned int)(unsigned char)pChar[0]);
+                continue;
+            }
+        } else {
+            if (pChar[0] == '"') {
+                putchar('"');   /* Quotes are doubled up in CSV. */
+            }
+        }
+
+        putchar(pChar[0]);
+    }
+
+    putchar('"');
+}
+
+static void cyberfm_list_print_header(const cyberfm_list_config* pConfig)
+{
+    if (pConfig->format != CYBERFM_LIST_FORMAT_CSV) {
+        return;
+    }
+
+    if (pConfig->isSummary) {
+        printf("archive,files,subfiles,size,compressed_size,ratio\n");
+    } else {
+        printf("archive,hash,name,subfiles,size,compressed_size,ratio,offset\n");
+    }
+}
+
+static void cyberfm_list_print_archive_summary(const cyberfm_list_archive* pListArchive, const cyberfm_list_config* pConfig)
+{
+    double ratio = cyberfm_list_get_ratio(pListArchive->compressedSize, pListArchive->uncompressedSize);
+
+    if (pConfig->format == CYBERFM_LIST_FORMAT_JSON) {
+        printf("{\"archive\": ");
+        cyberfm_list_print_string(pListArchive->pArchivePath, pConfig->format);
+        printf(", \"files\": %llu, \"subFiles\": %llu, \"size\": %llu, \"compressedSize\": %llu, \"ratio\": %.4f}\n", (unsigned long long)pListArchive->entryCount, (unsigned long long)pListArchive->subFileCount, (unsigned long long)pListArchive->uncompressedSize, (unsigned long long)pListArchive->compressedSize, ratio);
+    } else {
+        cyberfm_list_print_string(pListArchive->pArchivePath, pConfig->format);
+        printf(",%llu,%llu,%llu,%llu,%.4f\n", (unsigned long long)pListArchive->entryCount, (unsigned long long)pListArchive->subFileCount, (unsigned long long)pListArchive->uncompressedSize, (unsigned long long)pListArchive->compressedSize, ratio);
+    }
+}
+
+static void cyberfm_list_print_entry(const cyberfm_list_archive* pListArchive, const cyberfm_archive_entry* pEntry, const cyberfm_list_config* pConfig)
+{
+    const char* pName = cyberfm_path_dictionary_find(pConfig->pPathDictionary, pEntry->hashedName);
+    double ratio = cyberfm_list_get_ratio(pEntry->compressedSize, pEntry->uncompressedSize);
+
+    if (pConfig->format == CYBERFM_LIST_FORMAT_JSON) {
+        printf("{\"archive\": ");
+        cyberfm_list_print_string(pListArchive->pArchivePath, pConfig->format);
+        printf(", \"hash\": \"%llu\", \"name\": ", (unsigned long long)pEntry->hashedName);
+        if (pName != NULL) {
+            cyberfm_list_print_string(pName, pConfig->format);
+        } else {
+            printf("null");
+        }
+        printf(", \"subFiles\": %u, \"size\": %llu, \"compressedSize\": %llu, \"ratio\": %.4f, \"offset\": %llu}\n", pEntry->subFileCount, (unsigned long long)pEntry->uncompressedSize, (unsigned long long)pEntry->compressedSize, ratio, (unsigned long long)pEntry->offset);
+    } else {
+        cyberfm_list_print_string(pListArchive->pArchivePath, pConfig->format);
+        printf(",%llu,", (unsigned long long)pEntry->hashedName);
+        if (pName != NULL) {
+            cyberfm_list_print_string(pName, pConfig->format);
+        }
+        printf(",%u,%llu,%llu,%.4f,%llu\n", pEntry->subFileCount, (unsigned long long)pEntry->uncompressedSize, (unsigned long long)pEntry->compressedSize, ratio, (unsigned long long)pEntry->offset);
+    }
+}
+
+static cyberfm_result cyberfm_list_archives(const cyberfm_string_list* pArchivePaths, const cyberfm_list_config* pConfig)
+{
+    cyberfm_result result = CYBERFM_SUCCESS;
+    cyberfm_list_context context;
+    cyberfm_job_pool pool;
+    cyberfm_job_pool_config poolConfig;
+    cyberfm_bool32 isPoolInitialized;
+    cyberfm_list_item* pItems = NULL;
+    size_t itemCount = 0;
+    uint64_t printedCount = 0;
+    uint32_t archiveCount = (uint32_t)pArchivePaths->count;
+    uint32_t iArchive;
+    size_t iItem;
+
+    context.pConfig   = pConfig;
+    context.pArchives = (cyberfm_list_archive*)calloc(archiveCount + 1, sizeof(*context.pArchives));
+    if (context.pArchives == NULL) {
+        return CYBERFM_OUT_OF_MEMORY;
+    }
+
+    for (iArchive = 0; iArchive < archiveCount; iArchive += 1) {
+        context.pArchives[iArchive].pArchivePath = pArchivePaths->ppNames[iArchive];
+    }
+
+    poolConfig = cyberfm_job_pool_config_init(pConfig->threadCount, archiveCount, cyberfm_list_job_proc, &context);
+
+    isPoolInitialized = (archiveCount > 0 && cyberfm_job_pool_init(&poolConfig, &pool) == CYBERFM_SUCCESS);
+    if (!isPoolInitialized) {
+        for (iArchive = 0; iArchive < archiveCount; iArchive += 1) {
+            cyberfm_list_job_proc(&context, iArchive);
+        }
+    }
+
+    cyberfm_list_print_header(pConfig);
+
+    /* Archives are handled in order. When sorting they're just collected. Otherwise they're printed as they come in. */
+    for (iArchive = 0; iArchive < archiveCount; iArchive += 1) {
+        cyberfm_list_archive* pListArchive = &context.pArchives[iArchive];
+
+        while (cyberfm_atomic_load_32(&pListArchive->isDone) == 0) {
+            cyberfm_sleep(1);
+        }
+
+        if (pListArchive->result != CYBERFM_SUCCESS) {
+            fprintf(stderr, "Failed to read archive \"%s\".\n", pListArchive->pArchivePath);
+            result = pListArchive->result;
+            continue;
+        }
+
+        if (pConfig->isSummary) {
+            if (pConfig->limit == 0 || printedCount < pConfig->limit) {
+                cyberfm_list_print_archive_summary(pListArchive, pConfig);
+                printedCount += 1;
+            }
+        } else if (pConfig->sortKey == CYBERFM_LIST_SORT_NONE) {
+            for (iItem = 0; iItem < pListArchive->entryCount && (pConfig->limit == 0 || printedCount < pConfig->limit); iItem += 1) {
+                cyberfm_list_print_entry(pListArchive, &pListArchive->pEntries[iItem], pConfig);
+                printedCount += 1;
+            }
+
+            /* Nothing more is needed from this archive. */
+            free(pListArchive->pEntries);
+            pListArchive->pEntries = NULL;
+        } else {
+            cyberfm_list_item* pNewItems = (cyberfm_list_item*)realloc(pItems, (itemCount + pListArchive->entryCount + 1) * sizeof(*pItems));
+            if (pNewItems == NULL) {
+                result = CYBERFM_OUT_OF_MEMORY;
+                break;
+            }
+
+            pItems = pNewItems;
+
+            for (iItem = 0; iItem < pListArchive->entryCount; iItem += 1) {
+                pItems[itemCount].pArchive = pListArchive;
+                pItems[itemCount].pEntry   = &pListArchive->pEntries[iItem];
+                itemCount += 1;
+            }
+        }
+    }
+
+    if (isPoolInitialized) {
+        cyberfm_job_pool_uninit(&pool);
+    }
+
+    if (result != CYBERFM_OUT_OF_MEMORY && itemCount > 0) {
+        g_cyberfmListSortKey = pConfig->sortKey;
+        qsort(pItems, itemCount, sizeof(*pItems), cyberfm_list_item_compare);
+
+        for (iItem = 0; iItem < itemCount && (pConfig->limit == 0 || iItem < pConfig->limit); iItem += 1) {
+            const cyberfm_list_item* pItem = &pItems[(pConfig->isDescending) ? itemCount - iItem - 1 : iItem];
+            cyberfm_list_print_entry(pItem->pArchive, pItem->pEntry, pConfig);
+        }
+    }
+
+    for (iArchive = 0; iArchive < archiveCount; iArchive += 1) {
+        free(context.pArchives[iArchive].pEntries);
+    }
+
+    free(pItems);
+    free(context.pArchives);
+
+    return result;
+}
+
+
 int main(int argc, char** argv)
 {
     cyberfm_result result;
     cyberfm_archive archive;
     char outputDir[256];
-    uint32_t iFile;
+    const char* pCmdLineStatsFormat;
 
     if (argc < 2) {
         printf("No input file specified.");
         return 0;
     }
 
+    /* "--stats json" prints the statistics as JSON. Anything else is a table. */
+    pCmdLineStatsFormat = cyberfm_argv_get_value(argc, argv, "--stats");
+
     /* If we're extracting, extract every archive on the command line. */
     if (cyberfm_argv_is_set(argc, argv, "--extract")) {
         int iarg;
+        cyberfm_archive_config archiveConfig;
+        cyberfm_extract_config extractConfig;
+        uint32_t threadCount = 1;
+        const char* pCmdLineThreadCount;
+        const char* pCmdLineQueueDepth;
+        const char* pCmdLineStageThreadCount;
+        const char* pCmdLineLinkMode;
+        const char* pCmdLineNames;
+        const char* pCmdLineTypes;
+        char storeDir[256];
+        char manifestPath[512];
+        char typeIndexPath[512];
+        cyberfm_path_dictionary pathDictionary;
+        uint32_t typeMask = 0;
+
+        /* -j 0 will use one thread per CPU. */
+        pCmdLineThreadCount = cyberfm_argv_get_value(argc, argv, "-j");
+        if (pCmdLineThreadCount != NULL) {
+            if (!cyberfm_parse_uint32_option("-j", pCmdLineThreadCount, &threadCount)) {
+                return -1;
+            }
+
+            if (threadCount == 0) {
+                threadCount = cyberfm_get_cpu_count();
+            }
+        }
+
+        /* The number of threads for each stage of the pipeline can be set individually. Otherwise they're derived from -j. */
+        extractConfig = cyberfm_extract_config_init(threadCount);
+
+        pCmdLineStageThreadCount = cyberfm_argv_get_value(argc, argv, "--readers");
+        if (pCmdLineStageThreadCount != NULL && !cyberfm_parse_uint32_option("--readers", pCmdLineStageThreadCount, &extractConfig.readerThreadCount)) {
+            return -1;
+        }
+
+        pCmdLineStageThreadCount = cyberfm_argv_get_value(argc, argv, "--decoders");
+        if (pCmdLineStageThreadCount != NULL && !cyberfm_parse_uint32_option("--decoders", pCmdLineStageThreadCount, &extractConfig.decoderThreadCount)) {
+            return -1;
+        }
+
+        pCmdLineStageThreadCount = cyberfm_argv_get_value(argc, argv, "--writers");
+        if (pCmdLineStageThreadCount != NULL && !cyberfm_parse_uint32_option("--writers", pCmdLineStageThreadCount, &extractConfig.writerThreadCount)) {
+            return -1;
+        }
+
+        /*
+        With --dedupe, files with the same content are only written once to a store and then linked into the output
+        directory. The store defaults to a folder called "store" in the output directory, but can be set with --store so
+        that it can be shared between archives. Links are made with absolute paths so they work no matter where the store is.
+        */
+        pCmdLineLinkMode = cyberfm_argv_get_value(argc, argv, "--link");
+        if (pCmdLineLinkMode != NULL) {
+            if (strcmp(pCmdLineLinkMode, "sym") == 0) {
+                extractConfig.linkMode = CYBERFM_EXTRACT_LINK_SYMBOLIC;
+            } else if (strcmp(pCmdLineLinkMode, "index") == 0) {
+                extractConfig.linkMode = CYBERFM_EXTRACT_LINK_INDEX;
+            } else {
+                extractConfig.linkMode = CYBERFM_EXTRACT_LINK_HARD;
+            }
+        }
+
+        /* With --names, files are output with their real path when it's in the list of names. */
+        CYBERFM_ZERO_OBJECT(&pathDictionary);
+
+        pCmdLineNames = cyberfm_argv_get_value(argc, argv, "--names");
+        if (pCmdLineNames != NULL) {
+            double startTime = cyberfm_get_time();
+
+            if (cyberfm_path_dictionary_init(pCmdLineNames, &pathDictionary) != CYBERFM_SUCCESS) {
+                printf("Failed to load names from \"%s\".\n", pCmdLineNames);
+                return -1;
+            }
+
+            printf("Loaded %u names in %.2fs.\n", pathDictionary.count, cyberfm_get_time() - startTime);
+            extractConfig.pPathDictionary = &pathDictionary;
+        }
+
+        /* With --type, only files of the given types are extracted. It's a comma separated list, such as "riff,bank". */
+        pCmdLineTypes = cyberfm_argv_get_value(argc, argv, "--type");
+        if (pCmdLineTypes != NULL) {
+            const char* pTypeName = pCmdLineTypes;
+
+            while (pTypeName != NULL) {
+                char typeName[32];
+                const char* pComma = strchr(pTypeName, ',');
+                size_t typeNameLength = (pComma != NULL) ? (size_t)(pComma - pTypeName) : strlen(pTypeName);
+                uint32_t type;
+
+                snprintf(typeName, sizeof(typeName), "%.*s", (int)typeNameLength, pTypeName);
+                if (cyberfm_content_type_from_string(typeName, &type) != CYBERFM_SUCCESS) {
+                    printf("Unknown type \"%s\".\n", typeName);
+                    cyberfm_path_dictionary_uninit(&pathDictionary);
+                    return -1;
+                }
+
+                typeMask |= (1U << type);
+                pTypeName = (pComma != NULL) ? pComma + 1 : NULL;
+            }
+        }
+
+        /* Memory mapping is used by default because it avoids a copy for uncompressed files. */
+        if (cyberfm_argv_is_set(argc, argv, "--no-mmap")) {
+            archiveConfig = cyberfm_archive_config_init(0);
+        } else {
+            archiveConfig = cyberfm_archive_config_init(CYBERFM_ARCHIVE_FLAG_MEMORY_MAP);
+        }
+
+        /* The number of reads to have in flight at once. Only used with io_uring. */
+        pCmdLineQueueDepth = cyberfm_argv_get_value(argc, argv, "--queue-depth");
+        if (pCmdLineQueueDepth != NULL && !cyberfm_parse_uint32_option("--queue-depth", pCmdLineQueueDepth, &archiveConfig.ioQueueDepth)) {
+            return -1;
+        }
 
         for (iarg = 1; iarg < argc; iarg += 1) {
             const char* pArchivePath = argv[iarg];
 
             if (mfs_file_exists(pArchivePath)) {
                 const char* pCmdLineOutputDir;
+                const char* pArchiveFileName = pArchivePath;
+                const char* pChar;
+                cyberfm_extract_stage_stats stageStats[CYBERFM_EXTRACT_STAGE_COUNT];
+                uint8_t* pFileSelection = NULL;
+                double startTime;
 
-                result = cyberfm_archive_init(pArchivePath, &archive);
+                result = cyberfm_archive_init_ex(pArchivePath, &archiveConfig, &archive);
                 if (result != CYBERFM_SUCCESS) {
                     printf("Failed to open archive \"%s\".", argv[1]);
                     return -1;
@@ -108,78 +2574,418 @@ int main(int argc, char** argv)
                     printf("Failed to create directory: %s\n", outputDir);
                 }
 
-                /* Now we can extract the files. When there's only a single sub-file we'll just output the file directly. Otherwise we'll create a folder. */
-                for (iFile = 0; iFile < archive.pCentralDirectory->fileInfoCount; iFile += 1) {
-                    cyberfm_file* pFile;
-            
-                    printf("Extracting %u/%u: %llu", iFile + 1, archive.pCentralDirectory->fileInfoCount, archive.pCentralDirectory->pFileInfo[iFile].hashedName);
-
-                    if ((archive.pCentralDirectory->pFileInfo[iFile].dataSpecRangeEnd - archive.pCentralDirectory->pFileInfo[iFile].dataSpecRangeBeg) > 1) {
-                        /* Output to a folder. */
-                        uint32_t iSubFile;
-                        char fileDir[256];
-
-                        /* First make sure the folder exists. */
-                        snprintf(fileDir, sizeof(fileDir), "%s/%llu", outputDir, archive.pCentralDirectory->pFileInfo[iFile].hashedName);
-                        mfs_mkdir(fileDir, MFS_TRUE);
-                
-                        for (iSubFile = archive.pCentralDirectory->pFileInfo[iFile].dataSpecRangeBeg; iSubFile < archive.pCentralDirectory->pFileInfo[iFile].dataSpecRangeEnd; iSubFile += 1) {
-                            char subFilePath[256];
-                            snprintf(subFilePath, sizeof(subFilePath), "%s/%u", fileDir, iSubFile - archive.pCentralDirectory->pFileInfo[iFile].dataSpecRangeBeg);
-
-                            result = cyberfm_file_open_by_index(&archive, iFile, iSubFile - archive.pCentralDirectory->pFileInfo[iFile].dataSpecRangeBeg, &pFile);
-                            if (result != CYBERFM_SUCCESS) {
-                                printf(". Failed to open file");
-                                continue;
-                            }
-
-                            result = cyberfm_result_from_minifs(mfs_open_and_write_file(subFilePath, pFile->size, pFile->pData));
-                            if (result != CYBERFM_SUCCESS) {
-                                cyberfm_file_close(pFile);
-                                printf(". Failed to extract file");
-                                continue;
-                            }
-
-                            /* Extraction complete. */
-                            cyberfm_file_close(pFile);
-                        }
-                    } else {
-                        /* Output the file directly. */
-                        char subFilePath[256];
-                        snprintf(subFilePath, sizeof(subFilePath), "%s/%llu", outputDir, archive.pCentralDirectory->pFileInfo[iFile].hashedName);
+                if (cyberfm_argv_is_set(argc, argv, "--dedupe")) {
+                    const char* pCmdLineStoreDir;
 
-                        result = cyberfm_file_open_by_index(&archive, iFile, 0, &pFile);
-                        if (result != CYBERFM_SUCCESS) {
-                            printf(". Failed to open file");
+                    pCmdLineStoreDir = cyberfm_argv_get_value(argc, argv, "--store");
+                    if (pCmdLineStoreDir != NULL) {
+                        mfs_path_copy(storeDir, sizeof(storeDir), pCmdLineStoreDir, NULL);
+                    } else {
+                        if (snprintf(storeDir, sizeof(storeDir), "%s/store", outputDir) >= (int)sizeof(storeDir)) {
+                            printf("Output directory path is too long: %s\n", outputDir);
+                            cyberfm_archive_uninit(&archive);
                             continue;
                         }
+                    }
 
-                        /* TODO: Later on once we've figured out the compression stuff we'll want to change this. */
-                        result = cyberfm_result_from_minifs(mfs_open_and_write_file(subFilePath, pFile->size, pFile->pData));
-                        if (result != CYBERFM_SUCCESS) {
-                            cyberfm_file_close(pFile);
-                            printf(". Failed to extract file");
-                            continue;
-                        }
+                    if (mfs_mkdir(storeDir, MFS_TRUE) != MFS_SUCCESS || cyberfm_get_absolute_path(storeDir, storeDir, sizeof(storeDir)) != CYBERFM_SUCCESS) {
+                        printf("Failed to create directory: %s\n", storeDir);
+                        cyberfm_archive_uninit(&archive);
+                        continue;
+                    }
+
+                    extractConfig.pStoreDir = storeDir;
+                }
+
+                for (pChar = pArchivePath; pChar[0] != '\0'; pChar += 1) {
+                    if (pChar[0] == '/' || pChar[0] == '\\') {
+                        pArchiveFileName = pChar + 1;
+                    }
+                }
+
+                /*
+                With --incremental, a manifest named after the archive is kept in the output directory and only what's
+                changed since the last extraction is extracted. Named after the archive so that many archives can be
+                extracted to the same directory.
+                */
+                if (cyberfm_argv_is_set(argc, argv, "--incremental")) {
+                    snprintf(manifestPath, sizeof(manifestPath), "%s/%s.manifest", outputDir, pArchiveFileName);
+                    extractConfig.pManifestPath = manifestPath;
+                }
+
+                /*
+                With --type, the type of every sub-file is worked out from it's first few bytes. This is saved to the output
+                directory so that next time only the central directory needs to be read.
+                */
+                extractConfig.pFileSelection = NULL;
+
+                if (typeMask != 0) {
+                    cyberfm_type_index_config typeIndexConfig;
+                    cyberfm_type_index typeIndex;
+                    uint32_t iFile;
+                    uint32_t selectedFileCount = 0;
+                    uint32_t fileCount = archive.pCentralDirectory->fileInfoCount;
+
+                    snprintf(typeIndexPath, sizeof(typeIndexPath), "%s/%s.types", outputDir, pArchiveFileName);
+
+                    typeIndexConfig = cyberfm_type_index_config_init();
+                    typeIndexConfig.pFilePath = typeIndexPath;
+
+                    startTime = cyberfm_get_time();
+
+                    pFileSelection = (uint8_t*)malloc(fileCount + 1);
+                    if (pFileSelection == NULL || cyberfm_type_index_init(&archive, &typeIndexConfig, &typeIndex) != CYBERFM_SUCCESS) {
+                        printf("Failed to work out the type of the files in \"%s\".\n", pArchivePath);
+                        free(pFileSelection);
+                        pFileSelection = NULL;
+                        cyberfm_archive_uninit(&archive);
+                        continue;
+                    }
+
+                    for (iFile = 0; iFile < fileCount; iFile += 1) {
+                        pFileSelection[iFile] = (uint8_t)((typeMask >> cyberfm_type_index_get_file_type(&typeIndex, &archive, iFile)) & 1);
+                        selectedFileCount += pFileSelection[iFile];
+                    }
 
-                        /* Extraction complete. */
-                        cyberfm_file_close(pFile);
+                    if (typeIndex.isLoaded) {
+                        printf("Loaded the types of %u sub-files in %.2fs.", typeIndex.entryCount, cyberfm_get_time() - startTime);
+                    } else {
+                        printf("Worked out the types of %u sub-files in %.2fs.", typeIndex.entryCount, cyberfm_get_time() - startTime);
+                        if (typeIndex.failedCount > 0) {
+                            printf(" %u could not be read.", typeIndex.failedCount);
+                        }
                     }
 
-                    printf("\n");
+                    printf(" Selected %u of %u files.\n", selectedFileCount, fileCount);
+
+                    cyberfm_type_index_uninit(&typeIndex);
+                    extractConfig.pFileSelection = pFileSelection;
+                }
+
+                startTime = cyberfm_get_time();
+
+                result = cyberfm_extract_archive(&archive, outputDir, &extractConfig, stageStats);
+                if (result != CYBERFM_SUCCESS) {
+                    printf("Failed to extract archive \"%s\".\n", pArchivePath);
+                } else {
+                    cyberfm_extract_print_stage_stats(stageStats, cyberfm_get_time() - startTime);
                 }
 
+                free(pFileSelection);
+                pFileSelection = NULL;
+
                 cyberfm_archive_uninit(&archive);
             } else {
                 /* As soon as we hit an argument that's not a file, end iterating. */
                 break;
             }
         }
+
+        cyberfm_path_dictionary_uninit(&pathDictionary);
+
+        if (cyberfm_argv_is_set(argc, argv, "--stats")) {
+            cyberfm_print_stats(pCmdLineStatsFormat != NULL && strcmp(pCmdLineStatsFormat, "json") == 0);
+        }
+    }
+
+    /* Verifying checks every file in every archive on the command line against it's hash. Nothing is written. */
+    if (cyberfm_argv_is_set(argc, argv, "--verify")) {
+        int iarg;
+        uint32_t threadCount = 0;
+        uint32_t totalFailedCount = 0;
+        const char* pCmdLineThreadCount;
+        cyberfm_archive_config archiveConfig;
+
+        /* Memory mapping means uncompressed files can be hashed without copying them. */
+        if (cyberfm_argv_is_set(argc, argv, "--no-mmap")) {
+            archiveConfig = cyberfm_archive_config_init(0);
+        } else {
+            archiveConfig = cyberfm_archive_config_init(CYBERFM_ARCHIVE_FLAG_MEMORY_MAP);
+        }
+
+        /* Uses every CPU by default. */
+        pCmdLineThreadCount = cyberfm_argv_get_value(argc, argv, "-j");
+        if (pCmdLineThreadCount != NULL && !cyberfm_parse_uint32_option("-j", pCmdLineThreadCount, &threadCount)) {
+            return -1;
+        }
+
+        for (iarg = 1; iarg < argc; iarg += 1) {
+            const char* pArchivePath = argv[iarg];
+            uint32_t failedCount;
+
+            if (!mfs_file_exists(pArchivePath)) {
+                break;
+            }
+
+            result = cyberfm_archive_init_ex(pArchivePath, &archiveConfig, &archive);
+            if (result != CYBERFM_SUCCESS) {
+                printf("Failed to open archive \"%s\".\n", pArchivePath);
+                return -1;
+            }
+
+            result = cyberfm_verify_archive(&archive, threadCount, &failedCount);
+            if (result != CYBERFM_SUCCESS) {
+                printf("Failed to verify archive \"%s\".\n", pArchivePath);
+                failedCount = 1;
+            }
+
+            totalFailedCount += failedCount;
+            cyberfm_archive_uninit(&archive);
+        }
+
+        if (cyberfm_argv_is_set(argc, argv, "--stats")) {
+            cyberfm_print_stats(pCmdLineStatsFormat != NULL && strcmp(pCmdLineStatsFormat, "json") == 0);
+        }
+
+        if (totalFailedCount > 0) {
+            return -1;
+        }
+    }
+
+    /* Packing builds an archive from a directory in the same layout that the extractor outputs. */
+    if (cyberfm_argv_is_set(argc, argv, "--pack")) {
+        cyberfm_archive_writer_config writerConfig;
+        const char* pCmdLineThreadCount;
+        const char* pCmdLineAlignment;
+        const char* pCmdLineOutputPath;
+        char outputPath[256];
+
+        writerConfig = cyberfm_archive_writer_config_init();
+
+        /* Uses every CPU by default. */
+        pCmdLineThreadCount = cyberfm_argv_get_value(argc, argv, "-j");
+        if (pCmdLineThreadCount != NULL && !cyberfm_parse_uint32_option("-j", pCmdLineThreadCount, &writerConfig.threadCount)) {
+            return -1;
+        }
+
+        pCmdLineAlignment = cyberfm_argv_get_value(argc, argv, "--align");
+        if (pCmdLineAlignment != NULL) {
+            if (!cyberfm_parse_uint32_option("--align", pCmdLineAlignment, &writerConfig.alignment)) {
+                return -1;
+            }
+
+            if (writerConfig.alignment == 0 || (writerConfig.alignment & (writerConfig.alignment - 1)) != 0) {
+                printf("Invalid value for --align: \"%s\". It must be a power of two.\n", pCmdLineAlignment);
+                return -1;
+            }
+        }
+
+        if (cyberfm_argv_is_set(argc, argv, "--store-only")) {
+            writerConfig.pCodec = NULL;
+        }
+
+        /* The output defaults to the name of the input directory with the extension added. */
+        pCmdLineOutputPath = cyberfm_argv_get_value(argc, argv, "-o");
+        if (pCmdLineOutputPath != NULL) {
+            mfs_path_copy(outputPath, sizeof(outputPath), pCmdLineOutputPath, NULL);
+        } else {
+            size_t inputDirLength = strlen(argv[1]);
+            while (inputDirLength > 1 && (argv[1][inputDirLength - 1] == '/' || argv[1][inputDirLength - 1] == '\\')) {
+                inputDirLength -= 1;
+            }
+
+            snprintf(outputPath, sizeof(outputPath), "%.*s.archive", (int)inputDirLength, argv[1]);
+        }
+
+        result = cyberfm_pack_directory(argv[1], outputPath, &writerConfig);
+
+        if (cyberfm_argv_is_set(argc, argv, "--stats")) {
+            cyberfm_print_stats(pCmdLineStatsFormat != NULL && strcmp(pCmdLineStatsFormat, "json") == 0);
+        }
+
+        if (result != CYBERFM_SUCCESS) {
+            printf("Failed to pack \"%s\".\n", argv[1]);
+            return -1;
+        }
+    }
+
+    /*
+    Listing prints the file list of every archive on the command line, or every archive in a directory, straight from the
+    central directory. Nothing is decompressed so it's quick even across all of the game's archives.
+    */
+    if (cyberfm_argv_is_set(argc, argv, "--list")) {
+        int iarg;
+        cyberfm_list_config listConfig;
+        cyberfm_string_list archivePaths;
+        cyberfm_path_dictionary pathDictionary;
+        uint64_t* pHashedNames = NULL;
+        uint32_t hashedNameCount = 0;
+        const char* pCmdLineValue;
+
+        CYBERFM_ZERO_OBJECT(&listConfig);
+        CYBERFM_ZERO_OBJECT(&archivePaths);
+        CYBERFM_ZERO_OBJECT(&pathDictionary);
+        listConfig.filter = cyberfm_archive_entry_filter_init();
+
+        /* "--list archives" prints a line for each archive instead of each file. */
+        pCmdLineValue = cyberfm_argv_get_value(argc, argv, "--list");
+        listConfig.isSummary = (pCmdLineValue != NULL && strcmp(pCmdLineValue, "archives") == 0);
+
+        /* Uses every CPU by default. */
+        pCmdLineValue = cyberfm_argv_get_value(argc, argv, "-j");
+        if (pCmdLineValue != NULL && !cyberfm_parse_uint32_option("-j", pCmdLineValue, &listConfig.threadCount)) {
+            return -1;
+        }
+
+        pCmdLineValue = cyberfm_argv_get_value(argc, argv, "--format");
+        if (pCmdLineValue != NULL && strcmp(pCmdLineValue, "json") == 0) {
+            listConfig.format = CYBERFM_LIST_FORMAT_JSON;
+        }
+
+        pCmdLineValue = cyberfm_argv_get_value(argc, argv, "--sort");
+        if (pCmdLineValue != NULL) {
+            if (strcmp(pCmdLineValue, "hash") == 0) {
+                listConfig.sortKey = CYBERFM_LIST_SORT_HASH;
+            } else if (strcmp(pCmdLineValue, "size") == 0) {
+                listConfig.sortKey = CYBERFM_LIST_SORT_SIZE;
+            } else if (strcmp(pCmdLineValue, "csize") == 0) {
+                listConfig.sortKey = CYBERFM_LIST_SORT_COMPRESSED_SIZE;
+            } else if (strcmp(pCmdLineValue, "ratio") == 0) {
+                listConfig.sortKey = CYBERFM_LIST_SORT_RATIO;
+            } else {
+                printf("Unknown sort key \"%s\". Use hash, size, csize or ratio.\n", pCmdLineValue);
+                return -1;
+            }
+        }
+
+        listConfig.isDescending = cyberfm_argv_is_set(argc, argv, "--desc");
+
+        pCmdLineValue = cyberfm_argv_get_value(argc, argv, "--limit");
+        if (pCmdLineValue != NULL && !cyberfm_parse_uint64_option("--limit", pCmdLineValue, &listConfig.limit)) {
+            return -1;
+        }
+
+        pCmdLineValue = cyberfm_argv_get_value(argc, argv, "--min-size");
+        if (pCmdLineValue != NULL && !cyberfm_parse_uint64_option("--min-size", pCmdLineValue, &listConfig.filter.minUncompressedSize)) {
+            return -1;
+        }
+
+        pCmdLineValue = cyberfm_argv_get_value(argc, argv, "--max-size");
+        if (pCmdLineValue != NULL && !cyberfm_parse_uint64_option("--max-size", pCmdLineValue, &listConfig.filter.maxUncompressedSize)) {
+            return -1;
+        }
+
+        pCmdLineValue = cyberfm_argv_get_value(argc, argv, "--min-ratio");
+        if (pCmdLineValue != NULL) {
+            listConfig.filter.minRatio = atof(pCmdLineValue);
+        }
+
+        pCmdLineValue = cyberfm_argv_get_value(argc, argv, "--max-ratio");
+        if (pCmdLineValue != NULL) {
+            listConfig.filter.maxRatio = atof(pCmdLineValue);
+        }
+
+        /*
+        Specific files can be looked up with "--hash" which takes a comma separated list of hashes, or "--path" which takes a
+        path and hashes it. These go through the archive's lookup rather than looking at every file.
+        */
+        pCmdLineValue = cyberfm_argv_get_value(argc, argv, "--hash");
+        if (pCmdLineValue != NULL) {
+            const char* pHash = pCmdLineValue;
+            const char* pChar;
+
+            hashedNameCount = 1;
+            for (pChar = pCmdLineValue; pChar[0] != '\0'; pChar += 1) {
+                if (pChar[0] == ',') {
+                    hashedNameCount += 1;
+                }
+            }
+
+            pHashedNames = (uint64_t*)malloc(sizeof(*pHashedNames) * (hashedNameCount + 1));
+            if (pHashedNames == NULL) {
+                return -1;
+            }
+
+            hashedNameCount = 0;
+            while (pHash != NULL) {
+                char hash[32];
+                const char* pComma = strchr(pHash, ',');
+                size_t hashLength = (pComma != NULL) ? (size_t)(pComma - pHash) : strlen(pHash);
+
+                if (hashLength > 0 && hashLength < sizeof(hash)) {
+                    memcpy(hash, pHash, hashLength);
+                    hash[hashLength] = '\0';
+
+                    if (cyberfm_parse_uint64(hash, &pHashedNames[hashedNameCount])) {
+                        hashedNameCount += 1;
+                    } else {
+                        printf("\"%s\" is not a valid hash.\n", hash);
+                    }
+                }
+
+                pHash = (pComma != NULL) ? pComma + 1 : NULL;
+            }
+        } else {
+            pCmdLineValue = cyberfm_argv_get_value(argc, argv, "--path");
+            if (pCmdLineValue != NULL) {
+                pHashedNames = (uint64_t*)malloc(sizeof(*pHashedNames));
+                if (pHashedNames == NULL) {
+                    return -1;
+                }
+
+                pHashedNames[0] = cyberfm_hash_path(pCmdLineValue);
+                hashedNameCount = 1;
+            }
+        }
+
+        if (pHashedNames != NULL) {
+            listConfig.filter.pHashedNames    = pHashedNames;
+            listConfig.filter.hashedNameCount = hashedNameCount;
+        }
+
+        /* With --names, the path of each file is included when it's known. */
+        pCmdLineValue = cyberfm_argv_get_value(argc, argv, "--names");
+        if (pCmdLineValue != NULL) {
+            if (cyberfm_path_dictionary_init(pCmdLineValue, &pathDictionary) != CYBERFM_SUCCESS) {
+                printf("Failed to load names from \"%s\".\n", pCmdLineValue);
+                free(pHashedNames);
+                return -1;
+            }
+
+            listConfig.pPathDictionary = &pathDictionary;
+        }
+
+        /* Directories are expanded to the archives inside them. */
+        for (iarg = 1; iarg < argc; iarg += 1) {
+            cyberfm_string_list fileNames;
+            size_t iFileName;
+
+            CYBERFM_ZERO_OBJECT(&fileNames);
+
+            if (cyberfm_list_directory(argv[iarg], cyberfm_has_archive_extension, &fileNames) == CYBERFM_SUCCESS) {
+                for (iFileName = 0; iFileName < fileNames.count; iFileName += 1) {
+                    char archivePath[512];
+                    snprintf(archivePath, sizeof(archivePath), "%s/%s", argv[iarg], fileNames.ppNames[iFileName]);
+                    cyberfm_string_list_append(&archivePaths, archivePath);
+                }
+
+                cyberfm_string_list_free(&fileNames);
+            } else if (mfs_file_exists(argv[iarg])) {
+                cyberfm_string_list_append(&archivePaths, argv[iarg]);
+            } else {
+                break;
+            }
+        }
+
+        result = cyberfm_list_archives(&archivePaths, &listConfig);
+
+        cyberfm_string_list_free(&archivePaths);
+        cyberfm_path_dictionary_uninit(&pathDictionary);
+        free(pHashedNames);
+
+        if (cyberfm_argv_is_set(argc, argv, "--stats")) {
+            cyberfm_print_stats(pCmdLineStatsFormat != NULL && strcmp(pCmdLineStatsFormat, "json") == 0);
+        }
+
+        if (result != CYBERFM_SUCCESS) {
+            return -1;
+        }
     }
 
 
 #if 0
     /* TESTING: Output all audio files. */
+    uint32_t iFile;
 
     /* Make sure the output folder exists first. */
     mfs_mkdir(AUDIO_OUTPUT_PATH, MFS_TRUE);
@@ -230,3 +3036,4 @@ int main(int argc, char** argv)
 
     return 0;
 }
+#endif  /* CYBERFM_NO_MAIN */
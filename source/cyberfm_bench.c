@@ -0,0 +1,756 @@
+/*
+Public domain.
+
+David Reid - mackron@gmail.com
+*/
+
+/*
+Benchmarks for the archive reader. There are two modes. The first compares the throughput of cyberfm_archive_load_files()
+at different queue depths on an existing archive. Compile with CYBERFM_USE_IO_URING defined on Linux, otherwise every queue
+depth will be the same.
+
+    cyberfm_bench "inputfile.archive" [--warm] [--iterations 3]
+
+The second is a suite that doesn't need any real archives. It generates an archive from a seed and then times initializing
+it, looking up files, opening files and extracting the whole thing. The same seed and settings always generate exactly the
+same archive, so the numbers can be compared between builds and machines. The results are output as JSON.
+
+    cyberfm_bench --suite [--seed 1] [--files 10000] [--subfiles 4] [--min-size 64] [--max-size 1048576]
+                          [--compressed 0.5] [--iterations 3] [--threads 0] [--dir /tmp] [--warm] [--keep]
+
+Sizes are spread evenly on a log scale between --min-size and --max-size, which gives lots of small files and a long tail
+of big ones, like the real archives. Each file gets between 1 and --subfiles sub-files. --compressed is the fraction of
+sub-files that are compressible. The archive is created with the archive writer which compresses with the built-in CFLZ
+codec so Oodle isn't needed. The archive and the
+extracted files are put in --dir, and are deleted at the end unless --keep is used.
+
+By default the archive is evicted from the page cache before each run so that the numbers reflect the device rather than
+memory. Use "--warm" to skip this.
+*/
+#define CYBERFM_NO_MAIN
+#include "cyberfm.c"    /* For the extractor. This includes libcyberfm.c. */
+#include <stdio.h>
+
+#include <math.h>       /* pow() */
+
+#ifndef _WIN32
+#include <fcntl.h>      /* posix_fadvise() */
+#endif
+
+#define CYBERFM_BENCH_BATCH_SIZE    256
+
+static void cyberfm_bench_evict_from_page_cache(cyberfm_archive* pArchive)
+{
+#if !defined(_WIN32) && defined(POSIX_FADV_DONTNEED)
+    posix_fadvise(fileno(pArchive->pFile), 0, 0, POSIX_FADV_DONTNEED);
+#else
+    (void)pArchive;
+#endif
+}
+
+/*
+Loads every sub-file in the archive in offset order, CYBERFM_BENCH_BATCH_SIZE at a time. Outputs the time taken and the
+number of bytes read from the archive.
+*/
+static cyberfm_result cyberfm_bench_load_all(const char* pArchivePath, uint32_t queueDepth, cyberfm_bool32 isWarm, double* pSeconds, uint64_t* pBytesRead, cyberfm_bool32* pUsedRing)
+{
+    cyberfm_result result;
+    cyberfm_archive archive;
+    cyberfm_archive_config archiveConfig;
+    cyberfm_read_plan plan;
+    cyberfm_load_request requests[CYBERFM_BENCH_BATCH_SIZE];
+    void* pBuffer = NULL;
+    size_t bufferSize = 0;
+    uint32_t iFirstItem;
+    double startTime;
+
+    *pSeconds   = 0;
+    *pBytesRead = 0;
+    *pUsedRing  = CYBERFM_FALSE;
+
+    /* Not memory mapping because we want to measure the reads. */
+    archiveConfig = cyberfm_archive_config_init(0);
+    archiveConfig.ioQueueDepth = queueDepth;
+
+    result = cyberfm_archive_init_ex(pArchivePath, &archiveConfig, &archive);
+    if (result != CYBERFM_SUCCESS) {
+        return result;
+    }
+
+    result = cyberfm_read_plan_init(&archive, NULL, &plan);
+    if (result != CYBERFM_SUCCESS) {
+        cyberfm_archive_uninit(&archive);
+        return result;
+    }
+
+    if (!isWarm) {
+        cyberfm_bench_evict_from_page_cache(&archive);
+    }
+
+    startTime = cyberfm_get_time();
+
+    for (iFirstItem = 0; iFirstItem < plan.itemCount; iFirstItem += CYBERFM_BENCH_BATCH_SIZE) {
+        uint32_t requestCount = CYBERFM_MIN(plan.itemCount - iFirstItem, CYBERFM_BENCH_BATCH_SIZE);
+        uint32_t iRequest;
+        size_t totalSize = 0;
+
+        for (iRequest = 0; iRequest < requestCount; iRequest += 1) {
+            totalSize += archive.pCentralDirectory->pFileDataSpec[plan.pItems[iFirstItem + iRequest].dataSpecIndex].uncompressedSize;
+        }
+
+        if (bufferSize < totalSize) {
+            free(pBuffer);
+            pBuffer = malloc(totalSize);
+            if (pBuffer == NULL) {
+                result = CYBERFM_OUT_OF_MEMORY;
+                break;
+            }
+
+            bufferSize = totalSize;
+        }
+
+        totalSize = 0;
+        for (iRequest = 0; iRequest < requestCount; iRequest += 1) {
+            const cyberfm_read_plan_item* pItem = &plan.pItems[iFirstItem + iRequest];
+            size_t uncompressedSize = archive.pCentralDirectory->pFileDataSpec[pItem->dataSpecIndex].uncompressedSize;
+
+            requests[iRequest].index   = pItem->fileIndex;
+            requests[iRequest].subfile = pItem->subfile;
+            requests[iRequest].pDst    = CYBERFM_OFFSET_PTR(pBuffer, totalSize);
+            requests[iRequest].dstCap  = uncompressedSize;
+
+            totalSize   += uncompressedSize;
+            *pBytesRead += pItem->size;
+        }
+
+        /* Failures are ignored. They'll usually be because Oodle isn't available. */
+        cyberfm_archive_load_files(&archive, requests, requestCount);
+    }
+
+    *pSeconds = cyberfm_get_time() - startTime;
+    *pUsedRing = (archive.pool.pFreeRings != NULL);
+
+    free(pBuffer);
+    cyberfm_read_plan_uninit(&plan);
+    cyberfm_archive_uninit(&archive);
+
+    return result;
+}
+
+
+
+/*
+A splitmix64 generator. Used instead of rand() so the generated archive is the same on every platform.
+*/
+typedef struct
+{
+    uint64_t state;
+} cyberfm_bench_rng;
+
+static uint64_t cyberfm_bench_rng_next(cyberfm_bench_rng* pRNG)
+{
+    uint64_t z;
+
+    pRNG->state += 0x9E3779B97F4A7C15ULL;
+
+    z = pRNG->state;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+/* Returns a value in [0, 1). */
+static double cyberfm_bench_rng_next_double(cyberfm_bench_rng* pRNG)
+{
+    return (double)(cyberfm_bench_rng_next(pRNG) >> 11) / 9007199254740992.0;
+}
+
+static int cyberfm_bench_compare_uint64(const void* a, const void* b)
+{
+    uint64_t valueA = *(const uint64_t*)a;
+    uint64_t valueB = *(const uint64_t*)b;
+    return (valueA < valueB) ? -1 : (valueA > valueB) ? 1 : 0;
+}
+
+static int cyberfm_bench_compare_double(const void* a, const void* b)
+{
+    double valueA = *(const double*)a;
+    double valueB = *(const double*)b;
+    return (valueA < valueB) ? -1 : (valueA > valueB) ? 1 : 0;
+}
+
+
+typedef struct
+{
+    uint64_t seed;
+    uint32_t fileCount;
+    uint32_t maxSubFileCount;
+    uint32_t minSize;
+    uint32_t maxSize;
+    double compressedRatio;     /* The fraction of sub-files to compress, between 0 and 1. */
+    uint32_t threadCount;       /* For compressing. Doesn't affect the output. */
+} cyberfm_bench_fixture_config;
+
+typedef struct
+{
+    uint32_t subFileCount;
+    uint32_t compressedSubFileCount;
+    uint64_t uncompressedSize;
+    uint64_t archiveSize;
+    double seconds;
+} cyberfm_bench_fixture_stats;
+
+/*
+Fills a buffer with data that compresses about as well as typical game data. It's a random block repeated over and over
+with some of the bytes changed, so there's plenty of matches without it being trivial. When not compressible, it's all
+random, like the textures and audio in the real archives which are already compressed.
+*/
+static void cyberfm_bench_generate_data(cyberfm_bench_rng* pRNG, uint8_t* pData, size_t size, cyberfm_bool32 isCompressible)
+{
+    uint8_t block[256];
+    size_t blockSize;
+    size_t i;
+
+    if (!isCompressible) {
+        for (i = 0; i < size; i += 1) {
+            pData[i] = (uint8_t)(cyberfm_bench_rng_next(pRNG) >> 56);
+        }
+
+        return;
+    }
+
+    blockSize = 16 + (size_t)(cyberfm_bench_rng_next(pRNG) % (sizeof(block) - 16));
+    for (i = 0; i < blockSize; i += 1) {
+        block[i] = (uint8_t)cyberfm_bench_rng_next(pRNG);
+    }
+
+    for (i = 0; i < size; i += 1) {
+        pData[i] = block[i % blockSize];
+    }
+
+    for (i = 0; i < size / 16; i += 1) {
+        uint64_t r = cyberfm_bench_rng_next(pRNG);
+        pData[(size_t)(r % size)] = (uint8_t)(r >> 56);
+    }
+}
+
+/*
+Generates an archive with the archive writer. The writer compresses anything that gets smaller, so the fraction of
+compressed sub-files is controlled by how many are filled with compressible data. Compression happens on multiple threads,
+but the output is the same regardless of the thread count.
+*/
+static cyberfm_result cyberfm_bench_generate_fixture(const char* pFilePath, const cyberfm_bench_fixture_config* pConfig, cyberfm_bench_fixture_stats* pStats)
+{
+    cyberfm_result result = CYBERFM_SUCCESS;
+    cyberfm_bench_rng rng;
+    cyberfm_archive_writer writer;
+    cyberfm_archive_writer_config writerConfig;
+    cyberfm_archive_writer_stats writerStats;
+    uint64_t* pHashedNames = NULL;
+    uint8_t* pData = NULL;
+    size_t* pSubFileSizes = NULL;
+    const void** ppSubFileData = NULL;
+    uint32_t iFile;
+    double startTime;
+
+    memset(pStats, 0, sizeof(*pStats));
+    startTime = cyberfm_get_time();
+
+    if (pConfig->fileCount == 0 || pConfig->maxSubFileCount == 0 || pConfig->minSize > pConfig->maxSize) {
+        return CYBERFM_INVALID_ARGS;
+    }
+
+    rng.state = pConfig->seed;
+
+    pHashedNames  = (uint64_t*)malloc(pConfig->fileCount * sizeof(*pHashedNames));
+    pData         = (uint8_t*)malloc((size_t)CYBERFM_MAX(pConfig->maxSize, 1) * pConfig->maxSubFileCount);
+    pSubFileSizes = (size_t*)malloc(pConfig->maxSubFileCount * sizeof(*pSubFileSizes));
+    ppSubFileData = (const void**)malloc(pConfig->maxSubFileCount * sizeof(*ppSubFileData));
+    if (pHashedNames == NULL || pData == NULL || pSubFileSizes == NULL || ppSubFileData == NULL) {
+        result = CYBERFM_OUT_OF_MEMORY;
+        goto done;
+    }
+
+    /* Names need to be unique. The writer takes care of sorting, but we sort here too so the data is in the same order. */
+    for (iFile = 0; iFile < pConfig->fileCount; iFile += 1) {
+        pHashedNames[iFile] = cyberfm_bench_rng_next(&rng);
+    }
+
+    qsort(pHashedNames, pConfig->fileCount, sizeof(*pHashedNames), cyberfm_bench_compare_uint64);
+
+    for (iFile = 1; iFile < pConfig->fileCount; iFile += 1) {
+        if (pHashedNames[iFile] <= pHashedNames[iFile - 1]) {
+            pHashedNames[iFile] = pHashedNames[iFile - 1] + 1;
+        }
+    }
+
+    writerConfig = cyberfm_archive_writer_config_init();
+    writerConfig.threadCount = pConfig->threadCount;
+
+    result = cyberfm_archive_writer_init(pFilePath, &writerConfig, &writer);
+    if (result != CYBERFM_SUCCESS) {
+        goto done;
+    }
+
+    for (iFile = 0; iFile < pConfig->fileCount; iFile += 1) {
+        cyberfm_archive_writer_file file;
+        uint32_t subFileCount = 1 + (uint32_t)(cyberfm_bench_rng_next(&rng) % pConfig->maxSubFileCount);
+        uint32_t iSubFile;
+        size_t dataSize = 0;
+
+        for (iSubFile = 0; iSubFile < subFileCount; iSubFile += 1) {
+            size_t size;
+
+            size = (size_t)(pConfig->minSize * pow((double)pConfig->maxSize / CYBERFM_MAX(pConfig->minSize, 1), cyberfm_bench_rng_next_double(&rng)));
+            size = CYBERFM_MIN(CYBERFM_MAX(size, pConfig->minSize), pConfig->maxSize);
+
+            cyberfm_bench_generate_data(&rng, pData + dataSize, size, cyberfm_bench_rng_next_double(&rng) < pConfig->compressedRatio);
+
+            pSubFileSizes[iSubFile] = size;
+            ppSubFileData[iSubFile] = pData + dataSize;
+            dataSize += size;
+        }
+
+        memset(&file, 0, sizeof(file));
+        file.hashedName    = pHashedNames[iFile];
+        file.unknown1      = 132500000000000000ULL + (cyberfm_bench_rng_next(&rng) % 10000000000000ULL);  /* Looks like a FILETIME from around 2020. */
+        file.subFileCount  = subFileCount;
+        file.ppSubFileData = ppSubFileData;
+        file.pSubFileSizes = pSubFileSizes;
+
+        result = cyberfm_archive_writer_add_file(&writer, &file);
+        if (result != CYBERFM_SUCCESS) {
+            break;
+        }
+    }
+
+    if (result == CYBERFM_SUCCESS) {
+        result = cyberfm_archive_writer_finalize(&writer);
+    }
+
+    cyberfm_archive_writer_get_stats(&writer, &writerStats);
+    cyberfm_archive_writer_uninit(&writer);
+
+    pStats->subFileCount           = writerStats.subFileCount;
+    pStats->compressedSubFileCount = writerStats.compressedSubFileCount;
+    pStats->uncompressedSize       = writerStats.uncompressedSize;
+    pStats->archiveSize            = writerStats.archiveSize;
+
+done:
+    free(pHashedNames);
+    free(pData);
+    free(pSubFileSizes);
+    free((void*)ppSubFileData);
+
+    pStats->seconds = cyberfm_get_time() - startTime;
+    return result;
+}
+
+
+/* Sorts the samples and prints the percentiles as a JSON object. Samples are in seconds and are printed in the given unit. */
+static void cyberfm_bench_print_percentiles(const char* pName, double* pSamples, size_t sampleCount, double scale, const char* pTrailing)
+{
+    static const double percentiles[] = {0.5, 0.9, 0.99};
+    static const char* percentileNames[] = {"p50", "p90", "p99"};
+    size_t iPercentile;
+
+    printf("\"%s\": {", pName);
+
+    if (sampleCount > 0) {
+        qsort(pSamples, sampleCount, sizeof(*pSamples), cyberfm_bench_compare_double);
+
+        printf("\"min\": %.3f, ", pSamples[0] * scale);
+        for (iPercentile = 0; iPercentile < sizeof(percentiles)/sizeof(percentiles[0]); iPercentile += 1) {
+            printf("\"%s\": %.3f, ", percentileNames[iPercentile], pSamples[(size_t)(percentiles[iPercentile] * (sampleCount - 1) + 0.5)] * scale);
+        }
+        printf("\"max\": %.3f", pSamples[sampleCount - 1] * scale);
+    }
+
+    printf("}%s", pTrailing);
+}
+
+/* Times initializing and uninitializing the archive. */
+static cyberfm_result cyberfm_bench_run_init(const char* pArchivePath, uint32_t flags, uint32_t iterationCount, const char* pName)
+{
+    double* pSamples;
+    uint32_t iIteration;
+
+    pSamples = (double*)malloc(iterationCount * sizeof(*pSamples));
+    if (pSamples == NULL) {
+        return CYBERFM_OUT_OF_MEMORY;
+    }
+
+    for (iIteration = 0; iIteration < iterationCount; iIteration += 1) {
+        cyberfm_archive archive;
+        cyberfm_archive_config archiveConfig;
+        cyberfm_result result;
+        double startTime;
+
+        archiveConfig = cyberfm_archive_config_init(flags);
+
+        startTime = cyberfm_get_time();
+        result = cyberfm_archive_init_ex(pArchivePath, &archiveConfig, &archive);
+        if (result != CYBERFM_SUCCESS) {
+            free(pSamples);
+            return result;
+        }
+        cyberfm_archive_uninit(&archive);
+        pSamples[iIteration] = cyberfm_get_time() - startTime;
+    }
+
+    printf("    \"%s\": {\"iterations\": %u, ", pName, iterationCount);
+    cyberfm_bench_print_percentiles("latencyUs", pSamples, iterationCount, 1000000.0, "},\n");
+
+    free(pSamples);
+    return CYBERFM_SUCCESS;
+}
+
+#define CYBERFM_BENCH_FIND_BATCH_SIZE   1024
+
+/*
+Times cyberfm_archive_find(). A single lookup is too quick to time on it's own so they're timed in batches, and the
+latency is the average of each batch. Every lookup is of a file that exists, in a random order.
+*/
+static cyberfm_result cyberfm_bench_run_find(cyberfm_archive* pArchive, cyberfm_bench_rng* pRNG, uint32_t lookupCount)
+{
+    uint64_t* pNames;
+    double* pSamples;
+    uint32_t batchCount = (lookupCount + CYBERFM_BENCH_FIND_BATCH_SIZE - 1) / CYBERFM_BENCH_FIND_BATCH_SIZE;
+    uint32_t iBatch;
+    uint32_t iLookup;
+    uint32_t foundCount = 0;
+    double totalTime = 0;
+
+    pNames   = (uint64_t*)malloc(CYBERFM_BENCH_FIND_BATCH_SIZE * sizeof(*pNames));
+    pSamples = (double*)malloc((batchCount + 1) * sizeof(*pSamples));
+    if (pNames == NULL || pSamples == NULL) {
+        free(pNames);
+        free(pSamples);
+        return CYBERFM_OUT_OF_MEMORY;
+    }
+
+    for (iBatch = 0; iBatch < batchCount; iBatch += 1) {
+        double startTime;
+
+        for (iLookup = 0; iLookup < CYBERFM_BENCH_FIND_BATCH_SIZE; iLookup += 1) {
+            pNames[iLookup] = pArchive->pCentralDirectory->pFileInfo[cyberfm_bench_rng_next(pRNG) % pArchive->pCentralDirectory->fileInfoCount].hashedName;
+        }
+
+        startTime = cyberfm_get_time();
+        for (iLookup = 0; iLookup < CYBERFM_BENCH_FIND_BATCH_SIZE; iLookup += 1) {
+            uint32_t iFile;
+            if (cyberfm_archive_find(pArchive, pNames[iLookup], &iFile) == CYBERFM_SUCCESS) {
+                foundCount += 1;
+            }
+        }
+        pSamples[iBatch] = (cyberfm_get_time() - startTime) / CYBERFM_BENCH_FIND_BATCH_SIZE;
+        totalTime += pSamples[iBatch] * CYBERFM_BENCH_FIND_BATCH_SIZE;
+    }
+
+    printf("    \"find\": {\"lookups\": %u, \"found\": %u, \"lookupsPerSecond\": %.0f, ", batchCount * CYBERFM_BENCH_FIND_BATCH_SIZE, foundCount, (totalTime > 0) ? (batchCount * CYBERFM_BENCH_FIND_BATCH_SIZE) / totalTime : 0);
+    cyberfm_bench_print_percentiles("latencyNs", pSamples, batchCount, 1000000000.0, "},\n");
+
+    free(pNames);
+    free(pSamples);
+    return CYBERFM_SUCCESS;
+}
+
+/* Times opening and closing random sub-files. Opening a file loads and decompresses the whole thing. */
+static cyberfm_result cyberfm_bench_run_open(cyberfm_archive* pArchive, cyberfm_bench_rng* pRNG, uint32_t operationCount)
+{
+    double* pSamples;
+    uint32_t iOperation;
+    uint64_t totalSize = 0;
+    double totalTime = 0;
+
+    pSamples = (double*)malloc((operationCount + 1) * sizeof(*pSamples));
+    if (pSamples == NULL) {
+        return CYBERFM_OUT_OF_MEMORY;
+    }
+
+    for (iOperation = 0; iOperation < operationCount; iOperation += 1) {
+        uint32_t iFile = (uint32_t)(cyberfm_bench_rng_next(pRNG) % pArchive->pCentralDirectory->fileInfoCount);
+        const cyberfm_archive_file_info* pFileInfo = &pArchive->pCentralDirectory->pFileInfo[iFile];
+        uint32_t iSubFile = (uint32_t)(cyberfm_bench_rng_next(pRNG) % (pFileInfo->dataSpecRangeEnd - pFileInfo->dataSpecRangeBeg));
+        cyberfm_file* pFile;
+        cyberfm_result result;
+        double startTime;
+
+        startTime = cyberfm_get_time();
+        result = cyberfm_file_open_by_index(pArchive, iFile, iSubFile, &pFile);
+        if (result != CYBERFM_SUCCESS) {
+            free(pSamples);
+            return result;
+        }
+        cyberfm_file_close(pFile);
+        pSamples[iOperation] = cyberfm_get_time() - startTime;
+
+        totalTime += pSamples[iOperation];
+        totalSize += pArchive->pCentralDirectory->pFileDataSpec[pFileInfo->dataSpecRangeBeg + iSubFile].uncompressedSize;
+    }
+
+    printf("    \"open\": {\"operations\": %u, \"bytesPerSecond\": %.0f, ", operationCount, (totalTime > 0) ? totalSize / totalTime : 0);
+    cyberfm_bench_print_percentiles("latencyUs", pSamples, operationCount, 1000000.0, "},\n");
+
+    free(pSamples);
+    return CYBERFM_SUCCESS;
+}
+
+/* Deletes everything the extractor wrote. The file names all come from the central directory so there's no need to walk the folder. */
+static void cyberfm_bench_delete_extracted_files(cyberfm_archive* pArchive, const char* pOutputDir)
+{
+    uint32_t iFile;
+
+    for (iFile = 0; iFile < pArchive->pCentralDirectory->fileInfoCount; iFile += 1) {
+        const cyberfm_archive_file_info* pFileInfo = &pArchive->pCentralDirectory->pFileInfo[iFile];
+        cyberfm_manifest_entry entry;
+
+        /* The manifest already knows how to delete the output of a file. */
+        memset(&entry, 0, sizeof(entry));
+        entry.hashedName   = pFileInfo->hashedName;
+        entry.subFileCount = pFileInfo->dataSpecRangeEnd - pFileInfo->dataSpecRangeBeg;
+        cyberfm_manifest_delete_output(&entry, NULL, pOutputDir);
+    }
+
+#ifdef _WIN32
+    RemoveDirectoryA(pOutputDir);
+#else
+    rmdir(pOutputDir);
+#endif
+}
+
+/* Times extracting the whole archive with the same pipeline as the extractor, minus the progress output. */
+static cyberfm_result cyberfm_bench_run_extract(const char* pArchivePath, const char* pOutputDir, uint32_t threadCount, uint32_t iterationCount, cyberfm_bool32 isWarm)
+{
+    double* pSamples;
+    uint32_t iIteration;
+    uint64_t totalSize = 0;
+    uint32_t fileCount = 0;
+    cyberfm_extract_config extractConfig;
+    int stdoutCopy;
+
+    pSamples = (double*)malloc(iterationCount * sizeof(*pSamples));
+    if (pSamples == NULL) {
+        return CYBERFM_OUT_OF_MEMORY;
+    }
+
+    extractConfig = cyberfm_extract_config_init(threadCount);
+
+    for (iIteration = 0; iIteration < iterationCount; iIteration += 1) {
+        cyberfm_archive archive;
+        cyberfm_archive_config archiveConfig;
+        cyberfm_extract_stage_stats stageStats[CYBERFM_EXTRACT_STAGE_COUNT];
+        cyberfm_result result;
+        double startTime;
+        uint32_t iDataSpec;
+
+        archiveConfig = cyberfm_archive_config_init(CYBERFM_ARCHIVE_FLAG_MEMORY_MAP);
+
+        result = cyberfm_archive_init_ex(pArchivePath, &archiveConfig, &archive);
+        if (result != CYBERFM_SUCCESS) {
+            free(pSamples);
+            return result;
+        }
+
+        if (!isWarm) {
+            cyberfm_bench_evict_from_page_cache(&archive);
+        }
+
+        mfs_mkdir(pOutputDir, MFS_TRUE);
+
+        /* The extractor prints it's progress which we don't want mixed in with the JSON. */
+        fflush(stdout);
+        stdoutCopy = dup(fileno(stdout));
+    #ifdef _WIN32
+        freopen("NUL", "w", stdout);
+    #else
+        freopen("/dev/null", "w", stdout);
+    #endif
+
+        startTime = cyberfm_get_time();
+        result = cyberfm_extract_archive(&archive, pOutputDir, &extractConfig, stageStats);
+        fflush(stdout);
+        pSamples[iIteration] = cyberfm_get_time() - startTime;
+
+        dup2(stdoutCopy, fileno(stdout));
+        close(stdoutCopy);
+
+        fileCount = archive.pCentralDirectory->fileInfoCount;
+        totalSize = 0;
+        for (iDataSpec = 0; iDataSpec < archive.pCentralDirectory->fileDataSpecCount; iDataSpec += 1) {
+            totalSize += archive.pCentralDirectory->pFileDataSpec[iDataSpec].uncompressedSize;
+        }
+
+        cyberfm_bench_delete_extracted_files(&archive, pOutputDir);
+        cyberfm_archive_uninit(&archive);
+
+        if (result != CYBERFM_SUCCESS) {
+            free(pSamples);
+            return result;
+        }
+    }
+
+    qsort(pSamples, iterationCount, sizeof(*pSamples), cyberfm_bench_compare_double);
+
+    printf("    \"extract\": {\"iterations\": %u, \"readers\": %u, \"decoders\": %u, \"writers\": %u, ", iterationCount, extractConfig.readerThreadCount, extractConfig.decoderThreadCount, extractConfig.writerThreadCount);
+    printf("\"bytesPerSecond\": %.0f, \"filesPerSecond\": %.0f, ", totalSize / pSamples[0], fileCount / pSamples[0]);
+    cyberfm_bench_print_percentiles("seconds", pSamples, iterationCount, 1.0, "}\n");
+
+    free(pSamples);
+    return CYBERFM_SUCCESS;
+}
+
+static int cyberfm_bench_run_suite(int argc, char** argv)
+{
+    cyberfm_result result;
+    cyberfm_bench_fixture_config fixtureConfig;
+    cyberfm_bench_fixture_stats fixtureStats;
+    cyberfm_bench_rng rng;
+    cyberfm_archive archive;
+    cyberfm_archive_config archiveConfig;
+    const char* pValue;
+    const char* pDir = "/tmp";
+    char archivePath[256];
+    char outputDir[256];
+    uint32_t iterationCount = 3;
+    uint32_t threadCount = 0;
+    cyberfm_bool32 isWarm = cyberfm_argv_is_set(argc, argv, "--warm");
+
+    fixtureConfig.seed            = 1;
+    fixtureConfig.fileCount       = 10000;
+    fixtureConfig.maxSubFileCount = 4;
+    fixtureConfig.minSize         = 64;
+    fixtureConfig.maxSize         = 1024 * 1024;
+    fixtureConfig.compressedRatio = 0.5;
+    fixtureConfig.threadCount     = 0;
+
+    if ((pValue = cyberfm_argv_get_value(argc, argv, "--seed"))       != NULL) { fixtureConfig.seed            = (uint64_t)strtoull(pValue, NULL, 10); }
+    if ((pValue = cyberfm_argv_get_value(argc, argv, "--files"))      != NULL) { fixtureConfig.fileCount       = (uint32_t)atoi(pValue); }
+    if ((pValue = cyberfm_argv_get_value(argc, argv, "--subfiles"))   != NULL) { fixtureConfig.maxSubFileCount = (uint32_t)atoi(pValue); }
+    if ((pValue = cyberfm_argv_get_value(argc, argv, "--min-size"))   != NULL) { fixtureConfig.minSize         = (uint32_t)atoi(pValue); }
+    if ((pValue = cyberfm_argv_get_value(argc, argv, "--max-size"))   != NULL) { fixtureConfig.maxSize         = (uint32_t)atoi(pValue); }
+    if ((pValue = cyberfm_argv_get_value(argc, argv, "--compressed")) != NULL) { fixtureConfig.compressedRatio = atof(pValue); }
+    if ((pValue = cyberfm_argv_get_value(argc, argv, "--iterations")) != NULL) { iterationCount                = (uint32_t)atoi(pValue); }
+    if ((pValue = cyberfm_argv_get_value(argc, argv, "--threads"))    != NULL) { threadCount                   = (uint32_t)atoi(pValue); }
+    if ((pValue = cyberfm_argv_get_value(argc, argv, "--dir"))        != NULL) { pDir                          = pValue; }
+
+    if (iterationCount == 0) {
+        iterationCount = 1;
+    }
+
+    if (threadCount == 0) {
+        threadCount = cyberfm_get_cpu_count();
+    }
+
+    snprintf(archivePath, sizeof(archivePath), "%s/cyberfm_bench_%llu.archive", pDir, (unsigned long long)fixtureConfig.seed);
+    snprintf(outputDir,   sizeof(outputDir),   "%s/cyberfm_bench_%llu", pDir, (unsigned long long)fixtureConfig.seed);
+
+    result = cyberfm_bench_generate_fixture(archivePath, &fixtureConfig, &fixtureStats);
+    if (result != CYBERFM_SUCCESS) {
+        fprintf(stderr, "Failed to generate archive \"%s\".\n", archivePath);
+        return -1;
+    }
+
+    printf("{\n");
+    printf("    \"fixture\": {\"seed\": %llu, \"files\": %u, \"subFiles\": %u, \"compressedSubFiles\": %u, \"uncompressedBytes\": %llu, \"archiveBytes\": %llu, \"generateSeconds\": %.3f},\n",
+        (unsigned long long)fixtureConfig.seed, fixtureConfig.fileCount, fixtureStats.subFileCount, fixtureStats.compressedSubFileCount, (unsigned long long)fixtureStats.uncompressedSize, (unsigned long long)fixtureStats.archiveSize, fixtureStats.seconds);
+    printf("    \"sha1Accelerated\": %s,\n", (cyberfm_sha1_is_accelerated()) ? "true" : "false");
+
+    /* The rest of the benchmarks use their own generator so they don't depend on how many numbers the fixture used. */
+    rng.state = fixtureConfig.seed ^ 0xB5AD4ECEDA1CE2A9ULL;
+
+    result = cyberfm_bench_run_init(archivePath, 0, iterationCount * 10, "init");
+    if (result == CYBERFM_SUCCESS) {
+        result = cyberfm_bench_run_init(archivePath, CYBERFM_ARCHIVE_FLAG_MEMORY_MAP, iterationCount * 10, "initMemoryMapped");
+    }
+
+    if (result == CYBERFM_SUCCESS) {
+        archiveConfig = cyberfm_archive_config_init(CYBERFM_ARCHIVE_FLAG_MEMORY_MAP);
+        result = cyberfm_archive_init_ex(archivePath, &archiveConfig, &archive);
+        if (result == CYBERFM_SUCCESS) {
+            result = cyberfm_bench_run_find(&archive, &rng, 1000000);
+            if (result == CYBERFM_SUCCESS) {
+                result = cyberfm_bench_run_open(&archive, &rng, CYBERFM_MIN(fixtureStats.subFileCount, 10000));
+            }
+
+            cyberfm_archive_uninit(&archive);
+        }
+    }
+
+    if (result == CYBERFM_SUCCESS) {
+        result = cyberfm_bench_run_extract(archivePath, outputDir, threadCount, iterationCount, isWarm);
+    }
+
+    printf("}\n");
+
+    if (!cyberfm_argv_is_set(argc, argv, "--keep")) {
+        remove(archivePath);
+    }
+
+    if (result != CYBERFM_SUCCESS) {
+        fprintf(stderr, "Benchmark failed with result %d.\n", result);
+        return -1;
+    }
+
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    static const uint32_t queueDepths[] = {1, 2, 4, 8, 16, 32, 64};
+    cyberfm_bool32 isWarm = CYBERFM_FALSE;
+    uint32_t iterationCount = 3;
+    uint32_t iQueueDepth;
+    int iarg;
+
+    if (argc < 2) {
+        printf("No input file specified.");
+        return 0;
+    }
+
+    if (cyberfm_argv_is_set(argc, argv, "--suite")) {
+        return cyberfm_bench_run_suite(argc, argv);
+    }
+
+    for (iarg = 2; iarg < argc; iarg += 1) {
+        if (strcmp(argv[iarg], "--warm") == 0) {
+            isWarm = CYBERFM_TRUE;
+        } else if (strcmp(argv[iarg], "--iterations") == 0 && iarg + 1 < argc) {
+            iterationCount = (uint32_t)atoi(argv[iarg + 1]);
+            iarg += 1;
+        }
+    }
+
+    if (iterationCount == 0) {
+        iterationCount = 1;
+    }
+
+    printf("%-12s %-10s %-12s %s\n", "Queue Depth", "io_uring", "Time (ms)", "MB/s");
+
+    for (iQueueDepth = 0; iQueueDepth < sizeof(queueDepths)/sizeof(queueDepths[0]); iQueueDepth += 1) {
+        double bestSeconds = 0;
+        uint64_t bytesRead = 0;
+        cyberfm_bool32 usedRing = CYBERFM_FALSE;
+        uint32_t iIteration;
+
+        /* The best of each iteration is reported. */
+        for (iIteration = 0; iIteration < iterationCount; iIteration += 1) {
+            double seconds;
+            cyberfm_result result;
+
+            result = cyberfm_bench_load_all(argv[1], queueDepths[iQueueDepth], isWarm, &seconds, &bytesRead, &usedRing);
+            if (result != CYBERFM_SUCCESS) {
+                printf("Failed to load archive \"%s\".\n", argv[1]);
+                return -1;
+            }
+
+            if (iIteration == 0 || seconds < bestSeconds) {
+                bestSeconds = seconds;
+            }
+        }
+
+        printf("%-12u %-10s %-12.2f %.1f\n", queueDepths[iQueueDepth], (usedRing) ? "yes" : "no", bestSeconds * 1000, (bestSeconds > 0) ? (bytesRead / (1024.0 * 1024.0)) / bestSeconds : 0);
+    }
+
+    return 0;
+}
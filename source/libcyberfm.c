@@ -11,8 +11,47 @@ David Reid - mackron@gmail.com
 #define DR_WAV_IMPLEMENTATION
 #include "external/dr_libs/dr_wav.h"
 
+#ifdef _WIN32
+#include <io.h>         /* _get_osfhandle() */
+#else
+#include <sys/mman.h>
+#include <unistd.h>     /* pread() */
+#include <errno.h>
+#include <time.h>       /* nanosleep() */
+#include <dirent.h>
+#endif
+
+#ifdef __linux__
+#include <fcntl.h>          /* open() */
+#include <sys/sendfile.h>
+#include <sys/syscall.h>    /* For copy_file_range() on versions of glibc that don't have a wrapper. */
+#endif
+
+#if defined(CYBERFM_USE_IO_URING) && defined(__linux__)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#define CYBERFM_HAS_IO_URING
+#endif
+
+/* The SHA extensions are only used on x86 with compilers that let us enable them for a single function. */
+#if !defined(CYBERFM_NO_SHA_NI)
+    #if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+        #include <cpuid.h>
+        #include <immintrin.h>
+        #define CYBERFM_HAS_SHA_NI
+        #define CYBERFM_SHA_NI_TARGET   __attribute__((target("sha,ssse3,sse4.1")))
+    #elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+        #include <intrin.h>
+        #include <immintrin.h>
+        #define CYBERFM_HAS_SHA_NI
+        #define CYBERFM_SHA_NI_TARGET
+    #endif
+#endif
+
 #define CYBERFM_ZERO_OBJECT(p)          memset(p, 0, sizeof(*p))
 #define CYBERFM_OFFSET_PTR(p, offset)   (((uint8_t*)(p)) + (offset))
+#define CYBERFM_MIN(a, b)               (((a) < (b)) ? (a) : (b))
+#define CYBERFM_MAX(a, b)               (((a) > (b)) ? (a) : (b))
 
 
 /*
@@ -20,7 +59,16 @@ This is a list of Oodle shared objects to try loading, in order. If I've missed
 me know and I'll add it to the list.
 */
 static const char* g_cyberfmOodleSONames[] = {
-    "oo2core_8_win64.dll"
+#ifdef _WIN32
+    "oo2core_9_win64.dll",
+    "oo2core_8_win64.dll",
+    "oo2core_7_win64.dll"
+#else
+    "liboo2corelinux64.so.9",
+    "liboo2corelinux64.so.8",
+    "liboo2corelinux64.so",
+    "oo2core_8_win64.dll"   /* For when the Windows DLL has been wrapped for Linux. */
+#endif
 };
 
 
@@ -68,420 +116,6901 @@ cyberfm_proc cyberfm_dlsym(cyberfm_handle handle, const char* symbol)
 
 
 
-static cyberfm_result cyberfm_result_from_minifs(cyberfm_result result)
+
+#ifdef _WIN32
+typedef struct
 {
-    return (cyberfm_result)result;  /* Result codes should be the same. */
+    cyberfm_thread_proc entryProc;
+    void* pUserData;
+} cyberfm_thread_start_data;
+
+static DWORD WINAPI cyberfm_thread_entry_proc_win32(LPVOID pParameter)
+{
+    cyberfm_thread_start_data startData = *(cyberfm_thread_start_data*)pParameter;
+    free(pParameter);
+
+    startData.entryProc(startData.pUserData);
+    return 0;
 }
+#endif
 
-cyberfm_result cyberfm_archive_init(const char* pFilePath, cyberfm_archive* pArchive)
+cyberfm_result cyberfm_thread_create(cyberfm_thread* pThread, cyberfm_thread_proc entryProc, void* pUserData)
 {
-    cyberfm_result result;
-    FILE* pFile;
-    struct _stat64 info;
-    uint64_t fileInfoChunkSize;
-    uint64_t fileDataSpecChunkSize;
-    uint64_t unknownDataChunkSize;
-    size_t iOodleSOName;
+    if (pThread == NULL || entryProc == NULL) {
+        return CYBERFM_INVALID_ARGS;
+    }
 
-    if (pArchive == NULL) {
+#ifdef _WIN32
+    {
+        cyberfm_thread_start_data* pStartData;
+
+        pStartData = (cyberfm_thread_start_data*)malloc(sizeof(*pStartData));
+        if (pStartData == NULL) {
+            return CYBERFM_OUT_OF_MEMORY;
+        }
+
+        pStartData->entryProc = entryProc;
+        pStartData->pUserData = pUserData;
+
+        *pThread = (cyberfm_thread)CreateThread(NULL, 0, cyberfm_thread_entry_proc_win32, pStartData, 0, NULL);
+        if (*pThread == NULL) {
+            free(pStartData);
+            return CYBERFM_ERROR;
+        }
+    }
+#else
+    if (pthread_create(pThread, NULL, entryProc, pUserData) != 0) {
+        return CYBERFM_ERROR;
+    }
+#endif
+
+    return CYBERFM_SUCCESS;
+}
+
+void cyberfm_thread_wait(cyberfm_thread* pThread)
+{
+    if (pThread == NULL) {
+        return;
+    }
+
+#ifdef _WIN32
+    WaitForSingleObject((HANDLE)*pThread, INFINITE);
+    CloseHandle((HANDLE)*pThread);
+#else
+    pthread_join(*pThread, NULL);
+#endif
+}
+
+uint32_t cyberfm_get_cpu_count(void)
+{
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+
+    return (info.dwNumberOfProcessors > 0) ? (uint32_t)info.dwNumberOfProcessors : 1;
+#else
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return (count > 0) ? (uint32_t)count : 1;
+#endif
+}
+
+void cyberfm_sleep(uint32_t milliseconds)
+{
+#ifdef _WIN32
+    Sleep((DWORD)milliseconds);
+#else
+    struct timespec ts;
+    ts.tv_sec  = milliseconds / 1000;
+    ts.tv_nsec = (long)(milliseconds % 1000) * 1000000;
+    nanosleep(&ts, NULL);
+#endif
+}
+
+double cyberfm_get_time(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER counter;
+    LARGE_INTEGER frequency;
+
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+
+    return (double)counter.QuadPart / (double)frequency.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (double)ts.tv_sec + ((double)ts.tv_nsec / 1000000000.0);
+#endif
+}
+
+
+cyberfm_result cyberfm_mutex_init(cyberfm_mutex* pMutex)
+{
+    if (pMutex == NULL) {
         return CYBERFM_INVALID_ARGS;
     }
 
-    CYBERFM_ZERO_OBJECT(pArchive);
+#ifdef _WIN32
+    InitializeSRWLock((PSRWLOCK)pMutex);
+#else
+    if (pthread_mutex_init(pMutex, NULL) != 0) {
+        return CYBERFM_ERROR;
+    }
+#endif
 
-    if (pFilePath == NULL) {
+    return CYBERFM_SUCCESS;
+}
+
+void cyberfm_mutex_uninit(cyberfm_mutex* pMutex)
+{
+    if (pMutex == NULL) {
+        return;
+    }
+
+#ifdef _WIN32
+    /* Nothing to do for SRW locks. */
+#else
+    pthread_mutex_destroy(pMutex);
+#endif
+}
+
+void cyberfm_mutex_lock(cyberfm_mutex* pMutex)
+{
+#ifdef _WIN32
+    AcquireSRWLockExclusive((PSRWLOCK)pMutex);
+#else
+    pthread_mutex_lock(pMutex);
+#endif
+}
+
+void cyberfm_mutex_unlock(cyberfm_mutex* pMutex)
+{
+#ifdef _WIN32
+    ReleaseSRWLockExclusive((PSRWLOCK)pMutex);
+#else
+    pthread_mutex_unlock(pMutex);
+#endif
+}
+
+
+uint32_t cyberfm_atomic_load_32(volatile uint32_t* pValue)
+{
+#ifdef _MSC_VER
+    return (uint32_t)InterlockedCompareExchange((volatile LONG*)pValue, 0, 0);
+#else
+    return __atomic_load_n(pValue, __ATOMIC_ACQUIRE);
+#endif
+}
+
+void cyberfm_atomic_store_32(volatile uint32_t* pValue, uint32_t value)
+{
+#ifdef _MSC_VER
+    InterlockedExchange((volatile LONG*)pValue, (LONG)value);
+#else
+    __atomic_store_n(pValue, value, __ATOMIC_RELEASE);
+#endif
+}
+
+uint32_t cyberfm_atomic_fetch_add_32(volatile uint32_t* pValue, uint32_t value)
+{
+#ifdef _MSC_VER
+    return (uint32_t)InterlockedExchangeAdd((volatile LONG*)pValue, (LONG)value);
+#else
+    return __atomic_fetch_add(pValue, value, __ATOMIC_ACQ_REL);
+#endif
+}
+
+uint64_t cyberfm_atomic_fetch_add_64(volatile uint64_t* pValue, uint64_t value)
+{
+#ifdef _MSC_VER
+    return (uint64_t)InterlockedExchangeAdd64((volatile LONG64*)pValue, (LONG64)value);
+#else
+    return __atomic_fetch_add(pValue, value, __ATOMIC_ACQ_REL);
+#endif
+}
+
+cyberfm_bool32 cyberfm_atomic_compare_exchange_32(volatile uint32_t* pValue, uint32_t expected, uint32_t desired)
+{
+#ifdef _MSC_VER
+    return (uint32_t)InterlockedCompareExchange((volatile LONG*)pValue, (LONG)desired, (LONG)expected) == expected;
+#else
+    return __atomic_compare_exchange_n(pValue, &expected, desired, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+#endif
+}
+
+
+static const char* g_cyberfmStatCounterNames[CYBERFM_STAT_COUNTER_COUNT] = {
+    "bytesRead",
+    "bytesDecompressed",
+    "bytesWritten",
+    "fileOpens",
+    "lookups",
+    "lookupProbes",
+    "allocations",
+    "bytesAllocated"
+};
+
+static const char* g_cyberfmStatTimerNames[CYBERFM_STAT_TIMER_COUNT] = {
+    "archiveInit",
+    "fileOpen",
+    "read",
+    "decompress",
+    "write"
+};
+
+const char* cyberfm_stat_counter_to_string(uint32_t counter)
+{
+    if (counter >= CYBERFM_STAT_COUNTER_COUNT) {
+        return "unknown";
+    }
+
+    return g_cyberfmStatCounterNames[counter];
+}
+
+const char* cyberfm_stat_timer_to_string(uint32_t timer)
+{
+    if (timer >= CYBERFM_STAT_TIMER_COUNT) {
+        return "unknown";
+    }
+
+    return g_cyberfmStatTimerNames[timer];
+}
+
+static uint64_t cyberfm_histogram_get_bucket_value(uint32_t bucket)
+{
+    uint32_t shift;
+
+    if (bucket < (2 * CYBERFM_STATS_HISTOGRAM_SUB_BUCKET_COUNT)) {
+        return bucket;
+    }
+
+    shift = (bucket / CYBERFM_STATS_HISTOGRAM_SUB_BUCKET_COUNT) - 1;
+    return (uint64_t)(CYBERFM_STATS_HISTOGRAM_SUB_BUCKET_COUNT + (bucket % CYBERFM_STATS_HISTOGRAM_SUB_BUCKET_COUNT)) << shift;
+}
+
+uint64_t cyberfm_histogram_get_percentile(const cyberfm_histogram* pHistogram, double percentile)
+{
+    uint64_t target;
+    uint64_t runningCount = 0;
+    uint32_t iBucket;
+
+    if (pHistogram == NULL || pHistogram->count == 0) {
+        return 0;
+    }
+
+    percentile = CYBERFM_MIN(CYBERFM_MAX(percentile, 0.0), 100.0);
+
+    target = (uint64_t)((percentile / 100.0) * pHistogram->count + 0.5);
+    target = CYBERFM_MAX(target, 1);
+
+    for (iBucket = 0; iBucket < CYBERFM_STATS_HISTOGRAM_BUCKET_COUNT; iBucket += 1) {
+        runningCount += pHistogram->buckets[iBucket];
+        if (runningCount >= target) {
+            return cyberfm_histogram_get_bucket_value(iBucket);
+        }
+    }
+
+    return cyberfm_histogram_get_max(pHistogram);
+}
+
+uint64_t cyberfm_histogram_get_max(const cyberfm_histogram* pHistogram)
+{
+    uint32_t iBucket;
+
+    if (pHistogram == NULL) {
+        return 0;
+    }
+
+    for (iBucket = CYBERFM_STATS_HISTOGRAM_BUCKET_COUNT; iBucket > 0; iBucket -= 1) {
+        if (pHistogram->buckets[iBucket - 1] > 0) {
+            return cyberfm_histogram_get_bucket_value(iBucket - 1);
+        }
+    }
+
+    return 0;
+}
+
+uint64_t cyberfm_stats_get_time_ns(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER counter;
+    LARGE_INTEGER frequency;
+
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+
+    return (uint64_t)((counter.QuadPart / frequency.QuadPart) * 1000000000) + (uint64_t)(((counter.QuadPart % frequency.QuadPart) * 1000000000) / frequency.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((uint64_t)ts.tv_sec * 1000000000) + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+#ifdef CYBERFM_ENABLE_STATS
+#if defined(_MSC_VER)
+    #define CYBERFM_THREAD_LOCAL    __declspec(thread)
+#else
+    #define CYBERFM_THREAD_LOCAL    __thread
+#endif
+
+typedef struct
+{
+    volatile uint64_t count;
+    volatile uint64_t totalNanoseconds;
+    volatile uint64_t buckets[CYBERFM_STATS_HISTOGRAM_BUCKET_COUNT];
+} cyberfm_stats_histogram_slot;
+
+typedef struct
+{
+    volatile uint64_t counters[CYBERFM_STAT_COUNTER_COUNT];
+    cyberfm_stats_histogram_slot timers[CYBERFM_STAT_TIMER_COUNT];
+    uint8_t padding[64];    /* Keeps the counters of the next slot off the last cache line of this one. */
+} cyberfm_stats_slot;
+
+static cyberfm_stats_slot g_cyberfmStatsSlots[CYBERFM_STATS_SLOT_COUNT];
+static volatile uint32_t g_cyberfmStatsNextSlot = 0;
+static CYBERFM_THREAD_LOCAL uint32_t g_cyberfmStatsThreadSlot = 0;   /* The slot index plus 1. 0 means a slot hasn't been assigned yet. */
+
+static uint32_t cyberfm_histogram_get_bucket(uint64_t value)
+{
+    uint32_t msb = 0;
+    uint32_t shift;
+
+    if (value < (2 * CYBERFM_STATS_HISTOGRAM_SUB_BUCKET_COUNT)) {
+        return (uint32_t)value;
+    }
+
+    if (value >= ((uint64_t)1 << CYBERFM_STATS_HISTOGRAM_MAX_BITS)) {
+        return CYBERFM_STATS_HISTOGRAM_BUCKET_COUNT - 1;
+    }
+
+    while ((value >> (msb + 1)) != 0) {
+        msb += 1;
+    }
+
+    /* Each power of two is split into SUB_BUCKET_COUNT linear buckets. */
+    shift = msb - CYBERFM_STATS_HISTOGRAM_SUB_BUCKET_BITS;
+    return ((shift + 1) * CYBERFM_STATS_HISTOGRAM_SUB_BUCKET_COUNT) + (uint32_t)((value >> shift) - CYBERFM_STATS_HISTOGRAM_SUB_BUCKET_COUNT);
+}
+
+static cyberfm_stats_slot* cyberfm_stats_get_thread_slot(void)
+{
+    if (g_cyberfmStatsThreadSlot == 0) {
+        g_cyberfmStatsThreadSlot = (cyberfm_atomic_fetch_add_32(&g_cyberfmStatsNextSlot, 1) % CYBERFM_STATS_SLOT_COUNT) + 1;
+    }
+
+    return &g_cyberfmStatsSlots[g_cyberfmStatsThreadSlot - 1];
+}
+
+void cyberfm_stats_add(uint32_t counter, uint64_t value)
+{
+    if (counter >= CYBERFM_STAT_COUNTER_COUNT) {
+        return;
+    }
+
+    cyberfm_atomic_fetch_add_64(&cyberfm_stats_get_thread_slot()->counters[counter], value);
+}
+
+void cyberfm_stats_record_time(uint32_t timer, uint64_t nanoseconds)
+{
+    cyberfm_stats_histogram_slot* pHistogram;
+
+    if (timer >= CYBERFM_STAT_TIMER_COUNT) {
+        return;
+    }
+
+    pHistogram = &cyberfm_stats_get_thread_slot()->timers[timer];
+
+    cyberfm_atomic_fetch_add_64(&pHistogram->count, 1);
+    cyberfm_atomic_fetch_add_64(&pHistogram->totalNanoseconds, nanoseconds);
+    cyberfm_atomic_fetch_add_64(&pHistogram->buckets[cyberfm_histogram_get_bucket(nanoseconds)], 1);
+}
+
+cyberfm_result cyberfm_get_stats(cyberfm_stats* pStats)
+{
+    uint32_t iSlot;
+    uint32_t iCounter;
+    uint32_t iTimer;
+    uint32_t iBucket;
+
+    if (pStats == NULL) {
         return CYBERFM_INVALID_ARGS;
     }
 
-    /*
-    Try loading Oodle. It's not a critical error if this is not avaiable, but compressed files won't be able
-    to be opened.
-    */
-    for (iOodleSOName = 0; iOodleSOName < sizeof(g_cyberfmOodleSONames)/sizeof(g_cyberfmOodleSONames[0]); iOodleSOName += 1) {
-        pArchive->oodle.hOodle = cyberfm_dlopen(g_cyberfmOodleSONames[iOodleSOName]);
-        if (pArchive->oodle.hOodle != NULL) {
-            pArchive->oodle.OodleLZ_Decompress = (cyberfm_OodleLZ_Decompress_proc)cyberfm_dlsym(pArchive->oodle.hOodle, "OodleLZ_Decompress");
-            if (pArchive->oodle.OodleLZ_Decompress != NULL) {
-                /* Everything looks good. */
-                break;
-            } else {
-                /* The shared object is avaialable, but not the function. Keep trying. */
-                cyberfm_dlclose(pArchive->oodle.hOodle);
-                pArchive->oodle.hOodle = NULL;
+    CYBERFM_ZERO_OBJECT(pStats);
+
+    /* Adding 0 is just an atomic load. We don't have a 64-bit load, and this is not called often enough to matter. */
+    for (iSlot = 0; iSlot < CYBERFM_STATS_SLOT_COUNT; iSlot += 1) {
+        cyberfm_stats_slot* pSlot = &g_cyberfmStatsSlots[iSlot];
+
+        for (iCounter = 0; iCounter < CYBERFM_STAT_COUNTER_COUNT; iCounter += 1) {
+            pStats->counters[iCounter] += cyberfm_atomic_fetch_add_64(&pSlot->counters[iCounter], 0);
+        }
+
+        for (iTimer = 0; iTimer < CYBERFM_STAT_TIMER_COUNT; iTimer += 1) {
+            cyberfm_stats_histogram_slot* pHistogramSlot = &pSlot->timers[iTimer];
+            cyberfm_histogram* pHistogram = &pStats->timers[iTimer];
+
+            pHistogram->count            += cyberfm_atomic_fetch_add_64(&pHistogramSlot->count, 0);
+            pHistogram->totalNanoseconds += cyberfm_atomic_fetch_add_64(&pHistogramSlot->totalNanoseconds, 0);
+
+            for (iBucket = 0; iBucket < CYBERFM_STATS_HISTOGRAM_BUCKET_COUNT; iBucket += 1) {
+                pHistogram->buckets[iBucket] += cyberfm_atomic_fetch_add_64(&pHistogramSlot->buckets[iBucket], 0);
             }
         }
     }
-    
 
-    result = cyberfm_result_from_minifs(mfs_fopen(&pFile, pFilePath, "rb"));
-    if (result != CYBERFM_SUCCESS) {
-        goto error0;
+    return CYBERFM_SUCCESS;
+}
+
+void cyberfm_reset_stats(void)
+{
+    memset((void*)g_cyberfmStatsSlots, 0, sizeof(g_cyberfmStatsSlots));
+}
+#else
+void cyberfm_stats_add(uint32_t counter, uint64_t value)
+{
+    (void)counter;
+    (void)value;
+}
+
+void cyberfm_stats_record_time(uint32_t timer, uint64_t nanoseconds)
+{
+    (void)timer;
+    (void)nanoseconds;
+}
+
+cyberfm_result cyberfm_get_stats(cyberfm_stats* pStats)
+{
+    if (pStats == NULL) {
+        return CYBERFM_INVALID_ARGS;
+    }
+
+    CYBERFM_ZERO_OBJECT(pStats);
+    return CYBERFM_INVALID_OPERATION;   /* Not compiled with CYBERFM_ENABLE_STATS. */
+}
+
+void cyberfm_reset_stats(void)
+{
+}
+#endif  /* CYBERFM_ENABLE_STATS */
+
+
+typedef struct
+{
+    uint64_t cost;
+    uint32_t jobIndex;
+} cyberfm_job_sort_item;
+
+static int cyberfm_job_sort_item_compare(const void* a, const void* b)
+{
+    const cyberfm_job_sort_item* pA = (const cyberfm_job_sort_item*)a;
+    const cyberfm_job_sort_item* pB = (const cyberfm_job_sort_item*)b;
+
+    /* Descending cost, with the job index used as a tie breaker to keep things deterministic. */
+    if (pA->cost != pB->cost) {
+        return (pA->cost > pB->cost) ? -1 : 1;
+    }
+
+    return (pA->jobIndex < pB->jobIndex) ? -1 : ((pA->jobIndex > pB->jobIndex) ? 1 : 0);
+}
+
+static cyberfm_bool32 cyberfm_job_queue_take(cyberfm_job_queue* pQueue, uint32_t* pJobIndex)
+{
+    cyberfm_bool32 result = CYBERFM_FALSE;
+
+    cyberfm_mutex_lock(&pQueue->lock);
+    {
+        if (pQueue->head < pQueue->tail) {
+            *pJobIndex = pQueue->pJobs[pQueue->head];
+            pQueue->head += 1;
+            result = CYBERFM_TRUE;
+        }
+    }
+    cyberfm_mutex_unlock(&pQueue->lock);
+
+    return result;
+}
+
+static void* cyberfm_job_pool_thread(void* pUserData)
+{
+    cyberfm_job_queue* pQueue = (cyberfm_job_queue*)pUserData;
+    cyberfm_job_pool* pPool = pQueue->pPool;
+    uint32_t jobIndex;
+
+    for (;;) {
+        if (!cyberfm_job_queue_take(pQueue, &jobIndex)) {
+            /* Our own queue is empty. Try stealing from the other threads. */
+            uint32_t iVictim;
+            cyberfm_bool32 stole = CYBERFM_FALSE;
+
+            for (iVictim = 1; iVictim < pPool->threadCount; iVictim += 1) {
+                if (cyberfm_job_queue_take(&pPool->pQueues[(pQueue->threadIndex + iVictim) % pPool->threadCount], &jobIndex)) {
+                    stole = CYBERFM_TRUE;
+                    break;
+                }
+            }
+
+            if (!stole) {
+                break;  /* Nothing left anywhere. The set of jobs is fixed so we're done. */
+            }
+        }
+
+        pPool->config.onJob(pPool->config.pUserData, jobIndex);
+    }
+
+    return NULL;
+}
+
+cyberfm_job_pool_config cyberfm_job_pool_config_init(uint32_t threadCount, uint32_t jobCount, cyberfm_job_proc onJob, void* pUserData)
+{
+    cyberfm_job_pool_config config;
+
+    CYBERFM_ZERO_OBJECT(&config);
+    config.threadCount = threadCount;
+    config.jobCount    = jobCount;
+    config.onJob       = onJob;
+    config.pUserData   = pUserData;
+
+    return config;
+}
+
+cyberfm_result cyberfm_job_pool_init(const cyberfm_job_pool_config* pConfig, cyberfm_job_pool* pPool)
+{
+    uint32_t threadCount;
+    uint32_t iThread;
+    uint32_t iJob;
+    uint32_t threadsCreated;
+
+    if (pPool == NULL) {
+        return CYBERFM_INVALID_ARGS;
+    }
+
+    CYBERFM_ZERO_OBJECT(pPool);
+
+    if (pConfig == NULL || pConfig->onJob == NULL) {
+        return CYBERFM_INVALID_ARGS;
+    }
+
+    pPool->config = *pConfig;
+
+    threadCount = pConfig->threadCount;
+    if (threadCount == 0) {
+        threadCount = cyberfm_get_cpu_count();
+    }
+
+    if (threadCount > pConfig->jobCount && pConfig->jobCount > 0) {
+        threadCount = pConfig->jobCount;    /* No point having more threads than jobs. */
+    }
+
+    if (threadCount == 0) {
+        threadCount = 1;
+    }
+
+    pPool->threadCount = threadCount;
+
+    pPool->pAllocation = malloc((sizeof(*pPool->pThreads) * threadCount) + (sizeof(*pPool->pQueues) * threadCount) + (sizeof(*pPool->pJobs) * pConfig->jobCount));
+    if (pPool->pAllocation == NULL) {
+        return CYBERFM_OUT_OF_MEMORY;
+    }
+
+    pPool->pQueues  = (cyberfm_job_queue*)pPool->pAllocation;
+    pPool->pThreads = (cyberfm_thread*)CYBERFM_OFFSET_PTR(pPool->pQueues, sizeof(*pPool->pQueues) * threadCount);
+    pPool->pJobs    = (uint32_t*)CYBERFM_OFFSET_PTR(pPool->pThreads, sizeof(*pPool->pThreads) * threadCount);
+
+    /*
+    The jobs are dealt out to each thread in a round-robin fashion. When we have costs we do it in order of descending cost
+    which means the largest jobs will be started first, and that each thread gets a fair share of the large ones. Each
+    thread's jobs are stored contiguously in pJobs.
+    */
+    {
+        cyberfm_job_sort_item* pSortItems;
+
+        pSortItems = (cyberfm_job_sort_item*)malloc(sizeof(*pSortItems) * (pConfig->jobCount + 1));
+        if (pSortItems == NULL) {
+            free(pPool->pAllocation);
+            return CYBERFM_OUT_OF_MEMORY;
+        }
+
+        for (iJob = 0; iJob < pConfig->jobCount; iJob += 1) {
+            pSortItems[iJob].cost     = (pConfig->pJobCosts != NULL) ? pConfig->pJobCosts[iJob] : 0;
+            pSortItems[iJob].jobIndex = iJob;
+        }
+
+        if (pConfig->pJobCosts != NULL) {
+            qsort(pSortItems, pConfig->jobCount, sizeof(*pSortItems), cyberfm_job_sort_item_compare);
+        }
+
+        for (iThread = 0; iThread < threadCount; iThread += 1) {
+            uint32_t jobCountForThread = (pConfig->jobCount / threadCount) + ((iThread < (pConfig->jobCount % threadCount)) ? 1 : 0);
+            uint32_t jobOffset = (iThread == 0) ? 0 : (pPool->pQueues[iThread - 1].pJobs - pPool->pJobs) + pPool->pQueues[iThread - 1].tail;
+
+            pPool->pQueues[iThread].pPool       = pPool;
+            pPool->pQueues[iThread].threadIndex = iThread;
+            pPool->pQueues[iThread].pJobs       = pPool->pJobs + jobOffset;
+            pPool->pQueues[iThread].head        = 0;
+            pPool->pQueues[iThread].tail        = jobCountForThread;
+        }
+
+        for (iJob = 0; iJob < pConfig->jobCount; iJob += 1) {
+            cyberfm_job_queue* pQueue = &pPool->pQueues[iJob % threadCount];
+            pQueue->pJobs[iJob / threadCount] = pSortItems[iJob].jobIndex;
+        }
+
+        free(pSortItems);
+    }
+
+    for (iThread = 0; iThread < threadCount; iThread += 1) {
+        cyberfm_mutex_init(&pPool->pQueues[iThread].lock);
+    }
+
+    /*
+    Now we can start the threads. If we fail to create a thread it's not a critical error because it's jobs will be stolen
+    by the other threads. We just need at least one thread.
+    */
+    threadsCreated = 0;
+    for (iThread = 0; iThread < threadCount; iThread += 1) {
+        if (cyberfm_thread_create(&pPool->pThreads[threadsCreated], cyberfm_job_pool_thread, &pPool->pQueues[iThread]) == CYBERFM_SUCCESS) {
+            threadsCreated += 1;
+        }
+    }
+
+    if (threadsCreated == 0) {
+        /* Couldn't create any threads. Just run everything on this thread. */
+        cyberfm_job_pool_thread(&pPool->pQueues[0]);
+    }
+
+    pPool->createdThreadCount = threadsCreated;
+
+    return CYBERFM_SUCCESS;
+}
+
+void cyberfm_job_pool_uninit(cyberfm_job_pool* pPool)
+{
+    uint32_t iThread;
+
+    if (pPool == NULL || pPool->pAllocation == NULL) {
+        return;
+    }
+
+    for (iThread = 0; iThread < pPool->createdThreadCount; iThread += 1) {
+        cyberfm_thread_wait(&pPool->pThreads[iThread]);
+    }
+
+    for (iThread = 0; iThread < pPool->threadCount; iThread += 1) {
+        cyberfm_mutex_uninit(&pPool->pQueues[iThread].lock);
+    }
+
+    free(pPool->pAllocation);
+    pPool->pAllocation = NULL;
+}
+
+/*
+This is the bounded queue described by Dmitry Vyukov. Each cell has a sequence number which tells a producer whether or not
+the cell is free, and a consumer whether or not it's been filled. The cursors are only ever advanced with a compare-exchange
+which means there's no locking.
+*/
+cyberfm_result cyberfm_queue_init(uint32_t capacity, cyberfm_queue* pQueue)
+{
+    uint32_t iCell;
+
+    if (pQueue == NULL) {
+        return CYBERFM_INVALID_ARGS;
+    }
+
+    CYBERFM_ZERO_OBJECT(pQueue);
+
+    if (capacity == 0 || capacity > 0x80000000) {
+        return CYBERFM_INVALID_ARGS;
+    }
+
+    pQueue->capacity = 1;
+    while (pQueue->capacity < capacity) {
+        pQueue->capacity *= 2;
+    }
+
+    pQueue->pCells = (cyberfm_queue_cell*)malloc(pQueue->capacity * sizeof(*pQueue->pCells));
+    if (pQueue->pCells == NULL) {
+        return CYBERFM_OUT_OF_MEMORY;
+    }
+
+    for (iCell = 0; iCell < pQueue->capacity; iCell += 1) {
+        pQueue->pCells[iCell].sequence = iCell;
+    }
+
+    return CYBERFM_SUCCESS;
+}
+
+void cyberfm_queue_uninit(cyberfm_queue* pQueue)
+{
+    if (pQueue == NULL) {
+        return;
+    }
+
+    free(pQueue->pCells);
+}
+
+cyberfm_bool32 cyberfm_queue_try_push(cyberfm_queue* pQueue, uint32_t value)
+{
+    cyberfm_queue_cell* pCell;
+    uint32_t cursor;
+
+    cursor = cyberfm_atomic_load_32(&pQueue->pushCursor);
+    for (;;) {
+        int32_t difference;
+
+        pCell = &pQueue->pCells[cursor & (pQueue->capacity - 1)];
+        difference = (int32_t)(cyberfm_atomic_load_32(&pCell->sequence) - cursor);
+
+        if (difference == 0) {
+            /* The cell is free. Try claiming it. */
+            if (cyberfm_atomic_compare_exchange_32(&pQueue->pushCursor, cursor, cursor + 1)) {
+                break;
+            }
+        } else if (difference < 0) {
+            return CYBERFM_FALSE;   /* Full. */
+        }
+
+        /* Another thread got in first. */
+        cursor = cyberfm_atomic_load_32(&pQueue->pushCursor);
+    }
+
+    pCell->value = value;
+    cyberfm_atomic_store_32(&pCell->sequence, cursor + 1);
+
+    return CYBERFM_TRUE;
+}
+
+cyberfm_bool32 cyberfm_queue_try_pop(cyberfm_queue* pQueue, uint32_t* pValue)
+{
+    cyberfm_queue_cell* pCell;
+    uint32_t cursor;
+
+    cursor = cyberfm_atomic_load_32(&pQueue->popCursor);
+    for (;;) {
+        int32_t difference;
+
+        pCell = &pQueue->pCells[cursor & (pQueue->capacity - 1)];
+        difference = (int32_t)(cyberfm_atomic_load_32(&pCell->sequence) - (cursor + 1));
+
+        if (difference == 0) {
+            /* The cell has been filled. Try claiming it. */
+            if (cyberfm_atomic_compare_exchange_32(&pQueue->popCursor, cursor, cursor + 1)) {
+                break;
+            }
+        } else if (difference < 0) {
+            return CYBERFM_FALSE;   /* Empty. */
+        }
+
+        /* Another thread got in first. */
+        cursor = cyberfm_atomic_load_32(&pQueue->popCursor);
+    }
+
+    *pValue = pCell->value;
+    cyberfm_atomic_store_32(&pCell->sequence, cursor + pQueue->capacity);
+
+    return CYBERFM_TRUE;
+}
+
+
+
+#define CYBERFM_SHA1_ROTL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+#define CYBERFM_SHA1_ROUND(f, k) \
+    { \
+        uint32_t temp = CYBERFM_SHA1_ROTL(a, 5) + (f) + e + (k) + w[i]; \
+        e = d; \
+        d = c; \
+        c = CYBERFM_SHA1_ROTL(b, 30); \
+        b = a; \
+        a = temp; \
+    }
+
+static void cyberfm_sha1_compress_scalar(uint32_t* pState, const uint8_t* pBlocks, size_t blockCount)
+{
+    while (blockCount > 0) {
+        uint32_t w[80];
+        uint32_t a = pState[0];
+        uint32_t b = pState[1];
+        uint32_t c = pState[2];
+        uint32_t d = pState[3];
+        uint32_t e = pState[4];
+        uint32_t i;
+
+        for (i = 0; i < 16; i += 1) {
+            w[i] = ((uint32_t)pBlocks[i*4 + 0] << 24) | ((uint32_t)pBlocks[i*4 + 1] << 16) | ((uint32_t)pBlocks[i*4 + 2] << 8) | ((uint32_t)pBlocks[i*4 + 3] << 0);
+        }
+
+        for (i = 16; i < 80; i += 1) {
+            w[i] = CYBERFM_SHA1_ROTL(w[i-3] ^ w[i-8] ^ w[i-14] ^ w[i-16], 1);
+        }
+
+        /* Split into four loops so there's no branching inside each round. */
+        for (i = 0; i < 20; i += 1) {
+            CYBERFM_SHA1_ROUND((b & c) | (~b & d), 0x5A827999);
+        }
+
+        for (i = 20; i < 40; i += 1) {
+            CYBERFM_SHA1_ROUND(b ^ c ^ d, 0x6ED9EBA1);
+        }
+
+        for (i = 40; i < 60; i += 1) {
+            CYBERFM_SHA1_ROUND((b & c) | (b & d) | (c & d), 0x8F1BBCDC);
+        }
+
+        for (i = 60; i < 80; i += 1) {
+            CYBERFM_SHA1_ROUND(b ^ c ^ d, 0xCA62C1D6);
+        }
+
+        pState[0] += a;
+        pState[1] += b;
+        pState[2] += c;
+        pState[3] += d;
+        pState[4] += e;
+
+        pBlocks    += 64;
+        blockCount -= 1;
+    }
+}
+
+#if defined(CYBERFM_HAS_SHA_NI)
+/*
+Each step does four rounds. The message schedule for a step is worked out from the four steps before it, which are kept in
+a rotating set of four registers.
+*/
+#define CYBERFM_SHA1_NI_SCHEDULE(w0, w1, w2, w3) \
+    w0 = _mm_sha1msg2_epu32(_mm_xor_si128(_mm_sha1msg1_epu32(w0, w1), w2), w3)
+
+#define CYBERFM_SHA1_NI_ROUNDS(w, func) \
+    e = _mm_sha1nexte_epu32(ePrev, w); \
+    ePrev = abcd; \
+    abcd = _mm_sha1rnds4_epu32(abcd, e, func)
+
+CYBERFM_SHA_NI_TARGET
+static void cyberfm_sha1_compress_sha_ni(uint32_t* pState, const uint8_t* pBlocks, size_t blockCount)
+{
+    const __m128i byteSwapMask = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    __m128i abcd;
+    __m128i abcdSaved;
+    __m128i e;
+    __m128i ePrev;
+    __m128i eState;
+    __m128i w0, w1, w2, w3;
+
+    abcd   = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)pState), 0x1B);
+    eState = _mm_set_epi32((int)pState[4], 0, 0, 0);
+
+    while (blockCount > 0) {
+        abcdSaved = abcd;
+
+        w0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(pBlocks +  0)), byteSwapMask);
+        w1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(pBlocks + 16)), byteSwapMask);
+        w2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(pBlocks + 32)), byteSwapMask);
+        w3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(pBlocks + 48)), byteSwapMask);
+
+        /* Rounds 0-3. The first step adds E directly rather than deriving it from the previous step. */
+        e     = _mm_add_epi32(eState, w0);
+        ePrev = abcd;
+        abcd  = _mm_sha1rnds4_epu32(abcd, e, 0);
+
+        /* Rounds 4-19. */
+        CYBERFM_SHA1_NI_ROUNDS(w1, 0);
+        CYBERFM_SHA1_NI_ROUNDS(w2, 0);
+        CYBERFM_SHA1_NI_ROUNDS(w3, 0);
+        CYBERFM_SHA1_NI_SCHEDULE(w0, w1, w2, w3); CYBERFM_SHA1_NI_ROUNDS(w0, 0);
+
+        /* Rounds 20-39. */
+        CYBERFM_SHA1_NI_SCHEDULE(w1, w2, w3, w0); CYBERFM_SHA1_NI_ROUNDS(w1, 1);
+        CYBERFM_SHA1_NI_SCHEDULE(w2, w3, w0, w1); CYBERFM_SHA1_NI_ROUNDS(w2, 1);
+        CYBERFM_SHA1_NI_SCHEDULE(w3, w0, w1, w2); CYBERFM_SHA1_NI_ROUNDS(w3, 1);
+        CYBERFM_SHA1_NI_SCHEDULE(w0, w1, w2, w3); CYBERFM_SHA1_NI_ROUNDS(w0, 1);
+        CYBERFM_SHA1_NI_SCHEDULE(w1, w2, w3, w0); CYBERFM_SHA1_NI_ROUNDS(w1, 1);
+
+        /* Rounds 40-59. */
+        CYBERFM_SHA1_NI_SCHEDULE(w2, w3, w0, w1); CYBERFM_SHA1_NI_ROUNDS(w2, 2);
+        CYBERFM_SHA1_NI_SCHEDULE(w3, w0, w1, w2); CYBERFM_SHA1_NI_ROUNDS(w3, 2);
+        CYBERFM_SHA1_NI_SCHEDULE(w0, w1, w2, w3); CYBERFM_SHA1_NI_ROUNDS(w0, 2);
+        CYBERFM_SHA1_NI_SCHEDULE(w1, w2, w3, w0); CYBERFM_SHA1_NI_ROUNDS(w1, 2);
+        CYBERFM_SHA1_NI_SCHEDULE(w2, w3, w0, w1); CYBERFM_SHA1_NI_ROUNDS(w2, 2);
+
+        /* Rounds 60-79. */
+        CYBERFM_SHA1_NI_SCHEDULE(w3, w0, w1, w2); CYBERFM_SHA1_NI_ROUNDS(w3, 3);
+        CYBERFM_SHA1_NI_SCHEDULE(w0, w1, w2, w3); CYBERFM_SHA1_NI_ROUNDS(w0, 3);
+        CYBERFM_SHA1_NI_SCHEDULE(w1, w2, w3, w0); CYBERFM_SHA1_NI_ROUNDS(w1, 3);
+        CYBERFM_SHA1_NI_SCHEDULE(w2, w3, w0, w1); CYBERFM_SHA1_NI_ROUNDS(w2, 3);
+        CYBERFM_SHA1_NI_SCHEDULE(w3, w0, w1, w2); CYBERFM_SHA1_NI_ROUNDS(w3, 3);
+
+        eState = _mm_sha1nexte_epu32(ePrev, eState);
+        abcd   = _mm_add_epi32(abcd, abcdSaved);
+
+        pBlocks    += 64;
+        blockCount -= 1;
+    }
+
+    _mm_storeu_si128((__m128i*)pState, _mm_shuffle_epi32(abcd, 0x1B));
+    pState[4] = (uint32_t)_mm_extract_epi32(eState, 3);
+}
+
+static cyberfm_bool32 cyberfm_cpu_has_sha_ni(void)
+{
+    unsigned int regs1[4] = {0, 0, 0, 0};   /* EAX, EBX, ECX, EDX */
+    unsigned int regs7[4] = {0, 0, 0, 0};
+
+#if defined(_MSC_VER)
+    int info[4];
+
+    __cpuid(info, 0);
+    if (info[0] < 7) {
+        return CYBERFM_FALSE;
+    }
+
+    __cpuid(info, 1);
+    regs1[2] = (unsigned int)info[2];
+
+    __cpuidex(info, 7, 0);
+    regs7[1] = (unsigned int)info[1];
+#else
+    if (__get_cpuid_max(0, NULL) < 7) {
+        return CYBERFM_FALSE;
+    }
+
+    __cpuid(1, regs1[0], regs1[1], regs1[2], regs1[3]);
+    __cpuid_count(7, 0, regs7[0], regs7[1], regs7[2], regs7[3]);
+#endif
+
+    /* SHA is bit 29 of EBX for leaf 7. SSSE3 and SSE4.1 are bits 9 and 19 of ECX for leaf 1. */
+    return (regs7[1] & (1U << 29)) != 0 && (regs1[2] & (1U << 9)) != 0 && (regs1[2] & (1U << 19)) != 0;
+}
+#endif
+
+/* 0 = not yet checked, 1 = plain C, 2 = SHA extensions. Checking more than once at the same time is harmless. */
+static volatile uint32_t g_cyberfmSHA1Implementation = 0;
+
+static uint32_t cyberfm_sha1_get_implementation(void)
+{
+    uint32_t implementation = cyberfm_atomic_load_32(&g_cyberfmSHA1Implementation);
+
+    if (implementation == 0) {
+        implementation = 1;
+    #if defined(CYBERFM_HAS_SHA_NI)
+        if (cyberfm_cpu_has_sha_ni()) {
+            implementation = 2;
+        }
+    #endif
+
+        cyberfm_atomic_store_32(&g_cyberfmSHA1Implementation, implementation);
+    }
+
+    return implementation;
+}
+
+static void cyberfm_sha1_compress(uint32_t* pState, const uint8_t* pBlocks, size_t blockCount)
+{
+#if defined(CYBERFM_HAS_SHA_NI)
+    if (cyberfm_sha1_get_implementation() == 2) {
+        cyberfm_sha1_compress_sha_ni(pState, pBlocks, blockCount);
+        return;
+    }
+#endif
+
+    cyberfm_sha1_compress_scalar(pState, pBlocks, blockCount);
+}
+
+cyberfm_bool32 cyberfm_sha1_is_accelerated(void)
+{
+    return cyberfm_sha1_get_implementation() == 2;
+}
+
+void cyberfm_sha1_init(cyberfm_sha1* pSHA1)
+{
+    if (pSHA1 == NULL) {
+        return;
+    }
+
+    CYBERFM_ZERO_OBJECT(pSHA1);
+    pSHA1->state[0] = 0x67452301;
+    pSHA1->state[1] = 0xEFCDAB89;
+    pSHA1->state[2] = 0x98BADCFE;
+    pSHA1->state[3] = 0x10325476;
+    pSHA1->state[4] = 0xC3D2E1F0;
+}
+
+void cyberfm_sha1_update(cyberfm_sha1* pSHA1, const void* pData, size_t dataSize)
+{
+    const uint8_t* pBytes = (const uint8_t*)pData;
+    size_t bufferSize;
+
+    if (pSHA1 == NULL || (pData == NULL && dataSize > 0)) {
+        return;
+    }
+
+    bufferSize = (size_t)(pSHA1->size & 63);
+    pSHA1->size += dataSize;
+
+    /* Top up any partial block from last time first. */
+    if (bufferSize > 0) {
+        size_t bytesToCopy = CYBERFM_MIN(64 - bufferSize, dataSize);
+
+        memcpy(pSHA1->buffer + bufferSize, pBytes, bytesToCopy);
+        bufferSize += bytesToCopy;
+        pBytes     += bytesToCopy;
+        dataSize   -= bytesToCopy;
+
+        if (bufferSize < 64) {
+            return;
+        }
+
+        cyberfm_sha1_compress(pSHA1->state, pSHA1->buffer, 1);
+    }
+
+    /* Whole blocks are hashed straight out of the input. */
+    if (dataSize >= 64) {
+        cyberfm_sha1_compress(pSHA1->state, pBytes, dataSize / 64);
+        pBytes   += dataSize & ~(size_t)63;
+        dataSize &= 63;
+    }
+
+    memcpy(pSHA1->buffer, pBytes, dataSize);
+}
+
+void cyberfm_sha1_finalize(cyberfm_sha1* pSHA1, uint8_t* pDigest)
+{
+    uint8_t padding[72];
+    size_t paddingSize;
+    uint64_t sizeInBits;
+    uint32_t i;
+
+    if (pSHA1 == NULL || pDigest == NULL) {
+        return;
+    }
+
+    sizeInBits = pSHA1->size * 8;
+
+    /* A single 1 bit, then zeros up until there's 8 bytes left in the block, then the size in bits. */
+    paddingSize = 64 - (size_t)((pSHA1->size + 8) & 63);
+    memset(padding, 0, sizeof(padding));
+    padding[0] = 0x80;
+
+    for (i = 0; i < 8; i += 1) {
+        padding[paddingSize + i] = (uint8_t)(sizeInBits >> (56 - i*8));
+    }
+
+    cyberfm_sha1_update(pSHA1, padding, paddingSize + 8);
+
+    for (i = 0; i < 5; i += 1) {
+        pDigest[i*4 + 0] = (uint8_t)(pSHA1->state[i] >> 24);
+        pDigest[i*4 + 1] = (uint8_t)(pSHA1->state[i] >> 16);
+        pDigest[i*4 + 2] = (uint8_t)(pSHA1->state[i] >>  8);
+        pDigest[i*4 + 3] = (uint8_t)(pSHA1->state[i] >>  0);
+    }
+}
+
+static cyberfm_result cyberfm_result_from_minifs(cyberfm_result result)
+{
+    return (cyberfm_result)result;  /* Result codes should be the same. */
+}
+
+static cyberfm_result cyberfm_map_file(FILE* pFile, uint64_t fileSize, const uint8_t** ppData, cyberfm_handle* phMapping)
+{
+    *ppData    = NULL;
+    *phMapping = NULL;
+
+    if (fileSize == 0 || fileSize > (uint64_t)((size_t)-1)) {
+        return CYBERFM_OUT_OF_RANGE;    /* Can't map this file on this platform. Probably a 32-bit build. */
+    }
+
+#ifdef _WIN32
+    {
+        HANDLE hFile;
+        HANDLE hMapping;
+        const void* pData;
+
+        hFile = (HANDLE)_get_osfhandle(_fileno(pFile));
+        if (hFile == INVALID_HANDLE_VALUE) {
+            return CYBERFM_ERROR;
+        }
+
+        hMapping = CreateFileMappingA(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (hMapping == NULL) {
+            return CYBERFM_ERROR;
+        }
+
+        pData = MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+        if (pData == NULL) {
+            CloseHandle(hMapping);
+            return CYBERFM_ERROR;
+        }
+
+        *phMapping = (cyberfm_handle)hMapping;
+        *ppData    = (const uint8_t*)pData;
+    }
+#else
+    {
+        void* pData;
+
+        pData = mmap(NULL, (size_t)fileSize, PROT_READ, MAP_SHARED, fileno(pFile), 0);
+        if (pData == MAP_FAILED) {
+            return CYBERFM_ERROR;
+        }
+
+        *ppData = (const uint8_t*)pData;
+    }
+#endif
+
+    return CYBERFM_SUCCESS;
+}
+
+static void cyberfm_unmap_file(const uint8_t* pData, uint64_t size, cyberfm_handle hMapping)
+{
+    if (pData == NULL) {
+        return;
+    }
+
+#ifdef _WIN32
+    (void)size;
+    UnmapViewOfFile((LPCVOID)pData);
+    CloseHandle((HANDLE)hMapping);
+#else
+    (void)hMapping;
+    munmap((void*)pData, (size_t)size);
+#endif
+}
+
+static cyberfm_result cyberfm_archive_map(cyberfm_archive* pArchive, FILE* pFile, uint64_t fileSize)
+{
+    cyberfm_result result;
+
+    result = cyberfm_map_file(pFile, fileSize, &pArchive->map.pData, &pArchive->map.hMapping);
+    if (result != CYBERFM_SUCCESS) {
+        return result;
+    }
+
+    pArchive->map.size = fileSize;
+
+    return CYBERFM_SUCCESS;
+}
+
+static void cyberfm_archive_unmap(cyberfm_archive* pArchive)
+{
+    cyberfm_unmap_file(pArchive->map.pData, pArchive->map.size, pArchive->map.hMapping);
+
+    pArchive->map.pData    = NULL;
+    pArchive->map.size     = 0;
+    pArchive->map.hMapping = NULL;
+}
+
+/*
+Reads data from the archive at an absolute offset. This does not touch the file cursor which means it's safe to call from
+multiple threads at the same time.
+*/
+static cyberfm_result cyberfm_archive_read_at_impl(cyberfm_archive* pArchive, uint64_t offset, void* pDst, size_t bytesToRead)
+{
+    uint8_t* pDst8 = (uint8_t*)pDst;
+
+    if (pArchive->map.pData != NULL) {
+        if (offset > pArchive->map.size || bytesToRead > (pArchive->map.size - offset)) {
+            return CYBERFM_OUT_OF_RANGE;
+        }
+
+        memcpy(pDst, pArchive->map.pData + offset, bytesToRead);
+        return CYBERFM_SUCCESS;
+    }
+
+#ifdef _WIN32
+    {
+        HANDLE hFile = (HANDLE)_get_osfhandle(_fileno(pArchive->pFile));
+
+        while (bytesToRead > 0) {
+            OVERLAPPED overlapped;
+            DWORD bytesToReadThisIteration;
+            DWORD bytesRead;
+
+            bytesToReadThisIteration = (bytesToRead > 0x7FFFFFFF) ? 0x7FFFFFFF : (DWORD)bytesToRead;
+
+            /* A synchronous handle will read from the offset specified in the OVERLAPPED structure. */
+            ZeroMemory(&overlapped, sizeof(overlapped));
+            overlapped.Offset     = (DWORD)((offset >>  0) & 0xFFFFFFFF);
+            overlapped.OffsetHigh = (DWORD)((offset >> 32) & 0xFFFFFFFF);
+
+            if (!ReadFile(hFile, pDst8, bytesToReadThisIteration, &bytesRead, &overlapped) || bytesRead == 0) {
+                return CYBERFM_ERROR;
+            }
+
+            pDst8       += bytesRead;
+            offset      += bytesRead;
+            bytesToRead -= bytesRead;
+        }
+    }
+#else
+    {
+        int fd = fileno(pArchive->pFile);
+
+        while (bytesToRead > 0) {
+            ssize_t bytesRead;
+
+            bytesRead = pread(fd, pDst8, bytesToRead, (off_t)offset);
+            if (bytesRead < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+
+                return CYBERFM_ERROR;
+            }
+
+            if (bytesRead == 0) {
+                return CYBERFM_ERROR;   /* Unexpected end of file. */
+            }
+
+            pDst8       += bytesRead;
+            offset      += (uint64_t)bytesRead;
+            bytesToRead -= (size_t)bytesRead;
+        }
+    }
+#endif
+
+    return CYBERFM_SUCCESS;
+}
+
+static cyberfm_result cyberfm_archive_read_at(cyberfm_archive* pArchive, uint64_t offset, void* pDst, size_t bytesToRead)
+{
+    cyberfm_result result;
+    CYBERFM_STATS_DECLARE_TIMER(startTime)
+
+    CYBERFM_STATS_BEGIN_TIMER(startTime);
+    result = cyberfm_archive_read_at_impl(pArchive, offset, pDst, bytesToRead);
+    CYBERFM_STATS_END_TIMER(CYBERFM_STAT_TIMER_READ, startTime);
+
+    if (result == CYBERFM_SUCCESS) {
+        CYBERFM_STATS_ADD(CYBERFM_STAT_BYTES_READ, bytesToRead);
+    }
+
+    return result;
+}
+
+/*
+Batched reads. On Linux, when compiled with CYBERFM_USE_IO_URING, the reads in a batch are all submitted to an io_uring at
+once so the device can work on several of them at the same time. Rings aren't thread safe so each batch takes one from the
+archive's pool and gives it back when it's done, which means each thread ends up with it's own ring. If io_uring isn't
+compiled in, or the kernel doesn't let us use it, everything falls back to cyberfm_archive_read_at().
+*/
+#define CYBERFM_IO_PENDING  1   /* Internal. Used for the result of a read that's been submitted but not yet completed. */
+
+/*
+The number of times in a row the kernel can refuse a submission with EAGAIN or EBUSY while nothing is in flight before we
+give up on the ring. We sleep for a millisecond between each attempt so we're not spinning.
+*/
+#define CYBERFM_IO_MAX_BUSY_RETRIES 100
+
+#ifdef CYBERFM_HAS_IO_URING
+typedef struct cyberfm_io_ring cyberfm_io_ring;
+struct cyberfm_io_ring
+{
+    cyberfm_io_ring* pNext;
+    int fd;
+    uint32_t entryCount;
+    void* pSQRing;
+    size_t sqRingSize;
+    void* pCQRing;          /* Same as pSQRing when the kernel supports IORING_FEAT_SINGLE_MMAP. */
+    size_t cqRingSize;
+    struct io_uring_sqe* pSQEs;
+    size_t sqeSize;
+    volatile uint32_t* pSQTail;
+    uint32_t sqMask;
+    uint32_t* pSQArray;
+    volatile uint32_t* pCQHead;
+    volatile uint32_t* pCQTail;
+    uint32_t cqMask;
+    struct io_uring_cqe* pCQEs;
+};
+
+static void cyberfm_io_ring_delete(cyberfm_io_ring* pRing)
+{
+    if (pRing == NULL) {
+        return;
+    }
+
+    if (pRing->pSQEs != NULL) {
+        munmap(pRing->pSQEs, pRing->sqeSize);
+    }
+    if (pRing->pCQRing != NULL && pRing->pCQRing != pRing->pSQRing) {
+        munmap(pRing->pCQRing, pRing->cqRingSize);
+    }
+    if (pRing->pSQRing != NULL) {
+        munmap(pRing->pSQRing, pRing->sqRingSize);
+    }
+
+    close(pRing->fd);
+    free(pRing);
+}
+
+static cyberfm_io_ring* cyberfm_io_ring_create(int fileDescriptor, uint32_t entryCount)
+{
+    cyberfm_io_ring* pRing;
+    struct io_uring_params params;
+    void* pMapping;
+
+    pRing = (cyberfm_io_ring*)calloc(1, sizeof(*pRing));
+    if (pRing == NULL) {
+        return NULL;
+    }
+
+    memset(&params, 0, sizeof(params));
+
+    pRing->fd = (int)syscall(__NR_io_uring_setup, entryCount, &params);
+    if (pRing->fd < 0) {
+        free(pRing);
+        return NULL;    /* Probably not supported by the kernel, or it's been disabled. */
+    }
+
+    pRing->entryCount = params.sq_entries;
+    pRing->sqRingSize = params.sq_off.array + (params.sq_entries * sizeof(uint32_t));
+    pRing->cqRingSize = params.cq_off.cqes  + (params.cq_entries * sizeof(struct io_uring_cqe));
+    pRing->sqeSize    = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    if ((params.features & IORING_FEAT_SINGLE_MMAP) != 0) {
+        pRing->sqRingSize = CYBERFM_MAX(pRing->sqRingSize, pRing->cqRingSize);
+        pRing->cqRingSize = pRing->sqRingSize;
+    }
+
+    pMapping = mmap(NULL, pRing->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, pRing->fd, IORING_OFF_SQ_RING);
+    if (pMapping == MAP_FAILED) {
+        goto error;
+    }
+    pRing->pSQRing = pMapping;
+
+    if ((params.features & IORING_FEAT_SINGLE_MMAP) != 0) {
+        pRing->pCQRing = pRing->pSQRing;
+    } else {
+        pMapping = mmap(NULL, pRing->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, pRing->fd, IORING_OFF_CQ_RING);
+        if (pMapping == MAP_FAILED) {
+            goto error;
+        }
+        pRing->pCQRing = pMapping;
+    }
+
+    pMapping = mmap(NULL, pRing->sqeSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, pRing->fd, IORING_OFF_SQES);
+    if (pMapping == MAP_FAILED) {
+        goto error;
+    }
+    pRing->pSQEs = (struct io_uring_sqe*)pMapping;
+
+    pRing->pSQTail  = (volatile uint32_t*)CYBERFM_OFFSET_PTR(pRing->pSQRing, params.sq_off.tail);
+    pRing->sqMask   = *(uint32_t*)CYBERFM_OFFSET_PTR(pRing->pSQRing, params.sq_off.ring_mask);
+    pRing->pSQArray =  (uint32_t*)CYBERFM_OFFSET_PTR(pRing->pSQRing, params.sq_off.array);
+    pRing->pCQHead  = (volatile uint32_t*)CYBERFM_OFFSET_PTR(pRing->pCQRing, params.cq_off.head);
+    pRing->pCQTail  = (volatile uint32_t*)CYBERFM_OFFSET_PTR(pRing->pCQRing, params.cq_off.tail);
+    pRing->cqMask   = *(uint32_t*)CYBERFM_OFFSET_PTR(pRing->pCQRing, params.cq_off.ring_mask);
+    pRing->pCQEs    = (struct io_uring_cqe*)CYBERFM_OFFSET_PTR(pRing->pCQRing, params.cq_off.cqes);
+
+    /* The archive is registered as a fixed file so the kernel doesn't need to look it up for every read. */
+    if (syscall(__NR_io_uring_register, pRing->fd, IORING_REGISTER_FILES, &fileDescriptor, 1) < 0) {
+        goto error;
+    }
+
+    return pRing;
+
+error:
+    cyberfm_io_ring_delete(pRing);
+    return NULL;
+}
+
+static cyberfm_io_ring* cyberfm_archive_acquire_ring(cyberfm_archive* pArchive)
+{
+    cyberfm_io_ring* pRing;
+
+    if (pArchive->map.pData != NULL || pArchive->io.queueDepth <= 1 || cyberfm_atomic_load_32(&pArchive->io.isRingUnavailable)) {
+        return NULL;    /* Not using io_uring. */
+    }
+
+    cyberfm_mutex_lock(&pArchive->pool.lock);
+    {
+        pRing = (cyberfm_io_ring*)pArchive->pool.pFreeRings;
+        if (pRing != NULL) {
+            pArchive->pool.pFreeRings = pRing->pNext;
+        }
+    }
+    cyberfm_mutex_unlock(&pArchive->pool.lock);
+
+    if (pRing == NULL) {
+        pRing = cyberfm_io_ring_create(fileno(pArchive->pFile), pArchive->io.queueDepth);
+        if (pRing == NULL) {
+            /* Don't bother trying again. It's most likely not going to work next time either. */
+            cyberfm_atomic_store_32(&pArchive->io.isRingUnavailable, CYBERFM_TRUE);
+        }
+    }
+
+    return pRing;
+}
+
+static void cyberfm_archive_release_ring(cyberfm_archive* pArchive, cyberfm_io_ring* pRing)
+{
+    cyberfm_mutex_lock(&pArchive->pool.lock);
+    {
+        pRing->pNext = (cyberfm_io_ring*)pArchive->pool.pFreeRings;
+        pArchive->pool.pFreeRings = pRing;
+    }
+    cyberfm_mutex_unlock(&pArchive->pool.lock);
+}
+
+static void cyberfm_io_ring_complete(cyberfm_archive* pArchive, cyberfm_read_request* pRequest, int res)
+{
+    if (res < 0) {
+        /* The read failed. Try again with a normal read rather than failing outright. */
+        pRequest->result = cyberfm_archive_read_at(pArchive, pRequest->offset, pRequest->pDst, pRequest->size);
+    } else if ((size_t)res < pRequest->size) {
+        /* Short read. Just read the rest in the normal way. */
+        pRequest->result = cyberfm_archive_read_at(pArchive, pRequest->offset + (uint64_t)res, CYBERFM_OFFSET_PTR(pRequest->pDst, res), pRequest->size - (size_t)res);
+    } else {
+        pRequest->result = CYBERFM_SUCCESS;
+    }
+}
+
+static void cyberfm_archive_read_batch_io_uring(cyberfm_archive* pArchive, cyberfm_io_ring* pRing, cyberfm_read_request* pRequests, uint32_t requestCount)
+{
+    uint32_t iNextRequest = 0;
+    uint32_t inFlightCount = 0;     /* The number of reads the kernel has picked up but not yet completed. */
+    uint32_t unsubmittedCount = 0;  /* The number of reads in the submission queue that the kernel has not yet picked up. */
+    uint32_t busyRetryCount = 0;
+    uint32_t sqTail = *pRing->pSQTail;
+
+    for (;;) {
+        int enterResult;
+        uint32_t cqHead;
+        uint32_t cqTail;
+
+        /* Fill up the submission queue. */
+        while (iNextRequest < requestCount && (inFlightCount + unsubmittedCount) < pRing->entryCount) {
+            cyberfm_read_request* pRequest = &pRequests[iNextRequest];
+            struct io_uring_sqe* pSQE;
+
+            if (pRequest->size == 0 || pRequest->size > 0x7FFFF000) {
+                /* Nothing to read, or too big for a single read. Just do it the normal way. */
+                pRequest->result = cyberfm_archive_read_at(pArchive, pRequest->offset, pRequest->pDst, pRequest->size);
+                iNextRequest += 1;
+                continue;
+            }
+
+            pSQE = &pRing->pSQEs[sqTail & pRing->sqMask];
+            memset(pSQE, 0, sizeof(*pSQE));
+            pSQE->opcode    = IORING_OP_READ;
+            pSQE->flags     = IOSQE_FIXED_FILE;
+            pSQE->fd        = 0;    /* The index of the registered file. */
+            pSQE->off       = pRequest->offset;
+            pSQE->addr      = (uint64_t)(size_t)pRequest->pDst;
+            pSQE->len       = (uint32_t)pRequest->size;
+            pSQE->user_data = iNextRequest;
+
+            pRing->pSQArray[sqTail & pRing->sqMask] = sqTail & pRing->sqMask;
+            pRequest->result = CYBERFM_IO_PENDING;
+
+            sqTail           += 1;
+            unsubmittedCount += 1;
+            iNextRequest     += 1;
+        }
+
+        if ((inFlightCount + unsubmittedCount) == 0) {
+            break;  /* Everything is done. */
+        }
+
+        cyberfm_atomic_store_32((volatile uint32_t*)pRing->pSQTail, sqTail);
+
+        /* Submit everything and wait for at least one to complete. */
+        enterResult = (int)syscall(__NR_io_uring_enter, pRing->fd, unsubmittedCount, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+        if (enterResult >= 0) {
+            unsubmittedCount -= (uint32_t)enterResult;
+            inFlightCount    += (uint32_t)enterResult;
+            busyRetryCount    = 0;
+        } else if ((errno == EAGAIN || errno == EBUSY) && inFlightCount == 0) {
+            /*
+            The kernel is short on resources and there's nothing of ours in flight to wait on. Back off for a bit, and if it
+            keeps happening, stop using the ring and read everything that's left normally.
+            */
+            busyRetryCount += 1;
+            if (busyRetryCount > CYBERFM_IO_MAX_BUSY_RETRIES) {
+                cyberfm_atomic_store_32(&pArchive->io.isRingUnavailable, CYBERFM_TRUE);
+                break;
+            }
+
+            cyberfm_sleep(1);
+            continue;
+        } else if (errno != EINTR && errno != EAGAIN && errno != EBUSY && inFlightCount == 0) {
+            /* Something went wrong and nothing is in flight. We can't trust the ring so just read everything that's left normally. */
+            cyberfm_atomic_store_32(&pArchive->io.isRingUnavailable, CYBERFM_TRUE);
+            break;
+        }
+
+        /* Process completions. */
+        cqHead = *pRing->pCQHead;
+        cqTail = cyberfm_atomic_load_32((volatile uint32_t*)pRing->pCQTail);
+        while (cqHead != cqTail) {
+            const struct io_uring_cqe* pCQE = &pRing->pCQEs[cqHead & pRing->cqMask];
+
+            cyberfm_io_ring_complete(pArchive, &pRequests[pCQE->user_data], pCQE->res);
+            inFlightCount -= 1;
+            cqHead        += 1;
+        }
+        cyberfm_atomic_store_32((volatile uint32_t*)pRing->pCQHead, cqHead);
+    }
+
+    /* If we bailed out early, anything that's not been done yet needs to be read normally. */
+    for (iNextRequest = 0; iNextRequest < requestCount; iNextRequest += 1) {
+        if (pRequests[iNextRequest].result == CYBERFM_IO_PENDING) {
+            pRequests[iNextRequest].result = cyberfm_archive_read_at(pArchive, pRequests[iNextRequest].offset, pRequests[iNextRequest].pDst, pRequests[iNextRequest].size);
+        }
+    }
+}
+
+static void cyberfm_archive_free_rings(cyberfm_archive* pArchive)
+{
+    cyberfm_io_ring* pRing = (cyberfm_io_ring*)pArchive->pool.pFreeRings;
+
+    while (pRing != NULL) {
+        cyberfm_io_ring* pNext = pRing->pNext;
+        cyberfm_io_ring_delete(pRing);
+        pRing = pNext;
+    }
+
+    pArchive->pool.pFreeRings = NULL;
+}
+#else
+static void cyberfm_archive_free_rings(cyberfm_archive* pArchive)
+{
+    (void)pArchive;
+}
+#endif
+
+cyberfm_result cyberfm_archive_read_batch(cyberfm_archive* pArchive, cyberfm_read_request* pRequests, uint32_t requestCount)
+{
+    cyberfm_result result = CYBERFM_SUCCESS;
+    uint32_t iRequest;
+
+    if (pArchive == NULL || (pRequests == NULL && requestCount > 0)) {
+        return CYBERFM_INVALID_ARGS;
+    }
+
+#ifdef CYBERFM_HAS_IO_URING
+    {
+        cyberfm_io_ring* pRing = (requestCount > 1) ? cyberfm_archive_acquire_ring(pArchive) : NULL;
+        if (pRing != NULL) {
+            CYBERFM_STATS_DECLARE_TIMER(startTime)
+
+            /* Reads through the ring complete out of order so the whole batch is timed as one read. */
+            CYBERFM_STATS_BEGIN_TIMER(startTime);
+            cyberfm_archive_read_batch_io_uring(pArchive, pRing, pRequests, requestCount);
+            CYBERFM_STATS_END_TIMER(CYBERFM_STAT_TIMER_READ, startTime);
+
+            if (cyberfm_atomic_load_32(&pArchive->io.isRingUnavailable)) {
+                cyberfm_io_ring_delete(pRing);
+            } else {
+                cyberfm_archive_release_ring(pArchive, pRing);
+            }
+
+            for (iRequest = 0; iRequest < requestCount; iRequest += 1) {
+                if (pRequests[iRequest].result != CYBERFM_SUCCESS && result == CYBERFM_SUCCESS) {
+                    result = pRequests[iRequest].result;
+                }
+            }
+
+            return result;
+        }
+    }
+#endif
+
+    for (iRequest = 0; iRequest < requestCount; iRequest += 1) {
+        pRequests[iRequest].result = cyberfm_archive_read_at(pArchive, pRequests[iRequest].offset, pRequests[iRequest].pDst, pRequests[iRequest].size);
+        if (pRequests[iRequest].result != CYBERFM_SUCCESS && result == CYBERFM_SUCCESS) {
+            result = pRequests[iRequest].result;
+        }
+    }
+
+    return result;
+}
+
+/*
+Everything in the archive is little-endian and tightly packed. The sections of the central directory are referenced or
+copied straight into these structures so their layout needs to match exactly.
+*/
+#define CYBERFM_STATIC_ASSERT(name, condition)  typedef char cyberfm_static_assert_##name[(condition) ? 1 : -1]
+
+CYBERFM_STATIC_ASSERT(file_info_size,    sizeof(cyberfm_archive_file_info) == 56);
+CYBERFM_STATIC_ASSERT(data_spec_size,    sizeof(cyberfm_archive_file_data_spec) == 16);
+CYBERFM_STATIC_ASSERT(unknown_data_size, sizeof(cyberfm_archive_central_directory_unknown_data) == 8);
+
+#define CYBERFM_ARCHIVE_HEADER_SIZE             40
+#define CYBERFM_ARCHIVE_HEADER_PADDING_SIZE     132     /* The game's archives have this many zero bytes after the header before the first file's data. */
+#define CYBERFM_CENTRAL_DIRECTORY_HEADER_SIZE   28
+
+static cyberfm_bool32 cyberfm_is_little_endian(void)
+{
+    const uint32_t n = 1;
+    return *(const uint8_t*)&n == 1;
+}
+
+static uint32_t cyberfm_read_le32(const void* pData)
+{
+    const uint8_t* p = (const uint8_t*)pData;
+    return ((uint32_t)p[0] << 0) | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t cyberfm_read_le64(const void* pData)
+{
+    const uint8_t* p = (const uint8_t*)pData;
+    return ((uint64_t)cyberfm_read_le32(p + 0) << 0) | ((uint64_t)cyberfm_read_le32(p + 4) << 32);
+}
+
+/* Converts an array of little-endian values to native byte order in place. Does nothing on little-endian hosts. */
+static void cyberfm_le32_array_to_native(void* pData, size_t count)
+{
+    uint32_t* p = (uint32_t*)pData;
+    size_t i;
+
+    if (cyberfm_is_little_endian()) {
+        return;
+    }
+
+    for (i = 0; i < count; i += 1) {
+        p[i] = cyberfm_read_le32(&p[i]);
+    }
+}
+
+static void cyberfm_le64_array_to_native(void* pData, size_t count)
+{
+    uint64_t* p = (uint64_t*)pData;
+    size_t i;
+
+    if (cyberfm_is_little_endian()) {
+        return;
+    }
+
+    for (i = 0; i < count; i += 1) {
+        p[i] = cyberfm_read_le64(&p[i]);
+    }
+}
+
+static void cyberfm_archive_sections_to_native(cyberfm_archive_central_directory* pCentralDirectory)
+{
+    uint32_t i;
+
+    if (cyberfm_is_little_endian()) {
+        return;
+    }
+
+    for (i = 0; i < pCentralDirectory->fileInfoCount; i += 1) {
+        cyberfm_le64_array_to_native(&pCentralDirectory->pFileInfo[i].hashedName, 2);   /* hashedName, unknown1 */
+        cyberfm_le32_array_to_native(&pCentralDirectory->pFileInfo[i].unknown2,  10);   /* unknown2 through to the end of hash[5] */
+    }
+
+    for (i = 0; i < pCentralDirectory->fileDataSpecCount; i += 1) {
+        cyberfm_le64_array_to_native(&pCentralDirectory->pFileDataSpec[i].offset,         1);
+        cyberfm_le32_array_to_native(&pCentralDirectory->pFileDataSpec[i].compressedSize, 2);
+    }
+}
+
+/* Decodes the fixed 40 byte header at the start of the archive. The padding after it is not read. */
+static cyberfm_result cyberfm_archive_decode_header(cyberfm_archive* pArchive, const uint8_t* pHeader)
+{
+    pArchive->fourcc           = cyberfm_read_le32(pHeader +  0);
+    pArchive->unknown0         = cyberfm_read_le32(pHeader +  4);
+    pArchive->centralDirOffset = cyberfm_read_le64(pHeader +  8);
+    pArchive->centralDirSize   = cyberfm_read_le64(pHeader + 16);
+    pArchive->unknown1         = cyberfm_read_le64(pHeader + 24);
+    pArchive->archiveSize      = cyberfm_read_le64(pHeader + 32);
+
+    if (pArchive->fourcc != 0x52414452) {
+        return CYBERFM_ERROR;   /* Not a valid archive file. */
+    }
+
+    /* Quick validation check of the central directory offset + size. */
+    if (pArchive->centralDirOffset > pArchive->archiveSize || pArchive->centralDirSize > (pArchive->archiveSize - pArchive->centralDirOffset)) {
+        return CYBERFM_ERROR;   /* Central directory is invalid. */
+    }
+
+    if (pArchive->centralDirOffset > pArchive->fileSize || pArchive->centralDirSize > (pArchive->fileSize - pArchive->centralDirOffset)) {
+        return CYBERFM_ERROR;   /* Central directory is invalid. */
+    }
+
+    return CYBERFM_SUCCESS;
+}
+
+/*
+Decodes the 28 byte header of the central directory into pCentralDirectory and checks that the sections it describes
+actually fit inside the central directory.
+*/
+static cyberfm_result cyberfm_decode_central_directory_header(cyberfm_archive_central_directory* pCentralDirectory, const uint8_t* pHeader, uint64_t centralDirSize)
+{
+    uint64_t sectionsSize;
+
+    if (centralDirSize < CYBERFM_CENTRAL_DIRECTORY_HEADER_SIZE) {
+        return CYBERFM_ERROR;   /* Central directory is invalid. */
+    }
+
+    pCentralDirectory->fourcc            = cyberfm_read_le32(pHeader +  0);
+    pCentralDirectory->size              = cyberfm_read_le32(pHeader +  4);
+    pCentralDirectory->unknown0          = cyberfm_read_le64(pHeader +  8);
+    pCentralDirectory->fileInfoCount     = cyberfm_read_le32(pHeader + 16);
+    pCentralDirectory->fileDataSpecCount = cyberfm_read_le32(pHeader + 20);
+    pCentralDirectory->unknownDataCount  = cyberfm_read_le32(pHeader + 24);
+    pCentralDirectory->pFileInfo         = NULL;
+    pCentralDirectory->pFileDataSpec     = NULL;
+    pCentralDirectory->pUnknownData      = NULL;
+
+    /* The sections must all fit inside the central directory. */
+    sectionsSize = ((uint64_t)pCentralDirectory->fileInfoCount * 56) + ((uint64_t)pCentralDirectory->fileDataSpecCount * 16) + ((uint64_t)pCentralDirectory->unknownDataCount * 8);
+    if (sectionsSize > (centralDirSize - CYBERFM_CENTRAL_DIRECTORY_HEADER_SIZE)) {
+        return CYBERFM_ERROR;   /* Central directory is invalid. */
+    }
+
+    return CYBERFM_SUCCESS;
+}
+
+/*
+Loads the central directory from memory that will remain valid for the life of the archive, such as a memory mapping. The
+sections will be referenced directly from that memory where possible.
+*/
+static cyberfm_result cyberfm_archive_load_central_directory_from_memory(cyberfm_archive* pArchive, const uint8_t* pCentralDir, uint64_t centralDirSize)
+{
+    cyberfm_result result;
+    cyberfm_archive_central_directory header;
+    uint64_t fileInfoChunkSize;
+    uint64_t fileDataSpecChunkSize;
+    cyberfm_bool32 isAligned;
+
+    result = cyberfm_decode_central_directory_header(&header, pCentralDir, centralDirSize);
+    if (result != CYBERFM_SUCCESS) {
+        return result;
+    }
+
+    fileInfoChunkSize     = (uint64_t)header.fileInfoCount     * 56;
+    fileDataSpecChunkSize = (uint64_t)header.fileDataSpecCount * 16;
+
+    /*
+    The sections can only be referenced directly when they're aligned properly and the host is little-endian. If not we'll
+    need to fall back to making a copy. The archive format aligns everything to 4 bytes, but our structures need 8. The
+    sections start straight after the 28 byte header, and since each item in the first two sections is a multiple of 8 bytes
+    we only need to check the start of the first section.
+
+    When we need to make a copy, the unknown section is left out. It'll be loaded on demand by cyberfm_archive_get_unknown_data().
+    */
+    isAligned = (((uintptr_t)pCentralDir + CYBERFM_CENTRAL_DIRECTORY_HEADER_SIZE) & 7) == 0 && cyberfm_is_little_endian();
+    if (isAligned) {
+        pArchive->pCentralDirectory = (cyberfm_archive_central_directory*)malloc(sizeof(*pArchive->pCentralDirectory));
+    } else {
+        pArchive->pCentralDirectory = (cyberfm_archive_central_directory*)malloc(sizeof(*pArchive->pCentralDirectory) + (size_t)(fileInfoChunkSize + fileDataSpecChunkSize));
+    }
+
+    if (pArchive->pCentralDirectory == NULL) {
+        return CYBERFM_OUT_OF_MEMORY;
+    }
+
+    *pArchive->pCentralDirectory = header;
+
+    pCentralDir += CYBERFM_CENTRAL_DIRECTORY_HEADER_SIZE;
+
+    if (isAligned) {
+        pArchive->pCentralDirectory->pFileInfo     = (cyberfm_archive_file_info*)                     CYBERFM_OFFSET_PTR(pCentralDir, 0);
+        pArchive->pCentralDirectory->pFileDataSpec = (cyberfm_archive_file_data_spec*)                CYBERFM_OFFSET_PTR(pCentralDir, fileInfoChunkSize);
+        pArchive->pCentralDirectory->pUnknownData  = (cyberfm_archive_central_directory_unknown_data*)CYBERFM_OFFSET_PTR(pCentralDir, fileInfoChunkSize + fileDataSpecChunkSize);
+        pArchive->deferred.isUnknownDataLoaded = CYBERFM_TRUE;
+    } else {
+        memcpy(pArchive->pCentralDirectory->pPayload, pCentralDir, (size_t)(fileInfoChunkSize + fileDataSpecChunkSize));
+
+        pArchive->pCentralDirectory->pFileInfo     = (cyberfm_archive_file_info*)     CYBERFM_OFFSET_PTR(pArchive->pCentralDirectory->pPayload, 0);
+        pArchive->pCentralDirectory->pFileDataSpec = (cyberfm_archive_file_data_spec*)CYBERFM_OFFSET_PTR(pArchive->pCentralDirectory->pPayload, fileInfoChunkSize);
+        cyberfm_archive_sections_to_native(pArchive->pCentralDirectory);
+    }
+
+    return CYBERFM_SUCCESS;
+}
+
+/*
+Loads the central directory from the archive file. The offset and size are already known from the archive header so the
+whole thing, including the header of the central directory, is read with a single read straight into the allocation that
+it'll live in. It's read far enough in that the sections after the 28 byte header end up aligned to 8 bytes. The unknown
+section comes along for free so it's loaded here as well.
+*/
+static cyberfm_result cyberfm_archive_load_central_directory_from_file(cyberfm_archive* pArchive)
+{
+    cyberfm_result result;
+    cyberfm_archive_central_directory header;
+    uint8_t* pCentralDir;
+    uint64_t fileInfoChunkSize;
+    uint64_t fileDataSpecChunkSize;
+
+    if (pArchive->centralDirSize > (size_t)-1 - sizeof(*pArchive->pCentralDirectory) - 8) {
+        return CYBERFM_OUT_OF_RANGE;
+    }
+
+    pArchive->pCentralDirectory = (cyberfm_archive_central_directory*)malloc(sizeof(*pArchive->pCentralDirectory) + 8 + (size_t)pArchive->centralDirSize);
+    if (pArchive->pCentralDirectory == NULL) {
+        return CYBERFM_OUT_OF_MEMORY;
+    }
+
+    pCentralDir  = (uint8_t*)pArchive->pCentralDirectory->pPayload;
+    pCentralDir += (8 - (((uintptr_t)pCentralDir + CYBERFM_CENTRAL_DIRECTORY_HEADER_SIZE) & 7)) & 7;
+
+    result = cyberfm_archive_read_at(pArchive, pArchive->centralDirOffset, pCentralDir, (size_t)pArchive->centralDirSize);
+    if (result == CYBERFM_SUCCESS) {
+        result = cyberfm_decode_central_directory_header(&header, pCentralDir, pArchive->centralDirSize);
+    }
+
+    if (result != CYBERFM_SUCCESS) {
+        free(pArchive->pCentralDirectory);
+        pArchive->pCentralDirectory = NULL;
+        return result;
+    }
+
+    fileInfoChunkSize     = (uint64_t)header.fileInfoCount     * 56;
+    fileDataSpecChunkSize = (uint64_t)header.fileDataSpecCount * 16;
+
+    pCentralDir += CYBERFM_CENTRAL_DIRECTORY_HEADER_SIZE;
+
+    *pArchive->pCentralDirectory = header;
+    pArchive->pCentralDirectory->pFileInfo     = (cyberfm_archive_file_info*)                     CYBERFM_OFFSET_PTR(pCentralDir, 0);
+    pArchive->pCentralDirectory->pFileDataSpec = (cyberfm_archive_file_data_spec*)                CYBERFM_OFFSET_PTR(pCentralDir, fileInfoChunkSize);
+    pArchive->pCentralDirectory->pUnknownData  = (cyberfm_archive_central_directory_unknown_data*)CYBERFM_OFFSET_PTR(pCentralDir, fileInfoChunkSize + fileDataSpecChunkSize);
+
+    cyberfm_archive_sections_to_native(pArchive->pCentralDirectory);
+    cyberfm_le64_array_to_native(pArchive->pCentralDirectory->pUnknownData, pArchive->pCentralDirectory->unknownDataCount);
+    pArchive->deferred.isUnknownDataLoaded = CYBERFM_TRUE;
+
+    return CYBERFM_SUCCESS;
+}
+
+static uint32_t cyberfm_ctz32(uint32_t x)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return (x == 0) ? 32 : (uint32_t)__builtin_ctz(x);
+#elif defined(_MSC_VER)
+    unsigned long index;
+    return _BitScanForward(&index, x) ? (uint32_t)index : 32;
+#else
+    uint32_t n = 0;
+    if (x == 0) {
+        return 32;
+    }
+    while ((x & 1) == 0) {
+        x >>= 1;
+        n  += 1;
+    }
+    return n;
+#endif
+}
+
+typedef struct
+{
+    uint64_t hashedName;
+    uint32_t fileIndex;
+} cyberfm_lookup_item;
+
+static int cyberfm_lookup_item_compare(const void* a, const void* b)
+{
+    const cyberfm_lookup_item* pA = (const cyberfm_lookup_item*)a;
+    const cyberfm_lookup_item* pB = (const cyberfm_lookup_item*)b;
+
+    if (pA->hashedName != pB->hashedName) {
+        return (pA->hashedName < pB->hashedName) ? -1 : 1;
+    }
+
+    /* Duplicates should resolve to the first file, just like a linear search would. */
+    return (pA->fileIndex < pB->fileIndex) ? -1 : ((pA->fileIndex > pB->fileIndex) ? 1 : 0);
+}
+
+static uint32_t cyberfm_lookup_fill_eytzinger(cyberfm_archive* pArchive, const cyberfm_lookup_item* pItems, uint32_t i, uint32_t k)
+{
+    /* In-order traversal of the implicit tree. The depth is bounded by log2 of the file count so recursion is fine here. */
+    if (k <= pArchive->lookup.count) {
+        i = cyberfm_lookup_fill_eytzinger(pArchive, pItems, i, 2 * k);
+        pArchive->lookup.pHashes[k]      = pItems[i].hashedName;
+        pArchive->lookup.pFileIndices[k] = pItems[i].fileIndex;
+        i = cyberfm_lookup_fill_eytzinger(pArchive, pItems, i + 1, (2 * k) + 1);
+    }
+
+    return i;
+}
+
+/*
+Builds the lookup table used by cyberfm_archive_find(). The hashed names are copied out of the file info records into a
+dense array stored in Eytzinger (BFS) order. This means a lookup only touches 8 bytes per level rather than a whole 56
+byte record, and the top levels of the tree all share a handful of cache lines.
+
+The hashed names should already be sorted, but if they aren't we'll sort a copy ourselves. If we fail to allocate memory
+for the table, cyberfm_archive_find() will just fall back to a linear search.
+*/
+static void cyberfm_archive_build_lookup(cyberfm_archive* pArchive)
+{
+    uint32_t count = pArchive->pCentralDirectory->fileInfoCount;
+    uint32_t iFile;
+    cyberfm_lookup_item* pItems;
+    cyberfm_bool32 isSorted = CYBERFM_TRUE;
+    size_t hashesSize;
+
+    if (count == 0) {
+        return;
+    }
+
+    pItems = (cyberfm_lookup_item*)malloc(sizeof(*pItems) * count);
+    if (pItems == NULL) {
+        return;
+    }
+
+    for (iFile = 0; iFile < count; iFile += 1) {
+        pItems[iFile].hashedName = pArchive->pCentralDirectory->pFileInfo[iFile].hashedName;
+        pItems[iFile].fileIndex  = iFile;
+
+        if (iFile > 0 && pItems[iFile].hashedName <= pItems[iFile - 1].hashedName) {
+            isSorted = CYBERFM_FALSE;
+        }
+    }
+
+    if (!isSorted) {
+        qsort(pItems, count, sizeof(*pItems), cyberfm_lookup_item_compare);
+    }
+
+    /*
+    Index 0 is unused (the tree is 1-based). We align the hashes to a cache line so that the prefetch in the search
+    lines up with the 8 descendants of each node. Prefetching past the end of the array is harmless.
+    */
+    hashesSize = sizeof(uint64_t) * ((size_t)count + 1);
+
+    pArchive->lookup.pAllocation = malloc(64 + hashesSize + (sizeof(uint32_t) * ((size_t)count + 1)));
+    if (pArchive->lookup.pAllocation == NULL) {
+        free(pItems);
+        return;
+    }
+
+    pArchive->lookup.count        = count;
+    pArchive->lookup.pHashes      = (uint64_t*)(((uintptr_t)pArchive->lookup.pAllocation + 63) & ~(uintptr_t)63);
+    pArchive->lookup.pFileIndices = (uint32_t*)CYBERFM_OFFSET_PTR(pArchive->lookup.pHashes, hashesSize);
+
+    pArchive->lookup.pHashes[0]      = 0;
+    pArchive->lookup.pFileIndices[0] = 0;
+    cyberfm_lookup_fill_eytzinger(pArchive, pItems, 0, 1);
+
+    free(pItems);
+}
+
+/*
+The reference codec. This is a simple byte oriented LZ77 with the block split up into sequences. Each sequence starts with
+a token byte where the high 4 bits is the number of literals and the low 4 bits is the length of the match, minus 4. When
+either of these is 15, more bytes follow which are added to the length until a byte other than 255 is found. The literals
+come next, and then a 16-bit little-endian offset for the match. The last sequence is just literals, and is identified by
+reaching the end of the input after the literals.
+*/
+#define CYBERFM_CFLZ_MIN_MATCH      4
+#define CYBERFM_CFLZ_MAX_OFFSET     65535
+#define CYBERFM_CFLZ_HASH_BITS      14
+
+size_t cyberfm_cflz_compress_bound(size_t srcSize)
+{
+    return CYBERFM_CFLZ_HEADER_SIZE + srcSize + (srcSize / 255) + 16;
+}
+
+static void cyberfm_cflz_write_header(uint8_t* pDst, uint32_t uncompressedSize, uint8_t method)
+{
+    pDst[ 0] = 'C';
+    pDst[ 1] = 'F';
+    pDst[ 2] = 'L';
+    pDst[ 3] = 'Z';
+    pDst[ 4] = (uint8_t)((uncompressedSize >>  0) & 0xFF);
+    pDst[ 5] = (uint8_t)((uncompressedSize >>  8) & 0xFF);
+    pDst[ 6] = (uint8_t)((uncompressedSize >> 16) & 0xFF);
+    pDst[ 7] = (uint8_t)((uncompressedSize >> 24) & 0xFF);
+    pDst[ 8] = method;
+    pDst[ 9] = 0;
+    pDst[10] = 0;
+    pDst[11] = 0;
+}
+
+static uint8_t* cyberfm_cflz_write_length(uint8_t* pOut, size_t length)
+{
+    while (length >= 255) {
+        *pOut++ = 255;
+        length -= 255;
+    }
+
+    *pOut++ = (uint8_t)length;
+    return pOut;
+}
+
+/* Writes a sequence. Returns NULL if there's not enough room in the output buffer. */
+static uint8_t* cyberfm_cflz_write_sequence(uint8_t* pOut, uint8_t* pOutEnd, const uint8_t* pLiterals, size_t literalCount, size_t matchOffset, size_t matchLength)
+{
+    size_t encodedMatchLength = (matchLength > 0) ? matchLength - CYBERFM_CFLZ_MIN_MATCH : 0;
+
+    /* The worst case size of the sequence. */
+    if ((size_t)(pOutEnd - pOut) < 1 + (literalCount / 255) + 1 + literalCount + 2 + (encodedMatchLength / 255) + 1) {
+        return NULL;
+    }
+
+    *pOut++ = (uint8_t)(((literalCount >= 15) ? 15 : literalCount) << 4) | (uint8_t)((encodedMatchLength >= 15) ? 15 : encodedMatchLength);
+
+    if (literalCount >= 15) {
+        pOut = cyberfm_cflz_write_length(pOut, literalCount - 15);
+    }
+
+    memcpy(pOut, pLiterals, literalCount);
+    pOut += literalCount;
+
+    if (matchLength > 0) {
+        *pOut++ = (uint8_t)((matchOffset >> 0) & 0xFF);
+        *pOut++ = (uint8_t)((matchOffset >> 8) & 0xFF);
+
+        if (encodedMatchLength >= 15) {
+            pOut = cyberfm_cflz_write_length(pOut, encodedMatchLength - 15);
+        }
+    }
+
+    return pOut;
+}
+
+static uint32_t cyberfm_cflz_hash(const uint8_t* p)
+{
+    uint32_t value;
+    memcpy(&value, p, 4);
+    return (value * 2654435761U) >> (32 - CYBERFM_CFLZ_HASH_BITS);
+}
+
+cyberfm_result cyberfm_cflz_compress(const void* pSrc, size_t srcSize, void* pDst, size_t dstCap, size_t* pCompressedSize)
+{
+    const uint8_t* pIn = (const uint8_t*)pSrc;
+    const uint8_t* pInEnd;
+    const uint8_t* pAnchor;
+    const uint8_t* pCursor;
+    uint8_t* pOut;
+    uint8_t* pOutEnd;
+    uint32_t* pHashTable;
+
+    if (pCompressedSize == NULL) {
+        return CYBERFM_INVALID_ARGS;
+    }
+
+    *pCompressedSize = 0;
+
+    if ((pSrc == NULL && srcSize > 0) || pDst == NULL || srcSize > 0xFFFFFFFF) {
+        return CYBERFM_INVALID_ARGS;
+    }
+
+    if (dstCap < CYBERFM_CFLZ_HEADER_SIZE) {
+        return CYBERFM_OUT_OF_RANGE;
+    }
+
+    pHashTable = (uint32_t*)calloc((size_t)1 << CYBERFM_CFLZ_HASH_BITS, sizeof(*pHashTable));
+    if (pHashTable == NULL) {
+        return CYBERFM_OUT_OF_MEMORY;
+    }
+
+    /* Compressed data must be smaller than the stored version or else there's no point. */
+    pOut    = (uint8_t*)pDst + CYBERFM_CFLZ_HEADER_SIZE;
+    pOutEnd = (uint8_t*)pDst + CYBERFM_MIN(dstCap, CYBERFM_CFLZ_HEADER_SIZE + srcSize);
+    pInEnd  = pIn + srcSize;
+    pAnchor = pIn;
+    pCursor = pIn;
+
+    /* The hash reads 4 bytes so we need to stop looking for matches a little before the end. */
+    while (pOut != NULL && srcSize >= CYBERFM_CFLZ_MIN_MATCH && pCursor <= pInEnd - CYBERFM_CFLZ_MIN_MATCH) {
+        uint32_t hash = cyberfm_cflz_hash(pCursor);
+        const uint8_t* pCandidate = pIn + pHashTable[hash];
+
+        pHashTable[hash] = (uint32_t)(pCursor - pIn);
+
+        if (pCandidate < pCursor && (size_t)(pCursor - pCandidate) <= CYBERFM_CFLZ_MAX_OFFSET && memcmp(pCandidate, pCursor, CYBERFM_CFLZ_MIN_MATCH) == 0) {
+            size_t matchLength = CYBERFM_CFLZ_MIN_MATCH;
+
+            while (pCursor + matchLength < pInEnd && pCandidate[matchLength] == pCursor[matchLength]) {
+                matchLength += 1;
+            }
+
+            pOut = cyberfm_cflz_write_sequence(pOut, pOutEnd, pAnchor, (size_t)(pCursor - pAnchor), (size_t)(pCursor - pCandidate), matchLength);
+
+            pCursor += matchLength;
+            pAnchor  = pCursor;
+        } else {
+            pCursor += 1;
+        }
+    }
+
+    /* The last sequence is whatever literals are left over. */
+    if (pOut != NULL) {
+        pOut = cyberfm_cflz_write_sequence(pOut, pOutEnd, pAnchor, (size_t)(pInEnd - pAnchor), 0, 0);
+    }
+
+    free(pHashTable);
+
+    if (pOut != NULL && pOut < pOutEnd) {
+        cyberfm_cflz_write_header((uint8_t*)pDst, (uint32_t)srcSize, CYBERFM_CFLZ_METHOD_LZ);
+        *pCompressedSize = (size_t)(pOut - (uint8_t*)pDst);
+    } else {
+        /* Didn't compress. Fall back to storing it. */
+        if (dstCap - CYBERFM_CFLZ_HEADER_SIZE < srcSize) {
+            return CYBERFM_OUT_OF_RANGE;
+        }
+
+        cyberfm_cflz_write_header((uint8_t*)pDst, (uint32_t)srcSize, CYBERFM_CFLZ_METHOD_STORED);
+        if (srcSize > 0) {
+            memcpy((uint8_t*)pDst + CYBERFM_CFLZ_HEADER_SIZE, pSrc, srcSize);
+        }
+
+        *pCompressedSize = CYBERFM_CFLZ_HEADER_SIZE + srcSize;
+    }
+
+    return CYBERFM_SUCCESS;
+}
+
+static cyberfm_bool32 cyberfm_cflz_read_length(const uint8_t** ppIn, const uint8_t* pInEnd, size_t* pLength)
+{
+    const uint8_t* pIn = *ppIn;
+    uint8_t b;
+
+    do {
+        if (pIn == pInEnd) {
+            return CYBERFM_FALSE;
+        }
+
+        b = *pIn++;
+        *pLength += b;
+    } while (b == 255);
+
+    *ppIn = pIn;
+    return CYBERFM_TRUE;
+}
+
+/*
+Decodes the LZ sequences of a block. When isPrefix is true, decoding stops as soon as pDst is full, and pDst is allowed to be
+smaller than the uncompressed size. Otherwise the sequences must fill pDst exactly.
+*/
+static cyberfm_result cyberfm_cflz_decode_sequences(const uint8_t* pIn, const uint8_t* pInEnd, uint8_t* pDst, size_t dstSize, cyberfm_bool32 isPrefix)
+{
+    uint8_t* pOut = pDst;
+    uint8_t* pOutEnd = pDst + dstSize;
+
+    for (;;) {
+        uint8_t token;
+        size_t literalCount;
+        size_t matchLength;
+        size_t matchOffset;
+
+        if (isPrefix && pOut == pOutEnd) {
+            return CYBERFM_SUCCESS;
+        }
+
+        if (pIn == pInEnd) {
+            return CYBERFM_ERROR;   /* Unexpected end of input. */
+        }
+
+        token = *pIn++;
+
+        literalCount = token >> 4;
+        if (literalCount == 15 && !cyberfm_cflz_read_length(&pIn, pInEnd, &literalCount)) {
+            return CYBERFM_ERROR;
+        }
+
+        if (isPrefix) {
+            literalCount = CYBERFM_MIN(literalCount, (size_t)(pOutEnd - pOut));
+        }
+
+        if (literalCount > (size_t)(pInEnd - pIn) || literalCount > (size_t)(pOutEnd - pOut)) {
+            return CYBERFM_ERROR;
+        }
+
+        memcpy(pOut, pIn, literalCount);
+        pIn  += literalCount;
+        pOut += literalCount;
+
+        if (isPrefix && pOut == pOutEnd) {
+            return CYBERFM_SUCCESS;
+        }
+
+        if (pIn == pInEnd) {
+            break;  /* That was the last sequence. */
+        }
+
+        if ((pInEnd - pIn) < 2) {
+            return CYBERFM_ERROR;
+        }
+
+        matchOffset = (size_t)pIn[0] | ((size_t)pIn[1] << 8);
+        pIn += 2;
+
+        matchLength = token & 0x0F;
+        if (matchLength == 15 && !cyberfm_cflz_read_length(&pIn, pInEnd, &matchLength)) {
+            return CYBERFM_ERROR;
+        }
+
+        matchLength += CYBERFM_CFLZ_MIN_MATCH;
+
+        if (isPrefix) {
+            matchLength = CYBERFM_MIN(matchLength, (size_t)(pOutEnd - pOut));
+        }
+
+        if (matchOffset == 0 || matchOffset > (size_t)(pOut - pDst) || matchLength > (size_t)(pOutEnd - pOut)) {
+            return CYBERFM_ERROR;
+        }
+
+        if (matchOffset >= matchLength) {
+            memcpy(pOut, pOut - matchOffset, matchLength);
+            pOut += matchLength;
+        } else {
+            /* Overlapping. Needs to be done one byte at a time. */
+            const uint8_t* pMatch = pOut - matchOffset;
+            size_t i;
+
+            for (i = 0; i < matchLength; i += 1) {
+                pOut[i] = pMatch[i];
+            }
+
+            pOut += matchLength;
+        }
+    }
+
+    if (pOut != pOutEnd) {
+        return CYBERFM_ERROR;   /* Didn't produce the expected amount of data. */
+    }
+
+    return CYBERFM_SUCCESS;
+}
+
+cyberfm_result cyberfm_cflz_decompress(const void* pCompressedData, size_t compressedSize, void* pDst, size_t dstSize)
+{
+    const uint8_t* pIn = (const uint8_t*)pCompressedData;
+
+    if (pCompressedData == NULL || (pDst == NULL && dstSize > 0)) {
+        return CYBERFM_INVALID_ARGS;
+    }
+
+    if (compressedSize < CYBERFM_CFLZ_HEADER_SIZE || cyberfm_read_le32(pIn) != CYBERFM_CFLZ_FOURCC || cyberfm_read_le32(pIn + 4) != dstSize) {
+        return CYBERFM_ERROR;
+    }
+
+    if (pIn[8] == CYBERFM_CFLZ_METHOD_STORED) {
+        if (compressedSize - CYBERFM_CFLZ_HEADER_SIZE != dstSize) {
+            return CYBERFM_ERROR;
+        }
+
+        if (dstSize > 0) {
+            memcpy(pDst, pIn + CYBERFM_CFLZ_HEADER_SIZE, dstSize);
+        }
+
+        return CYBERFM_SUCCESS;
+    }
+
+    if (pIn[8] != CYBERFM_CFLZ_METHOD_LZ) {
+        return CYBERFM_ERROR;   /* Unknown method. */
+    }
+
+    return cyberfm_cflz_decode_sequences(pIn + CYBERFM_CFLZ_HEADER_SIZE, pIn + compressedSize, (uint8_t*)pDst, dstSize, CYBERFM_FALSE);
+}
+
+cyberfm_result cyberfm_cflz_decompress_prefix(const void* pCompressedData, size_t compressedSize, void* pDst, size_t dstSize)
+{
+    const uint8_t* pIn = (const uint8_t*)pCompressedData;
+
+    if (pCompressedData == NULL || (pDst == NULL && dstSize > 0)) {
+        return CYBERFM_INVALID_ARGS;
+    }
+
+    if (compressedSize < CYBERFM_CFLZ_HEADER_SIZE || cyberfm_read_le32(pIn) != CYBERFM_CFLZ_FOURCC || cyberfm_read_le32(pIn + 4) < dstSize) {
+        return CYBERFM_ERROR;
+    }
+
+    if (pIn[8] == CYBERFM_CFLZ_METHOD_STORED) {
+        if (compressedSize - CYBERFM_CFLZ_HEADER_SIZE < dstSize) {
+            return CYBERFM_ERROR;
+        }
+
+        if (dstSize > 0) {
+            memcpy(pDst, pIn + CYBERFM_CFLZ_HEADER_SIZE, dstSize);
+        }
+
+        return CYBERFM_SUCCESS;
+    }
+
+    if (pIn[8] != CYBERFM_CFLZ_METHOD_LZ) {
+        return CYBERFM_ERROR;   /* Unknown method. */
+    }
+
+    return cyberfm_cflz_decode_sequences(pIn + CYBERFM_CFLZ_HEADER_SIZE, pIn + compressedSize, (uint8_t*)pDst, dstSize, CYBERFM_TRUE);
+}
+
+static cyberfm_bool32 cyberfm_cflz_codec_probe(void* pUserData, const void* pCompressedData, size_t compressedSize)
+{
+    (void)pUserData;
+    return compressedSize >= CYBERFM_CFLZ_HEADER_SIZE && cyberfm_read_le32(pCompressedData) == CYBERFM_CFLZ_FOURCC;
+}
+
+static cyberfm_result cyberfm_cflz_codec_decompress(void* pUserData, const void* pCompressedData, size_t compressedSize, void* pDst, size_t dstSize)
+{
+    (void)pUserData;
+    return cyberfm_cflz_decompress(pCompressedData, compressedSize, pDst, dstSize);
+}
+
+static void cyberfm_codec_batch_job_proc(void* pUserData, uint32_t jobIndex)
+{
+    cyberfm_codec_job* pJob = &((cyberfm_codec_job*)pUserData)[jobIndex];
+    pJob->result = cyberfm_cflz_decompress(pJob->pCompressedData, pJob->compressedSize, pJob->pDst, pJob->dstSize);
+}
+
+/* Batches that are big enough are decoded across all CPUs. It's not worth starting up threads for small batches. */
+#define CYBERFM_CFLZ_PARALLEL_BATCH_THRESHOLD   (4 * 1024 * 1024)
+
+static void cyberfm_cflz_codec_decompress_batch(void* pUserData, cyberfm_codec_job* pJobs, uint32_t jobCount)
+{
+    uint64_t totalSize = 0;
+    uint32_t iJob;
+
+    (void)pUserData;
+
+    for (iJob = 0; iJob < jobCount; iJob += 1) {
+        totalSize += pJobs[iJob].dstSize;
+    }
+
+    if (jobCount > 1 && totalSize >= CYBERFM_CFLZ_PARALLEL_BATCH_THRESHOLD && cyberfm_get_cpu_count() > 1) {
+        cyberfm_job_pool pool;
+        cyberfm_job_pool_config poolConfig;
+
+        poolConfig = cyberfm_job_pool_config_init(0, jobCount, cyberfm_codec_batch_job_proc, pJobs);
+        if (cyberfm_job_pool_init(&poolConfig, &pool) == CYBERFM_SUCCESS) {
+            cyberfm_job_pool_uninit(&pool);
+            return;
+        }
+
+        /* Getting here means we couldn't create the pool. Just fall through and do it on this thread. */
+    }
+
+    for (iJob = 0; iJob < jobCount; iJob += 1) {
+        cyberfm_codec_batch_job_proc(pJobs, iJob);
+    }
+}
+
+static cyberfm_result cyberfm_cflz_codec_compress(void* pUserData, const void* pSrc, size_t srcSize, void* pDst, size_t dstCap, size_t* pCompressedSize)
+{
+    (void)pUserData;
+    return cyberfm_cflz_compress(pSrc, srcSize, pDst, dstCap, pCompressedSize);
+}
+
+static cyberfm_result cyberfm_cflz_codec_decompress_prefix(void* pUserData, const void* pCompressedData, size_t compressedSize, void* pDst, size_t dstSize)
+{
+    (void)pUserData;
+    return cyberfm_cflz_decompress_prefix(pCompressedData, compressedSize, pDst, dstSize);
+}
+
+static const cyberfm_codec g_cyberfmCodecCFLZ = {
+    "CFLZ",
+    NULL,
+    cyberfm_cflz_codec_probe,
+    cyberfm_cflz_codec_decompress,
+    cyberfm_cflz_codec_decompress_batch,
+    cyberfm_cflz_codec_compress,
+    cyberfm_cflz_codec_decompress_prefix
+};
+
+const cyberfm_codec* cyberfm_get_cflz_codec(void)
+{
+    return &g_cyberfmCodecCFLZ;
+}
+
+
+/* Oodle blocks start with "KARK" followed by the uncompressed size. */
+#define CYBERFM_OODLE_FOURCC    0x4B52414B  /* "KARK" */
+
+static cyberfm_bool32 cyberfm_oodle_codec_probe(void* pUserData, const void* pCompressedData, size_t compressedSize)
+{
+    (void)pUserData;
+    return compressedSize >= 8 && cyberfm_read_le32(pCompressedData) == CYBERFM_OODLE_FOURCC;
+}
+
+static cyberfm_result cyberfm_oodle_codec_decompress(void* pUserData, const void* pCompressedData, size_t compressedSize, void* pDst, size_t dstSize)
+{
+    cyberfm_OodleLZ_Decompress_proc OodleLZ_Decompress = ((cyberfm_archive*)pUserData)->oodle.OodleLZ_Decompress;
+    int decompressionResult;
+
+    if (compressedSize < 8 || compressedSize > 0x7FFFFFFF || dstSize > 0x7FFFFFFF) {
+        return CYBERFM_INVALID_ARGS;
+    }
+
+    /* The header has the decompressed size which should always match the size in the central directory. */
+    if (cyberfm_read_le32(CYBERFM_OFFSET_PTR(pCompressedData, 4)) != dstSize) {
+        return CYBERFM_CORRUPT_DATA;
+    }
+
+    /* The compressed data starts after the 8 byte header. */
+    decompressionResult = OodleLZ_Decompress((unsigned char*)CYBERFM_OFFSET_PTR(pCompressedData, 8), (int)(compressedSize - 8), (unsigned char*)pDst, (int)dstSize, 0, 0, 0, NULL, NULL, NULL, NULL, NULL, NULL, 0);
+    if (decompressionResult != (int)dstSize) {
+        return CYBERFM_ERROR;   /* Failed to decompress. */
+    }
+
+    return CYBERFM_SUCCESS;
+}
+
+static const cyberfm_codec* cyberfm_archive_find_codec(cyberfm_archive* pArchive, const void* pCompressedData, size_t compressedSize)
+{
+    uint32_t iCodec;
+
+    for (iCodec = 0; iCodec < pArchive->codecs.count; iCodec += 1) {
+        const cyberfm_codec* pCodec = pArchive->codecs.pCodecs[iCodec];
+        if (pCodec->onProbe(pCodec->pUserData, pCompressedData, compressedSize)) {
+            return pCodec;
+        }
+    }
+
+    return NULL;
+}
+
+cyberfm_result cyberfm_archive_decompress_batch(cyberfm_archive* pArchive, cyberfm_codec_job* pJobs, uint32_t jobCount)
+{
+    cyberfm_result result = CYBERFM_SUCCESS;
+    uint32_t iJob;
+    CYBERFM_STATS_DECLARE_TIMER(startTime)
+
+    if (pArchive == NULL || (pJobs == NULL && jobCount > 0)) {
+        return CYBERFM_INVALID_ARGS;
+    }
+
+    CYBERFM_STATS_BEGIN_TIMER(startTime);
+
+    iJob = 0;
+    while (iJob < jobCount) {
+        const cyberfm_codec* pCodec;
+        uint32_t iRunEnd;
+
+        pCodec = cyberfm_archive_find_codec(pArchive, pJobs[iJob].pCompressedData, pJobs[iJob].compressedSize);
+        if (pCodec == NULL) {
+            pJobs[iJob].result = CYBERFM_INVALID_OPERATION;    /* Don't have a codec for this block. */
+            result = CYBERFM_ERROR;
+            iJob += 1;
+            continue;
+        }
+
+        /* Find the end of the run of blocks that use the same codec. */
+        for (iRunEnd = iJob + 1; iRunEnd < jobCount; iRunEnd += 1) {
+            if (cyberfm_archive_find_codec(pArchive, pJobs[iRunEnd].pCompressedData, pJobs[iRunEnd].compressedSize) != pCodec) {
+                break;
+            }
+        }
+
+        if (pCodec->onDecompressBatch != NULL) {
+            pCodec->onDecompressBatch(pCodec->pUserData, pJobs + iJob, iRunEnd - iJob);
+        } else {
+            uint32_t iRunJob;
+            for (iRunJob = iJob; iRunJob < iRunEnd; iRunJob += 1) {
+                pJobs[iRunJob].result = pCodec->onDecompress(pCodec->pUserData, pJobs[iRunJob].pCompressedData, pJobs[iRunJob].compressedSize, pJobs[iRunJob].pDst, pJobs[iRunJob].dstSize);
+            }
+        }
+
+        for (; iJob < iRunEnd; iJob += 1) {
+            if (pJobs[iJob].result != CYBERFM_SUCCESS) {
+                result = CYBERFM_ERROR;
+            } else {
+                CYBERFM_STATS_ADD(CYBERFM_STAT_BYTES_DECOMPRESSED, pJobs[iJob].dstSize);
+            }
+        }
+    }
+
+    CYBERFM_STATS_END_TIMER(CYBERFM_STAT_TIMER_DECOMPRESS, startTime);
+
+    return result;
+}
+
+/*
+Memory for files and for the compressed data of files is recycled through pools owned by the archive so that opening a
+file doesn't need to touch the heap once things have warmed up.
+
+File objects are grouped into power of two size classes, starting at CYBERFM_FILE_POOL_MIN_SIZE. Closed files are put onto
+a free list for their size class, using the start of the allocation as the link to the next item. Files too big for the
+largest size class are allocated and freed directly. Scratch buffers for compressed data work the same way, only there's a
+single list since they can be resized. Each thread that's decompressing at the same time will end up with it's own buffer.
+*/
+typedef struct cyberfm_pool_item cyberfm_pool_item;
+struct cyberfm_pool_item
+{
+    cyberfm_pool_item* pNext;
+    size_t size;    /* Only used by scratch buffers. The size of the data after this header. */
+};
+
+static uint32_t cyberfm_file_pool_get_size_class(size_t allocationSize)
+{
+    uint32_t sizeClass = 0;
+
+    while (((size_t)CYBERFM_FILE_POOL_MIN_SIZE << sizeClass) < allocationSize) {
+        sizeClass += 1;
+        if (sizeClass == CYBERFM_FILE_POOL_SIZE_CLASS_COUNT) {
+            break;  /* Too big to be pooled. */
+        }
+    }
+
+    return sizeClass;
+}
+
+static cyberfm_file* cyberfm_archive_alloc_file(cyberfm_archive* pArchive, size_t payloadSize)
+{
+    cyberfm_file* pFile = NULL;
+    size_t allocationSize;
+    uint32_t sizeClass;
+
+    allocationSize = sizeof(*pFile) + payloadSize;
+    sizeClass = cyberfm_file_pool_get_size_class(allocationSize);
+
+    if (sizeClass == CYBERFM_FILE_POOL_SIZE_CLASS_COUNT) {
+        pFile = (cyberfm_file*)malloc(allocationSize);
+        CYBERFM_STATS_ADD(CYBERFM_STAT_ALLOCATIONS, 1);
+        CYBERFM_STATS_ADD(CYBERFM_STAT_BYTES_ALLOCATED, allocationSize);
+    } else {
+        cyberfm_mutex_lock(&pArchive->pool.lock);
+        {
+            cyberfm_pool_item* pItem = (cyberfm_pool_item*)pArchive->pool.pFreeFiles[sizeClass];
+            if (pItem != NULL) {
+                pArchive->pool.pFreeFiles[sizeClass] = pItem->pNext;
+                pArchive->pool.cachedSize -= (size_t)CYBERFM_FILE_POOL_MIN_SIZE << sizeClass;
+                pFile = (cyberfm_file*)pItem;
+            }
+        }
+        cyberfm_mutex_unlock(&pArchive->pool.lock);
+
+        if (pFile == NULL) {
+            pFile = (cyberfm_file*)malloc((size_t)CYBERFM_FILE_POOL_MIN_SIZE << sizeClass);
+            CYBERFM_STATS_ADD(CYBERFM_STAT_ALLOCATIONS, 1);
+            CYBERFM_STATS_ADD(CYBERFM_STAT_BYTES_ALLOCATED, (size_t)CYBERFM_FILE_POOL_MIN_SIZE << sizeClass);
+        }
+    }
+
+    if (pFile == NULL) {
+        return NULL;
+    }
+
+    CYBERFM_ZERO_OBJECT(pFile);
+    pFile->sizeClass = sizeClass;
+
+    return pFile;
+}
+
+static void cyberfm_archive_free_file(cyberfm_archive* pArchive, cyberfm_file* pFile)
+{
+    size_t allocationSize;
+
+    if (pFile->sizeClass == CYBERFM_FILE_POOL_SIZE_CLASS_COUNT) {
+        free(pFile);
+        return;
+    }
+
+    allocationSize = (size_t)CYBERFM_FILE_POOL_MIN_SIZE << pFile->sizeClass;
+
+    cyberfm_mutex_lock(&pArchive->pool.lock);
+    {
+        /* We don't want to hold on to an unbounded amount of memory. */
+        if (pArchive->pool.cachedSize + allocationSize <= CYBERFM_FILE_POOL_MAX_CACHED_SIZE) {
+            cyberfm_pool_item* pItem = (cyberfm_pool_item*)pFile;
+            uint32_t sizeClass = pFile->sizeClass;
+
+            pItem->pNext = (cyberfm_pool_item*)pArchive->pool.pFreeFiles[sizeClass];
+            pArchive->pool.pFreeFiles[sizeClass] = pItem;
+            pArchive->pool.cachedSize += allocationSize;
+            pFile = NULL;
+        }
+    }
+    cyberfm_mutex_unlock(&pArchive->pool.lock);
+
+    free(pFile);    /* Will be NULL if it was put back into the pool. */
+}
+
+/* Retrieves a scratch buffer of at least the given size. Return it with cyberfm_archive_release_scratch(). */
+static void* cyberfm_archive_acquire_scratch(cyberfm_archive* pArchive, size_t size)
+{
+    cyberfm_pool_item* pItem;
+
+    cyberfm_mutex_lock(&pArchive->pool.lock);
+    {
+        pItem = (cyberfm_pool_item*)pArchive->pool.pFreeScratch;
+        if (pItem != NULL) {
+            pArchive->pool.pFreeScratch = pItem->pNext;
+        }
+    }
+    cyberfm_mutex_unlock(&pArchive->pool.lock);
+
+    if (pItem == NULL || pItem->size < size) {
+        cyberfm_pool_item* pNewItem;
+        size_t newSize = (pItem != NULL) ? pItem->size : CYBERFM_FILE_POOL_MIN_SIZE;
+
+        while (newSize < size) {
+            newSize *= 2;
+        }
+
+        /* Don't need to use realloc() because we don't care about the existing content. */
+        free(pItem);
+        pNewItem = (cyberfm_pool_item*)malloc(sizeof(*pNewItem) + newSize);
+        if (pNewItem == NULL) {
+            return NULL;
+        }
+
+        CYBERFM_STATS_ADD(CYBERFM_STAT_ALLOCATIONS, 1);
+        CYBERFM_STATS_ADD(CYBERFM_STAT_BYTES_ALLOCATED, sizeof(*pNewItem) + newSize);
+
+        pItem = pNewItem;
+        pItem->size = newSize;
+    }
+
+    return pItem + 1;
+}
+
+static void cyberfm_archive_release_scratch(cyberfm_archive* pArchive, void* pScratch)
+{
+    cyberfm_pool_item* pItem;
+
+    if (pScratch == NULL) {
+        return;
+    }
+
+    pItem = ((cyberfm_pool_item*)pScratch) - 1;
+
+    /* Very large buffers are not kept around. */
+    if (pItem->size > CYBERFM_SCRATCH_MAX_CACHED_SIZE) {
+        free(pItem);
+        return;
+    }
+
+    cyberfm_mutex_lock(&pArchive->pool.lock);
+    {
+        pItem->pNext = (cyberfm_pool_item*)pArchive->pool.pFreeScratch;
+        pArchive->pool.pFreeScratch = pItem;
+    }
+    cyberfm_mutex_unlock(&pArchive->pool.lock);
+}
+
+static void cyberfm_archive_free_pools(cyberfm_archive* pArchive)
+{
+    uint32_t iSizeClass;
+    cyberfm_pool_item* pItem;
+
+    for (iSizeClass = 0; iSizeClass < CYBERFM_FILE_POOL_SIZE_CLASS_COUNT; iSizeClass += 1) {
+        pItem = (cyberfm_pool_item*)pArchive->pool.pFreeFiles[iSizeClass];
+        while (pItem != NULL) {
+            cyberfm_pool_item* pNext = pItem->pNext;
+            free(pItem);
+            pItem = pNext;
+        }
+    }
+
+    pItem = (cyberfm_pool_item*)pArchive->pool.pFreeScratch;
+    while (pItem != NULL) {
+        cyberfm_pool_item* pNext = pItem->pNext;
+        free(pItem);
+        pItem = pNext;
+    }
+}
+
+/*
+The cache of decoded sub-files. Everything here must be called while the cache lock is held.
+*/
+static void cyberfm_cache_unlink(cyberfm_archive* pArchive, cyberfm_cache_entry* pEntry)
+{
+    if (pEntry->pPrev != NULL) {
+        pEntry->pPrev->pNext = pEntry->pNext;
+    } else {
+        pArchive->cache.pHead = pEntry->pNext;
+    }
+
+    if (pEntry->pNext != NULL) {
+        pEntry->pNext->pPrev = pEntry->pPrev;
+    } else {
+        pArchive->cache.pTail = pEntry->pPrev;
+    }
+
+    pEntry->pPrev = NULL;
+    pEntry->pNext = NULL;
+}
+
+static void cyberfm_cache_link_at_head(cyberfm_archive* pArchive, cyberfm_cache_entry* pEntry)
+{
+    pEntry->pPrev = NULL;
+    pEntry->pNext = pArchive->cache.pHead;
+
+    if (pArchive->cache.pHead != NULL) {
+        pArchive->cache.pHead->pPrev = pEntry;
+    } else {
+        pArchive->cache.pTail = pEntry;
+    }
+
+    pArchive->cache.pHead = pEntry;
+}
+
+/* Evicts the least recently used entries that aren't in use until we're back within budget. */
+static void cyberfm_cache_evict(cyberfm_archive* pArchive)
+{
+    cyberfm_cache_entry* pEntry = pArchive->cache.pTail;
+
+    while (pEntry != NULL && pArchive->cache.sizeInBytes > pArchive->cache.capacityInBytes) {
+        cyberfm_cache_entry* pPrev = pEntry->pPrev;
+
+        if (pEntry->refCount == 0) {
+            cyberfm_cache_unlink(pArchive, pEntry);
+            pArchive->cache.ppEntries[pEntry->dataSpecIndex] = NULL;
+            pArchive->cache.sizeInBytes   -= pEntry->size;
+            pArchive->cache.entryCount    -= 1;
+            pArchive->cache.evictionCount += 1;
+            free(pEntry);
+        }
+
+        pEntry = pPrev;
+    }
+}
+
+/* Looks for an entry, and if found, adds a reference to it and makes it the most recently used. */
+static cyberfm_cache_entry* cyberfm_cache_acquire(cyberfm_archive* pArchive, uint32_t dataSpecIndex)
+{
+    cyberfm_cache_entry* pEntry = NULL;
+
+    if (pArchive->cache.ppEntries != NULL) {
+        pEntry = pArchive->cache.ppEntries[dataSpecIndex];
+    }
+
+    if (pEntry == NULL) {
+        pArchive->cache.missCount += 1;
+        return NULL;
+    }
+
+    pArchive->cache.hitCount += 1;
+    pEntry->refCount += 1;
+
+    if (pEntry != pArchive->cache.pHead) {
+        cyberfm_cache_unlink(pArchive, pEntry);
+        cyberfm_cache_link_at_head(pArchive, pEntry);
+    }
+
+    return pEntry;
+}
+
+/*
+Adds a newly decoded entry to the cache with a single reference. Another thread might have added the same entry while we
+were decoding ours, in which case our entry is freed and the existing one is returned instead.
+*/
+static cyberfm_cache_entry* cyberfm_cache_insert(cyberfm_archive* pArchive, cyberfm_cache_entry* pEntry)
+{
+    if (pArchive->cache.ppEntries == NULL) {
+        pArchive->cache.ppEntries = (cyberfm_cache_entry**)calloc(pArchive->pCentralDirectory->fileDataSpecCount, sizeof(*pArchive->cache.ppEntries));
+    }
+
+    pEntry->pPrev      = NULL;
+    pEntry->pNext      = NULL;
+    pEntry->refCount   = 1;
+    pEntry->isResident = CYBERFM_FALSE;
+
+    if (pArchive->cache.ppEntries == NULL) {
+        return pEntry;  /* Out of memory. The entry will just be freed when it's no longer referenced. */
+    }
+
+    if (pArchive->cache.ppEntries[pEntry->dataSpecIndex] != NULL) {
+        cyberfm_cache_entry* pExistingEntry = pArchive->cache.ppEntries[pEntry->dataSpecIndex];
+
+        free(pEntry);
+        pExistingEntry->refCount += 1;
+
+        return pExistingEntry;
+    }
+
+    pEntry->isResident = CYBERFM_TRUE;
+    pArchive->cache.ppEntries[pEntry->dataSpecIndex] = pEntry;
+    pArchive->cache.sizeInBytes += pEntry->size;
+    pArchive->cache.entryCount  += 1;
+    cyberfm_cache_link_at_head(pArchive, pEntry);
+
+    cyberfm_cache_evict(pArchive);
+
+    return pEntry;
+}
+
+static void cyberfm_cache_release(cyberfm_archive* pArchive, cyberfm_cache_entry* pEntry)
+{
+    pEntry->refCount -= 1;
+
+    if (!pEntry->isResident) {
+        if (pEntry->refCount == 0) {
+            free(pEntry);
+        }
+    } else {
+        /* We may have gone over budget while this entry was in use. */
+        cyberfm_cache_evict(pArchive);
+    }
+}
+
+static void cyberfm_cache_free_entries(cyberfm_archive* pArchive)
+{
+    cyberfm_cache_entry* pEntry = pArchive->cache.pHead;
+
+    while (pEntry != NULL) {
+        cyberfm_cache_entry* pNext = pEntry->pNext;
+        free(pEntry);
+        pEntry = pNext;
+    }
+
+    free(pArchive->cache.ppEntries);
+}
+
+/*
+A cached central directory is only used if the archive looks like it hasn't changed since the cache was created. We check
+the size and modified time of the file, and the checksum-like value in the header of the central directory.
+*/
+static cyberfm_bool32 cyberfm_archive_is_cached_central_directory_valid(cyberfm_archive* pArchive, const cyberfm_archive_config* pConfig)
+{
+    uint8_t unknown0[8];
+
+    if (pConfig->cachedCentralDirectory.pData == NULL || pConfig->cachedCentralDirectory.size < CYBERFM_CENTRAL_DIRECTORY_HEADER_SIZE) {
+        return CYBERFM_FALSE;
+    }
+
+    if (pConfig->cachedCentralDirectory.archiveFileSize != pArchive->fileSize || pConfig->cachedCentralDirectory.archiveModifiedTime != pArchive->fileModifiedTime) {
+        return CYBERFM_FALSE;
+    }
+
+    if (cyberfm_archive_read_at(pArchive, pArchive->centralDirOffset + 8, unknown0, sizeof(unknown0)) != CYBERFM_SUCCESS) {
+        return CYBERFM_FALSE;
+    }
+
+    if (memcmp(unknown0, CYBERFM_OFFSET_PTR(pConfig->cachedCentralDirectory.pData, 8), 8) != 0) {
+        return CYBERFM_FALSE;
+    }
+
+    return CYBERFM_TRUE;
+}
+
+cyberfm_archive_config cyberfm_archive_config_init(uint32_t flags)
+{
+    cyberfm_archive_config config;
+
+    CYBERFM_ZERO_OBJECT(&config);
+    config.flags = flags;
+
+    return config;
+}
+
+static cyberfm_result cyberfm_archive_init_ex_impl(const char* pFilePath, const cyberfm_archive_config* pConfig, cyberfm_archive* pArchive)
+{
+    cyberfm_result result;
+    struct _stat64 info;
+    uint8_t header[CYBERFM_ARCHIVE_HEADER_SIZE];
+    size_t iOodleSOName;
+
+    if (pArchive == NULL) {
+        return CYBERFM_INVALID_ARGS;
+    }
+
+    CYBERFM_ZERO_OBJECT(pArchive);
+
+    if (pFilePath == NULL) {
+        return CYBERFM_INVALID_ARGS;
+    }
+
+    pArchive->io.queueDepth = CYBERFM_DEFAULT_IO_QUEUE_DEPTH;
+
+    if (pConfig != NULL) {
+        pArchive->flags = pConfig->flags;
+        pArchive->cache.capacityInBytes = pConfig->cacheSizeInBytes;
+
+        if (pConfig->ioQueueDepth > 0) {
+            pArchive->io.queueDepth = pConfig->ioQueueDepth;
+        }
+    }
+
+    result = cyberfm_mutex_init(&pArchive->deferred.lock);
+    if (result != CYBERFM_SUCCESS) {
+        return result;
+    }
+
+    result = cyberfm_mutex_init(&pArchive->pool.lock);
+    if (result != CYBERFM_SUCCESS) {
+        cyberfm_mutex_uninit(&pArchive->deferred.lock);
+        return result;
+    }
+
+    result = cyberfm_mutex_init(&pArchive->cache.lock);
+    if (result != CYBERFM_SUCCESS) {
+        cyberfm_mutex_uninit(&pArchive->pool.lock);
+        cyberfm_mutex_uninit(&pArchive->deferred.lock);
+        return result;
+    }
+
+    /*
+    Try loading Oodle. It's not a critical error if this is not avaiable, but files compressed with Oodle won't
+    be able to be opened.
+    */
+    for (iOodleSOName = 0; iOodleSOName < sizeof(g_cyberfmOodleSONames)/sizeof(g_cyberfmOodleSONames[0]); iOodleSOName += 1) {
+        pArchive->oodle.hOodle = cyberfm_dlopen(g_cyberfmOodleSONames[iOodleSOName]);
+        if (pArchive->oodle.hOodle != NULL) {
+            pArchive->oodle.OodleLZ_Decompress = (cyberfm_OodleLZ_Decompress_proc)cyberfm_dlsym(pArchive->oodle.hOodle, "OodleLZ_Decompress");
+            if (pArchive->oodle.OodleLZ_Decompress != NULL) {
+                /* Everything looks good. */
+                break;
+            } else {
+                /* The shared object is avaialable, but not the function. Keep trying. */
+                cyberfm_dlclose(pArchive->oodle.hOodle);
+                pArchive->oodle.hOodle = NULL;
+            }
+        }
+    }
+
+    /* Custom codecs first so they can override the built-in ones. */
+    if (pConfig != NULL && pConfig->ppCodecs != NULL) {
+        uint32_t iCodec;
+        for (iCodec = 0; iCodec < pConfig->codecCount && pArchive->codecs.count < CYBERFM_MAX_CODEC_COUNT - 2; iCodec += 1) {
+            if (pConfig->ppCodecs[iCodec] != NULL && pConfig->ppCodecs[iCodec]->onProbe != NULL && pConfig->ppCodecs[iCodec]->onDecompress != NULL) {
+                pArchive->codecs.pCodecs[pArchive->codecs.count++] = pConfig->ppCodecs[iCodec];
+            }
+        }
+    }
+
+    if (pArchive->oodle.hOodle != NULL) {
+        pArchive->oodle.codec.pName              = "Oodle";
+        pArchive->oodle.codec.pUserData          = pArchive;
+        pArchive->oodle.codec.onProbe            = cyberfm_oodle_codec_probe;
+        pArchive->oodle.codec.onDecompress       = cyberfm_oodle_codec_decompress;
+        pArchive->oodle.codec.onDecompressBatch  = NULL;
+        pArchive->oodle.codec.onCompress         = NULL;
+        pArchive->oodle.codec.onDecompressPrefix = NULL;
+        pArchive->codecs.pCodecs[pArchive->codecs.count++] = &pArchive->oodle.codec;
+    }
+
+    pArchive->codecs.pCodecs[pArchive->codecs.count++] = &g_cyberfmCodecCFLZ;
+    
+
+    /* The file needs to be left open so we can extract data later. */
+    result = cyberfm_result_from_minifs(mfs_fopen(&pArchive->pFile, pFilePath, "rb"));
+    if (result != CYBERFM_SUCCESS) {
+        goto error0;
+    }
+
+    result = cyberfm_result_from_minifs(mfs_fstat(pArchive->pFile, &info));
+    if (result != CYBERFM_SUCCESS) {
+        goto error1;
+    }
+
+    pArchive->fileSize         = (uint64_t)info.st_size;
+    pArchive->fileModifiedTime = (int64_t)info.st_mtime;
+
+    /*
+    When memory mapping we can reference the central directory straight out of the mapping. If we fail to map the file it's
+    not a critical error - we'll just fall back to the normal file reading path.
+    */
+    if ((pArchive->flags & CYBERFM_ARCHIVE_FLAG_MEMORY_MAP) != 0) {
+        if (cyberfm_archive_map(pArchive, pArchive->pFile, pArchive->fileSize) != CYBERFM_SUCCESS) {
+            pArchive->flags &= ~CYBERFM_ARCHIVE_FLAG_MEMORY_MAP;
+        }
+    }
+
+    /* The header is read in one go and then decoded. Not going to bother reading the padding. */
+    result = cyberfm_archive_read_at(pArchive, 0, header, sizeof(header));
+    if (result != CYBERFM_SUCCESS) {
+        goto error1;
+    }
+
+    result = cyberfm_archive_decode_header(pArchive, header);
+    if (result != CYBERFM_SUCCESS) {
+        goto error1;
+    }
+
+    /*
+    Now we can load the central directory. If we've been given a cached copy we can use that instead of reading it from the
+    archive. Getting a failure when loading from the cache means it's corrupt, in which case we just fall back to the archive.
+    */
+    result = CYBERFM_ERROR;
+
+    if (pConfig != NULL && cyberfm_archive_is_cached_central_directory_valid(pArchive, pConfig)) {
+        result = cyberfm_archive_load_central_directory_from_memory(pArchive, (const uint8_t*)pConfig->cachedCentralDirectory.pData, pConfig->cachedCentralDirectory.size);
+        if (result == CYBERFM_SUCCESS) {
+            pArchive->isCentralDirectoryCached = CYBERFM_TRUE;
+        }
+    }
+
+    if (result != CYBERFM_SUCCESS) {
+        if (pArchive->map.pData != NULL) {
+            result = cyberfm_archive_load_central_directory_from_memory(pArchive, pArchive->map.pData + pArchive->centralDirOffset, pArchive->centralDirSize);
+        } else {
+            result = cyberfm_archive_load_central_directory_from_file(pArchive);
+        }
+    }
+
+    if (result != CYBERFM_SUCCESS) {
+        goto error1;
+    }
+
+    cyberfm_archive_build_lookup(pArchive);
+
+    return CYBERFM_SUCCESS;
+
+error1: cyberfm_archive_unmap(pArchive);
+        mfs_fclose(pArchive->pFile);
+        pArchive->pFile = NULL;
+error0: if (pArchive->oodle.hOodle != NULL) {
+            cyberfm_dlclose(pArchive->oodle.hOodle);
+        }
+        cyberfm_mutex_uninit(&pArchive->cache.lock);
+        cyberfm_mutex_uninit(&pArchive->pool.lock);
+        cyberfm_mutex_uninit(&pArchive->deferred.lock);
+        return result;
+}
+
+cyberfm_result cyberfm_archive_init_ex(const char* pFilePath, const cyberfm_archive_config* pConfig, cyberfm_archive* pArchive)
+{
+    cyberfm_result result;
+    CYBERFM_STATS_DECLARE_TIMER(startTime)
+
+    CYBERFM_STATS_BEGIN_TIMER(startTime);
+    result = cyberfm_archive_init_ex_impl(pFilePath, pConfig, pArchive);
+    CYBERFM_STATS_END_TIMER(CYBERFM_STAT_TIMER_ARCHIVE_INIT, startTime);
+
+    return result;
+}
+
+cyberfm_result cyberfm_archive_init(const char* pFilePath, cyberfm_archive* pArchive)
+{
+    return cyberfm_archive_init_ex(pFilePath, NULL, pArchive);
+}
+
+void cyberfm_archive_uninit(cyberfm_archive* pArchive)
+{
+    if (pArchive == NULL) {
+        return;
+    }
+
+    free(pArchive->lookup.pAllocation);
+    free(pArchive->deferred.pUnknownDataAllocation);
+    free(pArchive->pCentralDirectory);
+    cyberfm_cache_free_entries(pArchive);
+    cyberfm_archive_free_pools(pArchive);
+    cyberfm_archive_free_rings(pArchive);
+    cyberfm_archive_unmap(pArchive);
+    mfs_fclose(pArchive->pFile);
+
+    if (pArchive->oodle.hOodle != NULL) {
+        cyberfm_dlclose(pArchive->oodle.hOodle);
+    }
+
+    cyberfm_mutex_uninit(&pArchive->cache.lock);
+    cyberfm_mutex_uninit(&pArchive->pool.lock);
+    cyberfm_mutex_uninit(&pArchive->deferred.lock);
+}
+
+cyberfm_result cyberfm_archive_get_cache_stats(cyberfm_archive* pArchive, cyberfm_cache_stats* pStats)
+{
+    if (pStats == NULL) {
+        return CYBERFM_INVALID_ARGS;
+    }
+
+    CYBERFM_ZERO_OBJECT(pStats);
+
+    if (pArchive == NULL) {
+        return CYBERFM_INVALID_ARGS;
+    }
+
+    cyberfm_mutex_lock(&pArchive->cache.lock);
+    {
+        pStats->hitCount        = pArchive->cache.hitCount;
+        pStats->missCount       = pArchive->cache.missCount;
+        pStats->evictionCount   = pArchive->cache.evictionCount;
+        pStats->entryCount      = pArchive->cache.entryCount;
+        pStats->sizeInBytes     = pArchive->cache.sizeInBytes;
+        pStats->capacityInBytes = pArchive->cache.capacityInBytes;
+    }
+    cyberfm_mutex_unlock(&pArchive->cache.lock);
+
+    return CYBERFM_SUCCESS;
+}
+
+cyberfm_result cyberfm_archive_get_unknown_data(cyberfm_archive* pArchive, const cyberfm_archive_central_directory_unknown_data** ppUnknownData)
+{
+    cyberfm_result result = CYBERFM_SUCCESS;
+
+    if (ppUnknownData == NULL) {
+        return CYBERFM_INVALID_ARGS;
+    }
+
+    *ppUnknownData = NULL;
+
+    if (pArchive == NULL) {
+        return CYBERFM_INVALID_ARGS;
+    }
+
+    /* Fast path for when it's already been loaded. */
+    if (cyberfm_atomic_load_32(&pArchive->deferred.isUnknownDataLoaded)) {
+        *ppUnknownData = pArchive->pCentralDirectory->pUnknownData;
+        return CYBERFM_SUCCESS;
+    }
+
+    cyberfm_mutex_lock(&pArchive->deferred.lock);
+    {
+        /* Need to check again now that we're inside the lock because another thread might have beaten us to it. */
+        if (!cyberfm_atomic_load_32(&pArchive->deferred.isUnknownDataLoaded)) {
+            uint64_t unknownDataOffset;
+            size_t unknownDataChunkSize;
+            void* pUnknownData = NULL;
+
+            unknownDataOffset    = pArchive->centralDirOffset + CYBERFM_CENTRAL_DIRECTORY_HEADER_SIZE + ((uint64_t)pArchive->pCentralDirectory->fileInfoCount * 56) + ((uint64_t)pArchive->pCentralDirectory->fileDataSpecCount * 16);
+            unknownDataChunkSize = (size_t)pArchive->pCentralDirectory->unknownDataCount * 8;
+
+            if (unknownDataChunkSize > 0) {
+                pUnknownData = malloc(unknownDataChunkSize);
+                if (pUnknownData == NULL) {
+                    result = CYBERFM_OUT_OF_MEMORY;
+                } else {
+                    result = cyberfm_archive_read_at(pArchive, unknownDataOffset, pUnknownData, unknownDataChunkSize);
+                    if (result != CYBERFM_SUCCESS) {
+                        free(pUnknownData);
+                        pUnknownData = NULL;
+                    } else {
+                        cyberfm_le64_array_to_native(pUnknownData, pArchive->pCentralDirectory->unknownDataCount);
+                    }
+                }
+            }
+
+            if (result == CYBERFM_SUCCESS) {
+                pArchive->deferred.pUnknownDataAllocation = pUnknownData;
+                pArchive->pCentralDirectory->pUnknownData = (cyberfm_archive_central_directory_unknown_data*)pUnknownData;
+                cyberfm_atomic_store_32(&pArchive->deferred.isUnknownDataLoaded, CYBERFM_TRUE);
+            }
+        }
+
+        if (result == CYBERFM_SUCCESS) {
+            *ppUnknownData = pArchive->pCentralDirectory->pUnknownData;
+        }
+    }
+    cyberfm_mutex_unlock(&pArchive->deferred.lock);
+
+    return result;
+}
+
+cyberfm_result cyberfm_archive_find(cyberfm_archive* pArchive, uint64_t hashedName, uint32_t* pFileIndex)
+{
+    uint32_t iFile;
+
+    if (pArchive == NULL || pFileIndex == NULL) {
+        return CYBERFM_INVALID_ARGS;
+    }
+
+    CYBERFM_STATS_ADD(CYBERFM_STAT_LOOKUPS, 1);
+
+    if (pArchive->lookup.pHashes != NULL) {
+        const uint64_t* pHashes = pArchive->lookup.pHashes;
+        uint32_t count = pArchive->lookup.count;
+        uint32_t k = 1;
+
+        /*
+        Branchless descent down the Eytzinger tree. The 8 descendants three levels down are stored in a single cache
+        line so we can prefetch that ahead of time which hides most of the latency of the deeper levels.
+        */
+        while (k <= count) {
+        #if defined(__GNUC__) || defined(__clang__)
+            __builtin_prefetch(pHashes + ((size_t)k * 8));
+        #endif
+            k = (2 * k) + (pHashes[k] < hashedName);
+        }
+
+    #ifdef CYBERFM_ENABLE_STATS
+        {
+            /* Each level of the tree adds a bit to k so the number of probes is the position of it's highest bit. */
+            uint32_t probeCount = 0;
+            uint32_t kRemaining = k;
+
+            while (kRemaining > 1) {
+                kRemaining >>= 1;
+                probeCount  += 1;
+            }
+
+            CYBERFM_STATS_ADD(CYBERFM_STAT_LOOKUP_PROBES, probeCount);
+        }
+    #endif
+
+        /* k has gone past a leaf. Undoing the trailing right turns (and the final left turn) gives us the lower bound. */
+        k >>= cyberfm_ctz32(~k) + 1;
+
+        if (k != 0 && pHashes[k] == hashedName) {
+            *pFileIndex = pArchive->lookup.pFileIndices[k];
+            return CYBERFM_SUCCESS;
+        }
+
+        return CYBERFM_ERROR;   /* Not found. */
+    }
+
+    /* Getting here means we don't have a lookup table. Fall back to a linear search. */
+    for (iFile = 0; iFile < pArchive->pCentralDirectory->fileInfoCount; iFile += 1) {
+        if (pArchive->pCentralDirectory->pFileInfo[iFile].hashedName == hashedName) {
+            CYBERFM_STATS_ADD(CYBERFM_STAT_LOOKUP_PROBES, iFile + 1);
+            *pFileIndex = iFile;
+            return CYBERFM_SUCCESS;
+        }
+    }
+
+    CYBERFM_STATS_ADD(CYBERFM_STAT_LOOKUP_PROBES, iFile);
+
+    /* Getting here means the file could not be found. */
+    return CYBERFM_ERROR;
+}
+
+
+static cyberfm_result cyberfm_archive_get_data_spec_index(cyberfm_archive* pArchive, uint32_t index, uint32_t subfile, uint32_t* pDataSpecIndex)
+{
+    const cyberfm_archive_file_info* pFileInfo;
+
+    if (index >= pArchive->pCentralDirectory->fileInfoCount) {
+        return CYBERFM_INVALID_ARGS;
+    }
+
+    pFileInfo = &pArchive->pCentralDirectory->pFileInfo[index];
+
+    /* The sub-file needs to be within range. */
+    if (subfile >= (pFileInfo->dataSpecRangeEnd - pFileInfo->dataSpecRangeBeg)) {
+        return CYBERFM_INVALID_ARGS;    /* The sub-file is invalid. */
+    }
+
+    if ((pFileInfo->dataSpecRangeBeg + subfile) >= pArchive->pCentralDirectory->fileDataSpecCount) {
+        return CYBERFM_ERROR;   /* The central directory is corrupt. */
+    }
+
+    *pDataSpecIndex = pFileInfo->dataSpecRangeBeg + subfile;
+
+    return CYBERFM_SUCCESS;
+}
+
+void cyberfm_file_info_get_hash(const cyberfm_archive_file_info* pFileInfo, uint8_t* pHash)
+{
+    uint32_t iWord;
+
+    /* The words have been converted to native byte order so we can't just copy the bytes. */
+    for (iWord = 0; iWord < 5; iWord += 1) {
+        pHash[iWord*4 + 0] = (uint8_t)((pFileInfo->hash[iWord] >>  0) & 0xFF);
+        pHash[iWord*4 + 1] = (uint8_t)((pFileInfo->hash[iWord] >>  8) & 0xFF);
+        pHash[iWord*4 + 2] = (uint8_t)((pFileInfo->hash[iWord] >> 16) & 0xFF);
+        pHash[iWord*4 + 3] = (uint8_t)((pFileInfo->hash[iWord] >> 24) & 0xFF);
+    }
+}
+
+static const uint8_t* cyberfm_archive_get_mapped_data(cyberfm_archive* pArchive, uint64_t offset, uint64_t size)
+{
+    if (pArchive->map.pData == NULL) {
+        return NULL;
+    }
+
+    if (offset > pArchive->map.size || size > (pArchive->map.size - offset)) {
+        return NULL;    /* Out of bounds. */
+    }
+
+    return pArchive->map.pData + offset;
+}
+
+cyberfm_result cyberfm_archive_get_file_view_by_index(cyberfm_archive* pArchive, uint32_t index, uint32_t subfile, const void** ppData, size_t* pDataSize)
+{
+    cyberfm_result result;
+    uint32_t iDataSpec;
+    const cyberfm_archive_file_data_spec* pDataSpec;
+    const uint8_t* pData;
+
+    if (ppData == NULL || pDataSize == NULL) {
+        return CYBERFM_INVALID_ARGS;
+    }
+
+    *ppData    = NULL;
+    *pDataSize = 0;
+
+    if (pArchive == NULL) {
+        return CYBERFM_INVALID_ARGS;
+    }
+
+    result = cyberfm_archive_get_data_spec_index(pArchive, index, subfile, &iDataSpec);
+    if (result != CYBERFM_SUCCESS) {
+        return result;
+    }
+
+    pDataSpec = &pArchive->pCentralDirectory->pFileDataSpec[iDataSpec];
+    if (pDataSpec->compressedSize != pDataSpec->uncompressedSize) {
+        return CYBERFM_INVALID_OPERATION;   /* Compressed data can't be viewed directly. */
+    }
+
+    if (pArchive->map.pData == NULL) {
+        return CYBERFM_INVALID_OPERATION;   /* Not memory mapped. */
+    }
+
+    pData = cyberfm_archive_get_mapped_data(pArchive, pDataSpec->offset, pDataSpec->uncompressedSize);
+    if (pData == NULL) {
+        return CYBERFM_ERROR;   /* The data spec points outside of the archive. */
+    }
+
+    *ppData    = pData;
+    *pDataSize = pDataSpec->uncompressedSize;
+
+    return CYBERFM_SUCCESS;
+}
+
+/*
+Decompresses a sub-file into pDst which must be at least uncompressedSize bytes. The compressed data is decoded straight out
+of the mapping when the archive is mapped. Otherwise it's read into a scratch buffer from the archive's pool first.
+*/
+static cyberfm_result cyberfm_archive_decompress(cyberfm_archive* pArchive, const cyberfm_archive_file_data_spec* pDataSpec, void* pDst)
+{
+    cyberfm_result result;
+    const cyberfm_codec* pCodec;
+    const uint8_t* pMappedData;
+    void* pCompressedData;
+
+    pMappedData = cyberfm_archive_get_mapped_data(pArchive, pDataSpec->offset, pDataSpec->compressedSize);
+    if (pMappedData != NULL) {
+        pCompressedData = (void*)pMappedData;
+    } else {
+        pCompressedData = cyberfm_archive_acquire_scratch(pArchive, pDataSpec->compressedSize);
+        if (pCompressedData == NULL) {
+            return CYBERFM_OUT_OF_MEMORY;
+        }
+
+        result = cyberfm_archive_read_at(pArchive, pDataSpec->offset, pCompressedData, pDataSpec->compressedSize);
+        if (result != CYBERFM_SUCCESS) {
+            cyberfm_archive_release_scratch(pArchive, pCompressedData);
+            return result;
+        }
+    }
+
+    pCodec = cyberfm_archive_find_codec(pArchive, pCompressedData, pDataSpec->compressedSize);
+    if (pCodec != NULL) {
+        CYBERFM_STATS_DECLARE_TIMER(startTime)
+
+        CYBERFM_STATS_BEGIN_TIMER(startTime);
+        result = pCodec->onDecompress(pCodec->pUserData, pCompressedData, pDataSpec->compressedSize, pDst, pDataSpec->uncompressedSize);
+        CYBERFM_STATS_END_TIMER(CYBERFM_STAT_TIMER_DECOMPRESS, startTime);
+
+        if (result == CYBERFM_SUCCESS) {
+            CYBERFM_STATS_ADD(CYBERFM_STAT_BYTES_DECOMPRESSED, pDataSpec->uncompressedSize);
+        }
+    } else {
+        result = CYBERFM_INVALID_OPERATION;     /* Don't have a codec for this block. Oodle probably isn't available. */
+    }
+
+    if (pCompressedData != pMappedData) {
+        cyberfm_archive_release_scratch(pArchive, pCompressedData);
+    }
+
+    return result;
+}
+
+cyberfm_result cyberfm_archive_read_file_by_index(cyberfm_archive* pArchive, uint32_t index, uint32_t subfile, void* pDst, size_t dstCap, size_t* pSize)
+{
+    cyberfm_result result;
+    uint32_t iDataSpec;
+    const cyberfm_archive_file_data_spec* pDataSpec;
+
+    if (pSize == NULL) {
+        return CYBERFM_INVALID_ARGS;
+    }
+
+    *pSize = 0;
+
+    if (pArchive == NULL) {
+        return CYBERFM_INVALID_ARGS;
+    }
+
+    result = cyberfm_archive_get_data_spec_index(pArchive, index, subfile, &iDataSpec);
+    if (result != CYBERFM_SUCCESS) {
+        return result;
+    }
+
+    pDataSpec = &pArchive->pCentralDirectory->pFileDataSpec[iDataSpec];
+
+    /* The size is always reported, even when the buffer is too small, so the caller knows how much to allocate. */
+    *pSize = pDataSpec->uncompressedSize;
+
+    if (pDst == NULL) {
+        return CYBERFM_SUCCESS; /* Just querying the size. */
+    }
+
+    if (dstCap < pDataSpec->uncompressedSize) {
+        return CYBERFM_OUT_OF_RANGE;
+    }
+
+    if (pDataSpec->compressedSize != pDataSpec->uncompressedSize) {
+        return cyberfm_archive_decompress(pArchive, pDataSpec, pDst);
+    } else {
+        return cyberfm_archive_read_at(pArchive, pDataSpec->offset, pDst, pDataSpec->uncompressedSize);
+    }
+}
+
+cyberfm_result cyberfm_archive_read_file(cyberfm_archive* pArchive, uint64_t hashedName, uint32_t subfile, void* pDst, size_t dstCap, size_t* pSize)
+{
+    cyberfm_result result;
+    uint32_t iFile;
+
+    if (pSize == NULL) {
+        return CYBERFM_INVALID_ARGS;
+    }
+
+    *pSize = 0;
+
+    if (pArchive == NULL) {
+        return CYBERFM_INVALID_ARGS;
+    }
+
+    result = cyberfm_archive_find(pArchive, hashedName, &iFile);
+    if (result != CYBERFM_SUCCESS) {
+        return result;
+    }
+
+    return cyberfm_archive_read_file_by_index(pArchive, iFile, subfile, pDst, dstCap, pSize);
+}
+
+
+/*
+When peeking at a compressed sub-file in an archive that isn't mapped, only this much of the block is read to begin with.
+That's plenty for the reference codec to get the first few bytes out. If it's not enough, the whole block is read.
+*/
+#define CYBERFM_PEEK_READ_SIZE  4096
+
+/*
+Decodes the first dstSize bytes of a sub-file. availableSize can be less than the compressed size, in which case the codec
+needs to be able to stop early or else this fails with CYBERFM_OUT_OF_RANGE.
+*/
+static cyberfm_result cyberfm_archive_decompress_prefix(cyberfm_archive* pArchive, const cyberfm_archive_file_data_spec* pDataSpec, const void* pCompressedData, size_t availableSize, void* pDst, size_t dstSize)
+{
+    cyberfm_result result;
+    const cyberfm_codec* pCodec;
+    void* pDecompressedData;
+    CYBERFM_STATS_DECLARE_TIMER(startTime)
+
+    pCodec = cyberfm_archive_find_codec(pArchive, pCompressedData, availableSize);
+    if (pCodec == NULL) {
+        return CYBERFM_INVALID_OPERATION;   /* Don't have a codec for this block. Oodle probably isn't available. */
+    }
+
+    if (pCodec->onDecompressPrefix != NULL) {
+        CYBERFM_STATS_BEGIN_TIMER(startTime);
+        result = pCodec->onDecompressPrefix(pCodec->pUserData, pCompressedData, availableSize, pDst, dstSize);
+        CYBERFM_STATS_END_TIMER(CYBERFM_STAT_TIMER_DECOMPRESS, startTime);
+
+        if (result == CYBERFM_SUCCESS) {
+            CYBERFM_STATS_ADD(CYBERFM_STAT_BYTES_DECOMPRESSED, dstSize);
+        }
+
+        return result;
+    }
+
+    /* The codec can't stop early so the whole block needs to be decompressed. */
+    if (availableSize < pDataSpec->compressedSize) {
+        return CYBERFM_OUT_OF_RANGE;
+    }
+
+    if (dstSize == pDataSpec->uncompressedSize) {
+        pDecompressedData = pDst;
+    } else {
+        pDecompressedData = cyberfm_archive_acquire_scratch(pArchive, pDataSpec->uncompressedSize);
+        if (pDecompressedData == NULL) {
+            return CYBERFM_OUT_OF_MEMORY;
+        }
+    }
+
+    CYBERFM_STATS_BEGIN_TIMER(startTime);
+    result = pCodec->onDecompress(pCodec->pUserData, pCompressedData, pDataSpec->compressedSize, pDecompressedData, pDataSpec->uncompressedSize);
+    CYBERFM_STATS_END_TIMER(CYBERFM_STAT_TIMER_DECOMPRESS, startTime);
+
+    if (result == CYBERFM_SUCCESS) {
+        CYBERFM_STATS_ADD(CYBERFM_STAT_BYTES_DECOMPRESSED, pDataSpec->uncompressedSize);
+    }
+
+    if (pDecompressedData != pDst) {
+        if (result == CYBERFM_SUCCESS) {
+            memcpy(pDst, pDecompressedData, dstSize);
+        }
+
+        cyberfm_archive_release_scratch(pArchive, pDecompressedData);
+    }
+
+    return result;
+}
+
+static cyberfm_result cyberfm_archive_peek_data_spec(cyberfm_archive* pArchive, const cyberfm_archive_file_data_spec* pDataSpec, void* pDst, size_t dstCap, size_t* pSize)
+{
+    cyberfm_result result;
+    const uint8_t* pMappedData;
+    void* pCompressedData;
+    size_t bytesToOutput;
+    size_t bytesToRead;
+
+    *pSize = 0;
+
+    bytesToOutput = (size_t)CYBERFM_MIN(dstCap, pDataSpec->uncompressedSize);
+
+    if (bytesToOutput == 0) {
+        return CYBERFM_SUCCESS;
+    }
+
+    /* Stored sub-files are just a straight read. */
+    if (pDataSpec->compressedSize == pDataSpec->uncompressedSize) {
+        pMappedData = cyberfm_archive_get_mapped_data(pArchive, pDataSpec->offset, bytesToOutput);
+        if (pMappedData != NULL) {
+            memcpy(pDst, pMappedData, bytesToOutput);
+        } else {
+            result = cyberfm_archive_read_at(pArchive, pDataSpec->offset, pDst, bytesToOutput);
+            if (result != CYBERFM_SUCCESS) {
+                return result;
+            }
+        }
+
+        *pSize = bytesToOutput;
+        return CYBERFM_SUCCESS;
+    }
+
+    /* When the archive is mapped, only the pages the codec actually touches will be read in. */
+    pMappedData = cyberfm_archive_get_mapped_data(pArchive, pDataSpec->offset, pDataSpec->compressedSize);
+    if (pMappedData != NULL) {
+        result = cyberfm_archive_decompress_prefix(pArchive, pDataSpec, pMappedData, pDataSpec->compressedSize, pDst, bytesToOutput);
+        if (result == CYBERFM_SUCCESS) {
+            *pSize = bytesToOutput;
+        }
+
+        return result;
+    }
+
+    /* Not mapped. Try with the start of the block first, and then fall back to the whole block. */
+    bytesToRead = (size_t)CYBERFM_MIN(pDataSpec->compressedSize, CYBERFM_PEEK_READ_SIZE);
+
+    for (;;) {
+        pCompressedData = cyberfm_archive_acquire_scratch(pArchive, bytesToRead);
+        if (pCompressedData == NULL) {
+            return CYBERFM_OUT_OF_MEMORY;
+        }
+
+        result = cyberfm_archive_read_at(pArchive, pDataSpec->offset, pCompressedData, bytesToRead);
+        if (result == CYBERFM_SUCCESS) {
+            result = cyberfm_archive_decompress_prefix(pArchive, pDataSpec, pCompressedData, bytesToRead, pDst, bytesToOutput);
+        }
+
+        cyberfm_archive_release_scratch(pArchive, pCompressedData);
+
+        if (result == CYBERFM_SUCCESS || result == CYBERFM_INVALID_OPERATION || bytesToRead == pDataSpec->compressedSize) {
+            break;
+        }
+
+        bytesToRead = pDataSpec->compressedSize;
+    }
+
+    if (result == CYBERFM_SUCCESS) {
+        *pSize = bytesToOutput;
+    }
+
+    return result;
+}
+
+cyberfm_result cyberfm_archive_peek_file_by_index(cyberfm_archive* pArchive, uint32_t index, uint32_t subfile, void* pDst, size_t dstCap, size_t* pSize)
+{
+    cyberfm_result result;
+    uint32_t iDataSpec;
+
+    if (pSize == NULL) {
+        return CYBERFM_INVALID_ARGS;
+    }
+
+    *pSize = 0;
+
+    if (pArchive == NULL || (pDst == NULL && dstCap > 0)) {
+        return CYBERFM_INVALID_ARGS;
+    }
+
+    result = cyberfm_archive_get_data_spec_index(pArchive, index, subfile, &iDataSpec);
+    if (result != CYBERFM_SUCCESS) {
+        return result;
+    }
+
+    return cyberfm_archive_peek_data_spec(pArchive, &pArchive->pCentralDirectory->pFileDataSpec[iDataSpec], pDst, dstCap, pSize);
+}
+
+
+#define CYBERFM_VERIFY_CHUNK_SIZE   (1024 * 1024)   /* Data that doesn't need decompressing is hashed in chunks of this size when it's not mapped. */
+
+/* Hashes data straight out of the archive. This is either the raw data of a compressed sub-file, or an uncompressed sub-file. */
+static cyberfm_result cyberfm_archive_hash_range(cyberfm_archive* pArchive, uint64_t offset, size_t size, cyberfm_sha1* pSHA1)
+{
+    cyberfm_result result = CYBERFM_SUCCESS;
+    const uint8_t* pMappedData;
+    void* pChunk;
+    size_t totalBytesRead = 0;
+
+    if (size == 0) {
+        return CYBERFM_SUCCESS;
+    }
+
+    pMappedData = cyberfm_archive_get_mapped_data(pArchive, offset, size);
+    if (pMappedData != NULL) {
+        cyberfm_sha1_update(pSHA1, pMappedData, size);
+        return CYBERFM_SUCCESS;
+    }
+
+    pChunk = cyberfm_archive_acquire_scratch(pArchive, CYBERFM_MIN(size, CYBERFM_VERIFY_CHUNK_SIZE));
+    if (pChunk == NULL) {
+        return CYBERFM_OUT_OF_MEMORY;
+    }
+
+    while (totalBytesRead < size) {
+        size_t bytesToRead = CYBERFM_MIN(size - totalBytesRead, CYBERFM_VERIFY_CHUNK_SIZE);
+
+        result = cyberfm_archive_read_at(pArchive, offset + totalBytesRead, pChunk, bytesToRead);
+        if (result != CYBERFM_SUCCESS) {
+            break;
+        }
+
+        cyberfm_sha1_update(pSHA1, pChunk, bytesToRead);
+        totalBytesRead += bytesToRead;
+    }
+
+    cyberfm_archive_release_scratch(pArchive, pChunk);
+    return result;
+}
+
+static cyberfm_result cyberfm_archive_hash_file(cyberfm_archive* pArchive, uint32_t index, uint32_t hashKind, uint8_t* pHash)
+{
+    const cyberfm_archive_file_info* pFileInfo = &pArchive->pCentralDirectory->pFileInfo[index];
+    cyberfm_sha1 sha1;
+    uint32_t subFileCount;
+    uint32_t iSubFile;
+
+    subFileCount = pFileInfo->dataSpecRangeEnd - pFileInfo->dataSpecRangeBeg;
+    if (hashKind == CYBERFM_HASH_KIND_SHA1_FIRST_SUBFILE) {
+        subFileCount = CYBERFM_MIN(subFileCount, 1);
+    }
+
+    cyberfm_sha1_init(&sha1);
+
+    for (iSubFile = 0; iSubFile < subFileCount; iSubFile += 1) {
+        cyberfm_result result;
+        uint32_t iDataSpec;
+        const cyberfm_archive_file_data_spec* pDataSpec;
+
+        result = cyberfm_archive_get_data_spec_index(pArchive, index, iSubFile, &iDataSpec);
+        if (result != CYBERFM_SUCCESS) {
+            return result;
+        }
+
+        pDataSpec = &pArchive->pCentralDirectory->pFileDataSpec[iDataSpec];
+
+        if (hashKind == CYBERFM_HASH_KIND_SHA1_COMPRESSED || pDataSpec->compressedSize == pDataSpec->uncompressedSize) {
+            result = cyberfm_archive_hash_range(pArchive, pDataSpec->offset, pDataSpec->compressedSize, &sha1);
+        } else {
+            void* pDecompressedData = cyberfm_archive_acquire_scratch(pArchive, pDataSpec->uncompressedSize);
+            if (pDecompressedData == NULL) {
+                return CYBERFM_OUT_OF_MEMORY;
+            }
+
+            result = cyberfm_archive_decompress(pArchive, pDataSpec, pDecompressedData);
+            if (result == CYBERFM_SUCCESS) {
+                cyberfm_sha1_update(&sha1, pDecompressedData, pDataSpec->uncompressedSize);
+            }
+
+            cyberfm_archive_release_scratch(pArchive, pDecompressedData);
+        }
+
+        if (result != CYBERFM_SUCCESS) {
+            return result;
+        }
+    }
+
+    cyberfm_sha1_finalize(&sha1, pHash);
+    return CYBERFM_SUCCESS;
+}
+
+cyberfm_result cyberfm_archive_verify_file(cyberfm_archive* pArchive, uint32_t index, uint32_t* pHashKind)
+{
+    static const uint32_t defaultOrder[] = {CYBERFM_HASH_KIND_SHA1, CYBERFM_HASH_KIND_SHA1_COMPRESSED, CYBERFM_HASH_KIND_SHA1_FIRST_SUBFILE};
+    static const uint8_t nullHash[CYBERFM_SHA1_SIZE] = {0};
+    const cyberfm_archive_file_info* pFileInfo;
+    uint8_t expectedHash[CYBERFM_SHA1_SIZE];
+    uint32_t preferredHashKind;
+    uint32_t subFileCount;
+    cyberfm_bool32 isAnySubFileCompressed = CYBERFM_FALSE;
+    uint32_t iDataSpec;
+    uint32_t iHashKind;
+
+    if (pHashKind == NULL) {
+        return CYBERFM_INVALID_ARGS;
+    }
+
+    preferredHashKind = *pHashKind;
+    *pHashKind = CYBERFM_HASH_KIND_UNKNOWN;
+
+    if (pArchive == NULL || index >= pArchive->pCentralDirectory->fileInfoCount) {
+        return CYBERFM_INVALID_ARGS;
+    }
+
+    pFileInfo = &pArchive->pCentralDirectory->pFileInfo[index];
+
+    cyberfm_file_info_get_hash(pFileInfo, expectedHash);
+    if (memcmp(expectedHash, nullHash, sizeof(nullHash)) == 0) {
+        return CYBERFM_INVALID_OPERATION;   /* Nothing to verify against. */
+    }
+
+    subFileCount = pFileInfo->dataSpecRangeEnd - pFileInfo->dataSpecRangeBeg;
+    if (pFileInfo->dataSpecRangeEnd < pFileInfo->dataSpecRangeBeg || pFileInfo->dataSpecRangeEnd > pArchive->pCentralDirectory->fileDataSpecCount) {
+        return CYBERFM_ERROR;   /* The central directory is corrupt. */
+    }
+
+    for (iDataSpec = pFileInfo->dataSpecRangeBeg; iDataSpec < pFileInfo->dataSpecRangeEnd; iDataSpec += 1) {
+        if (pArchive->pCentralDirectory->pFileDataSpec[iDataSpec].compressedSize != pArchive->pCentralDirectory->pFileDataSpec[iDataSpec].uncompressedSize) {
+            isAnySubFileCompressed = CYBERFM_TRUE;
+        }
+    }
+
+    /* The preferred kind is tried first, followed by the rest in the default order. */
+    for (iHashKind = 0; iHashKind <= sizeof(defaultOrder)/sizeof(defaultOrder[0]); iHashKind += 1) {
+        cyberfm_result result;
+        uint32_t hashKind;
+        uint8_t hash[CYBERFM_SHA1_SIZE];
+
+        hashKind = (iHashKind == 0) ? preferredHashKind : defaultOrder[iHashKind - 1];
+        if (hashKind == CYBERFM_HASH_KIND_UNKNOWN || hashKind >= CYBERFM_HASH_KIND_COUNT || (iHashKind > 0 && hashKind == preferredHashKind)) {
+            continue;
+        }
+
+        /* Don't bother with kinds that would give the same hash as the plain SHA-1 for this file. */
+        if ((hashKind == CYBERFM_HASH_KIND_SHA1_COMPRESSED && !isAnySubFileCompressed) || (hashKind == CYBERFM_HASH_KIND_SHA1_FIRST_SUBFILE && subFileCount <= 1)) {
+            continue;
+        }
+
+        result = cyberfm_archive_hash_file(pArchive, index, hashKind, hash);
+        if (result != CYBERFM_SUCCESS) {
+            return result;
+        }
+
+        if (memcmp(hash, expectedHash, sizeof(hash)) == 0) {
+            *pHashKind = hashKind;
+            return CYBERFM_SUCCESS;
+        }
+    }
+
+    return CYBERFM_CORRUPT_DATA;
+}
+
+typedef struct
+{
+    cyberfm_archive* pArchive;
+    cyberfm_verify_request* pRequests;
+    volatile uint32_t hashKind;     /* The kind of hash that last matched. Tried first for every file. */
+} cyberfm_verify_job_context;
+
+static void cyberfm_verify_job_proc(void* pUserData, uint32_t jobIndex)
+{
+    cyberfm_verify_job_context* pContext = (cyberfm_verify_job_context*)pUserData;
+    cyberfm_verify_request* pRequest = &pContext->pRequests[jobIndex];
+
+    pRequest->hashKind = cyberfm_atomic_load_32(&pContext->hashKind);
+    pRequest->result   = cyberfm_archive_verify_file(pContext->pArchive, pRequest->index, &pRequest->hashKind);
+
+    if (pRequest->result == CYBERFM_SUCCESS) {
+        cyberfm_atomic_store_32(&pContext->hashKind, pRequest->hashKind);
+    }
+}
+
+cyberfm_result cyberfm_archive_verify_files(cyberfm_archive* pArchive, cyberfm_verify_request* pRequests, uint32_t count, uint32_t threadCount)
+{
+    cyberfm_verify_job_context context;
+    cyberfm_job_pool pool;
+    cyberfm_job_pool_config poolConfig;
+    uint64_t* pJobCosts;
+    uint32_t iRequest;
+
+    if (pArchive == NULL || (pRequests == NULL && count > 0)) {
+        return CYBERFM_INVALID_ARGS;
+    }
+
+    context.pArchive  = pArchive;
+    context.pRequests = pRequests;
+    context.hashKind  = CYBERFM_HASH_KIND_UNKNOWN;
+
+    /* The cost of a file is how much needs to be read. It doesn't matter if the request is invalid, it'll fail straight away. */
+    pJobCosts = (uint64_t*)malloc((count + 1) * sizeof(*pJobCosts));
+    if (pJobCosts != NULL) {
+        for (iRequest = 0; iRequest < count; iRequest += 1) {
+            pJobCosts[iRequest] = 0;
+
+            if (pRequests[iRequest].index < pArchive->pCentralDirectory->fileInfoCount) {
+                const cyberfm_archive_file_info* pFileInfo = &pArchive->pCentralDirectory->pFileInfo[pRequests[iRequest].index];
+                uint32_t iDataSpec;
+
+                for (iDataSpec = pFileInfo->dataSpecRangeBeg; iDataSpec < pFileInfo->dataSpecRangeEnd && iDataSpec < pArchive->pCentralDirectory->fileDataSpecCount; iDataSpec += 1) {
+                    pJobCosts[iRequest] += pArchive->pCentralDirectory->pFileDataSpec[iDataSpec].uncompressedSize;
+                }
+            }
+        }
+    }
+
+    poolConfig = cyberfm_job_pool_config_init(threadCount, count, cyberfm_verify_job_proc, &context);
+    poolConfig.pJobCosts = pJobCosts;
+
+    if (count > 1 && cyberfm_job_pool_init(&poolConfig, &pool) == CYBERFM_SUCCESS) {
+        cyberfm_job_pool_uninit(&pool);
+    } else {
+        /* Couldn't create the pool. Just do it on this thread. */
+        for (iRequest = 0; iRequest < count; iRequest += 1) {
+            cyberfm_verify_job_proc(&context, iRequest);
+        }
+    }
+
+    free(pJobCosts);
+
+    for (iRequest = 0; iRequest < count; iRequest += 1) {
+        if (pRequests[iRequest].result != CYBERFM_SUCCESS) {
+            return pRequests[iRequest].result;
+        }
+    }
+
+    return CYBERFM_SUCCESS;
+}
+
+const char* cyberfm_hash_kind_to_string(uint32_t hashKind)
+{
+    switch (hashKind)
+    {
+        case CYBERFM_HASH_KIND_SHA1:                 return "SHA-1 of the uncompressed data";
+        case CYBERFM_HASH_KIND_SHA1_COMPRESSED:      return "SHA-1 of the compressed data";
+        case CYBERFM_HASH_KIND_SHA1_FIRST_SUBFILE:   return "SHA-1 of the first sub-file";
+        default:                                     return "Unknown";
+    }
+}
+
+#define CYBERFM_LOAD_BATCH_SIZE 64
+
+cyberfm_result cyberfm_archive_load_files(cyberfm_archive* pArchive, cyberfm_load_request* pRequests, uint32_t requestCount)
+{
+    cyberfm_result result = CYBERFM_SUCCESS;
+    uint32_t iFirstRequest;
+
+    if (pArchive == NULL || (pRequests == NULL && requestCount > 0)) {
+        return CYBERFM_INVALID_ARGS;
+    }
+
+    /*
+    This is done in batches to keep the memory used for compressed data under control. For each batch, all of the reads are
+    submitted together, and then everything that's compressed is handed to the codecs in one go.
+    */
+    for (iFirstRequest = 0; iFirstRequest < requestCount; iFirstRequest += CYBERFM_LOAD_BATCH_SIZE) {
+        cyberfm_read_request reads[CYBERFM_LOAD_BATCH_SIZE];
+        cyberfm_codec_job codecJobs[CYBERFM_LOAD_BATCH_SIZE];
+        uint32_t codecJobRequests[CYBERFM_LOAD_BATCH_SIZE];    /* Maps a codec job to it's index in pRequests. */
+        uint32_t readRequests[CYBERFM_LOAD_BATCH_SIZE];        /* Maps a read to it's index in pRequests. */
+        void* pScratch[CYBERFM_LOAD_BATCH_SIZE];
+        uint32_t readCount = 0;
+        uint32_t codecJobCount = 0;
+        uint32_t scratchCount = 0;
+        uint32_t batchSize = CYBERFM_MIN(requestCount - iFirstRequest, CYBERFM_LOAD_BATCH_SIZE);
+        uint32_t iRequest;
+        uint32_t iRead;
+        uint32_t iCodecJob;
+
+        for (iRequest = iFirstRequest; iRequest < iFirstRequest + batchSize; iRequest += 1) {
+            cyberfm_load_request* pRequest = &pRequests[iRequest];
+            uint32_t iDataSpec;
+            const cyberfm_archive_file_data_spec* pDataSpec;
+
+            pRequest->size = 0;
+
+            pRequest->result = cyberfm_archive_get_data_spec_index(pArchive, pRequest->index, pRequest->subfile, &iDataSpec);
+            if (pRequest->result != CYBERFM_SUCCESS) {
+                continue;
+            }
+
+            pDataSpec = &pArchive->pCentralDirectory->pFileDataSpec[iDataSpec];
+            pRequest->size = pDataSpec->uncompressedSize;
+
+            if (pRequest->pDst == NULL) {
+                continue;   /* Just querying the size. */
+            }
+
+            if (pRequest->dstCap < pDataSpec->uncompressedSize) {
+                pRequest->result = CYBERFM_OUT_OF_RANGE;
+                continue;
+            }
+
+            if (pDataSpec->compressedSize != pDataSpec->uncompressedSize) {
+                const uint8_t* pCompressedData = cyberfm_archive_get_mapped_data(pArchive, pDataSpec->offset, pDataSpec->compressedSize);
+
+                if (pCompressedData == NULL) {
+                    void* pCompressedDataBuffer = cyberfm_archive_acquire_scratch(pArchive, pDataSpec->compressedSize);
+                    if (pCompressedDataBuffer == NULL) {
+                        pRequest->result = CYBERFM_OUT_OF_MEMORY;
+                        continue;
+                    }
+
+                    pScratch[scratchCount] = pCompressedDataBuffer;
+                    scratchCount += 1;
+
+                    reads[readCount].offset = pDataSpec->offset;
+                    reads[readCount].size   = pDataSpec->compressedSize;
+                    reads[readCount].pDst   = pCompressedDataBuffer;
+                    readRequests[readCount] = iRequest;
+                    readCount += 1;
+
+                    pCompressedData = (const uint8_t*)pCompressedDataBuffer;
+                }
+
+                codecJobs[codecJobCount].pCompressedData = pCompressedData;
+                codecJobs[codecJobCount].compressedSize  = pDataSpec->compressedSize;
+                codecJobs[codecJobCount].pDst            = pRequest->pDst;
+                codecJobs[codecJobCount].dstSize         = pDataSpec->uncompressedSize;
+                codecJobRequests[codecJobCount] = iRequest;
+                codecJobCount += 1;
+            } else {
+                reads[readCount].offset = pDataSpec->offset;
+                reads[readCount].size   = pDataSpec->uncompressedSize;
+                reads[readCount].pDst   = pRequest->pDst;
+                readRequests[readCount] = iRequest;
+                readCount += 1;
+            }
+        }
+
+        cyberfm_archive_read_batch(pArchive, reads, readCount);
+
+        for (iRead = 0; iRead < readCount; iRead += 1) {
+            pRequests[readRequests[iRead]].result = reads[iRead].result;
+        }
+
+        /* Anything that failed to read is left out of the decompression step. */
+        for (iCodecJob = 0; iCodecJob < codecJobCount; ) {
+            if (pRequests[codecJobRequests[iCodecJob]].result != CYBERFM_SUCCESS) {
+                codecJobs[iCodecJob]        = codecJobs[codecJobCount - 1];
+                codecJobRequests[iCodecJob] = codecJobRequests[codecJobCount - 1];
+                codecJobCount -= 1;
+            } else {
+                iCodecJob += 1;
+            }
+        }
+
+        cyberfm_archive_decompress_batch(pArchive, codecJobs, codecJobCount);
+
+        for (iCodecJob = 0; iCodecJob < codecJobCount; iCodecJob += 1) {
+            pRequests[codecJobRequests[iCodecJob]].result = codecJobs[iCodecJob].result;
+        }
+
+        for (iRequest = 0; iRequest < scratchCount; iRequest += 1) {
+            cyberfm_archive_release_scratch(pArchive, pScratch[iRequest]);
+        }
+
+        for (iRequest = iFirstRequest; iRequest < iFirstRequest + batchSize; iRequest += 1) {
+            if (pRequests[iRequest].result != CYBERFM_SUCCESS && result == CYBERFM_SUCCESS) {
+                result = pRequests[iRequest].result;
+            }
+        }
+    }
+
+    return result;
+}
+
+cyberfm_result cyberfm_archive_decompress_block(cyberfm_archive* pArchive, const void* pCompressedData, size_t compressedSize, void* pDst, size_t dstSize)
+{
+    cyberfm_result result;
+    const cyberfm_codec* pCodec;
+    CYBERFM_STATS_DECLARE_TIMER(startTime)
+
+    if (pArchive == NULL || pCompressedData == NULL || (pDst == NULL && dstSize > 0)) {
+        return CYBERFM_INVALID_ARGS;
+    }
+
+    pCodec = cyberfm_archive_find_codec(pArchive, pCompressedData, compressedSize);
+    if (pCodec == NULL) {
+        return CYBERFM_INVALID_OPERATION;   /* Don't have a codec for this block. */
+    }
+
+    CYBERFM_STATS_BEGIN_TIMER(startTime);
+    result = pCodec->onDecompress(pCodec->pUserData, pCompressedData, compressedSize, pDst, dstSize);
+    CYBERFM_STATS_END_TIMER(CYBERFM_STAT_TIMER_DECOMPRESS, startTime);
+
+    if (result == CYBERFM_SUCCESS) {
+        CYBERFM_STATS_ADD(CYBERFM_STAT_BYTES_DECOMPRESSED, dstSize);
+    }
+
+    return result;
+}
+
+
+cyberfm_read_plan_config cyberfm_read_plan_config_init(void)
+{
+    cyberfm_read_plan_config config;
+
+    CYBERFM_ZERO_OBJECT(&config);
+    config.maxSpanSize = CYBERFM_READ_PLAN_DEFAULT_MAX_SPAN_SIZE;
+    config.maxGapSize  = CYBERFM_READ_PLAN_DEFAULT_MAX_GAP_SIZE;
+
+    return config;
+}
+
+static int cyberfm_read_plan_item_compare(const void* a, const void* b)
+{
+    const cyberfm_read_plan_item* pA = (const cyberfm_read_plan_item*)a;
+    const cyberfm_read_plan_item* pB = (const cyberfm_read_plan_item*)b;
+
+    if (pA->offset < pB->offset) {
+        return -1;
+    }
+    if (pA->offset > pB->offset) {
+        return  1;
+    }
+
+    /* Keep things stable so the plan is the same every time. */
+    if (pA->fileIndex != pB->fileIndex) {
+        return (pA->fileIndex < pB->fileIndex) ? -1 : 1;
+    }
+
+    return (pA->subfile < pB->subfile) ? -1 : (pA->subfile > pB->subfile) ? 1 : 0;
+}
+
+cyberfm_result cyberfm_read_plan_init(cyberfm_archive* pArchive, const cyberfm_read_plan_config* pConfig, cyberfm_read_plan* pPlan)
+{
+    cyberfm_read_plan_config config;
+    const cyberfm_archive_central_directory* pCentralDirectory;
+    uint32_t itemCap;
+    uint32_t iFile;
+    uint32_t iItem;
+
+    if (pPlan == NULL) {
+        return CYBERFM_INVALID_ARGS;
+    }
+
+    CYBERFM_ZERO_OBJECT(pPlan);
+
+    if (pArchive == NULL) {
+        return CYBERFM_INVALID_ARGS;
+    }
+
+    if (pConfig != NULL) {
+        config = *pConfig;
+    } else {
+        config = cyberfm_read_plan_config_init();
+    }
+
+    pCentralDirectory = pArchive->pCentralDirectory;
+
+    /* Every sub-file can potentially be an item, and in the worst case every item will be in it's own span. */
+    itemCap = 0;
+    for (iFile = 0; iFile < pCentralDirectory->fileInfoCount; iFile += 1) {
+        const cyberfm_archive_file_info* pFileInfo = &pCentralDirectory->pFileInfo[iFile];
+        if (pFileInfo->dataSpecRangeEnd > pFileInfo->dataSpecRangeBeg) {
+            itemCap += pFileInfo->dataSpecRangeEnd - pFileInfo->dataSpecRangeBeg;
+        }
+    }
+
+    pPlan->pAllocation = malloc(((size_t)itemCap * sizeof(*pPlan->pItems)) + ((size_t)itemCap * sizeof(*pPlan->pSpans)) + 1);
+    if (pPlan->pAllocation == NULL) {
+        return CYBERFM_OUT_OF_MEMORY;
+    }
+
+    pPlan->pItems = (cyberfm_read_plan_item*)pPlan->pAllocation;
+    pPlan->pSpans = (cyberfm_read_plan_span*)CYBERFM_OFFSET_PTR(pPlan->pItems, (size_t)itemCap * sizeof(*pPlan->pItems));
+
+    /* Sub-files that point outside of the archive are left out of the plan, as are files that have been filtered out. */
+    for (iFile = 0; iFile < pCentralDirectory->fileInfoCount; iFile += 1) {
+        const cyberfm_archive_file_info* pFileInfo = &pCentralDirectory->pFileInfo[iFile];
+        uint32_t iSubFile;
+
+        if (config.pFileFilter != NULL && config.pFileFilter[iFile] == 0) {
+            continue;
+        }
+
+        for (iSubFile = 0; pFileInfo->dataSpecRangeBeg + iSubFile < pFileInfo->dataSpecRangeEnd; iSubFile += 1) {
+            uint32_t iDataSpec;
+            const cyberfm_archive_file_data_spec* pDataSpec;
+            cyberfm_read_plan_item* pItem;
+
+            if (cyberfm_archive_get_data_spec_index(pArchive, iFile, iSubFile, &iDataSpec) != CYBERFM_SUCCESS) {
+                continue;
+            }
+
+            pDataSpec = &pCentralDirectory->pFileDataSpec[iDataSpec];
+            if (pDataSpec->offset > pArchive->fileSize || pDataSpec->compressedSize > (pArchive->fileSize - pDataSpec->offset)) {
+                continue;
+            }
+
+            pItem = &pPlan->pItems[pPlan->itemCount];
+            pItem->offset        = pDataSpec->offset;
+            pItem->size          = pDataSpec->compressedSize;
+            pItem->dataSpecIndex = iDataSpec;
+            pItem->fileIndex     = iFile;
+            pItem->subfile       = iSubFile;
+            pPlan->itemCount += 1;
+        }
+    }
+
+    qsort(pPlan->pItems, pPlan->itemCount, sizeof(*pPlan->pItems), cyberfm_read_plan_item_compare);
+
+    /*
+    Now group the items into spans. An item is added to the current span if the gap between it and the end of the span is
+    small enough, and the span doesn't grow too big as a result. Items bigger than the maximum span size get their own span,
+    as do large uncompressed items when direct copies are enabled.
+    */
+    for (iItem = 0; iItem < pPlan->itemCount; iItem += 1) {
+        const cyberfm_read_plan_item* pItem = &pPlan->pItems[iItem];
+        const cyberfm_archive_file_data_spec* pDataSpec = &pCentralDirectory->pFileDataSpec[pItem->dataSpecIndex];
+        cyberfm_read_plan_span* pSpan = (pPlan->spanCount > 0) ? &pPlan->pSpans[pPlan->spanCount - 1] : NULL;
+        uint64_t itemEnd = pItem->offset + pItem->size;
+        cyberfm_bool32 isDirect;
+
+        isDirect = config.directCopyMinSize > 0 && pDataSpec->compressedSize == pDataSpec->uncompressedSize && pItem->size >= config.directCopyMinSize;
+
+        if (!isDirect && pSpan != NULL && (pSpan->flags & CYBERFM_READ_PLAN_SPAN_FLAG_DIRECT) == 0 && pItem->offset <= (pSpan->offset + pSpan->size + config.maxGapSize) && (CYBERFM_MAX(itemEnd, pSpan->offset + pSpan->size) - pSpan->offset) <= config.maxSpanSize) {
+            pSpan->size       = CYBERFM_MAX(itemEnd, pSpan->offset + pSpan->size) - pSpan->offset;
+            pSpan->itemCount += 1;
+        } else {
+            pSpan = &pPlan->pSpans[pPlan->spanCount];
+            pSpan->offset    = pItem->offset;
+            pSpan->size      = pItem->size;
+            pSpan->firstItem = iItem;
+            pSpan->itemCount = 1;
+            pSpan->flags     = (isDirect) ? CYBERFM_READ_PLAN_SPAN_FLAG_DIRECT : 0;
+            pPlan->spanCount += 1;
+        }
+    }
+
+    return CYBERFM_SUCCESS;
+}
+
+void cyberfm_read_plan_uninit(cyberfm_read_plan* pPlan)
+{
+    if (pPlan == NULL) {
+        return;
+    }
+
+    free(pPlan->pAllocation);
+}
+
+cyberfm_result cyberfm_read_plan_load_span(cyberfm_archive* pArchive, const cyberfm_read_plan_span* pSpan, const void** ppData)
+{
+    cyberfm_result result;
+    const uint8_t* pMappedData;
+    void* pData;
+    uint64_t bytesRead;
+
+    if (ppData == NULL) {
+        return CYBERFM_INVALID_ARGS;
+    }
+
+    *ppData = NULL;
+
+    if (pArchive == NULL || pSpan == NULL) {
+        return CYBERFM_INVALID_ARGS;
+    }
+
+    if (pSpan->size > (uint64_t)((size_t)-1)) {
+        return CYBERFM_OUT_OF_RANGE;
+    }
+
+    /* When the archive is mapped we can just point straight to it. */
+    pMappedData = cyberfm_archive_get_mapped_data(pArchive, pSpan->offset, pSpan->size);
+    if (pMappedData != NULL) {
+        *ppData = pMappedData;
+        return CYBERFM_SUCCESS;
+    }
+
+    pData = cyberfm_archive_acquire_scratch(pArchive, (size_t)pSpan->size);
+    if (pData == NULL) {
+        return CYBERFM_OUT_OF_MEMORY;
+    }
+
+    /* The span is read in chunks so that when io_uring is available the chunks can be read in parallel. */
+    result = CYBERFM_SUCCESS;
+    for (bytesRead = 0; bytesRead < pSpan->size && result == CYBERFM_SUCCESS; ) {
+        cyberfm_read_request requests[16];
+        uint32_t requestCount;
+
+        for (requestCount = 0; requestCount < sizeof(requests)/sizeof(requests[0]) && bytesRead < pSpan->size; requestCount += 1) {
+            requests[requestCount].offset = pSpan->offset + bytesRead;
+            requests[requestCount].size   = (size_t)CYBERFM_MIN(pSpan->size - bytesRead, CYBERFM_IO_CHUNK_SIZE);
+            requests[requestCount].pDst   = CYBERFM_OFFSET_PTR(pData, bytesRead);
+            bytesRead += requests[requestCount].size;
+        }
+
+        result = cyberfm_archive_read_batch(pArchive, requests, requestCount);
+    }
+
+    if (result != CYBERFM_SUCCESS) {
+        cyberfm_archive_release_scratch(pArchive, pData);
+        return result;
+    }
+
+    *ppData = pData;
+    return CYBERFM_SUCCESS;
+}
+
+void cyberfm_read_plan_unload_span(cyberfm_archive* pArchive, const cyberfm_read_plan_span* pSpan, const void* pData)
+{
+    if (pArchive == NULL || pSpan == NULL || pData == NULL) {
+        return;
+    }
+
+    if (pData == cyberfm_archive_get_mapped_data(pArchive, pSpan->offset, pSpan->size)) {
+        return; /* It's a view of the mapping. Nothing to free. */
+    }
+
+    cyberfm_archive_release_scratch(pArchive, (void*)pData);
+}
+
+#define CYBERFM_COPY_BUFFER_SIZE    (1024 * 1024)
+
+/* A normal buffered copy. This is the fallback when the kernel can't do the copy for us. */
+static cyberfm_result cyberfm_archive_copy_to_stream(cyberfm_archive* pArchive, uint64_t offset, uint64_t size, FILE* pOutputFile)
+{
+    cyberfm_result result = CYBERFM_SUCCESS;
+    void* pBuffer;
+
+    pBuffer = cyberfm_archive_acquire_scratch(pArchive, (size_t)CYBERFM_MIN(size, CYBERFM_COPY_BUFFER_SIZE));
+    if (pBuffer == NULL) {
+        return CYBERFM_OUT_OF_MEMORY;
+    }
+
+    while (size > 0) {
+        size_t bytesToCopy = (size_t)CYBERFM_MIN(size, CYBERFM_COPY_BUFFER_SIZE);
+
+        result = cyberfm_archive_read_at(pArchive, offset, pBuffer, bytesToCopy);
+        if (result != CYBERFM_SUCCESS) {
+            break;
+        }
+
+        result = cyberfm_result_from_minifs(mfs_fwrite(pOutputFile, pBuffer, bytesToCopy, NULL));
+        if (result != CYBERFM_SUCCESS) {
+            break;
+        }
+
+        offset += bytesToCopy;
+        size   -= bytesToCopy;
+    }
+
+    cyberfm_archive_release_scratch(pArchive, pBuffer);
+    return result;
+}
+
+#ifdef __linux__
+/*
+Copies as much as possible in the kernel. The offset and size are updated with how far it got. CYBERFM_INVALID_OPERATION is
+returned if the kernel can't do the rest of the copy, in which case the caller needs to finish it off with a buffered copy.
+*/
+static cyberfm_result cyberfm_archive_copy_to_fd_in_kernel(cyberfm_archive* pArchive, uint64_t* pOffset, uint64_t* pSize, int outputFD)
+{
+    int inputFD = fileno(pArchive->pFile);
+    cyberfm_bool32 isCopyFileRangeSupported = CYBERFM_TRUE;
+
+    while (*pSize > 0) {
+        size_t bytesToCopy = (size_t)CYBERFM_MIN(*pSize, 0x7FFFF000);
+        ssize_t bytesCopied = -1;
+        off_t inputOffset = (off_t)*pOffset;
+
+    #ifdef __NR_copy_file_range
+        if (isCopyFileRangeSupported) {
+            /* Going through syscall() directly because older versions of glibc don't have a wrapper. */
+            bytesCopied = (ssize_t)syscall(__NR_copy_file_range, inputFD, &inputOffset, outputFD, NULL, bytesToCopy, 0);
+            if (bytesCopied <= 0) {
+                if (bytesCopied < 0 && errno == EINTR) {
+                    continue;
+                }
+
+                /* Most likely not supported by the kernel or the filesystem, or the files are on different filesystems. Try sendfile(). */
+                isCopyFileRangeSupported = CYBERFM_FALSE;
+                inputOffset = (off_t)*pOffset;
+                bytesCopied = -1;
+            }
+        }
+    #endif
+
+        if (bytesCopied < 0) {
+            bytesCopied = sendfile(outputFD, inputFD, &inputOffset, bytesToCopy);
+            if (bytesCopied <= 0) {
+                if (bytesCopied < 0 && errno == EINTR) {
+                    continue;
+                }
+
+                return CYBERFM_INVALID_OPERATION;
+            }
+        }
+
+        *pOffset += (uint64_t)bytesCopied;
+        *pSize   -= (uint64_t)bytesCopied;
+    }
+
+    (void)isCopyFileRangeSupported;
+    return CYBERFM_SUCCESS;
+}
+#endif
+
+static cyberfm_result cyberfm_archive_copy_to_file_impl(cyberfm_archive* pArchive, uint64_t offset, uint64_t size, const char* pFilePath)
+{
+    cyberfm_result result;
+    FILE* pOutputFile;
+
+    if (pArchive == NULL || pFilePath == NULL) {
+        return CYBERFM_INVALID_ARGS;
+    }
+
+    if (offset > pArchive->fileSize || size > (pArchive->fileSize - offset)) {
+        return CYBERFM_OUT_OF_RANGE;
+    }
+
+#ifdef __linux__
+    {
+        int outputFD;
+
+        outputFD = open(pFilePath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+        if (outputFD < 0) {
+            return CYBERFM_ACCESS_DENIED;
+        }
+
+        result = cyberfm_archive_copy_to_fd_in_kernel(pArchive, &offset, &size, outputFD);
+        if (result == CYBERFM_SUCCESS) {
+            close(outputFD);
+            return CYBERFM_SUCCESS;
+        }
+
+        /* The kernel couldn't do it. Finish it off with a buffered copy. The file position will be where the kernel got up to. */
+        pOutputFile = fdopen(outputFD, "wb");
+        if (pOutputFile == NULL) {
+            close(outputFD);
+            return CYBERFM_ERROR;
+        }
+    }
+#else
+    result = cyberfm_result_from_minifs(mfs_fopen(&pOutputFile, pFilePath, "wb"));
+    if (result != CYBERFM_SUCCESS) {
+        return result;
+    }
+#endif
+
+    result = cyberfm_archive_copy_to_stream(pArchive, offset, size, pOutputFile);
+
+    if (mfs_fclose(pOutputFile) != MFS_SUCCESS && result == CYBERFM_SUCCESS) {
+        result = CYBERFM_ERROR; /* Failed to flush. */
+    }
+
+    return result;
+}
+
+cyberfm_result cyberfm_archive_copy_to_file(cyberfm_archive* pArchive, uint64_t offset, uint64_t size, const char* pFilePath)
+{
+    cyberfm_result result;
+    CYBERFM_STATS_DECLARE_TIMER(startTime)
+
+    CYBERFM_STATS_BEGIN_TIMER(startTime);
+    result = cyberfm_archive_copy_to_file_impl(pArchive, offset, size, pFilePath);
+    CYBERFM_STATS_END_TIMER(CYBERFM_STAT_TIMER_WRITE, startTime);
+
+    if (result == CYBERFM_SUCCESS) {
+        CYBERFM_STATS_ADD(CYBERFM_STAT_BYTES_WRITTEN, size);
+    }
+
+    return result;
+}
+
+/*
+Opens a file through the cache. On a miss the sub-file is decoded outside of the lock so that other threads aren't held up.
+*/
+static cyberfm_result cyberfm_file_open_cached(cyberfm_archive* pArchive, uint32_t iDataSpec, uint32_t flags, cyberfm_file** ppFile)
+{
+    cyberfm_result result;
+    const cyberfm_archive_file_data_spec* pDataSpec = &pArchive->pCentralDirectory->pFileDataSpec[iDataSpec];
+    cyberfm_cache_entry* pEntry;
+    cyberfm_file* pFile;
+
+    pFile = cyberfm_archive_alloc_file(pArchive, 0);
+    if (pFile == NULL) {
+        return CYBERFM_OUT_OF_MEMORY;
+    }
+
+    cyberfm_mutex_lock(&pArchive->cache.lock);
+    {
+        pEntry = cyberfm_cache_acquire(pArchive, iDataSpec);
+    }
+    cyberfm_mutex_unlock(&pArchive->cache.lock);
+
+    if (pEntry == NULL) {
+        pEntry = (cyberfm_cache_entry*)malloc(sizeof(*pEntry) + pDataSpec->uncompressedSize);
+        if (pEntry == NULL) {
+            cyberfm_archive_free_file(pArchive, pFile);
+            return CYBERFM_OUT_OF_MEMORY;
+        }
+
+        pEntry->dataSpecIndex = iDataSpec;
+        pEntry->size          = pDataSpec->uncompressedSize;
+
+        if (pDataSpec->compressedSize != pDataSpec->uncompressedSize) {
+            result = cyberfm_archive_decompress(pArchive, pDataSpec, pEntry->pData);
+        } else {
+            result = cyberfm_archive_read_at(pArchive, pDataSpec->offset, pEntry->pData, pDataSpec->uncompressedSize);
+        }
+
+        if (result != CYBERFM_SUCCESS) {
+            free(pEntry);
+            cyberfm_archive_free_file(pArchive, pFile);
+            return result;
+        }
+
+        cyberfm_mutex_lock(&pArchive->cache.lock);
+        {
+            pEntry = cyberfm_cache_insert(pArchive, pEntry);
+        }
+        cyberfm_mutex_unlock(&pArchive->cache.lock);
+    }
+
+    pFile->pArchive    = pArchive;
+    pFile->pDataSpec   = pDataSpec;
+    pFile->flags       = flags;
+    pFile->cursor      = 0;
+    pFile->size        = pEntry->size;
+    pFile->pData       = pEntry->pData;
+    pFile->pCacheEntry = pEntry;
+
+    *ppFile = pFile;
+
+    return CYBERFM_SUCCESS;
+}
+
+static cyberfm_result cyberfm_file_open_by_index_ex_impl(cyberfm_archive* pArchive, uint32_t index, uint32_t subfile, uint32_t flags, cyberfm_file** ppFile)
+{
+    cyberfm_result result;
+    uint32_t iDataSpec;
+    const cyberfm_archive_file_data_spec* pDataSpec;
+    cyberfm_bool32 isCompressed;
+    cyberfm_bool32 isStreamed;
+    const uint8_t* pMappedData;
+    size_t payloadSize;
+    cyberfm_file* pFile;
+
+    if (ppFile == NULL) {
+        return CYBERFM_INVALID_ARGS;
+    }
+
+    *ppFile = NULL;
+
+    if (pArchive == NULL) {
+        return CYBERFM_INVALID_ARGS;
+    }
+
+    result = cyberfm_archive_get_data_spec_index(pArchive, index, subfile, &iDataSpec);
+    if (result != CYBERFM_SUCCESS) {
+        return result;
+    }
+
+    pDataSpec    = &pArchive->pCentralDirectory->pFileDataSpec[iDataSpec];
+    isCompressed = pDataSpec->compressedSize != pDataSpec->uncompressedSize;
+    isStreamed   = (flags & CYBERFM_FILE_FLAG_STREAM) != 0;
+    pMappedData  = cyberfm_archive_get_mapped_data(pArchive, pDataSpec->offset, pDataSpec->compressedSize);
+
+    if (pArchive->map.pData != NULL && pMappedData == NULL) {
+        return CYBERFM_ERROR;   /* The data spec points outside of the archive. */
+    }
+
+    /*
+    Files that can be referenced straight out of the mapping don't benefit from the cache. Empty files would otherwise always
+    fit, so the cache needs to actually be enabled.
+    */
+    if (pArchive->cache.capacityInBytes > 0 && pArchive->cache.capacityInBytes >= pDataSpec->uncompressedSize && !isStreamed && (pMappedData == NULL || isCompressed)) {
+        return cyberfm_file_open_cached(pArchive, iDataSpec, flags, ppFile);
+    }
+
+    /*
+    It looks like the file is good at so far. Now we need to get the data. When the archive is memory mapped and the file is
+    not compressed we can reference the data directly from the mapping which means we need only allocate the file object
+    itself. Streamed files that are not compressed only need enough memory for their read window, and compressed ones don't
+    need anything until the first read. Otherwise we'll need to allocate memory for the whole file.
+    */
+    if (pMappedData != NULL && !isCompressed) {
+        payloadSize = 0;
+    } else if (isStreamed) {
+        payloadSize = isCompressed ? 0 : (size_t)CYBERFM_MIN(pDataSpec->uncompressedSize, CYBERFM_FILE_STREAM_WINDOW_SIZE);
+    } else {
+        payloadSize = pDataSpec->uncompressedSize;
+    }
+
+    pFile = cyberfm_archive_alloc_file(pArchive, payloadSize);
+    if (pFile == NULL) {
+        return CYBERFM_OUT_OF_MEMORY;
+    }
+
+    pFile->pArchive  = pArchive;
+    pFile->pDataSpec = pDataSpec;
+    pFile->flags     = flags;
+    pFile->cursor    = 0;
+    pFile->size      = pDataSpec->uncompressedSize;
+    pFile->pData     = pFile->pPayload;
+
+    if (!isCompressed) {
+        /* Not compressed. */
+        if (pMappedData != NULL) {
+            pFile->pData = pMappedData;
+        } else if (isStreamed) {
+            pFile->pData = NULL;    /* Data is read through the window by cyberfm_file_read(). */
+            pFile->stream.windowCap = payloadSize;
+        } else {
+            result = cyberfm_archive_read_at(pArchive, pDataSpec->offset, pFile->pPayload, (size_t)pFile->size);
+            if (result != CYBERFM_SUCCESS) {
+                cyberfm_archive_free_file(pArchive, pFile);
+                return result;
+            }
+        }
+    } else {
+        /* Compressed. */
+        if (isStreamed) {
+            pFile->pData = NULL;    /* Decoded on the first read. */
+        } else {
+            result = cyberfm_archive_decompress(pArchive, pDataSpec, pFile->pPayload);
+            if (result != CYBERFM_SUCCESS) {
+                cyberfm_archive_free_file(pArchive, pFile);
+                return result;
+            }
+        }
+    }
+
+    /* We're done. */
+    *ppFile = pFile;
+
+    return CYBERFM_SUCCESS;
+}
+
+cyberfm_result cyberfm_file_open_by_index_ex(cyberfm_archive* pArchive, uint32_t index, uint32_t subfile, uint32_t flags, cyberfm_file** ppFile)
+{
+    cyberfm_result result;
+    CYBERFM_STATS_DECLARE_TIMER(startTime)
+
+    CYBERFM_STATS_BEGIN_TIMER(startTime);
+    result = cyberfm_file_open_by_index_ex_impl(pArchive, index, subfile, flags, ppFile);
+    CYBERFM_STATS_END_TIMER(CYBERFM_STAT_TIMER_FILE_OPEN, startTime);
+
+    if (result == CYBERFM_SUCCESS) {
+        CYBERFM_STATS_ADD(CYBERFM_STAT_FILE_OPENS, 1);
+    }
+
+    return result;
+}
+
+cyberfm_result cyberfm_file_open_by_index(cyberfm_archive* pArchive, uint32_t index, uint32_t subfile, cyberfm_file** ppFile)
+{
+    return cyberfm_file_open_by_index_ex(pArchive, index, subfile, 0, ppFile);
+}
+
+cyberfm_result cyberfm_file_open_ex(cyberfm_archive* pArchive, uint64_t hashedName, uint32_t subfile, uint32_t flags, cyberfm_file** ppFile)
+{
+    cyberfm_result result;
+    uint32_t iFile;
+
+    if (ppFile == NULL) {
+        return CYBERFM_INVALID_ARGS;
+    }
+
+    *ppFile = NULL;
+
+    if (pArchive == NULL) {
+        return CYBERFM_INVALID_ARGS;
+    }
+
+    /* The first thing to do is find the file. */
+    result = cyberfm_archive_find(pArchive, hashedName, &iFile);
+    if (result != CYBERFM_SUCCESS) {
+        return result;  /* The file was probably not found. */
+    }
+
+    return cyberfm_file_open_by_index_ex(pArchive, iFile, subfile, flags, ppFile);
+}
+
+cyberfm_result cyberfm_file_open(cyberfm_archive* pArchive, uint64_t hashedName, uint32_t subfile, cyberfm_file** ppFile)
+{
+    return cyberfm_file_open_ex(pArchive, hashedName, subfile, 0, ppFile);
+}
+
+#define CYBERFM_FNV1A_64_OFFSET_BASIS   0xCBF29CE484222325ULL
+#define CYBERFM_FNV1A_64_PRIME          0x00000100000001B3ULL
+
+uint64_t cyberfm_fnv1a_64(const void* pData, size_t dataSize)
+{
+    const uint8_t* pData8 = (const uint8_t*)pData;
+    uint64_t hash = CYBERFM_FNV1A_64_OFFSET_BASIS;
+    size_t i;
+
+    for (i = 0; i < dataSize; i += 1) {
+        hash ^= pData8[i];
+        hash *= CYBERFM_FNV1A_64_PRIME;
+    }
+
+    return hash;
+}
+
+/* Paths are normalized as they're hashed so we don't need to make a copy of them. This compiles to conditional moves. */
+static uint8_t cyberfm_normalize_path_char(uint8_t c)
+{
+    c = (c == '/') ? (uint8_t)'\\' : c;
+    return ((uint8_t)(c - 'A') < 26) ? (uint8_t)(c + ('a' - 'A')) : c;
+}
+
+uint64_t cyberfm_hash_path(const char* pPath)
+{
+    uint64_t hash = CYBERFM_FNV1A_64_OFFSET_BASIS;
+    const char* pChar;
+
+    if (pPath == NULL) {
+        return hash;
+    }
+
+    for (pChar = pPath; pChar[0] != '\0'; pChar += 1) {
+        hash ^= cyberfm_normalize_path_char((uint8_t)pChar[0]);
+        hash *= CYBERFM_FNV1A_64_PRIME;
+    }
+
+    return hash;
+}
+
+/*
+Hashes four paths at the same time. Each step of FNV-1a depends on the multiply from the last one so a single path can't go
+any faster than one multiply per byte. Interleaving four paths keeps the multiplier busy. Used when loading dictionaries.
+*/
+static void cyberfm_hash_path_x4(const char** ppPaths, const uint32_t* pLengths, uint64_t* pHashes)
+{
+    uint64_t hash0 = CYBERFM_FNV1A_64_OFFSET_BASIS;
+    uint64_t hash1 = CYBERFM_FNV1A_64_OFFSET_BASIS;
+    uint64_t hash2 = CYBERFM_FNV1A_64_OFFSET_BASIS;
+    uint64_t hash3 = CYBERFM_FNV1A_64_OFFSET_BASIS;
+    uint32_t commonLength;
+    uint32_t i;
+
+    commonLength = CYBERFM_MIN(CYBERFM_MIN(pLengths[0], pLengths[1]), CYBERFM_MIN(pLengths[2], pLengths[3]));
+
+    for (i = 0; i < commonLength; i += 1) {
+        hash0 = (hash0 ^ cyberfm_normalize_path_char((uint8_t)ppPaths[0][i])) * CYBERFM_FNV1A_64_PRIME;
+        hash1 = (hash1 ^ cyberfm_normalize_path_char((uint8_t)ppPaths[1][i])) * CYBERFM_FNV1A_64_PRIME;
+        hash2 = (hash2 ^ cyberfm_normalize_path_char((uint8_t)ppPaths[2][i])) * CYBERFM_FNV1A_64_PRIME;
+        hash3 = (hash3 ^ cyberfm_normalize_path_char((uint8_t)ppPaths[3][i])) * CYBERFM_FNV1A_64_PRIME;
+    }
+
+    /* Whatever is left over of the longer paths. */
+    for (i = commonLength; i < pLengths[0]; i += 1) { hash0 = (hash0 ^ cyberfm_normalize_path_char((uint8_t)ppPaths[0][i])) * CYBERFM_FNV1A_64_PRIME; }
+    for (i = commonLength; i < pLengths[1]; i += 1) { hash1 = (hash1 ^ cyberfm_normalize_path_char((uint8_t)ppPaths[1][i])) * CYBERFM_FNV1A_64_PRIME; }
+    for (i = commonLength; i < pLengths[2]; i += 1) { hash2 = (hash2 ^ cyberfm_normalize_path_char((uint8_t)ppPaths[2][i])) * CYBERFM_FNV1A_64_PRIME; }
+    for (i = commonLength; i < pLengths[3]; i += 1) { hash3 = (hash3 ^ cyberfm_normalize_path_char((uint8_t)ppPaths[3][i])) * CYBERFM_FNV1A_64_PRIME; }
+
+    pHashes[0] = hash0;
+    pHashes[1] = hash1;
+    pHashes[2] = hash2;
+    pHashes[3] = hash3;
+}
+
+cyberfm_result cyberfm_file_open_by_path_ex(cyberfm_archive* pArchive, const char* pPath, uint32_t subfile, uint32_t flags, cyberfm_file** ppFile)
+{
+    if (pPath == NULL) {
+        if (ppFile != NULL) {
+            *ppFile = NULL;
+        }
+
+        return CYBERFM_INVALID_ARGS;
+    }
+
+    return cyberfm_file_open_ex(pArchive, cyberfm_hash_path(pPath), subfile, flags, ppFile);
+}
+
+cyberfm_result cyberfm_file_open_by_path(cyberfm_archive* pArchive, const char* pPath, uint32_t subfile, cyberfm_file** ppFile)
+{
+    return cyberfm_file_open_by_path_ex(pArchive, pPath, subfile, 0, ppFile);
+}
+
+
+cyberfm_archive_entry_filter cyberfm_archive_entry_filter_init(void)
+{
+    cyberfm_archive_entry_filter filter;
+
+    CYBERFM_ZERO_OBJECT(&filter);
+    filter.maxUncompressedSize = ~(uint64_t)0;
+    filter.minRatio            = 0;
+    filter.maxRatio            = 1e30;  /* A compressed size can technically be bigger than the uncompressed size. */
+
+    return filter;
+}
+
+cyberfm_bool32 cyberfm_archive_entry_filter_test(const cyberfm_archive_entry_filter* pFilter, const cyberfm_archive_entry* pEntry)
+{
+    double ratio;
+
+    if (pFilter == NULL) {
+        return CYBERFM_TRUE;
+    }
+
+    if (pEntry->uncompressedSize < pFilter->minUncompressedSize || pEntry->uncompressedSize > pFilter->maxUncompressedSize) {
+        return CYBERFM_FALSE;
+    }
+
+    ratio = (pEntry->uncompressedSize > 0) ? (double)pEntry->compressedSize / (double)pEntry->uncompressedSize : 1;
+    if (ratio < pFilter->minRatio || ratio > pFilter->maxRatio) {
+        return CYBERFM_FALSE;
+    }
+
+    return CYBERFM_TRUE;
+}
+
+cyberfm_result cyberfm_archive_get_entry(cyberfm_archive* pArchive, uint32_t fileIndex, cyberfm_archive_entry* pEntry)
+{
+    const cyberfm_archive_file_info* pFileInfo;
+    uint32_t iDataSpec;
+
+    if (pEntry == NULL) {
+        return CYBERFM_INVALID_ARGS;
+    }
+
+    CYBERFM_ZERO_OBJECT(pEntry);
+
+    if (pArchive == NULL || fileIndex >= pArchive->pCentralDirectory->fileInfoCount) {
+        return CYBERFM_INVALID_ARGS;
+    }
+
+    pFileInfo = &pArchive->pCentralDirectory->pFileInfo[fileIndex];
+    if (pFileInfo->dataSpecRangeBeg > pFileInfo->dataSpecRangeEnd || pFileInfo->dataSpecRangeEnd > pArchive->pCentralDirectory->fileDataSpecCount) {
+        return CYBERFM_CORRUPT_DATA;
+    }
+
+    pEntry->hashedName   = pFileInfo->hashedName;
+    pEntry->fileIndex    = fileIndex;
+    pEntry->subFileCount = pFileInfo->dataSpecRangeEnd - pFileInfo->dataSpecRangeBeg;
+    pEntry->unknown1     = pFileInfo->unknown1;
+
+    if (pEntry->subFileCount > 0) {
+        pEntry->offset = pArchive->pCentralDirectory->pFileDataSpec[pFileInfo->dataSpecRangeBeg].offset;
+    }
+
+    for (iDataSpec = pFileInfo->dataSpecRangeBeg; iDataSpec < pFileInfo->dataSpecRangeEnd; iDataSpec += 1) {
+        pEntry->compressedSize   += pArchive->pCentralDirectory->pFileDataSpec[iDataSpec].compressedSize;
+        pEntry->uncompressedSize += pArchive->pCentralDirectory->pFileDataSpec[iDataSpec].uncompressedSize;
+    }
+
+    return CYBERFM_SUCCESS;
+}
+
+cyberfm_result cyberfm_archive_iterator_init(cyberfm_archive* pArchive, const cyberfm_archive_entry_filter* pFilter, cyberfm_archive_iterator* pIterator)
+{
+    if (pIterator == NULL) {
+        return CYBERFM_INVALID_ARGS;
+    }
+
+    CYBERFM_ZERO_OBJECT(pIterator);
+
+    if (pArchive == NULL) {
+        return CYBERFM_INVALID_ARGS;
+    }
+
+    pIterator->pArchive = pArchive;
+
+    if (pFilter != NULL) {
+        pIterator->filter    = *pFilter;
+        pIterator->hasFilter = CYBERFM_TRUE;
+    }
+
+    return CYBERFM_SUCCESS;
+}
+
+cyberfm_bool32 cyberfm_archive_iterator_next(cyberfm_archive_iterator* pIterator)
+{
+    const cyberfm_archive_entry_filter* pFilter;
+
+    if (pIterator == NULL || pIterator->pArchive == NULL) {
+        return CYBERFM_FALSE;
+    }
+
+    pFilter = (pIterator->hasFilter) ? &pIterator->filter : NULL;
+
+    for (;;) {
+        uint32_t iFile;
+
+        if (pFilter != NULL && pFilter->pHashedNames != NULL) {
+            /* Only looking for specific files. */
+            if (pIterator->next >= pFilter->hashedNameCount) {
+                return CYBERFM_FALSE;
+            }
+
+            if (cyberfm_archive_find(pIterator->pArchive, pFilter->pHashedNames[pIterator->next++], &iFile) != CYBERFM_SUCCESS) {
+                continue;   /* Not in this archive. */
+            }
+        } else {
+            if (pIterator->next >= pIterator->pArchive->pCentralDirectory->fileInfoCount) {
+                return CYBERFM_FALSE;
+            }
+
+            iFile = pIterator->next++;
+        }
+
+        /* Files with a corrupt range are skipped. */
+        if (cyberfm_archive_get_entry(pIterator->pArchive, iFile, &pIterator->entry) == CYBERFM_SUCCESS && cyberfm_archive_entry_filter_test(pFilter, &pIterator->entry)) {
+            return CYBERFM_TRUE;
+        }
+    }
+}
+
+
+typedef struct
+{
+    const char* pSignature;
+    size_t signatureSize;
+    uint32_t type;
+} cyberfm_content_signature;
+
+static const cyberfm_content_signature g_cyberfmContentSignatures[] = {
+    {"CR2W",                  4, CYBERFM_CONTENT_TYPE_CR2W },
+    {"RIFF",                  4, CYBERFM_CONTENT_TYPE_RIFF },
+    {"BKHD",                  4, CYBERFM_CONTENT_TYPE_BANK },
+    {"DDS ",                  4, CYBERFM_CONTENT_TYPE_DDS  },
+    {"\x89PNG\r\n\x1A\n",     8, CYBERFM_CONTENT_TYPE_PNG  },
+    {"\xFF\xD8\xFF",          3, CYBERFM_CONTENT_TYPE_JPEG },
+    {"OggS",                  4, CYBERFM_CONTENT_TYPE_OGG  },
+    {"PK\x03\x04",            4, CYBERFM_CONTENT_TYPE_ZIP  },
+    {"<?xml",                 5, CYBERFM_CONTENT_TYPE_XML  },
+    {"\xEF\xBB\xBF<?xml",     8, CYBERFM_CONTENT_TYPE_XML  }  /* With a UTF-8 BOM. */
+};
+
+static const char* g_cyberfmContentTypeNames[CYBERFM_CONTENT_TYPE_COUNT] = {
+    "unknown",
+    "empty",
+    "cr2w",
+    "riff",
+    "bank",
+    "dds",
+    "png",
+    "jpeg",
+    "ogg",
+    "zip",
+    "xml"
+};
+
+uint32_t cyberfm_classify_content(const void* pData, size_t dataSize)
+{
+    size_t iSignature;
+
+    if (dataSize == 0) {
+        return CYBERFM_CONTENT_TYPE_EMPTY;
+    }
+
+    if (pData == NULL) {
+        return CYBERFM_CONTENT_TYPE_UNKNOWN;
+    }
+
+    for (iSignature = 0; iSignature < sizeof(g_cyberfmContentSignatures)/sizeof(g_cyberfmContentSignatures[0]); iSignature += 1) {
+        const cyberfm_content_signature* pSignature = &g_cyberfmContentSignatures[iSignature];
+        if (dataSize >= pSignature->signatureSize && memcmp(pData, pSignature->pSignature, pSignature->signatureSize) == 0) {
+            return pSignature->type;
+        }
+    }
+
+    return CYBERFM_CONTENT_TYPE_UNKNOWN;
+}
+
+const char* cyberfm_content_type_to_string(uint32_t type)
+{
+    if (type >= CYBERFM_CONTENT_TYPE_COUNT) {
+        return "unknown";
+    }
+
+    return g_cyberfmContentTypeNames[type];
+}
+
+cyberfm_result cyberfm_content_type_from_string(const char* pName, uint32_t* pType)
+{
+    uint32_t iType;
+
+    if (pName == NULL || pType == NULL) {
+        return CYBERFM_INVALID_ARGS;
+    }
+
+    for (iType = 0; iType < CYBERFM_CONTENT_TYPE_COUNT; iType += 1) {
+        if (strcmp(pName, g_cyberfmContentTypeNames[iType]) == 0) {
+            *pType = iType;
+            return CYBERFM_SUCCESS;
+        }
+    }
+
+    return CYBERFM_DOES_NOT_EXIST;
+}
+
+
+/*
+The saved type index is a header followed by an entry for each data spec. Like the manifest, it's in native byte order and
+is only meant to be read by the machine that wrote it.
+*/
+#define CYBERFM_TYPE_INDEX_FOURCC   0x49544643  /* "CFTI" */
+#define CYBERFM_TYPE_INDEX_VERSION  1
+#define CYBERFM_TYPE_INDEX_JOB_SIZE 1024        /* The number of sub-files classified by each job when building the index. */
+
+typedef struct
+{
+    uint32_t fourcc;
+    uint32_t version;
+    uint32_t entryCount;
+    uint32_t entrySize;
+    uint64_t archiveFileSize;
+    int64_t archiveModifiedTime;
+    uint64_t centralDirChecksum;
+} cyberfm_type_index_header;
+
+typedef struct
+{
+    cyberfm_archive* pArchive;
+    cyberfm_type_index* pIndex;
+    volatile uint32_t failedCount;
+} cyberfm_type_index_build_context;
+
+static void cyberfm_type_index_build_job_proc(void* pUserData, uint32_t jobIndex)
+{
+    cyberfm_type_index_build_context* pContext = (cyberfm_type_index_build_context*)pUserData;
+    uint32_t iDataSpecBeg = jobIndex * CYBERFM_TYPE_INDEX_JOB_SIZE;
+    uint32_t iDataSpecEnd = CYBERFM_MIN(iDataSpecBeg + CYBERFM_TYPE_INDEX_JOB_SIZE, pContext->pIndex->entryCount);
+    uint32_t iDataSpec;
+    uint32_t failedCount = 0;
+
+    for (iDataSpec = iDataSpecBeg; iDataSpec < iDataSpecEnd; iDataSpec += 1) {
+        cyberfm_type_index_entry* pEntry = &pContext->pIndex->pEntries[iDataSpec];
+        uint8_t data[CYBERFM_CONTENT_PEEK_SIZE];
+        size_t dataSize;
+
+        /* Zeroed so the magic of tiny sub-files is padded with zeros. */
+        memset(data, 0, sizeof(data));
+
+        if (cyberfm_archive_peek_data_spec(pContext->pArchive, &pContext->pArchive->pCentralDirectory->pFileDataSpec[iDataSpec], data, sizeof(data), &dataSize) == CYBERFM_SUCCESS) {
+            pEntry->magic = cyberfm_read_le32(data);
+            pEntry->type  = cyberfm_classify_content(data, dataSize);
+        } else {
+            pEntry->magic = 0;
+            pEntry->type  = CYBERFM_CONTENT_TYPE_UNKNOWN;
+            failedCount += 1;
+        }
+    }
+
+    if (failedCount > 0) {
+        cyberfm_atomic_fetch_add_32(&pContext->failedCount, failedCount);
+    }
+}
+
+static cyberfm_result cyberfm_type_index_build(cyberfm_archive* pArchive, uint32_t threadCount, cyberfm_type_index* pIndex)
+{
+    cyberfm_type_index_build_context context;
+    cyberfm_job_pool pool;
+    cyberfm_job_pool_config poolConfig;
+    uint32_t jobCount;
+    uint32_t iJob;
+
+    context.pArchive    = pArchive;
+    context.pIndex      = pIndex;
+    context.failedCount = 0;
+
+    jobCount = (pIndex->entryCount + CYBERFM_TYPE_INDEX_JOB_SIZE - 1) / CYBERFM_TYPE_INDEX_JOB_SIZE;
+
+    poolConfig = cyberfm_job_pool_config_init(threadCount, jobCount, cyberfm_type_index_build_job_proc, &context);
+
+    if (jobCount > 1 && cyberfm_job_pool_init(&poolConfig, &pool) == CYBERFM_SUCCESS) {
+        cyberfm_job_pool_uninit(&pool);
+    } else {
+        /* Couldn't create the pool. Just do it on this thread. */
+        for (iJob = 0; iJob < jobCount; iJob += 1) {
+            cyberfm_type_index_build_job_proc(&context, iJob);
+        }
+    }
+
+    pIndex->failedCount = context.failedCount;
+
+    return CYBERFM_SUCCESS;
+}
+
+static void cyberfm_type_index_header_init(cyberfm_archive* pArchive, uint32_t entryCount, cyberfm_type_index_header* pHeader)
+{
+    CYBERFM_ZERO_OBJECT(pHeader);
+    pHeader->fourcc              = CYBERFM_TYPE_INDEX_FOURCC;
+    pHeader->version             = CYBERFM_TYPE_INDEX_VERSION;
+    pHeader->entryCount          = entryCount;
+    pHeader->entrySize           = sizeof(cyberfm_type_index_entry);
+    pHeader->archiveFileSize     = pArchive->fileSize;
+    pHeader->archiveModifiedTime = pArchive->fileModifiedTime;
+    pHeader->centralDirChecksum  = pArchive->pCentralDirectory->unknown0;
+}
+
+/* Loads the index from a file. Fails if the file is missing, or if it was saved from a different version of the archive. */
+static cyberfm_result cyberfm_type_index_load(cyberfm_archive* pArchive, const char* pFilePath, cyberfm_type_index* pIndex)
+{
+    FILE* pFile;
+    cyberfm_type_index_header header;
+    cyberfm_type_index_header expectedHeader;
+
+    if (mfs_fopen(&pFile, pFilePath, "rb") != MFS_SUCCESS) {
+        return CYBERFM_DOES_NOT_EXIST;
+    }
+
+    cyberfm_type_index_header_init(pArchive, pArchive->pCentralDirectory->fileDataSpecCount, &expectedHeader);
+
+    if (fread(&header, sizeof(header), 1, pFile) != 1 || memcmp(&header, &expectedHeader, sizeof(header)) != 0) {
+        mfs_fclose(pFile);
+        return CYBERFM_CORRUPT_DATA;    /* Not an index, or the archive has changed. */
+    }
+
+    if (fread(pIndex->pEntries, sizeof(*pIndex->pEntries), pIndex->entryCount, pFile) != pIndex->entryCount) {
+        mfs_fclose(pFile);
+        return CYBERFM_CORRUPT_DATA;
+    }
+
+    mfs_fclose(pFile);
+
+    return CYBERFM_SUCCESS;
+}
+
+cyberfm_result cyberfm_type_index_save(const cyberfm_type_index* pIndex, cyberfm_archive* pArchive, const char* pFilePath)
+{
+    FILE* pFile;
+    cyberfm_type_index_header header;
+    char tempPath[4096];
+    cyberfm_bool32 success;
+
+    if (pIndex == NULL || pArchive == NULL || pFilePath == NULL || pIndex->entryCount != pArchive->pCentralDirectory->fileDataSpecCount) {
+        return CYBERFM_INVALID_ARGS;
+    }
+
+    /* Written to a temporary file first so an interrupted save doesn't leave a broken index behind. */
+    snprintf(tempPath, sizeof(tempPath), "%s.tmp", pFilePath);
+
+    if (mfs_fopen(&pFile, tempPath, "wb") != MFS_SUCCESS) {
+        return CYBERFM_ACCESS_DENIED;
+    }
+
+    cyberfm_type_index_header_init(pArchive, pIndex->entryCount, &header);
+
+    success =
+        fwrite(&header, sizeof(header), 1, pFile) == 1 &&
+        fwrite(pIndex->pEntries, sizeof(*pIndex->pEntries), pIndex->entryCount, pFile) == pIndex->entryCount;
+
+    mfs_fclose(pFile);
+
+    if (!success) {
+        remove(tempPath);
+        return CYBERFM_ERROR;
+    }
+
+#ifdef _WIN32
+    if (!MoveFileExA(tempPath, pFilePath, MOVEFILE_REPLACE_EXISTING)) {
+        remove(tempPath);
+        return CYBERFM_ACCESS_DENIED;
+    }
+#else
+    if (rename(tempPath, pFilePath) != 0) {
+        remove(tempPath);
+        return CYBERFM_ACCESS_DENIED;
+    }
+#endif
+
+    return CYBERFM_SUCCESS;
+}
+
+cyberfm_type_index_config cyberfm_type_index_config_init(void)
+{
+    cyberfm_type_index_config config;
+
+    CYBERFM_ZERO_OBJECT(&config);
+
+    return config;
+}
+
+cyberfm_result cyberfm_type_index_init(cyberfm_archive* pArchive, const cyberfm_type_index_config* pConfig, cyberfm_type_index* pIndex)
+{
+    cyberfm_result result;
+    cyberfm_type_index_config config;
+
+    if (pIndex == NULL) {
+        return CYBERFM_INVALID_ARGS;
+    }
+
+    CYBERFM_ZERO_OBJECT(pIndex);
+
+    if (pArchive == NULL) {
+        return CYBERFM_INVALID_ARGS;
+    }
+
+    if (pConfig != NULL) {
+        config = *pConfig;
+    } else {
+        config = cyberfm_type_index_config_init();
+    }
+
+    pIndex->entryCount = pArchive->pCentralDirectory->fileDataSpecCount;
+    pIndex->pEntries   = (cyberfm_type_index_entry*)calloc((size_t)pIndex->entryCount + 1, sizeof(*pIndex->pEntries));
+    if (pIndex->pEntries == NULL) {
+        return CYBERFM_OUT_OF_MEMORY;
+    }
+
+    if (config.pFilePath != NULL && cyberfm_type_index_load(pArchive, config.pFilePath, pIndex) == CYBERFM_SUCCESS) {
+        pIndex->isLoaded = CYBERFM_TRUE;
+        return CYBERFM_SUCCESS;
+    }
+
+    result = cyberfm_type_index_build(pArchive, config.threadCount, pIndex);
+    if (result != CYBERFM_SUCCESS) {
+        cyberfm_type_index_uninit(pIndex);
+        return result;
+    }
+
+    /* Sub-files that couldn't be read might be readable next time (Oodle might be available) so don't save those. */
+    if (config.pFilePath != NULL && pIndex->failedCount == 0) {
+        cyberfm_type_index_save(pIndex, pArchive, config.pFilePath);
+    }
+
+    return CYBERFM_SUCCESS;
+}
+
+void cyberfm_type_index_uninit(cyberfm_type_index* pIndex)
+{
+    if (pIndex == NULL) {
+        return;
+    }
+
+    free(pIndex->pEntries);
+    CYBERFM_ZERO_OBJECT(pIndex);
+}
+
+uint32_t cyberfm_type_index_get_file_type(const cyberfm_type_index* pIndex, cyberfm_archive* pArchive, uint32_t fileIndex)
+{
+    const cyberfm_archive_file_info* pFileInfo;
+
+    if (pIndex == NULL || pArchive == NULL || fileIndex >= pArchive->pCentralDirectory->fileInfoCount) {
+        return CYBERFM_CONTENT_TYPE_UNKNOWN;
+    }
+
+    pFileInfo = &pArchive->pCentralDirectory->pFileInfo[fileIndex];
+    if (pFileInfo->dataSpecRangeBeg >= pFileInfo->dataSpecRangeEnd) {
+        return CYBERFM_CONTENT_TYPE_EMPTY;
+    }
+
+    if (pFileInfo->dataSpecRangeBeg >= pIndex->entryCount) {
+        return CYBERFM_CONTENT_TYPE_UNKNOWN;
+    }
+
+    return pIndex->pEntries[pFileInfo->dataSpecRangeBeg].type;
+}
+
+void cyberfm_file_close(cyberfm_file* pFile)
+{
+    if (pFile == NULL) {
+        return;
+    }
+
+    if (pFile->pCacheEntry != NULL) {
+        cyberfm_mutex_lock(&pFile->pArchive->cache.lock);
+        {
+            cyberfm_cache_release(pFile->pArchive, pFile->pCacheEntry);
+        }
+        cyberfm_mutex_unlock(&pFile->pArchive->cache.lock);
+    }
+
+    free(pFile->stream.pDecodedData);
+    cyberfm_archive_free_file(pFile->pArchive, pFile);
+}
+
+/*
+Reads from a streamed file that has not been fully loaded into memory. The caller has already checked that the read is
+in range. Compressed files are decoded in full on the first read since Oodle can only decode a whole block at a time.
+Uncompressed files are read through the window. Reads that are at least as big as the window bypass it and go straight
+into the output buffer.
+*/
+static cyberfm_result cyberfm_file_read_streamed(cyberfm_file* pFile, uint8_t* pDst, size_t dataSize)
+{
+    cyberfm_result result;
+    uint64_t cursor = pFile->cursor;
+
+    if (pFile->pDataSpec->compressedSize != pFile->pDataSpec->uncompressedSize) {
+        pFile->stream.pDecodedData = (uint8_t*)malloc((size_t)pFile->size + 1);    /* +1 so we don't try allocating 0 bytes for empty files. */
+        if (pFile->stream.pDecodedData == NULL) {
+            return CYBERFM_OUT_OF_MEMORY;
+        }
+
+        result = cyberfm_archive_decompress(pFile->pArchive, pFile->pDataSpec, pFile->stream.pDecodedData);
+        if (result != CYBERFM_SUCCESS) {
+            free(pFile->stream.pDecodedData);
+            pFile->stream.pDecodedData = NULL;
+            return result;
+        }
+
+        pFile->pData = pFile->stream.pDecodedData;
+        memcpy(pDst, pFile->pData + cursor, dataSize);
+
+        return CYBERFM_SUCCESS;
+    }
+
+    while (dataSize > 0) {
+        size_t bytesCopied;
+
+        if (cursor >= pFile->stream.windowOffset && cursor < (pFile->stream.windowOffset + pFile->stream.windowSize)) {
+            /* The data is in the window. */
+            bytesCopied = (size_t)CYBERFM_MIN(dataSize, (pFile->stream.windowOffset + pFile->stream.windowSize) - cursor);
+            memcpy(pDst, pFile->pPayload + (cursor - pFile->stream.windowOffset), bytesCopied);
+        } else if (dataSize >= pFile->stream.windowCap) {
+            /* Big reads go straight into the output buffer. */
+            result = cyberfm_archive_read_at(pFile->pArchive, pFile->pDataSpec->offset + cursor, pDst, dataSize);
+            if (result != CYBERFM_SUCCESS) {
+                return result;
+            }
+
+            bytesCopied = dataSize;
+        } else {
+            /* Not in the window. Move the window to the cursor and try again. */
+            size_t bytesToRead = (size_t)CYBERFM_MIN(pFile->stream.windowCap, pFile->size - cursor);
+
+            pFile->stream.windowSize = 0;   /* In case the read fails. */
+
+            result = cyberfm_archive_read_at(pFile->pArchive, pFile->pDataSpec->offset + cursor, pFile->pPayload, bytesToRead);
+            if (result != CYBERFM_SUCCESS) {
+                return result;
+            }
+
+            pFile->stream.windowOffset = cursor;
+            pFile->stream.windowSize   = bytesToRead;
+            continue;
+        }
+
+        pDst     += bytesCopied;
+        cursor   += bytesCopied;
+        dataSize -= bytesCopied;
+    }
+
+    return CYBERFM_SUCCESS;
+}
+
+cyberfm_result cyberfm_file_read(cyberfm_file* pFile, void* pData, size_t dataSize)
+{
+    cyberfm_result result;
+
+    if (pFile == NULL || pData == NULL) {
+        return CYBERFM_INVALID_ARGS;
+    }
+
+    if (dataSize > (pFile->size - pFile->cursor)) {
+        return CYBERFM_INVALID_ARGS;    /* Trying to read too much. */
+    }
+
+    if (pFile->pData != NULL) {
+        memcpy(pData, pFile->pData + pFile->cursor, dataSize);
+    } else {
+        result = cyberfm_file_read_streamed(pFile, (uint8_t*)pData, dataSize);
+        if (result != CYBERFM_SUCCESS) {
+            return result;
+        }
+    }
+
+    pFile->cursor += dataSize;
+
+    return CYBERFM_SUCCESS;
+}
+
+cyberfm_result cyberfm_file_seek(cyberfm_file* pFile, int64_t offset, int origin)
+{
+    if (pFile == NULL) {
+        return CYBERFM_INVALID_ARGS;
+    }
+
+    switch (origin)
+    {
+        case SEEK_SET:
+        {
+            if (offset < 0 || (uint64_t)offset > pFile->size) {
+                return CYBERFM_INVALID_ARGS;    /* Seeking out of bounds. */
+            }
+
+            pFile->cursor = (uint64_t)offset;
+        } break;
+
+        case SEEK_CUR:
+        {
+            if (offset < 0) {
+                if ((uint64_t)-offset > pFile->cursor) {
+                    return CYBERFM_INVALID_ARGS;    /* Trying to seek too far backwards. */
+                }
+            } else {
+                if ((uint64_t)offset > (pFile->size - pFile->cursor)) {
+                    return CYBERFM_INVALID_ARGS;    /* Trying to seek too far forward. */
+                }
+            }
+
+            pFile->cursor = (uint64_t)(pFile->cursor + offset);
+        } break;
+
+        case SEEK_END:
+        {
+            if (offset < 0) {
+                return CYBERFM_INVALID_ARGS;
+            }
+
+            pFile->cursor = pFile->size - offset;
+        } break;
+
+        default: return CYBERFM_INVALID_ARGS;
+    }
+
+    return CYBERFM_SUCCESS;
+}
+
+cyberfm_bool32 cyberfm_file_eof(cyberfm_file* pFile)
+{
+    if (pFile == NULL) {
+        return CYBERFM_FALSE;
+    }
+
+    return pFile->cursor == pFile->size;
+}
+
+
+static uint32_t cyberfm_vfs_hash_slot(uint64_t hashedName, uint32_t cap)
+{
+    /* The hashed name is already a hash, but we give it a quick mix in case the low bits aren't well distributed. */
+    return (uint32_t)((hashedName * 0x9E3779B97F4A7C15ULL) >> 32) & (cap - 1);
+}
+
+static void cyberfm_vfs_insert_entry(cyberfm_vfs_entry* pEntries, uint32_t cap, const cyberfm_vfs_entry* pEntry, uint32_t* pEntryCount)
+{
+    uint32_t iSlot = cyberfm_vfs_hash_slot(pEntry->hashedName, cap);
+
+    for (;;) {
+        if (pEntries[iSlot].archiveIndex == CYBERFM_VFS_EMPTY_ENTRY) {
+            pEntries[iSlot] = *pEntry;
+            *pEntryCount += 1;
+            return;
+        }
+
+        if (pEntries[iSlot].hashedName == pEntry->hashedName) {
+            pEntries[iSlot] = *pEntry;  /* Later mounts override earlier ones. */
+            return;
+        }
+
+        iSlot = (iSlot + 1) & (cap - 1);
+    }
+}
+
+static cyberfm_result cyberfm_vfs_reserve_entries(cyberfm_vfs* pVFS, uint32_t additionalCount)
+{
+    uint64_t requiredCount;
+    uint32_t newCap;
+    cyberfm_vfs_entry* pNewEntries;
+    uint32_t newEntryCount;
+    uint32_t iSlot;
+
+    /* We keep the load factor below 3/4 to keep probe sequences short. */
+    requiredCount = (uint64_t)pVFS->entryCount + additionalCount;
+    if (pVFS->entryCap > 0 && requiredCount <= ((uint64_t)pVFS->entryCap * 3) / 4) {
+        return CYBERFM_SUCCESS;
+    }
+
+    newCap = (pVFS->entryCap > 0) ? pVFS->entryCap : 1024;
+    while (requiredCount > ((uint64_t)newCap * 3) / 4) {
+        if (newCap >= 0x80000000) {
+            return CYBERFM_OUT_OF_MEMORY;
+        }
+
+        newCap *= 2;
+    }
+
+    pNewEntries = (cyberfm_vfs_entry*)malloc(sizeof(*pNewEntries) * newCap);
+    if (pNewEntries == NULL) {
+        return CYBERFM_OUT_OF_MEMORY;
+    }
+
+    memset(pNewEntries, 0xFF, sizeof(*pNewEntries) * newCap);  /* Sets archiveIndex to CYBERFM_VFS_EMPTY_ENTRY. */
+
+    newEntryCount = 0;
+    for (iSlot = 0; iSlot < pVFS->entryCap; iSlot += 1) {
+        if (pVFS->pEntries[iSlot].archiveIndex != CYBERFM_VFS_EMPTY_ENTRY) {
+            cyberfm_vfs_insert_entry(pNewEntries, newCap, &pVFS->pEntries[iSlot], &newEntryCount);
+        }
+    }
+
+    free(pVFS->pEntries);
+    pVFS->pEntries   = pNewEntries;
+    pVFS->entryCap   = newCap;
+    pVFS->entryCount = newEntryCount;
+
+    return CYBERFM_SUCCESS;
+}
+
+/*
+The index cache file has the following layout. Everything is little-endian.
+
+    cyberfm_index_cache_header
+    cyberfm_index_cache_record[recordCount]
+    Archive paths (not null terminated)
+    Central directories, each one positioned such that it's sections are aligned to 8 bytes
+
+Each central directory is stored exactly as it is in the archive, starting from it's FourCC.
+*/
+#define CYBERFM_INDEX_CACHE_FOURCC  0x494D4643   /* "CFMI" */
+#define CYBERFM_INDEX_CACHE_VERSION 1
+
+typedef struct
+{
+    uint32_t fourcc;
+    uint32_t version;
+    uint32_t recordCount;
+    uint32_t reserved;
+} cyberfm_index_cache_header;
+
+typedef struct
+{
+    uint64_t pathOffset;
+    uint64_t pathLength;
+    uint64_t archiveFileSize;
+    int64_t archiveModifiedTime;
+    uint64_t centralDirOffset;  /* The offset of the central directory in the cache file. */
+    uint64_t centralDirSize;
+} cyberfm_index_cache_record;
+
+static void cyberfm_vfs_close_index_cache(cyberfm_vfs* pVFS)
+{
+    cyberfm_unmap_file(pVFS->indexCache.pData, pVFS->indexCache.size, pVFS->indexCache.hMapping);
+
+    if (pVFS->indexCache.pFile != NULL) {
+        mfs_fclose(pVFS->indexCache.pFile);
+    }
+
+    pVFS->indexCache.pData       = NULL;
+    pVFS->indexCache.size        = 0;
+    pVFS->indexCache.hMapping    = NULL;
+    pVFS->indexCache.pFile       = NULL;
+    pVFS->indexCache.recordCount = 0;
+}
+
+static void cyberfm_vfs_open_index_cache(cyberfm_vfs* pVFS)
+{
+    struct _stat64 info;
+    cyberfm_index_cache_header header;
+    const cyberfm_index_cache_record* pRecords;
+    uint32_t iRecord;
+
+    /* Any failure here just means we don't have a usable cache. It'll be rebuilt. */
+    pVFS->indexCache.isDirty = CYBERFM_TRUE;
+
+    if (mfs_fopen(&pVFS->indexCache.pFile, pVFS->indexCache.pFilePath, "rb") != MFS_SUCCESS) {
+        pVFS->indexCache.pFile = NULL;
+        return;
+    }
+
+    if (mfs_fstat(pVFS->indexCache.pFile, &info) != MFS_SUCCESS || (uint64_t)info.st_size < sizeof(header)) {
+        cyberfm_vfs_close_index_cache(pVFS);
+        return;
+    }
+
+    if (cyberfm_map_file(pVFS->indexCache.pFile, (uint64_t)info.st_size, &pVFS->indexCache.pData, &pVFS->indexCache.hMapping) != CYBERFM_SUCCESS) {
+        cyberfm_vfs_close_index_cache(pVFS);
+        return;
+    }
+
+    pVFS->indexCache.size = (uint64_t)info.st_size;
+
+    memcpy(&header, pVFS->indexCache.pData, sizeof(header));
+    if (header.fourcc != CYBERFM_INDEX_CACHE_FOURCC || header.version != CYBERFM_INDEX_CACHE_VERSION) {
+        cyberfm_vfs_close_index_cache(pVFS);
+        return;
+    }
+
+    if (sizeof(header) + ((uint64_t)header.recordCount * sizeof(*pRecords)) > pVFS->indexCache.size) {
+        cyberfm_vfs_close_index_cache(pVFS);
+        return;
+    }
+
+    /* Make sure everything is in bounds up front so we don't need to worry about it later. */
+    pRecords = (const cyberfm_index_cache_record*)(pVFS->indexCache.pData + sizeof(header));
+    for (iRecord = 0; iRecord < header.recordCount; iRecord += 1) {
+        if (pRecords[iRecord].pathOffset       > pVFS->indexCache.size || pRecords[iRecord].pathLength     > pVFS->indexCache.size - pRecords[iRecord].pathOffset ||
+            pRecords[iRecord].centralDirOffset > pVFS->indexCache.size || pRecords[iRecord].centralDirSize > pVFS->indexCache.size - pRecords[iRecord].centralDirOffset) {
+            cyberfm_vfs_close_index_cache(pVFS);
+            return;
+        }
+    }
+
+    pVFS->indexCache.recordCount = header.recordCount;
+    pVFS->indexCache.isDirty     = CYBERFM_FALSE;
+}
+
+static const cyberfm_index_cache_record* cyberfm_vfs_find_index_cache_record(cyberfm_vfs* pVFS, const char* pArchivePath)
+{
+    const cyberfm_index_cache_record* pRecords;
+    size_t pathLength;
+    uint32_t iRecord;
+
+    if (pVFS->indexCache.pData == NULL) {
+        return NULL;
+    }
+
+    pRecords   = (const cyberfm_index_cache_record*)(pVFS->indexCache.pData + sizeof(cyberfm_index_cache_header));
+    pathLength = strlen(pArchivePath);
+
+    for (iRecord = 0; iRecord < pVFS->indexCache.recordCount; iRecord += 1) {
+        if (pRecords[iRecord].pathLength == pathLength && memcmp(pVFS->indexCache.pData + pRecords[iRecord].pathOffset, pArchivePath, pathLength) == 0) {
+            return &pRecords[iRecord];
+        }
+    }
+
+    return NULL;
+}
+
+static uint64_t cyberfm_archive_get_central_directory_data_size(cyberfm_archive* pArchive)
+{
+    return 28 + ((uint64_t)pArchive->pCentralDirectory->fileInfoCount * 56) + ((uint64_t)pArchive->pCentralDirectory->fileDataSpecCount * 16) + ((uint64_t)pArchive->pCentralDirectory->unknownDataCount * 8);
+}
+
+static cyberfm_bool32 cyberfm_fwrite_all(FILE* pFile, const void* pData, size_t dataSize)
+{
+    return fwrite(pData, 1, dataSize, pFile) == dataSize;
+}
+
+static cyberfm_bool32 cyberfm_write_central_directory(FILE* pFile, cyberfm_archive* pArchive)
+{
+    const cyberfm_archive_central_directory* pCentralDirectory = pArchive->pCentralDirectory;
+    const cyberfm_archive_central_directory_unknown_data* pUnknownData;
+
+    /* The unknown section is deferred so it might need to be loaded first. */
+    if (cyberfm_archive_get_unknown_data(pArchive, &pUnknownData) != CYBERFM_SUCCESS) {
+        return CYBERFM_FALSE;
+    }
+
+    return
+        cyberfm_fwrite_all(pFile, &pCentralDirectory->fourcc,            4) &&
+        cyberfm_fwrite_all(pFile, &pCentralDirectory->size,              4) &&
+        cyberfm_fwrite_all(pFile, &pCentralDirectory->unknown0,          8) &&
+        cyberfm_fwrite_all(pFile, &pCentralDirectory->fileInfoCount,     4) &&
+        cyberfm_fwrite_all(pFile, &pCentralDirectory->fileDataSpecCount, 4) &&
+        cyberfm_fwrite_all(pFile, &pCentralDirectory->unknownDataCount,  4) &&
+        cyberfm_fwrite_all(pFile, pCentralDirectory->pFileInfo,     (size_t)pCentralDirectory->fileInfoCount     * 56) &&
+        cyberfm_fwrite_all(pFile, pCentralDirectory->pFileDataSpec, (size_t)pCentralDirectory->fileDataSpecCount * 16) &&
+        cyberfm_fwrite_all(pFile, pUnknownData,                     (size_t)pCentralDirectory->unknownDataCount  * 8);
+}
+
+static size_t cyberfm_index_cache_padding(uint64_t offset)
+{
+    /* The padding required to get offset + 28 aligned to 8 bytes. */
+    return (size_t)((4 - (offset & 7)) & 7);
+}
+
+/* Writes the index cache to a temporary file. It's moved into place with cyberfm_vfs_commit_index_cache(). */
+static cyberfm_result cyberfm_vfs_write_index_cache(cyberfm_vfs* pVFS, char* pTempPath, size_t tempPathSize)
+{
+    FILE* pFile;
+    cyberfm_index_cache_header header;
+    uint64_t pathsOffset;
+    uint64_t dataOffset;
+    uint64_t offset;
+    uint32_t iArchive;
+    cyberfm_bool32 success = CYBERFM_TRUE;
+    static const uint8_t padding[8] = {0};
+
+    /*
+    The central directories are written out in native byte order, but are decoded as little-endian when loaded back in. Not
+    bothering with caching on big-endian hosts.
+    */
+    if (!cyberfm_is_little_endian()) {
+        return CYBERFM_INVALID_OPERATION;
+    }
+
+    snprintf(pTempPath, tempPathSize, "%s.tmp", pVFS->indexCache.pFilePath);
+
+    if (mfs_fopen(&pFile, pTempPath, "wb") != MFS_SUCCESS) {
+        return CYBERFM_ACCESS_DENIED;
+    }
+
+    header.fourcc      = CYBERFM_INDEX_CACHE_FOURCC;
+    header.version     = CYBERFM_INDEX_CACHE_VERSION;
+    header.recordCount = pVFS->archiveCount;
+    header.reserved    = 0;
+    success = success && cyberfm_fwrite_all(pFile, &header, sizeof(header));
+
+    /* Records first. Paths go straight after the records, and then the central directories. */
+    pathsOffset = sizeof(header) + ((uint64_t)sizeof(cyberfm_index_cache_record) * pVFS->archiveCount);
+    dataOffset  = pathsOffset;
+    for (iArchive = 0; iArchive < pVFS->archiveCount; iArchive += 1) {
+        dataOffset += strlen(pVFS->ppArchivePaths[iArchive]);
+    }
+
+    offset = dataOffset;
+    for (iArchive = 0; iArchive < pVFS->archiveCount; iArchive += 1) {
+        cyberfm_index_cache_record record;
+
+        /* The sections start 28 bytes in, and they need to be aligned to 8 bytes so they can be referenced directly. */
+        offset += cyberfm_index_cache_padding(offset);
+
+        record.pathOffset          = pathsOffset;
+        record.pathLength          = strlen(pVFS->ppArchivePaths[iArchive]);
+        record.archiveFileSize     = pVFS->ppArchives[iArchive]->fileSize;
+        record.archiveModifiedTime = pVFS->ppArchives[iArchive]->fileModifiedTime;
+        record.centralDirOffset    = offset;
+        record.centralDirSize      = cyberfm_archive_get_central_directory_data_size(pVFS->ppArchives[iArchive]);
+        success = success && cyberfm_fwrite_all(pFile, &record, sizeof(record));
+
+        pathsOffset += record.pathLength;
+        offset      += record.centralDirSize;
+    }
+
+    for (iArchive = 0; iArchive < pVFS->archiveCount; iArchive += 1) {
+        success = success && cyberfm_fwrite_all(pFile, pVFS->ppArchivePaths[iArchive], strlen(pVFS->ppArchivePaths[iArchive]));
+    }
+
+    offset = dataOffset;
+    for (iArchive = 0; iArchive < pVFS->archiveCount; iArchive += 1) {
+        size_t paddingSize = cyberfm_index_cache_padding(offset);
+
+        success = success && cyberfm_fwrite_all(pFile, padding, paddingSize);
+        success = success && cyberfm_write_central_directory(pFile, pVFS->ppArchives[iArchive]);
+
+        offset += paddingSize + cyberfm_archive_get_central_directory_data_size(pVFS->ppArchives[iArchive]);
+    }
+
+    mfs_fclose(pFile);
+
+    if (!success) {
+        remove(pTempPath);
+        return CYBERFM_ERROR;
+    }
+
+    return CYBERFM_SUCCESS;
+}
+
+static cyberfm_result cyberfm_vfs_commit_index_cache(cyberfm_vfs* pVFS, const char* pTempPath)
+{
+#ifdef _WIN32
+    if (!MoveFileExA(pTempPath, pVFS->indexCache.pFilePath, MOVEFILE_REPLACE_EXISTING)) {
+        remove(pTempPath);
+        return CYBERFM_ACCESS_DENIED;   /* Will fail if the old cache is still mapped. */
+    }
+#else
+    if (rename(pTempPath, pVFS->indexCache.pFilePath) != 0) {
+        remove(pTempPath);
+        return CYBERFM_ACCESS_DENIED;
+    }
+#endif
+
+    pVFS->indexCache.isDirty = CYBERFM_FALSE;
+
+    return CYBERFM_SUCCESS;
+}
+
+cyberfm_result cyberfm_vfs_save_index_cache(cyberfm_vfs* pVFS)
+{
+    cyberfm_result result;
+    char tempPath[4096];
+
+    if (pVFS == NULL || pVFS->indexCache.pFilePath == NULL) {
+        return CYBERFM_INVALID_ARGS;
+    }
+
+    result = cyberfm_vfs_write_index_cache(pVFS, tempPath, sizeof(tempPath));
+    if (result != CYBERFM_SUCCESS) {
+        return result;
+    }
+
+    return cyberfm_vfs_commit_index_cache(pVFS, tempPath);
+}
+
+cyberfm_vfs_config cyberfm_vfs_config_init(void)
+{
+    cyberfm_vfs_config config;
+
+    CYBERFM_ZERO_OBJECT(&config);
+    config.archiveConfig = cyberfm_archive_config_init(CYBERFM_ARCHIVE_FLAG_MEMORY_MAP);
+
+    return config;
+}
+
+cyberfm_result cyberfm_vfs_init(const cyberfm_vfs_config* pConfig, cyberfm_vfs* pVFS)
+{
+    if (pVFS == NULL) {
+        return CYBERFM_INVALID_ARGS;
+    }
+
+    CYBERFM_ZERO_OBJECT(pVFS);
+
+    if (pConfig != NULL) {
+        pVFS->config = *pConfig;
+    } else {
+        pVFS->config = cyberfm_vfs_config_init();
+    }
+
+    if (pVFS->config.pIndexCachePath != NULL) {
+        pVFS->indexCache.pFilePath = (char*)malloc(strlen(pVFS->config.pIndexCachePath) + 1);
+        if (pVFS->indexCache.pFilePath == NULL) {
+            return CYBERFM_OUT_OF_MEMORY;
+        }
+
+        strcpy(pVFS->indexCache.pFilePath, pVFS->config.pIndexCachePath);
+        pVFS->config.pIndexCachePath = pVFS->indexCache.pFilePath;
+
+        cyberfm_vfs_open_index_cache(pVFS);
+    }
+
+    return CYBERFM_SUCCESS;
+}
+
+void cyberfm_vfs_uninit(cyberfm_vfs* pVFS)
+{
+    uint32_t iArchive;
+    cyberfm_bool32 isIndexCacheWritten = CYBERFM_FALSE;
+    char indexCacheTempPath[4096];
+
+    if (pVFS == NULL) {
+        return;
+    }
+
+    /*
+    The index cache needs to be rewritten if anything has changed. The archives may be referencing the old cache so we need
+    to write the new one to a temporary file and then move it into place once everything has been unmapped.
+    */
+    if (pVFS->indexCache.pFilePath != NULL && (pVFS->indexCache.isDirty || pVFS->indexCache.recordCount != pVFS->archiveCount)) {
+        isIndexCacheWritten = cyberfm_vfs_write_index_cache(pVFS, indexCacheTempPath, sizeof(indexCacheTempPath)) == CYBERFM_SUCCESS;
+    }
+
+    for (iArchive = 0; iArchive < pVFS->archiveCount; iArchive += 1) {
+        cyberfm_archive_uninit(pVFS->ppArchives[iArchive]);
+        free(pVFS->ppArchives[iArchive]);
+        free(pVFS->ppArchivePaths[iArchive]);
+    }
+
+    cyberfm_vfs_close_index_cache(pVFS);
+
+    if (isIndexCacheWritten) {
+        cyberfm_vfs_commit_index_cache(pVFS, indexCacheTempPath);
+    }
+
+    free(pVFS->ppArchives);
+    free(pVFS->ppArchivePaths);
+    free(pVFS->pEntries);
+    free(pVFS->indexCache.pFilePath);
+}
+
+cyberfm_result cyberfm_vfs_mount(cyberfm_vfs* pVFS, const char* pArchivePath)
+{
+    cyberfm_result result;
+    cyberfm_archive* pArchive;
+    cyberfm_archive_config archiveConfig;
+    const cyberfm_index_cache_record* pCacheRecord;
+    char* pArchivePathCopy;
+    uint32_t archiveIndex;
+    uint32_t iFile;
+
+    if (pVFS == NULL || pArchivePath == NULL) {
+        return CYBERFM_INVALID_ARGS;
+    }
+
+    if (pVFS->archiveCount == pVFS->archiveCap) {
+        uint32_t newCap = (pVFS->archiveCap > 0) ? pVFS->archiveCap * 2 : 16;
+        cyberfm_archive** ppNewArchives;
+        char** ppNewArchivePaths;
+
+        ppNewArchives = (cyberfm_archive**)realloc(pVFS->ppArchives, sizeof(*ppNewArchives) * newCap);
+        if (ppNewArchives == NULL) {
+            return CYBERFM_OUT_OF_MEMORY;
+        }
+
+        pVFS->ppArchives = ppNewArchives;
+
+        ppNewArchivePaths = (char**)realloc(pVFS->ppArchivePaths, sizeof(*ppNewArchivePaths) * newCap);
+        if (ppNewArchivePaths == NULL) {
+            return CYBERFM_OUT_OF_MEMORY;
+        }
+
+        pVFS->ppArchivePaths = ppNewArchivePaths;
+        pVFS->archiveCap = newCap;
+    }
+
+    pArchive = (cyberfm_archive*)malloc(sizeof(*pArchive));
+    if (pArchive == NULL) {
+        return CYBERFM_OUT_OF_MEMORY;
+    }
+
+    pArchivePathCopy = (char*)malloc(strlen(pArchivePath) + 1);
+    if (pArchivePathCopy == NULL) {
+        free(pArchive);
+        return CYBERFM_OUT_OF_MEMORY;
+    }
+
+    strcpy(pArchivePathCopy, pArchivePath);
+
+    /* If we have the central directory in the index cache we can give that to the archive so it doesn't need to be loaded. */
+    archiveConfig = pVFS->config.archiveConfig;
+
+    pCacheRecord = cyberfm_vfs_find_index_cache_record(pVFS, pArchivePath);
+    if (pCacheRecord != NULL) {
+        archiveConfig.cachedCentralDirectory.pData               = pVFS->indexCache.pData + pCacheRecord->centralDirOffset;
+        archiveConfig.cachedCentralDirectory.size                = pCacheRecord->centralDirSize;
+        archiveConfig.cachedCentralDirectory.archiveFileSize     = pCacheRecord->archiveFileSize;
+        archiveConfig.cachedCentralDirectory.archiveModifiedTime = pCacheRecord->archiveModifiedTime;
+    }
+
+    result = cyberfm_archive_init_ex(pArchivePath, &archiveConfig, pArchive);
+    if (result != CYBERFM_SUCCESS) {
+        free(pArchivePathCopy);
+        free(pArchive);
+        return result;
+    }
+
+    result = cyberfm_vfs_reserve_entries(pVFS, pArchive->pCentralDirectory->fileInfoCount);
+    if (result != CYBERFM_SUCCESS) {
+        cyberfm_archive_uninit(pArchive);
+        free(pArchivePathCopy);
+        free(pArchive);
+        return result;
+    }
+
+    if (!pArchive->isCentralDirectoryCached) {
+        pVFS->indexCache.isDirty = CYBERFM_TRUE;
+    }
+
+    archiveIndex = pVFS->archiveCount;
+    pVFS->ppArchives[archiveIndex]     = pArchive;
+    pVFS->ppArchivePaths[archiveIndex] = pArchivePathCopy;
+    pVFS->archiveCount += 1;
+
+    /*
+    Now merge the central directory into the index. If an archive has the same hashed name more than once, the first one
+    wins to stay consistent with cyberfm_archive_find(). We iterate backwards so that the first one is inserted last.
+    */
+    for (iFile = pArchive->pCentralDirectory->fileInfoCount; iFile > 0; iFile -= 1) {
+        const cyberfm_archive_file_info* pFileInfo = &pArchive->pCentralDirectory->pFileInfo[iFile - 1];
+        cyberfm_vfs_entry entry;
+        uint32_t iDataSpec;
+
+        entry.hashedName       = pFileInfo->hashedName;
+        entry.archiveIndex     = archiveIndex;
+        entry.fileIndex        = iFile - 1;
+        entry.compressedSize   = 0;
+        entry.uncompressedSize = 0;
+
+        for (iDataSpec = pFileInfo->dataSpecRangeBeg; iDataSpec < pFileInfo->dataSpecRangeEnd && iDataSpec < pArchive->pCentralDirectory->fileDataSpecCount; iDataSpec += 1) {
+            entry.compressedSize   += pArchive->pCentralDirectory->pFileDataSpec[iDataSpec].compressedSize;
+            entry.uncompressedSize += pArchive->pCentralDirectory->pFileDataSpec[iDataSpec].uncompressedSize;
+        }
+
+        cyberfm_vfs_insert_entry(pVFS->pEntries, pVFS->entryCap, &entry, &pVFS->entryCount);
+    }
+
+    return CYBERFM_SUCCESS;
+}
+
+static int cyberfm_string_compare(const void* a, const void* b)
+{
+    return strcmp(*(const char**)a, *(const char**)b);
+}
+
+static cyberfm_bool32 cyberfm_has_archive_extension(const char* pFileName)
+{
+    size_t len = strlen(pFileName);
+    return len > 8 && strcmp(pFileName + len - 8, ".archive") == 0;
+}
+
+typedef struct
+{
+    char** ppNames;
+    size_t count;
+    size_t cap;
+} cyberfm_string_list;
+
+static cyberfm_result cyberfm_string_list_append(cyberfm_string_list* pList, const char* pString)
+{
+    char* pStringCopy;
+
+    if (pList->count == pList->cap) {
+        size_t newCap = (pList->cap > 0) ? pList->cap * 2 : 64;
+        char** ppNewNames = (char**)realloc(pList->ppNames, sizeof(*ppNewNames) * newCap);
+        if (ppNewNames == NULL) {
+            return CYBERFM_OUT_OF_MEMORY;
+        }
+
+        pList->ppNames = ppNewNames;
+        pList->cap     = newCap;
+    }
+
+    pStringCopy = (char*)malloc(strlen(pString) + 1);
+    if (pStringCopy == NULL) {
+        return CYBERFM_OUT_OF_MEMORY;
+    }
+
+    strcpy(pStringCopy, pString);
+    pList->ppNames[pList->count] = pStringCopy;
+    pList->count += 1;
+
+    return CYBERFM_SUCCESS;
+}
+
+static void cyberfm_string_list_free(cyberfm_string_list* pList)
+{
+    size_t iName;
+
+    for (iName = 0; iName < pList->count; iName += 1) {
+        free(pList->ppNames[iName]);
+    }
+
+    free(pList->ppNames);
+}
+
+/*
+Gathers the names of the items in a directory that pass the filter, sorted alphabetically so the order doesn't depend on the
+file system. The "." and ".." entries are never included.
+*/
+static cyberfm_result cyberfm_list_directory(const char* pDirectoryPath, cyberfm_bool32 (* onFilter)(const char* pFileName), cyberfm_string_list* pList)
+{
+    cyberfm_result result = CYBERFM_SUCCESS;
+
+    CYBERFM_ZERO_OBJECT(pList);
+
+#ifdef _WIN32
+    {
+        char pattern[4096];
+        WIN32_FIND_DATAA findData;
+        HANDLE hFind;
+
+        snprintf(pattern, sizeof(pattern), "%s\\*", pDirectoryPath);
+
+        hFind = FindFirstFileA(pattern, &findData);
+        if (hFind == INVALID_HANDLE_VALUE) {
+            return CYBERFM_DOES_NOT_EXIST;
+        }
+
+        do {
+            if (strcmp(findData.cFileName, ".") != 0 && strcmp(findData.cFileName, "..") != 0 && onFilter(findData.cFileName)) {
+                result = cyberfm_string_list_append(pList, findData.cFileName);
+            }
+        } while (result == CYBERFM_SUCCESS && FindNextFileA(hFind, &findData));
+
+        FindClose(hFind);
+    }
+#else
+    {
+        DIR* pDir;
+        struct dirent* pDirEntry;
+
+        pDir = opendir(pDirectoryPath);
+        if (pDir == NULL) {
+            return CYBERFM_DOES_NOT_EXIST;
+        }
+
+        while (result == CYBERFM_SUCCESS && (pDirEntry = readdir(pDir)) != NULL) {
+            if (strcmp(pDirEntry->d_name, ".") != 0 && strcmp(pDirEntry->d_name, "..") != 0 && onFilter(pDirEntry->d_name)) {
+                result = cyberfm_string_list_append(pList, pDirEntry->d_name);
+            }
+        }
+
+        closedir(pDir);
+    }
+#endif
+
+    if (result != CYBERFM_SUCCESS) {
+        cyberfm_string_list_free(pList);
+        return result;
+    }
+
+    if (pList->count > 0) {
+        qsort(pList->ppNames, pList->count, sizeof(*pList->ppNames), cyberfm_string_compare);
+    }
+
+    return CYBERFM_SUCCESS;
+}
+
+cyberfm_result cyberfm_vfs_mount_directory(cyberfm_vfs* pVFS, const char* pDirectoryPath)
+{
+    cyberfm_result result;
+    cyberfm_string_list fileNames;
+    size_t iFileName;
+
+    if (pVFS == NULL || pDirectoryPath == NULL) {
+        return CYBERFM_INVALID_ARGS;
+    }
+
+    result = cyberfm_list_directory(pDirectoryPath, cyberfm_has_archive_extension, &fileNames);
+    if (result != CYBERFM_SUCCESS) {
+        return result;
+    }
+
+    for (iFileName = 0; iFileName < fileNames.count; iFileName += 1) {
+        char filePath[4096];
+
+        snprintf(filePath, sizeof(filePath), "%s/%s", pDirectoryPath, fileNames.ppNames[iFileName]);
+
+        result = cyberfm_vfs_mount(pVFS, filePath);
+        if (result != CYBERFM_SUCCESS) {
+            break;
+        }
+    }
+
+    cyberfm_string_list_free(&fileNames);
+
+    return result;
+}
+
+cyberfm_archive* cyberfm_vfs_get_archive(cyberfm_vfs* pVFS, uint32_t archiveIndex)
+{
+    if (pVFS == NULL || archiveIndex >= pVFS->archiveCount) {
+        return NULL;
+    }
+
+    return pVFS->ppArchives[archiveIndex];
+}
+
+cyberfm_result cyberfm_vfs_find(cyberfm_vfs* pVFS, uint64_t hashedName, const cyberfm_vfs_entry** ppEntry)
+{
+    uint32_t iSlot;
+
+    if (ppEntry == NULL) {
+        return CYBERFM_INVALID_ARGS;
+    }
+
+    *ppEntry = NULL;
+
+    if (pVFS == NULL) {
+        return CYBERFM_INVALID_ARGS;
+    }
+
+    if (pVFS->entryCap == 0) {
+        return CYBERFM_DOES_NOT_EXIST;
+    }
+
+    iSlot = cyberfm_vfs_hash_slot(hashedName, pVFS->entryCap);
+    for (;;) {
+        const cyberfm_vfs_entry* pEntry = &pVFS->pEntries[iSlot];
+
+        if (pEntry->archiveIndex == CYBERFM_VFS_EMPTY_ENTRY) {
+            return CYBERFM_DOES_NOT_EXIST;
+        }
+
+        if (pEntry->hashedName == hashedName) {
+            *ppEntry = pEntry;
+            return CYBERFM_SUCCESS;
+        }
+
+        iSlot = (iSlot + 1) & (pVFS->entryCap - 1);
+    }
+}
+
+cyberfm_result cyberfm_vfs_file_open(cyberfm_vfs* pVFS, uint64_t hashedName, uint32_t subfile, cyberfm_file** ppFile)
+{
+    cyberfm_result result;
+    const cyberfm_vfs_entry* pEntry;
+
+    if (ppFile == NULL) {
+        return CYBERFM_INVALID_ARGS;
+    }
+
+    *ppFile = NULL;
+
+    result = cyberfm_vfs_find(pVFS, hashedName, &pEntry);
+    if (result != CYBERFM_SUCCESS) {
+        return result;
+    }
+
+    return cyberfm_file_open_by_index(pVFS->ppArchives[pEntry->archiveIndex], pEntry->fileIndex, subfile, ppFile);
+}
+
+cyberfm_result cyberfm_vfs_read_file(cyberfm_vfs* pVFS, uint64_t hashedName, uint32_t subfile, void* pDst, size_t dstCap, size_t* pSize)
+{
+    cyberfm_result result;
+    const cyberfm_vfs_entry* pEntry;
+
+    if (pSize == NULL) {
+        return CYBERFM_INVALID_ARGS;
+    }
+
+    *pSize = 0;
+
+    result = cyberfm_vfs_find(pVFS, hashedName, &pEntry);
+    if (result != CYBERFM_SUCCESS) {
+        return result;
+    }
+
+    return cyberfm_archive_read_file_by_index(pVFS->ppArchives[pEntry->archiveIndex], pEntry->fileIndex, subfile, pDst, dstCap, pSize);
+}
+
+
+
+/* Parses the hash after the comma in a dictionary line. The whole string must be a decimal number. */
+static cyberfm_bool32 cyberfm_path_dictionary_parse_hash(const char* pString, uint64_t* pHashedName)
+{
+    uint64_t hashedName = 0;
+    const char* pChar;
+
+    if (pString[0] == '\0') {
+        return CYBERFM_FALSE;
+    }
+
+    for (pChar = pString; pChar[0] != '\0'; pChar += 1) {
+        uint64_t digit;
+
+        if (pChar[0] < '0' || pChar[0] > '9') {
+            return CYBERFM_FALSE;
+        }
+
+        digit = (uint64_t)(pChar[0] - '0');
+        if (hashedName > (~(uint64_t)0 - digit) / 10) {
+            return CYBERFM_FALSE;   /* Too big. */
+        }
+
+        hashedName = (hashedName * 10) + digit;
+    }
+
+    *pHashedName = hashedName;
+    return CYBERFM_TRUE;
+}
+
+/*
+Lines are parsed in batches. Paths without a hash are hashed four at a time, and then the slots of the whole batch are
+prefetched before inserting. With a big table every insert is a cache miss, and this lets them overlap rather than being
+taken one at a time.
+*/
+#define CYBERFM_PATH_DICTIONARY_BATCH_SIZE  32
+
+static void cyberfm_path_dictionary_insert_batch(cyberfm_path_dictionary* pDictionary, cyberfm_path_dictionary_entry* pBatch, uint32_t batchCount, const uint32_t* pUnhashed, uint32_t unhashedCount)
+{
+    uint32_t iBatch;
+    uint32_t iUnhashed;
+
+    for (iUnhashed = 0; iUnhashed + 4 <= unhashedCount; iUnhashed += 4) {
+        const char* ppPaths[4];
+        uint32_t lengths[4];
+        uint64_t hashes[4];
+        uint32_t iLane;
+
+        for (iLane = 0; iLane < 4; iLane += 1) {
+            ppPaths[iLane] = pDictionary->pPathData + pBatch[pUnhashed[iUnhashed + iLane]].pathOffset;
+            lengths[iLane] = pBatch[pUnhashed[iUnhashed + iLane]].pathLength;
+        }
+
+        cyberfm_hash_path_x4(ppPaths, lengths, hashes);
+
+        for (iLane = 0; iLane < 4; iLane += 1) {
+            pBatch[pUnhashed[iUnhashed + iLane]].hashedName = hashes[iLane];
+        }
+    }
+
+    for (; iUnhashed < unhashedCount; iUnhashed += 1) {
+        pBatch[pUnhashed[iUnhashed]].hashedName = cyberfm_hash_path(pDictionary->pPathData + pBatch[pUnhashed[iUnhashed]].pathOffset);
+    }
+
+#if defined(__GNUC__) || defined(__clang__)
+    for (iBatch = 0; iBatch < batchCount; iBatch += 1) {
+        __builtin_prefetch(&pDictionary->pEntries[cyberfm_vfs_hash_slot(pBatch[iBatch].hashedName, pDictionary->capacity)], 1);
+    }
+#endif
+
+    for (iBatch = 0; iBatch < batchCount; iBatch += 1) {
+        uint32_t iSlot = cyberfm_vfs_hash_slot(pBatch[iBatch].hashedName, pDictionary->capacity);
+
+        for (;;) {
+            cyberfm_path_dictionary_entry* pEntry = &pDictionary->pEntries[iSlot];
+
+            if (pEntry->pathLength == 0) {
+                *pEntry = pBatch[iBatch];
+                pDictionary->count += 1;
+                break;
+            }
+
+            if (pEntry->hashedName == pBatch[iBatch].hashedName) {
+                break;  /* Already have a path for this hash. The first one wins. */
+            }
+
+            iSlot = (iSlot + 1) & (pDictionary->capacity - 1);
+        }
+    }
+}
+
+cyberfm_result cyberfm_path_dictionary_init(const char* pFilePath, cyberfm_path_dictionary* pDictionary)
+{
+    cyberfm_result result;
+    FILE* pFile;
+    struct _stat64 info;
+    size_t lineCount;
+    char* pLine;
+    char* pDataEnd;
+    cyberfm_path_dictionary_entry batch[CYBERFM_PATH_DICTIONARY_BATCH_SIZE];
+    uint32_t batchCount = 0;
+    uint32_t unhashed[CYBERFM_PATH_DICTIONARY_BATCH_SIZE];  /* Indices into the batch of paths that need to be hashed. */
+    uint32_t unhashedCount = 0;
+
+    if (pDictionary == NULL) {
+        return CYBERFM_INVALID_ARGS;
+    }
+
+    CYBERFM_ZERO_OBJECT(pDictionary);
+
+    if (pFilePath == NULL) {
+        return CYBERFM_INVALID_ARGS;
+    }
+
+    result = cyberfm_result_from_minifs(mfs_fopen(&pFile, pFilePath, "rb"));
+    if (result != CYBERFM_SUCCESS) {
+        return result;
+    }
+
+    if (mfs_fstat(pFile, &info) != MFS_SUCCESS) {
+        mfs_fclose(pFile);
+        return CYBERFM_ERROR;
+    }
+
+    /* Entries store 32-bit offsets into the path data. */
+    if ((uint64_t)info.st_size >= 0xFFFFFFFF) {
+        mfs_fclose(pFile);
+        return CYBERFM_OUT_OF_RANGE;
+    }
+
+    /* The extra byte is so the last line can be null terminated even if there's no new line at the end of the file. */
+    pDictionary->pathDataSize = (size_t)info.st_size;
+    pDictionary->pPathData = (char*)malloc(pDictionary->pathDataSize + 1);
+    if (pDictionary->pPathData == NULL) {
+        mfs_fclose(pFile);
+        return CYBERFM_OUT_OF_MEMORY;
+    }
+
+    if (fread(pDictionary->pPathData, 1, pDictionary->pathDataSize, pFile) != pDictionary->pathDataSize) {
+        mfs_fclose(pFile);
+        cyberfm_path_dictionary_uninit(pDictionary);
+        return CYBERFM_ERROR;
+    }
+
+    mfs_fclose(pFile);
+
+    pDataEnd = pDictionary->pPathData + pDictionary->pathDataSize;
+    pDataEnd[0] = '\0';
+
+    /* The table is sized up front from the number of lines so it never needs to be resized. */
+    lineCount = 1;
+    for (pLine = pDictionary->pPathData; (pLine = (char*)memchr(pLine, '\n', (size_t)(pDataEnd - pLine))) != NULL; pLine += 1) {
+        lineCount += 1;
+    }
+
+    if (lineCount > 0x40000000) {
+        cyberfm_path_dictionary_uninit(pDictionary);
+        return CYBERFM_OUT_OF_RANGE;
+    }
+
+    pDictionary->capacity = 16;
+    while (pDictionary->capacity < lineCount * 2) {
+        pDictionary->capacity *= 2;
+    }
+
+    pDictionary->pEntries = (cyberfm_path_dictionary_entry*)calloc(pDictionary->capacity, sizeof(*pDictionary->pEntries));
+    if (pDictionary->pEntries == NULL) {
+        cyberfm_path_dictionary_uninit(pDictionary);
+        return CYBERFM_OUT_OF_MEMORY;
+    }
+
+    /* Each line is null terminated in place so the paths can be referenced straight out of the file data. */
+    pLine = pDictionary->pPathData;
+    while (pLine < pDataEnd) {
+        char* pLineEnd;
+        char* pComma;
+        size_t pathLength;
+        uint64_t hashedName;
+
+        pLineEnd = (char*)memchr(pLine, '\n', (size_t)(pDataEnd - pLine));
+        if (pLineEnd == NULL) {
+            pLineEnd = pDataEnd;
+        }
+
+        pathLength = (size_t)(pLineEnd - pLine);
+        if (pathLength > 0 && pLine[pathLength - 1] == '\r') {
+            pathLength -= 1;
+        }
+
+        pLine[pathLength] = '\0';
+
+        hashedName = 0;
+
+        pComma = (char*)memchr(pLine, ',', pathLength);
+        if (pComma != NULL) {
+            if (!cyberfm_path_dictionary_parse_hash(pComma + 1, &hashedName)) {
+                pLine = pLineEnd + 1;
+                continue;   /* Probably a header. */
+            }
+
+            pComma[0] = '\0';
+            pathLength = (size_t)(pComma - pLine);
+        } else if (pathLength > 0) {
+            unhashed[unhashedCount] = batchCount;   /* Hashed with the rest of the batch. */
+            unhashedCount += 1;
+        }
+
+        if (pathLength > 0) {
+            batch[batchCount].hashedName = hashedName;
+            batch[batchCount].pathOffset = (uint32_t)(pLine - pDictionary->pPathData);
+            batch[batchCount].pathLength = (uint32_t)pathLength;
+
+            batchCount += 1;
+            if (batchCount == CYBERFM_PATH_DICTIONARY_BATCH_SIZE) {
+                cyberfm_path_dictionary_insert_batch(pDictionary, batch, batchCount, unhashed, unhashedCount);
+                batchCount    = 0;
+                unhashedCount = 0;
+            }
+        }
+
+        pLine = pLineEnd + 1;
+    }
+
+    cyberfm_path_dictionary_insert_batch(pDictionary, batch, batchCount, unhashed, unhashedCount);
+
+    return CYBERFM_SUCCESS;
+}
+
+void cyberfm_path_dictionary_uninit(cyberfm_path_dictionary* pDictionary)
+{
+    if (pDictionary == NULL) {
+        return;
+    }
+
+    free(pDictionary->pEntries);
+    free(pDictionary->pPathData);
+    CYBERFM_ZERO_OBJECT(pDictionary);
+}
+
+const char* cyberfm_path_dictionary_find(const cyberfm_path_dictionary* pDictionary, uint64_t hashedName)
+{
+    uint32_t iSlot;
+
+    if (pDictionary == NULL || pDictionary->pEntries == NULL) {
+        return NULL;
+    }
+
+    iSlot = cyberfm_vfs_hash_slot(hashedName, pDictionary->capacity);
+
+    for (;;) {
+        const cyberfm_path_dictionary_entry* pEntry = &pDictionary->pEntries[iSlot];
+
+        if (pEntry->pathLength == 0) {
+            return NULL;
+        }
+
+        if (pEntry->hashedName == hashedName) {
+            return pDictionary->pPathData + pEntry->pathOffset;
+        }
+
+        iSlot = (iSlot + 1) & (pDictionary->capacity - 1);
+    }
+}
+
+
+
+cyberfm_archive_writer_config cyberfm_archive_writer_config_init(void)
+{
+    cyberfm_archive_writer_config config;
+
+    CYBERFM_ZERO_OBJECT(&config);
+    config.alignment       = CYBERFM_ARCHIVE_WRITER_DEFAULT_ALIGNMENT;
+    config.threadCount     = 0;
+    config.pCodec          = &g_cyberfmCodecCFLZ;
+    config.minCompressSize = CYBERFM_ARCHIVE_WRITER_DEFAULT_MIN_COMPRESS_SIZE;
+    config.batchSize       = CYBERFM_ARCHIVE_WRITER_DEFAULT_BATCH_SIZE;
+
+    return config;
+}
+
+cyberfm_result cyberfm_archive_writer_init(const char* pFilePath, const cyberfm_archive_writer_config* pConfig, cyberfm_archive_writer* pWriter)
+{
+    uint8_t header[CYBERFM_ARCHIVE_HEADER_SIZE + CYBERFM_ARCHIVE_HEADER_PADDING_SIZE];
+
+    if (pWriter == NULL) {
+        return CYBERFM_INVALID_ARGS;
+    }
+
+    CYBERFM_ZERO_OBJECT(pWriter);
+
+    if (pFilePath == NULL) {
+        return CYBERFM_INVALID_ARGS;
+    }
+
+    if (pConfig != NULL) {
+        pWriter->config = *pConfig;
+    } else {
+        pWriter->config = cyberfm_archive_writer_config_init();
     }
 
-    /* We opened the file successfully. We can now start extracting some data and do some validation checks. */
-    result = cyberfm_result_from_minifs(mfs_fread(pFile, &pArchive->fourcc, sizeof(pArchive->fourcc), NULL));
-    if (result != CYBERFM_SUCCESS) {
-        goto error1;
+    if (pWriter->config.alignment == 0 || (pWriter->config.alignment & (pWriter->config.alignment - 1)) != 0) {
+        return CYBERFM_INVALID_ARGS;    /* Alignment must be a power of two. */
     }
 
-    if (pArchive->fourcc != 0x52414452) {
-        result = CYBERFM_ERROR; /* Not a valid archive file. */
-        goto error1;
+    if (pWriter->config.pCodec != NULL && pWriter->config.pCodec->onCompress == NULL) {
+        pWriter->config.pCodec = NULL;  /* Can't compress with this codec so just store everything. */
     }
 
-    result = cyberfm_result_from_minifs(mfs_fread(pFile, &pArchive->unknown0, sizeof(pArchive->unknown0), NULL));
-    if (result != CYBERFM_SUCCESS) {
-        goto error1;
+    pWriter->pFilePath = (char*)malloc(strlen(pFilePath) + 1);
+    if (pWriter->pFilePath == NULL) {
+        return CYBERFM_OUT_OF_MEMORY;
     }
 
-    result = cyberfm_result_from_minifs(mfs_fread(pFile, &pArchive->centralDirOffset, sizeof(pArchive->centralDirOffset), NULL));
-    if (result != CYBERFM_SUCCESS) {
-        goto error1;
+    strcpy(pWriter->pFilePath, pFilePath);
+
+    if (mfs_fopen(&pWriter->pFile, pFilePath, "wb") != MFS_SUCCESS) {
+        free(pWriter->pFilePath);
+        pWriter->pFilePath = NULL;
+        return CYBERFM_ACCESS_DENIED;
     }
 
-    result = cyberfm_result_from_minifs(mfs_fread(pFile, &pArchive->centralDirSize, sizeof(pArchive->centralDirSize), NULL));
-    if (result != CYBERFM_SUCCESS) {
-        goto error1;
+    /*
+    The header can't be filled out until we know where the central directory is. Just reserve space for it for now. The
+    padding after it is written as well so that the file data starts where it does in the game's own archives.
+    */
+    memset(header, 0, sizeof(header));
+    if (!cyberfm_fwrite_all(pWriter->pFile, header, sizeof(header))) {
+        mfs_fclose(pWriter->pFile);
+        remove(pFilePath);
+        free(pWriter->pFilePath);
+        pWriter->pFilePath = NULL;
+        return CYBERFM_ERROR;
     }
 
-    result = cyberfm_result_from_minifs(mfs_fread(pFile, &pArchive->unknown1, sizeof(pArchive->unknown1), NULL));
-    if (result != CYBERFM_SUCCESS) {
-        goto error1;
+    pWriter->offset = sizeof(header);
+    pWriter->stats.archiveSize = pWriter->offset;
+
+    return CYBERFM_SUCCESS;
+}
+
+static void cyberfm_archive_writer_free_batch_compressed_data(cyberfm_archive_writer* pWriter)
+{
+    uint32_t iDataSpec;
+
+    if (pWriter->batch.ppCompressedData == NULL) {
+        return;
     }
 
-    result = cyberfm_result_from_minifs(mfs_fread(pFile, &pArchive->archiveSize, sizeof(pArchive->archiveSize), NULL));
-    if (result != CYBERFM_SUCCESS) {
-        goto error1;
+    for (iDataSpec = 0; iDataSpec < pWriter->dataSpecCount - pWriter->batch.firstDataSpec; iDataSpec += 1) {
+        free(pWriter->batch.ppCompressedData[iDataSpec]);
     }
 
-    /* Not going to bother reading the padding. */
+    free(pWriter->batch.ppCompressedData);
+    pWriter->batch.ppCompressedData = NULL;
+}
 
-    /* Quick validation check of the central directory offset + size. */
-    if ((pArchive->centralDirOffset + pArchive->centralDirSize) > pArchive->archiveSize) {
-        goto error1;    /* Central directory is invalid. */
+void cyberfm_archive_writer_uninit(cyberfm_archive_writer* pWriter)
+{
+    if (pWriter == NULL) {
+        return;
     }
 
-    /* Quickly check that the file size is correct. */
-    result = cyberfm_result_from_minifs(mfs_fstat(pFile, &info));
-    if (result != CYBERFM_SUCCESS) {
-        goto error1;
+    if (pWriter->pFile != NULL) {
+        mfs_fclose(pWriter->pFile);
     }
 
-    if ((pArchive->centralDirOffset + pArchive->centralDirSize) > (uint64_t)info.st_size) {
-        goto error1;    /* Central directory is invalid. */
+    /* An archive that wasn't finalized is missing it's central directory and can't be opened so there's no point keeping it. */
+    if (!pWriter->isFinalized && pWriter->pFilePath != NULL) {
+        remove(pWriter->pFilePath);
     }
 
+    cyberfm_archive_writer_free_batch_compressed_data(pWriter);
 
-    /*
-    We now need to load the central directory. The amount of memory can be based on the size of the central directory
-    we extracted earlier. Technically this will end up being more than we need, but it doesn't matter.
-    */
-    pArchive->pCentralDirectory = (cyberfm_archive_central_directory*)malloc(sizeof(*pArchive->pCentralDirectory) + pArchive->centralDirSize);
-    if (pArchive->pCentralDirectory == NULL) {
-        result = CYBERFM_OUT_OF_MEMORY;
-        goto error1;
+    free(pWriter->batch.pData);
+    free(pWriter->pFileInfos);
+    free(pWriter->pDataSpecs);
+    free(pWriter->pUnknownData);
+    free(pWriter->pFilePath);
+}
+
+/* Grows an array so it can fit at least `count` more items. */
+static cyberfm_result cyberfm_archive_writer_reserve(void** ppItems, uint32_t* pCap, uint32_t itemCount, uint32_t additionalItemCount, size_t itemSize)
+{
+    void* pNewItems;
+    uint64_t newCap;
+
+    if ((uint64_t)itemCount + additionalItemCount <= *pCap) {
+        return CYBERFM_SUCCESS;
     }
 
-    result = cyberfm_result_from_minifs(mfs_fseek(pFile, (mfs_int64)pArchive->centralDirOffset, SEEK_SET));
-    if (result != CYBERFM_SUCCESS) {
-        goto error2;    /* Failed to seek to the central directory. */
+    newCap = CYBERFM_MAX((uint64_t)*pCap * 2, (uint64_t)itemCount + additionalItemCount);
+    newCap = CYBERFM_MAX(newCap, 64);
+    if (newCap > 0xFFFFFFFF) {
+        return CYBERFM_OUT_OF_RANGE;    /* The archive format uses 32-bit counts. */
     }
 
-    result = cyberfm_result_from_minifs(mfs_fread(pFile, &pArchive->pCentralDirectory->fourcc, sizeof(pArchive->pCentralDirectory->fourcc), NULL));
-    if (result != CYBERFM_SUCCESS) {
-        goto error2;
+    pNewItems = realloc(*ppItems, (size_t)newCap * itemSize);
+    if (pNewItems == NULL) {
+        return CYBERFM_OUT_OF_MEMORY;
     }
 
-    result = cyberfm_result_from_minifs(mfs_fread(pFile, &pArchive->pCentralDirectory->size, sizeof(pArchive->pCentralDirectory->size), NULL));
-    if (result != CYBERFM_SUCCESS) {
-        goto error2;
+    *ppItems = pNewItems;
+    *pCap    = (uint32_t)newCap;
+
+    return CYBERFM_SUCCESS;
+}
+
+/*
+Compresses and hashes a single file in the batch. Each job only touches it's own file info and data specs, and it's own
+items in ppCompressedData so there's no need for any synchronization.
+*/
+static void cyberfm_archive_writer_compress_job_proc(void* pUserData, uint32_t jobIndex)
+{
+    cyberfm_archive_writer* pWriter = (cyberfm_archive_writer*)pUserData;
+    cyberfm_archive_file_info* pFileInfo = &pWriter->pFileInfos[pWriter->batch.firstFileInfo + jobIndex];
+    const cyberfm_codec* pCodec = pWriter->config.pCodec;
+    cyberfm_sha1 sha1;
+    uint8_t hash[CYBERFM_SHA1_SIZE];
+    uint32_t iDataSpec;
+    uint32_t iWord;
+
+    cyberfm_sha1_init(&sha1);
+
+    for (iDataSpec = pFileInfo->dataSpecRangeBeg; iDataSpec < pFileInfo->dataSpecRangeEnd; iDataSpec += 1) {
+        cyberfm_archive_file_data_spec* pDataSpec = &pWriter->pDataSpecs[iDataSpec];
+        const uint8_t* pData = pWriter->batch.pData + pDataSpec->offset;
+        void* pCompressedData;
+        size_t compressedSize;
+
+        cyberfm_sha1_update(&sha1, pData, pDataSpec->uncompressedSize);
+
+        if (pCodec == NULL || pDataSpec->uncompressedSize < pWriter->config.minCompressSize || pDataSpec->uncompressedSize < 2) {
+            continue;
+        }
+
+        /*
+        Compressed data is only kept if it's smaller than the original, so the output buffer is one byte smaller than the
+        original and if the codec runs out of room we just store it. The sizes being equal is how the reader knows a sub-file
+        is not compressed so this is required anyway.
+        */
+        pCompressedData = malloc(pDataSpec->uncompressedSize - 1);
+        if (pCompressedData == NULL) {
+            continue;   /* Not a critical error. Just store it. */
+        }
+
+        if (pCodec->onCompress(pCodec->pUserData, pData, pDataSpec->uncompressedSize, pCompressedData, pDataSpec->uncompressedSize - 1, &compressedSize) == CYBERFM_SUCCESS && compressedSize < pDataSpec->uncompressedSize) {
+            pWriter->batch.ppCompressedData[iDataSpec - pWriter->batch.firstDataSpec] = pCompressedData;
+            pDataSpec->compressedSize = (uint32_t)compressedSize;
+        } else {
+            free(pCompressedData);
+        }
     }
 
-    result = cyberfm_result_from_minifs(mfs_fread(pFile, &pArchive->pCentralDirectory->unknown0, sizeof(pArchive->pCentralDirectory->unknown0), NULL));
-    if (result != CYBERFM_SUCCESS) {
-        goto error2;
+    cyberfm_sha1_finalize(&sha1, hash);
+
+    /* Hashes are stored as native words. See cyberfm_file_info_get_hash(). */
+    for (iWord = 0; iWord < 5; iWord += 1) {
+        pFileInfo->hash[iWord] = cyberfm_read_le32(hash + iWord*4);
     }
+}
 
-    result = cyberfm_result_from_minifs(mfs_fread(pFile, &pArchive->pCentralDirectory->fileInfoCount, sizeof(pArchive->pCentralDirectory->fileInfoCount), NULL));
-    if (result != CYBERFM_SUCCESS) {
-        goto error2;
+/* Compresses every file in the batch and writes them out to the archive in the order they were added. */
+static cyberfm_result cyberfm_archive_writer_flush(cyberfm_archive_writer* pWriter)
+{
+    cyberfm_result result = CYBERFM_SUCCESS;
+    uint32_t fileCount    = pWriter->fileInfoCount - pWriter->batch.firstFileInfo;
+    uint32_t dataSpecCount = pWriter->dataSpecCount - pWriter->batch.firstDataSpec;
+    uint64_t* pJobCosts;
+    uint32_t iFile;
+    uint32_t iDataSpec;
+    static const uint8_t padding[64] = {0};
+    CYBERFM_STATS_DECLARE_TIMER(startTime)
+
+    if (fileCount == 0) {
+        return CYBERFM_SUCCESS;
     }
 
-    result = cyberfm_result_from_minifs(mfs_fread(pFile, &pArchive->pCentralDirectory->fileDataSpecCount, sizeof(pArchive->pCentralDirectory->fileDataSpecCount), NULL));
-    if (result != CYBERFM_SUCCESS) {
-        goto error2;
+    pWriter->batch.ppCompressedData = (void**)calloc(dataSpecCount, sizeof(*pWriter->batch.ppCompressedData));
+    pJobCosts = (uint64_t*)malloc(fileCount * sizeof(*pJobCosts));
+    if (pWriter->batch.ppCompressedData == NULL || pJobCosts == NULL) {
+        free(pWriter->batch.ppCompressedData);
+        pWriter->batch.ppCompressedData = NULL;
+        free(pJobCosts);
+        return CYBERFM_OUT_OF_MEMORY;
     }
 
-    result = cyberfm_result_from_minifs(mfs_fread(pFile, &pArchive->pCentralDirectory->unknownDataCount, sizeof(pArchive->pCentralDirectory->unknownDataCount), NULL));
-    if (result != CYBERFM_SUCCESS) {
-        goto error2;
+    /* Until they're compressed, the compressed size of each sub-file is the same as the uncompressed size. */
+    for (iFile = 0; iFile < fileCount; iFile += 1) {
+        const cyberfm_archive_file_info* pFileInfo = &pWriter->pFileInfos[pWriter->batch.firstFileInfo + iFile];
+
+        pJobCosts[iFile] = 0;
+        for (iDataSpec = pFileInfo->dataSpecRangeBeg; iDataSpec < pFileInfo->dataSpecRangeEnd; iDataSpec += 1) {
+            pJobCosts[iFile] += pWriter->pDataSpecs[iDataSpec].uncompressedSize;
+        }
     }
 
+    if (fileCount == 1 || pWriter->config.threadCount == 1) {
+        for (iFile = 0; iFile < fileCount; iFile += 1) {
+            cyberfm_archive_writer_compress_job_proc(pWriter, iFile);
+        }
+    } else {
+        cyberfm_job_pool pool;
+        cyberfm_job_pool_config poolConfig;
 
-    /*
-    We don't *technically* need to load this data into memory because we could just extract it from the file
-    dynamically, but it makes it easier to use and memory usage shouldn't be too crazy. We could also map the
-    file, but I'm not going to bother right now (might leave this as an excersize for later).
+        poolConfig = cyberfm_job_pool_config_init(pWriter->config.threadCount, fileCount, cyberfm_archive_writer_compress_job_proc, pWriter);
+        poolConfig.pJobCosts = pJobCosts;
 
-    Right now we're sitting on the first byte of the file info section. Each segment here is 56 bytes. We can
-    therefore determine how much data to read and then do it all in a single read.
-    */
-    fileInfoChunkSize = pArchive->pCentralDirectory->fileInfoCount * 56;
-    pArchive->pCentralDirectory->pFileInfo = (cyberfm_archive_file_info*)CYBERFM_OFFSET_PTR(pArchive->pCentralDirectory->pPayload, 0);
+        result = cyberfm_job_pool_init(&poolConfig, &pool);
+        if (result == CYBERFM_SUCCESS) {
+            cyberfm_job_pool_uninit(&pool);
+        } else {
+            /* Couldn't create the threads. Just do it on this thread. */
+            for (iFile = 0; iFile < fileCount; iFile += 1) {
+                cyberfm_archive_writer_compress_job_proc(pWriter, iFile);
+            }
 
-    result = cyberfm_result_from_minifs(mfs_fread(pFile, pArchive->pCentralDirectory->pFileInfo, fileInfoChunkSize, NULL));
-    if (result != CYBERFM_SUCCESS) {
-        goto error2;
+            result = CYBERFM_SUCCESS;
+        }
     }
 
-    /* The data specs are 16 bytes each. */
-    fileDataSpecChunkSize = pArchive->pCentralDirectory->fileDataSpecCount * 16;
-    pArchive->pCentralDirectory->pFileDataSpec = (cyberfm_archive_file_data_spec*)CYBERFM_OFFSET_PTR(pArchive->pCentralDirectory->pPayload, fileInfoChunkSize);
+    free(pJobCosts);
 
-    result = cyberfm_result_from_minifs(mfs_fread(pFile, pArchive->pCentralDirectory->pFileDataSpec, fileDataSpecChunkSize, NULL));
-    if (result != CYBERFM_SUCCESS) {
-        goto error2;
-    }
+    /* Now write everything out in order. */
+    CYBERFM_STATS_BEGIN_TIMER(startTime);
 
-    /* The as yet unknown section is 8 bytes each. */
-    unknownDataChunkSize = pArchive->pCentralDirectory->unknownDataCount * 8;
-    pArchive->pCentralDirectory->pUnknownData = (cyberfm_archive_central_directory_unknown_data*)CYBERFM_OFFSET_PTR(pArchive->pCentralDirectory->pPayload, fileInfoChunkSize + fileDataSpecChunkSize);
+    for (iDataSpec = pWriter->batch.firstDataSpec; iDataSpec < pWriter->dataSpecCount; iDataSpec += 1) {
+        cyberfm_archive_file_data_spec* pDataSpec = &pWriter->pDataSpecs[iDataSpec];
+        const void* pCompressedData = pWriter->batch.ppCompressedData[iDataSpec - pWriter->batch.firstDataSpec];
+        const void* pData;
+        size_t paddingSize;
 
-    result = cyberfm_result_from_minifs(mfs_fread(pFile, pArchive->pCentralDirectory->pUnknownData, unknownDataChunkSize, NULL));
-    if (result != CYBERFM_SUCCESS) {
-        goto error2;
-    }
+        if (pCompressedData != NULL) {
+            pData = pCompressedData;
+            pWriter->stats.compressedSubFileCount += 1;
+        } else {
+            pData = pWriter->batch.pData + pDataSpec->offset;
+        }
 
+        paddingSize = (size_t)((pWriter->config.alignment - (pWriter->offset & (pWriter->config.alignment - 1))) & (pWriter->config.alignment - 1));
+        while (paddingSize > 0) {
+            size_t paddingToWrite = CYBERFM_MIN(paddingSize, sizeof(padding));
+            if (!cyberfm_fwrite_all(pWriter->pFile, padding, paddingToWrite)) {
+                result = CYBERFM_ERROR;
+                break;
+            }
 
-    /* We're done. The file needs to be left open so we can extract data later. */
-    pArchive->pFile = pFile;
+            pWriter->offset += paddingToWrite;
+            paddingSize     -= paddingToWrite;
+        }
 
-    return CYBERFM_SUCCESS;
+        if (result != CYBERFM_SUCCESS || !cyberfm_fwrite_all(pWriter->pFile, pData, pDataSpec->compressedSize)) {
+            result = CYBERFM_ERROR;
+            break;
+        }
 
-error2: free(pArchive->pCentralDirectory);
-error1: mfs_fclose(pFile);
-error0: return result;
-}
+        pDataSpec->offset = pWriter->offset;
+        pWriter->offset  += pDataSpec->compressedSize;
 
-void cyberfm_archive_uninit(cyberfm_archive* pArchive)
-{
-    if (pArchive == NULL) {
-        return;
+        CYBERFM_STATS_ADD(CYBERFM_STAT_BYTES_WRITTEN, pDataSpec->compressedSize);
     }
 
-    free(pArchive->pCentralDirectory);
-    mfs_fclose(pArchive->pFile);
-}
+    CYBERFM_STATS_END_TIMER(CYBERFM_STAT_TIMER_WRITE, startTime);
 
-cyberfm_result cyberfm_archive_find(cyberfm_archive* pArchive, uint64_t hashedName, uint32_t* pFileIndex)
-{
-    uint32_t iFile;
+    cyberfm_archive_writer_free_batch_compressed_data(pWriter);
 
-    if (pArchive == NULL || pFileIndex == NULL) {
-        return CYBERFM_INVALID_ARGS;
-    }
+    pWriter->batch.size          = 0;
+    pWriter->batch.firstFileInfo = pWriter->fileInfoCount;
+    pWriter->batch.firstDataSpec = pWriter->dataSpecCount;
+    pWriter->stats.archiveSize   = pWriter->offset;
 
-    /* TODO: Binary search. */
-    for (iFile = 0; iFile < pArchive->pCentralDirectory->fileInfoCount; iFile += 1) {
-        if (pArchive->pCentralDirectory->pFileInfo[iFile].hashedName == hashedName) {
-            *pFileIndex = iFile;
-            return CYBERFM_SUCCESS;
-        }
+    /* The archive is missing data at this point so there's no way to recover. Anything after this will fail. */
+    if (result != CYBERFM_SUCCESS) {
+        mfs_fclose(pWriter->pFile);
+        pWriter->pFile = NULL;
     }
 
-    /* Getting here means the file could not be found. */
-    return CYBERFM_ERROR;
+    return result;
 }
 
-
-cyberfm_result cyberfm_file_open_by_index(cyberfm_archive* pArchive, uint32_t index, uint32_t subfile, cyberfm_file** ppFile)
+cyberfm_result cyberfm_archive_writer_add_file(cyberfm_archive_writer* pWriter, const cyberfm_archive_writer_file* pFile)
 {
     cyberfm_result result;
-    uint32_t iDataSpec;
-    cyberfm_file* pFile;
+    cyberfm_archive_file_info* pFileInfo;
+    uint64_t totalSize = 0;
+    uint32_t iSubFile;
 
-    if (ppFile == NULL) {
+    if (pWriter == NULL || pFile == NULL || pFile->subFileCount == 0 || pFile->pSubFileSizes == NULL || pFile->ppSubFileData == NULL || (pFile->pUnknownData == NULL && pFile->unknownDataCount > 0)) {
         return CYBERFM_INVALID_ARGS;
     }
 
-    /* The sub-file needs to be within range. */
-    if (subfile >= (pArchive->pCentralDirectory->pFileInfo[index].dataSpecRangeEnd - pArchive->pCentralDirectory->pFileInfo[index].dataSpecRangeBeg)) {
-        return CYBERFM_INVALID_ARGS;    /* The sub-file is invalid. */
+    if (pWriter->pFile == NULL || pWriter->isFinalized) {
+        return CYBERFM_INVALID_OPERATION;
     }
 
-    /*
-    It looks like the file is good at so far. Now we need to get the data. If we were memory mapping the archive file we could
-    avoid memory allocations, but for now we'll go ahead and use a malloc(). I don't think this method will scale.
-    */
-    iDataSpec = pArchive->pCentralDirectory->pFileInfo[index].dataSpecRangeBeg + subfile;
+    for (iSubFile = 0; iSubFile < pFile->subFileCount; iSubFile += 1) {
+        if (pFile->pSubFileSizes[iSubFile] > 0xFFFFFFFF) {
+            return CYBERFM_OUT_OF_RANGE;    /* Sizes are 32-bit in the archive format. */
+        }
 
-    pFile = (cyberfm_file*)malloc(sizeof(*pFile) + pArchive->pCentralDirectory->pFileDataSpec[iDataSpec].uncompressedSize);
-    if (pFile == NULL) {
-        return CYBERFM_OUT_OF_MEMORY;
+        if (pFile->ppSubFileData[iSubFile] == NULL && pFile->pSubFileSizes[iSubFile] > 0) {
+            return CYBERFM_INVALID_ARGS;
+        }
+
+        totalSize += pFile->pSubFileSizes[iSubFile];
     }
 
-    pFile->pArchive = pArchive;
-    pFile->cursor   = 0;
-    pFile->size     = pArchive->pCentralDirectory->pFileDataSpec[iDataSpec].uncompressedSize;
+    if (totalSize > ((size_t)-1) - pWriter->batch.size) {
+        return CYBERFM_OUT_OF_MEMORY;
+    }
 
-    /* TODO: This needs to be made thread safe. */
-    result = cyberfm_result_from_minifs(mfs_fseek(pArchive->pFile, pArchive->pCentralDirectory->pFileDataSpec[iDataSpec].offset, SEEK_SET));
+    result = cyberfm_archive_writer_reserve((void**)&pWriter->pFileInfos, &pWriter->fileInfoCap, pWriter->fileInfoCount, 1, sizeof(*pWriter->pFileInfos));
+    if (result == CYBERFM_SUCCESS) {
+        result = cyberfm_archive_writer_reserve((void**)&pWriter->pDataSpecs, &pWriter->dataSpecCap, pWriter->dataSpecCount, pFile->subFileCount, sizeof(*pWriter->pDataSpecs));
+    }
+    if (result == CYBERFM_SUCCESS && pFile->unknownDataCount > 0) {
+        result = cyberfm_archive_writer_reserve((void**)&pWriter->pUnknownData, &pWriter->unknownDataCap, pWriter->unknownDataCount, pFile->unknownDataCount, sizeof(*pWriter->pUnknownData));
+    }
     if (result != CYBERFM_SUCCESS) {
-        free(pFile);
         return result;
     }
 
-    if (pArchive->pCentralDirectory->pFileDataSpec[iDataSpec].compressedSize == pArchive->pCentralDirectory->pFileDataSpec[iDataSpec].uncompressedSize) {
-        /* Not compressed. */
-        result = cyberfm_result_from_minifs(mfs_fread(pArchive->pFile, pFile->pData, (size_t)pFile->size, NULL));
-        if (result != CYBERFM_SUCCESS) {
-            free(pFile);
-            return result;
-        }
-    } else {
-        /* Compressed. */
-        uint32_t compressedSize;
-        void* pCompressedData;
-        int decompressionResult;
+    if (pWriter->batch.size + totalSize > pWriter->batch.cap) {
+        size_t newCap = CYBERFM_MAX(pWriter->batch.cap * 2, pWriter->batch.size + (size_t)totalSize);
+        uint8_t* pNewData;
 
-        if (pArchive->oodle.hOodle == NULL) {
-            free(pFile);
-            return CYBERFM_INVALID_OPERATION;
-        }
+        newCap = CYBERFM_MAX(newCap, CYBERFM_MIN(pWriter->config.batchSize, 1024 * 1024));
 
-        compressedSize = pArchive->pCentralDirectory->pFileDataSpec[iDataSpec].compressedSize;
-        pCompressedData = malloc(compressedSize);
-        if (pCompressedData == NULL) {
-            free(pFile);
+        pNewData = (uint8_t*)realloc(pWriter->batch.pData, newCap);
+        if (pNewData == NULL) {
             return CYBERFM_OUT_OF_MEMORY;
         }
 
-        result = cyberfm_result_from_minifs(mfs_fread(pArchive->pFile, pCompressedData, compressedSize, NULL));
-        if (result != CYBERFM_SUCCESS) {
-            free(pFile);
-            return result;
-        }
+        pWriter->batch.pData = pNewData;
+        pWriter->batch.cap   = newCap;
+    }
 
-        /* TODO: Validate the compressed data to check the FourCC and that the decompressed sizes are equal. */
+    pFileInfo = &pWriter->pFileInfos[pWriter->fileInfoCount];
+    CYBERFM_ZERO_OBJECT(pFileInfo);
+    pFileInfo->hashedName          = pFile->hashedName;
+    pFileInfo->unknown1            = pFile->unknown1;
+    pFileInfo->unknown2            = pFile->unknown2;
+    pFileInfo->dataSpecRangeBeg    = pWriter->dataSpecCount;
+    pFileInfo->dataSpecRangeEnd    = pWriter->dataSpecCount + pFile->subFileCount;
+    pFileInfo->unknownDataRangeBeg = pWriter->unknownDataCount;
+    pFileInfo->unknownDataRangeEnd = pWriter->unknownDataCount + pFile->unknownDataCount;
+
+    for (iSubFile = 0; iSubFile < pFile->subFileCount; iSubFile += 1) {
+        cyberfm_archive_file_data_spec* pDataSpec = &pWriter->pDataSpecs[pWriter->dataSpecCount + iSubFile];
+        size_t size = pFile->pSubFileSizes[iSubFile];
+
+        pDataSpec->offset           = pWriter->batch.size;
+        pDataSpec->compressedSize   = (uint32_t)size;
+        pDataSpec->uncompressedSize = (uint32_t)size;
+
+        if (size > 0) {
+            memcpy(pWriter->batch.pData + pWriter->batch.size, pFile->ppSubFileData[iSubFile], size);
+        }
 
-        decompressionResult = pArchive->oodle.OodleLZ_Decompress(CYBERFM_OFFSET_PTR(pCompressedData, 8), compressedSize, pFile->pData, pArchive->pCentralDirectory->pFileDataSpec[iDataSpec].uncompressedSize, 0, 0, 0, NULL, NULL, NULL, NULL, NULL, NULL, 0);
-        free(pCompressedData);
+        pWriter->batch.size += size;
+    }
 
-        if (decompressionResult != pArchive->pCentralDirectory->pFileDataSpec[iDataSpec].uncompressedSize) {
-            free(pFile);
-            return CYBERFM_ERROR;   /* Failed to decompress. */
-        }
+    if (pFile->unknownDataCount > 0) {
+        memcpy(pWriter->pUnknownData + pWriter->unknownDataCount, pFile->pUnknownData, pFile->unknownDataCount * sizeof(*pWriter->pUnknownData));
     }
 
-    /* We're done. */
-    *ppFile = pFile;
+    pWriter->fileInfoCount    += 1;
+    pWriter->dataSpecCount    += pFile->subFileCount;
+    pWriter->unknownDataCount += pFile->unknownDataCount;
+
+    pWriter->stats.fileCount        += 1;
+    pWriter->stats.subFileCount     += pFile->subFileCount;
+    pWriter->stats.uncompressedSize += totalSize;
+
+    if (pWriter->batch.size >= pWriter->config.batchSize) {
+        return cyberfm_archive_writer_flush(pWriter);
+    }
 
     return CYBERFM_SUCCESS;
 }
 
-cyberfm_result cyberfm_file_open(cyberfm_archive* pArchive, uint64_t hashedName, uint32_t subfile, cyberfm_file** ppFile)
+static int cyberfm_file_info_compare_hashed_name(const void* a, const void* b)
+{
+    const cyberfm_archive_file_info* pFileInfoA = (const cyberfm_archive_file_info*)a;
+    const cyberfm_archive_file_info* pFileInfoB = (const cyberfm_archive_file_info*)b;
+
+    if (pFileInfoA->hashedName < pFileInfoB->hashedName) {
+        return -1;
+    } else if (pFileInfoA->hashedName > pFileInfoB->hashedName) {
+        return  1;
+    } else {
+        return  0;
+    }
+}
+
+static void cyberfm_write_le32(uint8_t* pDst, uint32_t value)
+{
+    pDst[0] = (uint8_t)((value >>  0) & 0xFF);
+    pDst[1] = (uint8_t)((value >>  8) & 0xFF);
+    pDst[2] = (uint8_t)((value >> 16) & 0xFF);
+    pDst[3] = (uint8_t)((value >> 24) & 0xFF);
+}
+
+static void cyberfm_write_le64(uint8_t* pDst, uint64_t value)
+{
+    cyberfm_write_le32(pDst + 0, (uint32_t)(value >>  0));
+    cyberfm_write_le32(pDst + 4, (uint32_t)(value >> 32));
+}
+
+cyberfm_result cyberfm_archive_writer_finalize(cyberfm_archive_writer* pWriter)
 {
     cyberfm_result result;
+    cyberfm_archive_central_directory centralDirectory;
+    uint8_t centralDirHeader[CYBERFM_CENTRAL_DIRECTORY_HEADER_SIZE];
+    uint8_t header[CYBERFM_ARCHIVE_HEADER_SIZE];
+    uint64_t centralDirOffset;
+    uint64_t centralDirSize;
     uint32_t iFile;
+    size_t paddingSize;
+    cyberfm_bool32 success = CYBERFM_TRUE;
+    static const uint8_t padding[8] = {0};
 
-    if (ppFile == NULL) {
+    if (pWriter == NULL) {
         return CYBERFM_INVALID_ARGS;
     }
 
-    *ppFile = NULL;
-
-    if (pArchive == NULL) {
-        return CYBERFM_INVALID_ARGS;
+    if (pWriter->pFile == NULL || pWriter->isFinalized) {
+        return CYBERFM_INVALID_OPERATION;
     }
 
-    /* The first thing to do is find the file. */
-    result = cyberfm_archive_find(pArchive, hashedName, &iFile);
+    result = cyberfm_archive_writer_flush(pWriter);
     if (result != CYBERFM_SUCCESS) {
-        return result;  /* The file was probably not found. */
+        return result;
     }
 
-    return cyberfm_file_open_by_index(pArchive, iFile, subfile, ppFile);
-}
+    /* Lookups depend on the files being sorted. The data specs are referenced by range so they can stay where they are. */
+    if (pWriter->fileInfoCount > 1) {
+        qsort(pWriter->pFileInfos, pWriter->fileInfoCount, sizeof(*pWriter->pFileInfos), cyberfm_file_info_compare_hashed_name);
+    }
 
-void cyberfm_file_close(cyberfm_file* pFile)
-{
-    if (pFile == NULL) {
-        return;
+    for (iFile = 1; iFile < pWriter->fileInfoCount; iFile += 1) {
+        if (pWriter->pFileInfos[iFile].hashedName == pWriter->pFileInfos[iFile - 1].hashedName) {
+            return CYBERFM_INVALID_OPERATION;   /* The same file was added more than once. */
+        }
     }
 
-    free(pFile);
-}
+    /*
+    The sections are 28 bytes into the central directory. Aligning that to 8 bytes lets the reader reference them straight
+    out of the memory mapping rather than making a copy.
+    */
+    paddingSize = (size_t)((4 - (pWriter->offset & 7)) & 7);
+    success = success && cyberfm_fwrite_all(pWriter->pFile, padding, paddingSize);
 
-cyberfm_result cyberfm_file_read(cyberfm_file* pFile, void* pData, size_t dataSize)
-{
-    if (pFile == NULL || pData == NULL) {
-        return CYBERFM_INVALID_ARGS;
+    centralDirOffset = pWriter->offset + paddingSize;
+    centralDirSize   = CYBERFM_CENTRAL_DIRECTORY_HEADER_SIZE + ((uint64_t)pWriter->fileInfoCount * 56) + ((uint64_t)pWriter->dataSpecCount * 16) + ((uint64_t)pWriter->unknownDataCount * 8);
+
+    if (centralDirSize - 8 > 0xFFFFFFFF) {
+        return CYBERFM_OUT_OF_RANGE;
     }
 
-    if (dataSize > (pFile->size - pFile->cursor)) {
-        return CYBERFM_INVALID_ARGS;    /* Trying to read too much. */
+    cyberfm_write_le32(centralDirHeader +  0, 8);
+    cyberfm_write_le32(centralDirHeader +  4, (uint32_t)(centralDirSize - 8));
+    cyberfm_write_le64(centralDirHeader +  8, 0);
+    cyberfm_write_le32(centralDirHeader + 16, pWriter->fileInfoCount);
+    cyberfm_write_le32(centralDirHeader + 20, pWriter->dataSpecCount);
+    cyberfm_write_le32(centralDirHeader + 24, pWriter->unknownDataCount);
+
+    /* Swapping bytes works both ways so the same function that converts the sections when reading will convert them back. */
+    CYBERFM_ZERO_OBJECT(&centralDirectory);
+    centralDirectory.fileInfoCount     = pWriter->fileInfoCount;
+    centralDirectory.fileDataSpecCount = pWriter->dataSpecCount;
+    centralDirectory.pFileInfo         = pWriter->pFileInfos;
+    centralDirectory.pFileDataSpec     = pWriter->pDataSpecs;
+    cyberfm_archive_sections_to_native(&centralDirectory);
+    cyberfm_le64_array_to_native(pWriter->pUnknownData, pWriter->unknownDataCount);
+
+    success = success && cyberfm_fwrite_all(pWriter->pFile, centralDirHeader, sizeof(centralDirHeader));
+    success = success && cyberfm_fwrite_all(pWriter->pFile, pWriter->pFileInfos,   (size_t)pWriter->fileInfoCount    * 56);
+    success = success && cyberfm_fwrite_all(pWriter->pFile, pWriter->pDataSpecs,   (size_t)pWriter->dataSpecCount    * 16);
+    success = success && (pWriter->unknownDataCount == 0 || cyberfm_fwrite_all(pWriter->pFile, pWriter->pUnknownData, (size_t)pWriter->unknownDataCount * 8));
+
+    cyberfm_archive_sections_to_native(&centralDirectory);
+    cyberfm_le64_array_to_native(pWriter->pUnknownData, pWriter->unknownDataCount);
+
+    pWriter->offset = centralDirOffset + centralDirSize;
+
+    /* Now that we know where everything is we can go back and fill out the header. */
+    cyberfm_write_le32(header +  0, 0x52414452);    /* "RDAR" */
+    cyberfm_write_le32(header +  4, 12);
+    cyberfm_write_le64(header +  8, centralDirOffset);
+    cyberfm_write_le64(header + 16, centralDirSize);
+    cyberfm_write_le64(header + 24, 0);
+    cyberfm_write_le64(header + 32, pWriter->offset);
+
+    success = success && fseek(pWriter->pFile, 0, SEEK_SET) == 0;
+    success = success && cyberfm_fwrite_all(pWriter->pFile, header, sizeof(header));
+    success = success && mfs_fclose(pWriter->pFile) == MFS_SUCCESS;
+    pWriter->pFile = NULL;
+
+    if (!success) {
+        return CYBERFM_ERROR;
     }
 
-    memcpy(pData, pFile->pData + pFile->cursor, dataSize);
-    pFile->cursor += dataSize;
+    pWriter->stats.archiveSize = pWriter->offset;
+    pWriter->isFinalized = CYBERFM_TRUE;
 
     return CYBERFM_SUCCESS;
 }
 
-cyberfm_result cyberfm_file_seek(cyberfm_file* pFile, int64_t offset, int origin)
+cyberfm_result cyberfm_archive_writer_get_stats(const cyberfm_archive_writer* pWriter, cyberfm_archive_writer_stats* pStats)
 {
-    if (pFile == NULL) {
+    if (pStats == NULL) {
         return CYBERFM_INVALID_ARGS;
     }
 
-    switch (origin)
-    {
-        case SEEK_SET:
-        {
-            if (offset < 0 || (uint64_t)offset > pFile->size) {
-                return CYBERFM_INVALID_ARGS;    /* Seeking out of bounds. */
-            }
-
-            pFile->cursor = (uint64_t)offset;
-        } break;
-
-        case SEEK_CUR:
-        {
-            if (offset < 0) {
-                if ((uint64_t)-offset > pFile->cursor) {
-                    return CYBERFM_INVALID_ARGS;    /* Trying to seek too far backwards. */
-                }
-            } else {
-                if ((uint64_t)offset > (pFile->size - pFile->cursor)) {
-                    return CYBERFM_INVALID_ARGS;    /* Trying to seek too far forward. */
-                }
-            }
-
-            pFile->cursor = (uint64_t)(pFile->cursor + offset);
-        } break;
-
-        case SEEK_END:
-        {
-            if (offset < 0) {
-                return CYBERFM_INVALID_ARGS;
-            }
-
-            pFile->cursor = pFile->size - offset;
-        } break;
+    CYBERFM_ZERO_OBJECT(pStats);
 
-        default: return CYBERFM_INVALID_ARGS;
+    if (pWriter == NULL) {
+        return CYBERFM_INVALID_ARGS;
     }
 
-    return CYBERFM_SUCCESS;
-}
-
-cyberfm_bool32 cyberfm_file_eof(cyberfm_file* pFile)
-{
-    if (pFile == NULL) {
-        return CYBERFM_FALSE;
-    }
+    *pStats = pWriter->stats;
 
-    return pFile->cursor == pFile->size;
+    return CYBERFM_SUCCESS;
 }
 
 
@@ -533,6 +7062,10 @@ cyberfm_result cyberfm_file_extract_audio(cyberfm_file* pFile, void** ppData, si
         return CYBERFM_INVALID_ARGS;
     }
 
+    if (pFile->pData == NULL) {
+        return CYBERFM_INVALID_OPERATION;   /* Streamed files are not supported here. The whole file needs to be in memory. */
+    }
+
     /* First thing is to check that we're actually looking at an audio file. */
     if (pFile->pData[0] != 'R' || pFile->pData[1] != 'I' || pFile->pData[2] != 'F' || pFile->pData[3] != 'F') {
         return CYBERFM_ERROR;   /* Not an audio file. */
@@ -9,6 +9,10 @@ David Reid - mackron@gmail.com
 #include "external/minifs/minifs.h"
 #include <stdint.h>
 
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
 typedef void* cyberfm_handle;
 typedef void (* cyberfm_proc)(void);
 
@@ -25,6 +29,20 @@ typedef int cyberfm_result;
 #define CYBERFM_OUT_OF_RANGE        -5
 #define CYBERFM_ACCESS_DENIED       -6
 #define CYBERFM_DOES_NOT_EXIST      -7
+#define CYBERFM_CORRUPT_DATA        -8
+
+#define CYBERFM_ARCHIVE_FLAG_MEMORY_MAP 0x00000001   /* Memory map the archive. The central directory and uncompressed files are served straight out of the mapping. */
+
+#define CYBERFM_FILE_FLAG_STREAM        0x00000001   /* Read the file from the archive on demand rather than loading it all when it is opened. */
+#define CYBERFM_FILE_STREAM_WINDOW_SIZE 65536
+
+#define CYBERFM_FILE_POOL_MIN_SIZE          256                 /* The size of the smallest size class for pooled file allocations. */
+#define CYBERFM_FILE_POOL_SIZE_CLASS_COUNT  17                  /* Size classes go up to CYBERFM_FILE_POOL_MIN_SIZE << 16, which is 16MB. Anything bigger is not pooled. */
+#define CYBERFM_FILE_POOL_MAX_CACHED_SIZE   (64 * 1024 * 1024)  /* The maximum number of bytes to keep in the file pool. */
+#define CYBERFM_SCRATCH_MAX_CACHED_SIZE     (64 * 1024 * 1024)  /* Scratch buffers bigger than this are freed rather than being reused. */
+
+#define CYBERFM_DEFAULT_IO_QUEUE_DEPTH  32                  /* The default maximum number of reads in flight at once for batched reads. Only used with io_uring. */
+#define CYBERFM_IO_CHUNK_SIZE           (256 * 1024)        /* Large reads are split into chunks of this size so they can be worked on in parallel. */
 
 #define CYBERFM_AUDIO_FORMAT_PCM    0x3102
 #define CYBERFM_AUDIO_FORMAT_OPUS   0x4101
@@ -32,6 +50,141 @@ typedef int cyberfm_result;
 typedef struct cyberfm_archive cyberfm_archive;
 typedef struct cyberfm_file    cyberfm_file;
 
+
+/*
+Threading
+=========
+These are just thin wrappers around the platform's threading APIs. On Windows the mutex is a SRWLOCK which is
+pointer sized and doesn't need to be uninitialized.
+*/
+#ifdef _WIN32
+typedef cyberfm_handle cyberfm_thread;
+typedef void*          cyberfm_mutex;
+#else
+typedef pthread_t       cyberfm_thread;
+typedef pthread_mutex_t cyberfm_mutex;
+#endif
+
+typedef void* (* cyberfm_thread_proc)(void* pUserData);
+
+cyberfm_result cyberfm_thread_create(cyberfm_thread* pThread, cyberfm_thread_proc entryProc, void* pUserData);
+void cyberfm_thread_wait(cyberfm_thread* pThread);
+uint32_t cyberfm_get_cpu_count(void);
+void cyberfm_sleep(uint32_t milliseconds);
+double cyberfm_get_time(void);  /* A monotonic time in seconds. Only useful for measuring the time between two points. */
+
+cyberfm_result cyberfm_mutex_init(cyberfm_mutex* pMutex);
+void cyberfm_mutex_uninit(cyberfm_mutex* pMutex);
+void cyberfm_mutex_lock(cyberfm_mutex* pMutex);
+void cyberfm_mutex_unlock(cyberfm_mutex* pMutex);
+
+uint32_t cyberfm_atomic_load_32(volatile uint32_t* pValue);
+void cyberfm_atomic_store_32(volatile uint32_t* pValue, uint32_t value);
+uint32_t cyberfm_atomic_fetch_add_32(volatile uint32_t* pValue, uint32_t value);
+uint64_t cyberfm_atomic_fetch_add_64(volatile uint64_t* pValue, uint64_t value);
+cyberfm_bool32 cyberfm_atomic_compare_exchange_32(volatile uint32_t* pValue, uint32_t expected, uint32_t desired);
+
+
+/*
+Job Pool
+========
+Runs a fixed set of jobs across a number of threads. Each thread has it's own queue of jobs, and when a thread runs out of
+work it'll steal from the other threads. When costs are specified, jobs are dealt out to each thread in order of descending
+cost so that large jobs are started first. This stops a single huge job from being left until the end and holding
+everything up.
+
+Jobs start running as soon as the pool is initialized. cyberfm_job_pool_uninit() will wait for every job to complete.
+*/
+typedef void (* cyberfm_job_proc)(void* pUserData, uint32_t jobIndex);
+
+typedef struct
+{
+    uint32_t threadCount;       /* Set to 0 to use one thread per CPU. */
+    uint32_t jobCount;
+    const uint64_t* pJobCosts;  /* Optional. An array of jobCount items used for scheduling. Larger costs are run first. */
+    cyberfm_job_proc onJob;
+    void* pUserData;
+} cyberfm_job_pool_config;
+
+typedef struct cyberfm_job_pool cyberfm_job_pool;
+
+typedef struct
+{
+    cyberfm_job_pool* pPool;
+    uint32_t threadIndex;
+    cyberfm_mutex lock;
+    uint32_t* pJobs;    /* An offset into the pool's job list. */
+    uint32_t head;      /* Jobs are taken from the head, both by the owner and by thieves. The largest jobs are at the head. */
+    uint32_t tail;
+} cyberfm_job_queue;
+
+struct cyberfm_job_pool
+{
+    cyberfm_job_pool_config config;
+    uint32_t threadCount;
+    uint32_t createdThreadCount;    /* Can be less than threadCount if thread creation failed. */
+    cyberfm_thread* pThreads;
+    cyberfm_job_queue* pQueues;
+    uint32_t* pJobs;
+    void* pAllocation;  /* A single allocation for the threads, queues and jobs. */
+};
+
+cyberfm_job_pool_config cyberfm_job_pool_config_init(uint32_t threadCount, uint32_t jobCount, cyberfm_job_proc onJob, void* pUserData);
+cyberfm_result cyberfm_job_pool_init(const cyberfm_job_pool_config* pConfig, cyberfm_job_pool* pPool);
+void cyberfm_job_pool_uninit(cyberfm_job_pool* pPool);
+
+
+/*
+Bounded Queue
+=============
+A fixed capacity, lock-free queue of 32-bit values which can be pushed to and popped from by any number of threads at the
+same time. This is used for passing work between the stages of a pipeline, where the values are usually indices into some
+other array. Pushing to a full queue and popping from an empty queue fails immediately rather than waiting. It's up to the
+caller to decide how to wait.
+
+The capacity is rounded up to a power of two.
+*/
+typedef struct
+{
+    volatile uint32_t sequence;
+    uint32_t value;
+} cyberfm_queue_cell;
+
+typedef struct
+{
+    cyberfm_queue_cell* pCells;
+    uint32_t capacity;
+    volatile uint32_t pushCursor;
+    volatile uint32_t popCursor;
+} cyberfm_queue;
+
+cyberfm_result cyberfm_queue_init(uint32_t capacity, cyberfm_queue* pQueue);
+void cyberfm_queue_uninit(cyberfm_queue* pQueue);
+cyberfm_bool32 cyberfm_queue_try_push(cyberfm_queue* pQueue, uint32_t value);
+cyberfm_bool32 cyberfm_queue_try_pop(cyberfm_queue* pQueue, uint32_t* pValue);
+
+
+/*
+SHA-1
+=====
+Used for checking files against the hash stored in the central directory. On x86 CPUs with the SHA extensions the block
+function uses the SHA instructions, which is several times faster than the plain C version. Which one to use is decided at
+run time so the same build works everywhere. Define CYBERFM_NO_SHA_NI to only ever use the plain C version.
+*/
+#define CYBERFM_SHA1_SIZE   20
+
+typedef struct
+{
+    uint32_t state[5];
+    uint64_t size;          /* The total number of bytes hashed so far. */
+    uint8_t buffer[64];     /* Holds a partial block between calls to cyberfm_sha1_update(). */
+} cyberfm_sha1;
+
+void cyberfm_sha1_init(cyberfm_sha1* pSHA1);
+void cyberfm_sha1_update(cyberfm_sha1* pSHA1, const void* pData, size_t dataSize);
+void cyberfm_sha1_finalize(cyberfm_sha1* pSHA1, uint8_t* pDigest);
+cyberfm_bool32 cyberfm_sha1_is_accelerated(void);
+
 /*
 Cyperpunk 2077 uses Oodle for compression. Unfortunately we don't have public access to the official Oodle
 headers, but we can write our own version of the necessary function declarations and dynamically load the
@@ -52,6 +205,74 @@ source of information going forward as well.
 typedef int (* cyberfm_OodleLZ_Decompress_proc)(unsigned char* pCompressedData, int compressedSize, unsigned char* pDecompressedData, int decompressedSize, int a, int b, int c, void* d, void* e, void* f, void* g, void* h, void* i, int j);
 
 
+/*
+Decompression goes through a codec. When decompressing a block, each codec attached to the archive is asked in turn whether
+or not it recognizes the block, which is done by looking at the signature at the start of the block. The first one to
+recognize it is used. Custom codecs can be attached with the config passed into cyberfm_archive_init_ex(), in which case
+they'll be probed before the built-in ones.
+
+There are two built-in codecs. The first is Oodle which handles blocks starting with "KARK", but is only available if the
+Oodle shared object could be loaded. The second is a simple reference codec which handles blocks starting with "CFLZ". This
+one is always available and can be used to exercise the compressed path without needing Oodle. Use cyberfm_cflz_compress()
+to create blocks in this format.
+
+The compressed data passed into a codec is the entire block, including it's signature.
+
+onDecompressBatch is optional. It's used for decompressing many independent blocks in one go so the codec can amortize
+it's setup costs or decode them in parallel. If it's NULL, onDecompress will be called for each block instead.
+
+onCompress is optional and is only used by the archive writer. It should output a complete block, including it's signature,
+and fail with CYBERFM_OUT_OF_RANGE if it doesn't fit in dstCap. It must be safe to call from multiple threads at the same
+time. Oodle is only used for decompression so the built-in Oodle codec leaves this as NULL.
+
+onDecompressPrefix is optional. It decodes only the first dstSize bytes of a block, which can be less than the uncompressed
+size, and should stop as soon as it has them. This is used for peeking at the start of files. The compressed data might be
+cut short, in which case it should fail if it runs out of input before getting dstSize bytes. If it's NULL, the whole block
+is decompressed instead. Oodle can't stop early so the built-in Oodle codec leaves this as NULL.
+*/
+typedef struct
+{
+    const void* pCompressedData;
+    size_t compressedSize;
+    void* pDst;
+    size_t dstSize;             /* Must be equal to the uncompressed size of the block. */
+    cyberfm_result result;      /* Set by the codec. */
+} cyberfm_codec_job;
+
+typedef struct
+{
+    const char* pName;
+    void* pUserData;
+    cyberfm_bool32 (* onProbe)(void* pUserData, const void* pCompressedData, size_t compressedSize);
+    cyberfm_result (* onDecompress)(void* pUserData, const void* pCompressedData, size_t compressedSize, void* pDst, size_t dstSize);
+    void (* onDecompressBatch)(void* pUserData, cyberfm_codec_job* pJobs, uint32_t jobCount);
+    cyberfm_result (* onCompress)(void* pUserData, const void* pSrc, size_t srcSize, void* pDst, size_t dstCap, size_t* pCompressedSize);
+    cyberfm_result (* onDecompressPrefix)(void* pUserData, const void* pCompressedData, size_t compressedSize, void* pDst, size_t dstSize);
+} cyberfm_codec;
+
+#define CYBERFM_MAX_CODEC_COUNT     16
+
+#define CYBERFM_CFLZ_FOURCC         0x5A4C4643  /* "CFLZ" */
+#define CYBERFM_CFLZ_HEADER_SIZE    12          /* FourCC, 32-bit uncompressed size, 8-bit method, 3 bytes reserved. */
+#define CYBERFM_CFLZ_METHOD_STORED  0
+#define CYBERFM_CFLZ_METHOD_LZ      1
+
+/*
+Compresses data with the reference codec. The output is a complete block, including the header. Use
+cyberfm_cflz_compress_bound() to get the size of the output buffer to use to be guaranteed to have enough room. If the
+data doesn't compress, it's written out uncompressed (the stored method).
+*/
+size_t cyberfm_cflz_compress_bound(size_t srcSize);
+cyberfm_result cyberfm_cflz_compress(const void* pSrc, size_t srcSize, void* pDst, size_t dstCap, size_t* pCompressedSize);
+cyberfm_result cyberfm_cflz_decompress(const void* pCompressedData, size_t compressedSize, void* pDst, size_t dstSize);
+
+/* Decompresses only the first dstSize bytes of a block. The block can be cut short so long as it has enough to get that far. */
+cyberfm_result cyberfm_cflz_decompress_prefix(const void* pCompressedData, size_t compressedSize, void* pDst, size_t dstSize);
+
+/* Retrieves the reference codec. This is always attached to an archive so you'll normally not need this. */
+const cyberfm_codec* cyberfm_get_cflz_codec(void);
+
+
 /*
 This is a bit weird. I know that the first item must be the hashed version of the file name. Also, it looks like maybe "file"
 is made up of a range of sub-files or something? The 4th and 5th members seem to be an range that correlates with the the
@@ -84,11 +305,13 @@ I have not been able to figure out what the third section in the central directo
 in total for each item contained within it.
 
 For the life of me I've not been able to figure out what this could possibly be used for...
+
+Nothing uses this section so it's not loaded when the archive is initialized. Use cyberfm_archive_get_unknown_data() to
+get access to it.
 */
 typedef struct
 {
     uint64_t unknown0;
-    uint64_t unknown1;
 } cyberfm_archive_central_directory_unknown_data;
 
 typedef struct
@@ -101,46 +324,384 @@ typedef struct
     uint32_t unknownDataCount;
     cyberfm_archive_file_info* pFileInfo;
     cyberfm_archive_file_data_spec* pFileDataSpec;
-    cyberfm_archive_central_directory_unknown_data* pUnknownData;
-    char pPayload[1]; /* The raw data of the central directory as a single allocation. Pointers above are offsets into this. */
+    cyberfm_archive_central_directory_unknown_data* pUnknownData;   /* Can be NULL until loaded with cyberfm_archive_get_unknown_data(). */
+    char pPayload[1]; /* The raw data of the sections as a single allocation when they couldn't be referenced in place. Pointers above point into this. */
 } cyberfm_archive_central_directory;
 
+/* An item in the archive's cache of decoded sub-files. The data is shared between every file that's opened from it. */
+typedef struct cyberfm_cache_entry cyberfm_cache_entry;
+struct cyberfm_cache_entry
+{
+    cyberfm_cache_entry* pPrev;     /* Towards the most recently used entry. */
+    cyberfm_cache_entry* pNext;     /* Towards the least recently used entry. */
+    uint32_t dataSpecIndex;
+    uint32_t refCount;              /* The number of open files referencing this entry. Entries can't be evicted while this is non-zero. */
+    cyberfm_bool32 isResident;      /* False if the entry could not be added to the cache, in which case it's freed with the last reference. */
+    uint64_t size;
+    uint8_t pData[1];
+};
+
+typedef struct
+{
+    uint64_t hitCount;
+    uint64_t missCount;
+    uint64_t evictionCount;
+    uint64_t entryCount;        /* The number of entries currently in the cache. */
+    uint64_t sizeInBytes;       /* The number of bytes currently in the cache. Can go over the capacity while entries are in use. */
+    uint64_t capacityInBytes;
+} cyberfm_cache_stats;
+
+typedef struct
+{
+    uint32_t flags; /* A combination of CYBERFM_ARCHIVE_FLAG_* flags. */
+    uint64_t cacheSizeInBytes;  /* The budget for the cache of decoded sub-files. Set to 0 (the default) to disable the cache. */
+    const cyberfm_codec* const* ppCodecs;   /* Optional. Custom codecs to try before the built-in ones. Must remain valid for the life of the archive. */
+    uint32_t codecCount;
+    uint32_t ioQueueDepth;      /* The maximum number of reads to have in flight at once for batched reads. Set to 0 to use CYBERFM_DEFAULT_IO_QUEUE_DEPTH, or 1 to always use blocking reads. */
+    struct
+    {
+        const void* pData;          /* The raw central directory, starting from it's FourCC. Must remain valid for the life of the archive. */
+        uint64_t size;
+        uint64_t archiveFileSize;   /* The size of the archive file at the time the copy was made. Used for validation. */
+        int64_t archiveModifiedTime;
+    } cachedCentralDirectory;   /* Optional. When valid, this will be used instead of loading the central directory from the archive. */
+} cyberfm_archive_config;
+
 struct cyberfm_archive
 {
     FILE* pFile;
+    uint32_t flags;
     uint32_t fourcc;
     uint32_t unknown0;      /* Always set to 0x0C000000. I think this is a fourcc that's intended to describe some kind of chunk of data in the archive. */
     uint64_t centralDirOffset;
     uint64_t centralDirSize;
     uint64_t unknown1;
     uint64_t archiveSize;   /* The size of the archive file. */
+    uint64_t fileSize;      /* The size of the file on disk. */
+    int64_t fileModifiedTime;
+    cyberfm_bool32 isCentralDirectoryCached;    /* Set to true if the central directory came from the config's cachedCentralDirectory. */
     uint8_t unknown2[132];  /* Padding? */
-    cyberfm_archive_central_directory* pCentralDirectory;   /* Must be dynamically allocated. */
+    cyberfm_archive_central_directory* pCentralDirectory;   /* Must be dynamically allocated. When memory mapped, only the header part is allocated and the section pointers refer to the mapping. */
+    struct
+    {
+        const uint8_t* pData;   /* The start of the mapped archive. Set to NULL when the archive is not memory mapped. */
+        uint64_t size;
+        cyberfm_handle hMapping;    /* Only used on Windows. */
+    } map;
+    struct
+    {
+        uint64_t* pHashes;          /* The hashed names of each file in Eytzinger order. Index 0 is unused. */
+        uint32_t* pFileIndices;     /* Maps an item in pHashes to the index of the file in the central directory. */
+        uint32_t count;
+        void* pAllocation;
+    } lookup;   /* For cyberfm_archive_find(). Can be empty if we ran out of memory, in which case lookups fall back to a linear search. */
     struct
     {
         cyberfm_handle hOodle;  /* A handle to the Oodle shared object for loading OodleLZ_Decompress() */
         cyberfm_OodleLZ_Decompress_proc OodleLZ_Decompress;
+        cyberfm_codec codec;    /* A codec wrapping OodleLZ_Decompress(). */
     } oodle;
+    struct
+    {
+        const cyberfm_codec* pCodecs[CYBERFM_MAX_CODEC_COUNT];  /* In the order in which they're probed. */
+        uint32_t count;
+    } codecs;
+    struct
+    {
+        cyberfm_mutex lock;                     /* Guards the loading of sections of the central directory that are loaded on demand. */
+        volatile uint32_t isUnknownDataLoaded;
+        void* pUnknownDataAllocation;
+    } deferred;
+    struct
+    {
+        cyberfm_mutex lock;
+        void* pFreeFiles[CYBERFM_FILE_POOL_SIZE_CLASS_COUNT];   /* A free list for each size class. */
+        void* pFreeScratch;     /* A free list of scratch buffers for reading compressed data. */
+        void* pFreeRings;       /* A free list of io_uring instances for batched reads. Always NULL if io_uring is not being used. */
+        size_t cachedSize;      /* The number of bytes sitting in pFreeFiles. */
+    } pool;     /* Recycles memory for cyberfm_file objects and compressed data so opening files doesn't need to allocate. */
+    struct
+    {
+        cyberfm_mutex lock;
+        uint64_t capacityInBytes;       /* Set to 0 when the cache is disabled. */
+        uint64_t sizeInBytes;
+        uint64_t entryCount;
+        cyberfm_cache_entry** ppEntries;    /* Indexed by data spec index. Allocated when the first entry is added. */
+        cyberfm_cache_entry* pHead;         /* The most recently used entry. */
+        cyberfm_cache_entry* pTail;         /* The least recently used entry. This is where eviction starts. */
+        uint64_t hitCount;
+        uint64_t missCount;
+        uint64_t evictionCount;
+    } cache;    /* A least recently used cache of decoded sub-files. */
+    struct
+    {
+        uint32_t queueDepth;
+        volatile uint32_t isRingUnavailable;    /* Set to true if io_uring could not be used, in which case blocking reads are used instead. */
+    } io;
 };
 
 struct cyberfm_file
 {
     cyberfm_archive* pArchive;
+    const cyberfm_archive_file_data_spec* pDataSpec;
+    uint32_t flags;
+    uint32_t sizeClass;     /* The size class of the allocation in the archive's file pool. CYBERFM_FILE_POOL_SIZE_CLASS_COUNT if it's not pooled. */
     uint64_t cursor;
     uint64_t size;
-    uint8_t pData[1];   /* I'm just allocating all of the memory for the file on the heap. Would be good to support dynamically decompressing on demand, but not practical with the tools we have available. */
+    const uint8_t* pData;   /* Points to the memory mapped archive for uncompressed files when the archive is mapped. Otherwise points to pPayload. NULL for streamed files that have not been loaded into memory. */
+    struct
+    {
+        uint64_t windowOffset;  /* The offset within the file of the first byte in the window. */
+        size_t windowSize;      /* The number of valid bytes in the window. */
+        size_t windowCap;       /* The size of the window in pPayload. */
+        uint8_t* pDecodedData;  /* For compressed files. Allocated on the first read. */
+    } stream;   /* Only used with CYBERFM_FILE_FLAG_STREAM. */
+    cyberfm_cache_entry* pCacheEntry;   /* Set when the data is coming from the archive's cache. pData will point to the entry's data. */
+    uint8_t pPayload[1];    /* Holds the whole file, or just the read window for streamed files. */
 };
 
+/*
+Retrieves the 20 byte hash of a file in the order it's stored in the archive. This looks to be a SHA-1 of the file's
+content, which can be checked with cyberfm_archive_verify_file(). Either way, files with the same hash can be assumed to
+have the same content.
+*/
+void cyberfm_file_info_get_hash(const cyberfm_archive_file_info* pFileInfo, uint8_t* pHash);
+
+cyberfm_archive_config cyberfm_archive_config_init(uint32_t flags);
+
+cyberfm_result cyberfm_archive_init_ex(const char* pFilePath, const cyberfm_archive_config* pConfig, cyberfm_archive* pArchive);
 cyberfm_result cyberfm_archive_init(const char* pFilePath, cyberfm_archive* pArchive);
 void cyberfm_archive_uninit(cyberfm_archive* pArchive);
 
+/*
+Finds the index of a file from it's hashed name. This is an O(log n) search over a cache friendly table that's built
+when the archive is initialized.
+*/
+cyberfm_result cyberfm_archive_find(cyberfm_archive* pArchive, uint64_t hashedName, uint32_t* pFileIndex);
+
+/*
+Decompresses a number of independent blocks in one call. The codec for each block is determined from it's signature, and
+runs of blocks using the same codec are handed to that codec's onDecompressBatch callback in one go. The result of each block
+is output to the result member of the job. The return value will be CYBERFM_SUCCESS only if every block was successful.
+*/
+cyberfm_result cyberfm_archive_decompress_batch(cyberfm_archive* pArchive, cyberfm_codec_job* pJobs, uint32_t jobCount);
+
+/*
+Retrieves the hit, miss and eviction counters of the cache of decoded sub-files, along with it's current size.
+*/
+cyberfm_result cyberfm_archive_get_cache_stats(cyberfm_archive* pArchive, cyberfm_cache_stats* pStats);
+
+/*
+Retrieves the unknown section of the central directory. This is loaded from the archive the first time it's requested
+rather than at initialization time since nothing needs it for extracting files. This is thread safe. The returned
+pointer remains valid until the archive is uninitialized and will be NULL if the section is empty.
+*/
+cyberfm_result cyberfm_archive_get_unknown_data(cyberfm_archive* pArchive, const cyberfm_archive_central_directory_unknown_data** ppUnknownData);
+
+/*
+Retrieves a read-only pointer to the data of an uncompressed sub-file straight out of the memory mapping. No memory
+is allocated and nothing is copied. This only works when the archive was initialized with CYBERFM_ARCHIVE_FLAG_MEMORY_MAP
+and the sub-file is not compressed. Otherwise CYBERFM_INVALID_OPERATION is returned and you'll need to go through
+cyberfm_file_open_by_index() instead. The pointer remains valid until the archive is uninitialized.
+*/
+cyberfm_result cyberfm_archive_get_file_view_by_index(cyberfm_archive* pArchive, uint32_t index, uint32_t subfile, const void** ppData, size_t* pDataSize);
+
+/*
+Reads or decompresses a sub-file straight into a buffer provided by the caller. This does not allocate a cyberfm_file or
+do any extra copies. The size of the sub-file is always output to pSize. Pass NULL for pDst to only retrieve the size.
+If dstCap is too small, CYBERFM_OUT_OF_RANGE is returned and nothing is read. Like opening files, this is thread safe.
+*/
+cyberfm_result cyberfm_archive_read_file_by_index(cyberfm_archive* pArchive, uint32_t index, uint32_t subfile, void* pDst, size_t dstCap, size_t* pSize);
+cyberfm_result cyberfm_archive_read_file(cyberfm_archive* pArchive, uint64_t hashedName, uint32_t subfile, void* pDst, size_t dstCap, size_t* pSize);
+
+/*
+Verification
+============
+Checks files against the hash in the central directory. The hash looks to be a SHA-1, but it's not known for sure what data
+it's taken over, so a few possibilities are tried. The kind of hash that matched is output so that it can be reported, and
+passed back in as a hint so that it's tried first next time, which means only one hash needs to be calculated per file in
+practice.
+
+CYBERFM_CORRUPT_DATA is returned when the file was read successfully but nothing matched. Files without a hash (it's all
+zeros) can't be verified and will return CYBERFM_INVALID_OPERATION. A compressed file that can't be decompressed fails the
+same way it would when reading it.
+*/
+#define CYBERFM_HASH_KIND_UNKNOWN               0   /* Nothing matched. */
+#define CYBERFM_HASH_KIND_SHA1                  1   /* A SHA-1 of the uncompressed data of each sub-file, one after the other. */
+#define CYBERFM_HASH_KIND_SHA1_COMPRESSED       2   /* A SHA-1 of the data of each sub-file as it's stored in the archive. */
+#define CYBERFM_HASH_KIND_SHA1_FIRST_SUBFILE    3   /* A SHA-1 of the uncompressed data of the first sub-file only. */
+#define CYBERFM_HASH_KIND_COUNT                 4
+
+typedef struct
+{
+    uint32_t index;         /* The index of the file to verify. */
+    uint32_t hashKind;      /* Set to the kind of hash that matched. */
+    cyberfm_result result;
+} cyberfm_verify_request;
+
+/*
+Verifies a single file. On input, *pHashKind is the kind of hash to try first, or CYBERFM_HASH_KIND_UNKNOWN to use the
+default order. On output it's set to the kind of hash that matched. This is thread safe.
+*/
+cyberfm_result cyberfm_archive_verify_file(cyberfm_archive* pArchive, uint32_t index, uint32_t* pHashKind);
+
+/*
+Verifies a number of files across threadCount threads, or one thread per CPU if threadCount is 0. The largest files are
+started first. The result of each file is output to the request. The return value will be CYBERFM_SUCCESS only if every
+file was verified successfully.
+*/
+cyberfm_result cyberfm_archive_verify_files(cyberfm_archive* pArchive, cyberfm_verify_request* pRequests, uint32_t count, uint32_t threadCount);
+
+/* Retrieves a description of a kind of hash for printing. */
+const char* cyberfm_hash_kind_to_string(uint32_t hashKind);
+
+/*
+Batched Reads
+=============
+cyberfm_archive_read_batch() reads a number of ranges of the archive in one go. On Linux, when compiled with
+CYBERFM_USE_IO_URING defined, these are all submitted to an io_uring together so that up to ioQueueDepth reads (from the
+archive config) are in flight at once. This makes a big difference on NVMe drives which can't get anywhere near their full
+bandwidth when reads are done one at a time. When io_uring is not compiled in or is not available, or when the archive is
+memory mapped, the reads are just done one after the other.
+
+cyberfm_archive_load_files() builds on this to load a number of sub-files, decompressing them as required. Sub-files are
+output straight into the buffers provided by the caller, just like cyberfm_archive_read_file_by_index(). You'll get the best
+results if the requests are sorted by offset in the archive.
+
+For both of these, the result of each request is output to it's result member and the return value will be CYBERFM_SUCCESS
+only if every request was successful. They're safe to call from multiple threads at the same time.
+*/
+typedef struct
+{
+    uint64_t offset;        /* The absolute offset in the archive. */
+    size_t size;
+    void* pDst;
+    cyberfm_result result;
+} cyberfm_read_request;
+
+typedef struct
+{
+    uint32_t index;         /* The index of the file in the central directory. */
+    uint32_t subfile;
+    void* pDst;             /* Must be big enough to hold the uncompressed sub-file. Set to NULL to only retrieve the size. */
+    size_t dstCap;
+    size_t size;            /* Set to the uncompressed size of the sub-file. */
+    cyberfm_result result;
+} cyberfm_load_request;
+
+cyberfm_result cyberfm_archive_read_batch(cyberfm_archive* pArchive, cyberfm_read_request* pRequests, uint32_t requestCount);
+cyberfm_result cyberfm_archive_load_files(cyberfm_archive* pArchive, cyberfm_load_request* pRequests, uint32_t requestCount);
+
+/*
+Decompresses a single block that's already been loaded into memory. This uses the same codec selection as everything else.
+*/
+cyberfm_result cyberfm_archive_decompress_block(cyberfm_archive* pArchive, const void* pCompressedData, size_t compressedSize, void* pDst, size_t dstSize);
+
+
+/*
+Read Planning
+=============
+The files in the central directory are in order of their hashed name which has nothing to do with where the data sits in the
+archive. Reading files in that order results in a lot of seeking which is slow on hard drives and network mounts. A read
+plan sorts every sub-file by it's offset in the archive and then groups them into spans. Each span is a contiguous range of
+the archive that can be read in one go. Sub-files that are close together are merged into the same span, even if there's a
+small gap between them. Once a span has been read, each item can be found at (pItem->offset - pSpan->offset) in the buffer.
+
+Sub-files with a data spec that points outside of the archive are not included in the plan.
+
+Large uncompressed sub-files don't need to be loaded into memory at all if they're just going to be written out to a file.
+When directCopyMinSize is set, uncompressed sub-files of at least that size are given a span of their own with the
+CYBERFM_READ_PLAN_SPAN_FLAG_DIRECT flag set. These can be passed to cyberfm_archive_copy_to_file() rather than being loaded.
+*/
+#define CYBERFM_READ_PLAN_DEFAULT_MAX_SPAN_SIZE (4 * 1024 * 1024)
+#define CYBERFM_READ_PLAN_DEFAULT_MAX_GAP_SIZE  (64 * 1024)
+
+#define CYBERFM_READ_PLAN_SPAN_FLAG_DIRECT      0x00000001  /* The span is a single uncompressed item that can be copied straight to a file. */
+
+typedef struct
+{
+    uint64_t maxSpanSize;   /* Items will not be merged into a span if it would make the span bigger than this. A single item can still be bigger. */
+    uint64_t maxGapSize;    /* The largest number of unused bytes allowed between two items in the same span. */
+    uint64_t directCopyMinSize; /* Uncompressed items at least this big get a span of their own with CYBERFM_READ_PLAN_SPAN_FLAG_DIRECT. Set to 0 (the default) to disable. */
+    const uint8_t* pFileFilter; /* Optional. One item for each file in the central directory. Files set to 0 are left out of the plan. */
+} cyberfm_read_plan_config;
+
+typedef struct
+{
+    uint64_t offset;        /* The offset of the data in the archive. */
+    uint32_t size;          /* The compressed size of the data. */
+    uint32_t dataSpecIndex;
+    uint32_t fileIndex;
+    uint32_t subfile;
+} cyberfm_read_plan_item;
+
+typedef struct
+{
+    uint64_t offset;        /* The offset of the span in the archive. */
+    uint64_t size;          /* The number of bytes to read, including any gaps. */
+    uint32_t firstItem;     /* An index into pItems. */
+    uint32_t itemCount;
+    uint32_t flags;         /* A combination of CYBERFM_READ_PLAN_SPAN_FLAG_* flags. */
+} cyberfm_read_plan_span;
+
+typedef struct
+{
+    cyberfm_read_plan_item* pItems; /* Sorted by offset. */
+    uint32_t itemCount;
+    cyberfm_read_plan_span* pSpans; /* Sorted by offset. */
+    uint32_t spanCount;
+    void* pAllocation;
+} cyberfm_read_plan;
+
+cyberfm_read_plan_config cyberfm_read_plan_config_init(void);
+cyberfm_result cyberfm_read_plan_init(cyberfm_archive* pArchive, const cyberfm_read_plan_config* pConfig, cyberfm_read_plan* pPlan);
+void cyberfm_read_plan_uninit(cyberfm_read_plan* pPlan);
+
+/*
+Loads the raw data of a span. When the archive is memory mapped this points straight to the mapping. Otherwise the span is
+read into a buffer from the archive's scratch pool. Either way, release it with cyberfm_read_plan_unload_span(). This is
+safe to call from multiple threads at the same time.
+*/
+cyberfm_result cyberfm_read_plan_load_span(cyberfm_archive* pArchive, const cyberfm_read_plan_span* pSpan, const void** ppData);
+void cyberfm_read_plan_unload_span(cyberfm_archive* pArchive, const cyberfm_read_plan_span* pSpan, const void* pData);
+
+/*
+Copies a range of the archive straight to a new file, replacing it if it already exists. This is intended for extracting
+uncompressed sub-files. On Linux the copy is done in the kernel with copy_file_range() so the data never comes into user
+space. On filesystems that support it, like XFS and Btrfs, this can share the underlying blocks rather than copying them.
+If copy_file_range() isn't supported, sendfile() is tried, and then finally a normal buffered copy, which is all that's
+used on other platforms. This is thread safe.
+*/
+cyberfm_result cyberfm_archive_copy_to_file(cyberfm_archive* pArchive, uint64_t offset, uint64_t size, const char* pFilePath);
+
 /*
 Opens a file in the archive. I'm not sure yet how the whole sub-file thing is supposed to work, so for now
-you need to specify an index. In the future it would be good to figure out the hashing algorithm used so
-we can supporting opening files by their name.
+you need to specify an index. Use cyberfm_file_open_by_path() to open a file by it's name rather than it's hash.
+
+Opening files is thread safe. Data is read from the archive with positional reads (or straight out of the
+mapping) so there's no shared file cursor, which means any number of threads can open files from the same
+archive at the same time. An individual cyberfm_file object should only be used by one thread at a time.
+
+When the archive was initialized with a non-zero cacheSizeInBytes, the decoded data is kept in a least recently used
+cache after the file is closed and the next open of the same sub-file will just reference it. Every file opened from the
+same cache entry shares the same read-only data, but each has it's own cursor. Entries are never evicted while a file is
+referencing them. Sub-files that can be referenced straight out of the memory mapping, and sub-files bigger than the
+whole cache, bypass the cache. All files must be closed before the archive is uninitialized.
 */
 cyberfm_result cyberfm_file_open_by_index(cyberfm_archive* pArchive, uint32_t index, uint32_t subfile, cyberfm_file** ppFile);
 cyberfm_result cyberfm_file_open(cyberfm_archive* pArchive, uint64_t hashedName, uint32_t subfile, cyberfm_file** ppFile);
+
+/*
+The same as the above, but with a combination of CYBERFM_FILE_FLAG_* flags.
+
+With CYBERFM_FILE_FLAG_STREAM, nothing is loaded when the file is opened. Uncompressed files are read from the archive on
+demand through a window of CYBERFM_FILE_STREAM_WINDOW_SIZE bytes so memory usage stays the same regardless of the size of
+the file. Compressed files are decoded on the first read. Oodle can only decode a whole block in one go so this still needs
+enough memory for the whole file, but opening and seeking is free. Streamed files will have a NULL pData until the data has
+been loaded so you must use cyberfm_file_read() to get at the data.
+*/
+cyberfm_result cyberfm_file_open_by_index_ex(cyberfm_archive* pArchive, uint32_t index, uint32_t subfile, uint32_t flags, cyberfm_file** ppFile);
+cyberfm_result cyberfm_file_open_ex(cyberfm_archive* pArchive, uint64_t hashedName, uint32_t subfile, uint32_t flags, cyberfm_file** ppFile);
 void cyberfm_file_close(cyberfm_file* pFile);
 cyberfm_result cyberfm_file_read(cyberfm_file* pFile, void* pData, size_t dataSize);
 cyberfm_result cyberfm_file_seek(cyberfm_file* pFile, int64_t offset, int origin);
@@ -148,6 +709,440 @@ cyberfm_bool32 cyberfm_file_eof(cyberfm_file* pFile);
 
 
 
+/*
+Names
+=====
+The hashed name of a file is the 64-bit FNV-1a hash of it's path, as in "base\characters\common\player_base_bodies.mesh".
+Paths are lower case and use backslashes. cyberfm_hash_path() takes care of that for you so you can pass in a path with
+forward slashes or upper case characters and still get the right hash. Use cyberfm_fnv1a_64() if you want to hash the
+bytes exactly as they are.
+*/
+uint64_t cyberfm_fnv1a_64(const void* pData, size_t dataSize);
+uint64_t cyberfm_hash_path(const char* pPath);
+
+/* The same as cyberfm_file_open() and cyberfm_file_open_ex(), only with a path instead of a hash. */
+cyberfm_result cyberfm_file_open_by_path(cyberfm_archive* pArchive, const char* pPath, uint32_t subfile, cyberfm_file** ppFile);
+cyberfm_result cyberfm_file_open_by_path_ex(cyberfm_archive* pArchive, const char* pPath, uint32_t subfile, uint32_t flags, cyberfm_file** ppFile);
+
+/*
+A path dictionary maps hashed names back to paths. Since the hash can't be reversed, the paths need to come from
+somewhere else. The community maintains lists of known paths, so a dictionary is loaded from a text file with one path
+on each line. Each line can optionally have the hash after a comma, as in "path,hash", in which case the hash is used as
+is rather than being computed from the path. Lines with a hash that isn't a number are skipped, which takes care of any
+header line in a CSV file. Empty lines are skipped, and "\r\n" line endings are fine.
+
+The whole file is loaded into a single block of memory and the paths are referenced straight out of it, so loading only
+takes a single allocation for the paths and another for the table. Lookups are done with an open addressing hash table
+which is kept at most half full. When a hash appears more than once, the first path is used.
+
+Paths are returned exactly as they appear in the file. Use cyberfm_path_dictionary_find() for lookups. This is thread safe
+once the dictionary is loaded.
+*/
+typedef struct
+{
+    uint64_t hashedName;
+    uint32_t pathOffset;    /* The offset of the path in pPathData. */
+    uint32_t pathLength;    /* Set to 0 for empty slots. */
+} cyberfm_path_dictionary_entry;
+
+typedef struct
+{
+    char* pPathData;                            /* The contents of the file, with the end of each path replaced with a null terminator. */
+    size_t pathDataSize;
+    cyberfm_path_dictionary_entry* pEntries;    /* The hash table. The capacity is always a power of two. */
+    uint32_t capacity;
+    uint32_t count;
+} cyberfm_path_dictionary;
+
+cyberfm_result cyberfm_path_dictionary_init(const char* pFilePath, cyberfm_path_dictionary* pDictionary);
+void cyberfm_path_dictionary_uninit(cyberfm_path_dictionary* pDictionary);
+
+/* Retrieves the path of a hashed name, or NULL if it's not in the dictionary. */
+const char* cyberfm_path_dictionary_find(const cyberfm_path_dictionary* pDictionary, uint64_t hashedName);
+
+
+
+/*
+Listing
+=======
+The central directory has the name, size and location of every file, which is enough to answer most questions about an
+archive without reading any file data. The functions here only ever look at the central directory.
+
+cyberfm_archive_get_entry() summarises a file, adding up the sizes of it's sub-files. To go over every file, use an
+iterator. An iterator can optionally be given a filter, in which case only the files that pass the filter are returned.
+When the filter has a list of hashed names, only those files are looked up rather than going over the whole archive.
+Iterators don't change the archive so any number of them can be used at the same time, from any thread.
+*/
+typedef struct
+{
+    uint64_t hashedName;
+    uint32_t fileIndex;
+    uint32_t subFileCount;
+    uint64_t offset;            /* The offset of the first sub-file. */
+    uint64_t compressedSize;    /* The size of every sub-file in the archive, added together. */
+    uint64_t uncompressedSize;  /* The size of every sub-file once they've been decompressed, added together. */
+    uint64_t unknown1;          /* Straight from the file info. */
+} cyberfm_archive_entry;
+
+typedef struct
+{
+    const uint64_t* pHashedNames;   /* Optional. When set, only these files are returned, in this order. Files that aren't in the archive are skipped. */
+    uint32_t hashedNameCount;
+    uint64_t minUncompressedSize;
+    uint64_t maxUncompressedSize;
+    double minRatio;                /* The compressed size divided by the uncompressed size. Files with an uncompressed size of 0 have a ratio of 1. */
+    double maxRatio;
+} cyberfm_archive_entry_filter;
+
+typedef struct
+{
+    cyberfm_archive* pArchive;
+    cyberfm_archive_entry_filter filter;
+    cyberfm_bool32 hasFilter;
+    uint32_t next;  /* The next file index, or the next index into pHashedNames. */
+    cyberfm_archive_entry entry;    /* The current entry. Valid after cyberfm_archive_iterator_next() returns true. */
+} cyberfm_archive_iterator;
+
+/* Initializes a filter that lets everything through. */
+cyberfm_archive_entry_filter cyberfm_archive_entry_filter_init(void);
+cyberfm_bool32 cyberfm_archive_entry_filter_test(const cyberfm_archive_entry_filter* pFilter, const cyberfm_archive_entry* pEntry);
+
+cyberfm_result cyberfm_archive_get_entry(cyberfm_archive* pArchive, uint32_t fileIndex, cyberfm_archive_entry* pEntry);
+
+/* pFilter can be NULL, in which case every file is returned. The filter is copied, but pHashedNames is not. */
+cyberfm_result cyberfm_archive_iterator_init(cyberfm_archive* pArchive, const cyberfm_archive_entry_filter* pFilter, cyberfm_archive_iterator* pIterator);
+cyberfm_bool32 cyberfm_archive_iterator_next(cyberfm_archive_iterator* pIterator);
+
+
+/*
+Content Types
+=============
+The archives don't say what kind of data each file holds, but most files start with a signature that gives it away. Only
+the first few bytes of a sub-file are needed to tell, so cyberfm_archive_peek_file_by_index() reads just those. Stored
+sub-files are read directly. Compressed sub-files are decoded only as far as needed when the codec supports it, which the
+reference codec does. Other codecs, including Oodle, have to decompress the whole sub-file.
+
+A type index records the type and the first four bytes (the magic) of every sub-file in an archive. Building it still
+means touching every sub-file, so it can be saved next to the archive and loaded back in later. A saved index is only used
+if the archive's size, modified time and central directory checksum are the same as when it was saved. Otherwise it's
+rebuilt, and saved again.
+
+The type of a file is the type of it's first sub-file. The other sub-files are normally buffers belonging to the first one
+and don't have a signature of their own.
+*/
+#define CYBERFM_CONTENT_TYPE_UNKNOWN    0
+#define CYBERFM_CONTENT_TYPE_EMPTY      1   /* The sub-file has no data. */
+#define CYBERFM_CONTENT_TYPE_CR2W       2   /* A REDengine resource. Most of the game's files are these. */
+#define CYBERFM_CONTENT_TYPE_RIFF       3   /* Audio. Use cyberfm_file_extract_audio() to get the audio data out of these. */
+#define CYBERFM_CONTENT_TYPE_BANK       4   /* A Wwise sound bank. */
+#define CYBERFM_CONTENT_TYPE_DDS        5
+#define CYBERFM_CONTENT_TYPE_PNG        6
+#define CYBERFM_CONTENT_TYPE_JPEG       7
+#define CYBERFM_CONTENT_TYPE_OGG        8
+#define CYBERFM_CONTENT_TYPE_ZIP        9
+#define CYBERFM_CONTENT_TYPE_XML        10
+#define CYBERFM_CONTENT_TYPE_COUNT      11
+
+#define CYBERFM_CONTENT_PEEK_SIZE       16  /* The number of bytes needed to classify a sub-file. */
+
+/* Works out the type from the start of a sub-file. pData only needs to have the first CYBERFM_CONTENT_PEEK_SIZE bytes. */
+uint32_t cyberfm_classify_content(const void* pData, size_t dataSize);
+const char* cyberfm_content_type_to_string(uint32_t type);
+cyberfm_result cyberfm_content_type_from_string(const char* pName, uint32_t* pType);
+
+/*
+Reads the first dstCap bytes of a sub-file, or the whole thing if it's smaller than that. pSize receives the number of
+bytes that were output.
+*/
+cyberfm_result cyberfm_archive_peek_file_by_index(cyberfm_archive* pArchive, uint32_t index, uint32_t subfile, void* pDst, size_t dstCap, size_t* pSize);
+
+typedef struct
+{
+    uint32_t magic;     /* The first four bytes of the sub-file, little-endian. Sub-files smaller than that are padded with zeros. */
+    uint32_t type;      /* One of CYBERFM_CONTENT_TYPE_*. */
+} cyberfm_type_index_entry;
+
+typedef struct
+{
+    uint32_t threadCount;       /* Set to 0 to use one thread per CPU. */
+    const char* pFilePath;      /* Optional. Where to load the index from and save it to. */
+} cyberfm_type_index_config;
+
+typedef struct
+{
+    cyberfm_type_index_entry* pEntries; /* One for each data spec in the archive, in the same order. */
+    uint32_t entryCount;
+    uint32_t failedCount;       /* The number of sub-files that couldn't be read, which are left as CYBERFM_CONTENT_TYPE_UNKNOWN. */
+    cyberfm_bool32 isLoaded;    /* Set to true if the index was loaded from pFilePath rather than built. */
+} cyberfm_type_index;
+
+cyberfm_type_index_config cyberfm_type_index_config_init(void);
+
+/*
+Loads the index from the config's pFilePath if it's there and up to date. Otherwise it's built from the archive, in which
+case it's saved to pFilePath. Failing to save is not an error.
+*/
+cyberfm_result cyberfm_type_index_init(cyberfm_archive* pArchive, const cyberfm_type_index_config* pConfig, cyberfm_type_index* pIndex);
+void cyberfm_type_index_uninit(cyberfm_type_index* pIndex);
+cyberfm_result cyberfm_type_index_save(const cyberfm_type_index* pIndex, cyberfm_archive* pArchive, const char* pFilePath);
+
+/* Retrieves the type of a file, which is the type of it's first sub-file. */
+uint32_t cyberfm_type_index_get_file_type(const cyberfm_type_index* pIndex, cyberfm_archive* pArchive, uint32_t fileIndex);
+
+
+
+/*
+Virtual File System
+===================
+The game ships with dozens of archives, and patches and mods add more archives on top which override files in the earlier
+ones. The VFS lets you mount any number of archives and then find files across all of them with a single lookup.
+
+When an archive is mounted, it's central directory is merged into a single global index keyed by the hashed name. Each item
+in the index only stores the archive, the file index and the sizes rather than the whole file info record. Archives mounted
+later override those mounted earlier. When mounting a directory, the archives are mounted in alphabetical order.
+
+Loading the central directory of every archive in a full installation is slow. You can optionally set pIndexCachePath in
+the config, in which case the central directory of each mounted archive is saved to that file. On later runs the cache file
+is memory mapped and the central directories are referenced straight from it, so long as the archive's size, modified time
+and central directory checksum haven't changed. Only archives that have changed are loaded from the archive itself. The
+cache is rewritten in cyberfm_vfs_uninit() if anything changed, or explicitly with cyberfm_vfs_save_index_cache().
+*/
+typedef struct
+{
+    uint64_t hashedName;
+    uint32_t archiveIndex;      /* Set to CYBERFM_VFS_EMPTY_ENTRY for empty slots in the index. */
+    uint32_t fileIndex;
+    uint64_t compressedSize;    /* The combined size of every sub-file. */
+    uint64_t uncompressedSize;  /* ^^ As above ^^ */
+} cyberfm_vfs_entry;
+
+#define CYBERFM_VFS_EMPTY_ENTRY 0xFFFFFFFF
+
+typedef struct
+{
+    cyberfm_archive_config archiveConfig;   /* The config to use when initializing each archive. */
+    const char* pIndexCachePath;            /* Optional. The path of the index cache file. */
+} cyberfm_vfs_config;
+
+typedef struct
+{
+    cyberfm_vfs_config config;
+    cyberfm_archive** ppArchives;   /* Archives are allocated individually so they don't move around as more are mounted. */
+    char** ppArchivePaths;
+    uint32_t archiveCount;
+    uint32_t archiveCap;
+    cyberfm_vfs_entry* pEntries;    /* An open addressed hash table. The capacity is always a power of two. */
+    uint32_t entryCount;
+    uint32_t entryCap;
+    struct
+    {
+        char* pFilePath;
+        const uint8_t* pData;       /* The memory mapped cache file. NULL if there is no cache, or if it's invalid. */
+        uint64_t size;
+        cyberfm_handle hMapping;
+        FILE* pFile;
+        uint32_t recordCount;
+        cyberfm_bool32 isDirty;     /* Set when the cache needs to be rewritten. */
+    } indexCache;
+} cyberfm_vfs;
+
+cyberfm_vfs_config cyberfm_vfs_config_init(void);
+cyberfm_result cyberfm_vfs_init(const cyberfm_vfs_config* pConfig, cyberfm_vfs* pVFS);
+void cyberfm_vfs_uninit(cyberfm_vfs* pVFS);
+cyberfm_result cyberfm_vfs_mount(cyberfm_vfs* pVFS, const char* pArchivePath);
+cyberfm_result cyberfm_vfs_mount_directory(cyberfm_vfs* pVFS, const char* pDirectoryPath);
+cyberfm_archive* cyberfm_vfs_get_archive(cyberfm_vfs* pVFS, uint32_t archiveIndex);
+cyberfm_result cyberfm_vfs_find(cyberfm_vfs* pVFS, uint64_t hashedName, const cyberfm_vfs_entry** ppEntry);
+cyberfm_result cyberfm_vfs_file_open(cyberfm_vfs* pVFS, uint64_t hashedName, uint32_t subfile, cyberfm_file** ppFile);
+cyberfm_result cyberfm_vfs_read_file(cyberfm_vfs* pVFS, uint64_t hashedName, uint32_t subfile, void* pDst, size_t dstCap, size_t* pSize);
+cyberfm_result cyberfm_vfs_save_index_cache(cyberfm_vfs* pVFS);
+
+
+
+/*
+Archive Writer
+==============
+Creates archives in the same format as the game's, which can then be opened with cyberfm_archive_init() like any other.
+
+Files are added one at a time with cyberfm_archive_writer_add_file(). The data is copied, so it doesn't need to remain
+valid after the call returns. Files are buffered until there's about batchSize bytes of them, at which point the whole
+batch is compressed across threadCount threads and written out in the order the files were added. The hash of each file is
+the SHA-1 of the uncompressed data of each of it's sub-files, which is what CYBERFM_HASH_KIND_SHA1 checks, and is
+calculated on the same threads as the compression.
+
+Sub-files are compressed with the codec in the config, which defaults to the reference codec. Anything smaller than
+minCompressSize, and anything that doesn't get any smaller when compressed, is stored uncompressed. Set pCodec to NULL to
+store everything. The data of each sub-file is aligned to the alignment in the config, which must be a power of two.
+
+Call cyberfm_archive_writer_finalize() once every file has been added. This writes out whatever is left in the batch and
+then the central directory and header. The central directory is sorted by hashed name since the reader depends on it, so
+files can be added in any order, but each hashed name can only be added once. If the writer is uninitialized without being
+finalized, or finalizing fails, the output file is deleted.
+*/
+#define CYBERFM_ARCHIVE_WRITER_DEFAULT_ALIGNMENT            4
+#define CYBERFM_ARCHIVE_WRITER_DEFAULT_BATCH_SIZE           (64 * 1024 * 1024)
+#define CYBERFM_ARCHIVE_WRITER_DEFAULT_MIN_COMPRESS_SIZE    256
+
+typedef struct
+{
+    uint32_t alignment;             /* The alignment of the data of each sub-file. Must be a power of two. Defaults to CYBERFM_ARCHIVE_WRITER_DEFAULT_ALIGNMENT. */
+    uint32_t threadCount;           /* The number of threads to compress on. Set to 0 to use one thread per CPU. */
+    const cyberfm_codec* pCodec;    /* The codec to compress with. Defaults to the reference codec. Set to NULL, or a codec without onCompress, to not compress anything. */
+    size_t minCompressSize;         /* Sub-files smaller than this are always stored uncompressed. */
+    size_t batchSize;               /* The number of uncompressed bytes to buffer before compressing them. Bigger batches keep more threads busy. */
+} cyberfm_archive_writer_config;
+
+typedef struct
+{
+    uint64_t hashedName;
+    uint64_t unknown1;              /* Written as is. This looks to be a timestamp in the game's archives. */
+    uint32_t unknown2;              /* ^^ As above ^^ */
+    uint32_t subFileCount;          /* Must be at least 1. */
+    const void* const* ppSubFileData;
+    const size_t* pSubFileSizes;
+    const cyberfm_archive_central_directory_unknown_data* pUnknownData;   /* Optional. Items to add to the unknown section for this file. */
+    uint32_t unknownDataCount;
+} cyberfm_archive_writer_file;
+
+typedef struct
+{
+    uint32_t fileCount;
+    uint32_t subFileCount;
+    uint32_t compressedSubFileCount;
+    uint64_t uncompressedSize;      /* The total size of every sub-file before compression. */
+    uint64_t archiveSize;           /* The size of the archive so far. Only includes the central directory after finalizing. */
+} cyberfm_archive_writer_stats;
+
+typedef struct
+{
+    cyberfm_archive_writer_config config;
+    char* pFilePath;
+    FILE* pFile;
+    uint64_t offset;                /* Where the data of the next sub-file goes. */
+    cyberfm_archive_file_info* pFileInfos;
+    uint32_t fileInfoCount;
+    uint32_t fileInfoCap;
+    cyberfm_archive_file_data_spec* pDataSpecs;
+    uint32_t dataSpecCount;
+    uint32_t dataSpecCap;
+    cyberfm_archive_central_directory_unknown_data* pUnknownData;
+    uint32_t unknownDataCount;
+    uint32_t unknownDataCap;
+    struct
+    {
+        uint8_t* pData;             /* The uncompressed data of every sub-file in the batch, one after the other. */
+        size_t size;
+        size_t cap;
+        uint32_t firstFileInfo;     /* Files from here to the end of pFileInfos are in the batch. */
+        uint32_t firstDataSpec;     /* ^^ As above ^^. While in the batch, the offset of the data spec is relative to pData. */
+        void** ppCompressedData;    /* The compressed data of each sub-file in the batch, or NULL if it's to be stored. */
+    } batch;
+    cyberfm_archive_writer_stats stats;
+    cyberfm_bool32 isFinalized;
+} cyberfm_archive_writer;
+
+cyberfm_archive_writer_config cyberfm_archive_writer_config_init(void);
+cyberfm_result cyberfm_archive_writer_init(const char* pFilePath, const cyberfm_archive_writer_config* pConfig, cyberfm_archive_writer* pWriter);
+void cyberfm_archive_writer_uninit(cyberfm_archive_writer* pWriter);
+cyberfm_result cyberfm_archive_writer_add_file(cyberfm_archive_writer* pWriter, const cyberfm_archive_writer_file* pFile);
+cyberfm_result cyberfm_archive_writer_finalize(cyberfm_archive_writer* pWriter);
+cyberfm_result cyberfm_archive_writer_get_stats(const cyberfm_archive_writer* pWriter, cyberfm_archive_writer_stats* pStats);
+
+
+
+/*
+Statistics
+==========
+Compile with CYBERFM_ENABLE_STATS defined to have the library count what it's doing and time the expensive parts. Use
+cyberfm_get_stats() to retrieve everything that's been recorded since the program started or since the last call to
+cyberfm_reset_stats(). When CYBERFM_ENABLE_STATS is not defined, the CYBERFM_STATS_* macros used for recording compile to
+nothing and cyberfm_get_stats() returns CYBERFM_INVALID_OPERATION, so there's no cost at all.
+
+Counters and timers are recorded into a set of slots. Each thread is given it's own slot the first time it records
+something, so threads don't fight over the same cache lines. If there's more threads than slots, slots are shared, which is
+fine because they're updated atomically. cyberfm_get_stats() adds up every slot.
+
+Timers are recorded into a histogram with CYBERFM_STATS_HISTOGRAM_SUB_BUCKET_COUNT buckets for each power of two nanoseconds,
+like an HDR histogram. Any value is within about 6% of the bottom of it's bucket. Times are taken at these points:
+
+    ARCHIVE_INIT    All of cyberfm_archive_init_ex().
+    FILE_OPEN       All of cyberfm_file_open_by_index_ex() and the functions that call it.
+    READ            Each read from the archive, or each batch when it's done with io_uring.
+    DECOMPRESS      Each block decompressed on it's own, or each batch passed to cyberfm_archive_decompress_batch().
+    WRITE           Each file copied out with cyberfm_archive_copy_to_file(), each batch of files written by the archive
+                    writer, and anything recorded by the application. The extractor records each file it writes.
+
+Applications can record their own counters and timers with cyberfm_stats_add() and cyberfm_stats_record_time(), which
+are the functions behind the macros.
+*/
+#define CYBERFM_STAT_BYTES_READ             0   /* Bytes read from archives. Doesn't include data referenced straight out of the memory mapping. */
+#define CYBERFM_STAT_BYTES_DECOMPRESSED     1   /* Bytes output by codecs. */
+#define CYBERFM_STAT_BYTES_WRITTEN          2
+#define CYBERFM_STAT_FILE_OPENS             3
+#define CYBERFM_STAT_LOOKUPS                4   /* Calls to cyberfm_archive_find(). */
+#define CYBERFM_STAT_LOOKUP_PROBES          5   /* The number of hashes compared across every lookup. */
+#define CYBERFM_STAT_ALLOCATIONS            6   /* Heap allocations for files and scratch buffers that couldn't be served from the pools. */
+#define CYBERFM_STAT_BYTES_ALLOCATED        7   /* ^^ As above ^^ */
+#define CYBERFM_STAT_COUNTER_COUNT          8
+
+#define CYBERFM_STAT_TIMER_ARCHIVE_INIT     0
+#define CYBERFM_STAT_TIMER_FILE_OPEN        1
+#define CYBERFM_STAT_TIMER_READ             2
+#define CYBERFM_STAT_TIMER_DECOMPRESS       3
+#define CYBERFM_STAT_TIMER_WRITE            4
+#define CYBERFM_STAT_TIMER_COUNT            5
+
+#define CYBERFM_STATS_HISTOGRAM_SUB_BUCKET_BITS     4
+#define CYBERFM_STATS_HISTOGRAM_SUB_BUCKET_COUNT    (1 << CYBERFM_STATS_HISTOGRAM_SUB_BUCKET_BITS)
+#define CYBERFM_STATS_HISTOGRAM_MAX_BITS            40  /* Times are clamped to 2^40 nanoseconds, which is about 18 minutes. */
+#define CYBERFM_STATS_HISTOGRAM_BUCKET_COUNT        ((CYBERFM_STATS_HISTOGRAM_MAX_BITS - CYBERFM_STATS_HISTOGRAM_SUB_BUCKET_BITS + 1) * CYBERFM_STATS_HISTOGRAM_SUB_BUCKET_COUNT)
+#define CYBERFM_STATS_SLOT_COUNT                    16
+
+typedef struct
+{
+    uint64_t count;
+    uint64_t totalNanoseconds;
+    uint64_t buckets[CYBERFM_STATS_HISTOGRAM_BUCKET_COUNT];
+} cyberfm_histogram;
+
+typedef struct
+{
+    uint64_t counters[CYBERFM_STAT_COUNTER_COUNT];
+    cyberfm_histogram timers[CYBERFM_STAT_TIMER_COUNT];
+} cyberfm_stats;
+
+/* Adds up the counters and histograms of every thread. This is thread safe, but anything being recorded at the same time may or may not be included. */
+cyberfm_result cyberfm_get_stats(cyberfm_stats* pStats);
+
+/* Clears everything. This should not be called while other threads are recording. */
+void cyberfm_reset_stats(void);
+
+void cyberfm_stats_add(uint32_t counter, uint64_t value);
+void cyberfm_stats_record_time(uint32_t timer, uint64_t nanoseconds);
+uint64_t cyberfm_stats_get_time_ns(void);
+
+/* Retrieves a value at a percentile between 0 and 100. This is the bottom of the bucket the value falls into. */
+uint64_t cyberfm_histogram_get_percentile(const cyberfm_histogram* pHistogram, double percentile);
+uint64_t cyberfm_histogram_get_max(const cyberfm_histogram* pHistogram);
+
+/* Retrieves the name of a counter or timer, for printing. */
+const char* cyberfm_stat_counter_to_string(uint32_t counter);
+const char* cyberfm_stat_timer_to_string(uint32_t timer);
+
+#ifdef CYBERFM_ENABLE_STATS
+    #define CYBERFM_STATS_ADD(counter, value)           cyberfm_stats_add(counter, value)
+    #define CYBERFM_STATS_DECLARE_TIMER(name)           uint64_t name;
+    #define CYBERFM_STATS_BEGIN_TIMER(name)             (name) = cyberfm_stats_get_time_ns()
+    #define CYBERFM_STATS_END_TIMER(timer, name)        cyberfm_stats_record_time(timer, cyberfm_stats_get_time_ns() - (name))
+#else
+    #define CYBERFM_STATS_ADD(counter, value)           ((void)0)
+    #define CYBERFM_STATS_DECLARE_TIMER(name)
+    #define CYBERFM_STATS_BEGIN_TIMER(name)             ((void)0)
+    #define CYBERFM_STATS_END_TIMER(timer, name)        ((void)0)
+#endif
+
+
+
 /*
 Audio
 =====